@@ -0,0 +1,165 @@
+#! /usr/bin/env bash
+## vim:set ts=4 sw=4 et:
+set -e; set -o pipefail
+argv0=$0; argv0abs=$(readlink -fn "$argv0"); argv0dir=$(dirname "$argv0abs")
+
+#
+# Copyright (C) Markus Franz Xaver Johannes Oberhumer
+#
+# check that the packed output only depends on the input and the options,
+# and not on the number of threads or their scheduling:
+#   - pack each file with each option set and --threads=1, then with
+#     --threads=N, and compare the results byte by byte
+#   - pack all files at once with --jobs=N, and compare again
+#   - run both halves of a --search-shard=I/2 search, and check that
+#     --search-merge gives the file of the unsharded search, for both
+#     orders of the concatenated result files
+#
+# usage:
+#   upx_deterministic.sh FILE...
+#   upx_deterministic.sh DIRECTORY    (all files in DIRECTORY, sorted)
+#
+# requires:
+#   $upx_exe                (required, but with convenience fallback "./upx")
+#
+# optional settings:
+#   $upx_det_options        (option sets separated by '|', see below)
+#   $UPX_DET_THREADS        (default 4)
+#   $UPX_DET_BUILDDIR       (default "./tmp-upx-deterministic")
+#
+# Files that upx cannot pack are skipped. Options whose result depends on
+# the machine (--time-budget, --memory-limit, --blocksize=auto) must not
+# be used here.
+#
+
+#***********************************************************************
+# init & checks
+#***********************************************************************
+
+# upx_exe
+[[ -z $upx_exe && -f ./upx && -x ./upx ]] && upx_exe=./upx # convenience fallback
+if [[ -z $upx_exe ]]; then echo "UPX-ERROR: please set \$upx_exe"; exit 1; fi
+if [[ ! -f $upx_exe ]]; then echo "UPX-ERROR: file '$upx_exe' does not exist"; exit 1; fi
+upx_exe=$(readlink -fn "$upx_exe") # make absolute
+[[ -f $upx_exe ]] || exit 1
+if ! "$upx_exe" --version-short >/dev/null; then echo "UPX-ERROR: FATAL: upx --version-short FAILED"; exit 1; fi
+
+if [[ $# == 0 ]]; then echo "usage: $argv0 FILE... | DIRECTORY"; exit 1; fi
+files=()
+if [[ $# == 1 && -d $1 ]]; then
+    mapfile -t files < <(find "$1" -maxdepth 1 -type f | LC_ALL=C sort)
+else
+    files=( "$@" )
+fi
+
+option_sets=()
+IFS='|' read -r -a option_sets <<< "${upx_det_options:--3|--nrv2e -9|--lzma -5|--nrv2e --best --nrv-parallel|-5 --all-methods --all-filters --no-lzma}"
+threads=${UPX_DET_THREADS:-4}
+[[ $threads -ge 2 ]] || exit 1
+
+if [[ -z $UPX_DET_BUILDDIR ]]; then
+    UPX_DET_BUILDDIR="./tmp-upx-deterministic"
+fi
+mkdir -p "$UPX_DET_BUILDDIR" || exit 1
+UPX_DET_BUILDDIR=$(readlink -fn "$UPX_DET_BUILDDIR") # make absolute
+[[ -d $UPX_DET_BUILDDIR ]] || exit 1
+cd "$UPX_DET_BUILDDIR" || exit 1
+rm -rf ./t1 ./tn ./jobs ./shards
+mkdir t1 tn jobs shards
+
+export UPX="--no-color --no-progress"
+export UPX_DEBUG_DISABLE_GITREV_WARNING=1
+
+#***********************************************************************
+# main
+#***********************************************************************
+
+num_errors=0
+num_checks=0
+error() {
+    echo "UPX-ERROR: $*"
+    let num_errors+=1 || true
+}
+
+# the files that can be packed at all
+packable=()
+for f in "${files[@]}"; do
+    if [[ ! -f $f ]]; then error "'$f' is not a file"; continue; fi
+    f=$(readlink -fn "$f")
+    if "$upx_exe" -qq -1 "$f" --force-overwrite -o ./t1/probe >/dev/null 2>&1; then
+        packable+=( "$f" )
+    else
+        echo "  skipped $(basename "$f"): cannot be packed"
+    fi
+    rm -f ./t1/probe
+done
+if [[ ${#packable[@]} == 0 ]]; then error "nothing to pack"; exit 1; fi
+
+for i in "${!option_sets[@]}"; do
+    opts=()
+    IFS=' ' read -r -a opts <<< "${option_sets[$i]}"
+    for f in "${packable[@]}"; do
+        name="$(basename "$f").$i"
+        if ! "$upx_exe" -qq "${opts[@]}" --threads=1 "$f" --force-overwrite -o "./t1/$name"; then
+            error "'upx ${opts[*]} --threads=1 $f' FAILED"; continue
+        fi
+        if ! "$upx_exe" -qq "${opts[@]}" --threads="$threads" "$f" --force-overwrite -o "./tn/$name"; then
+            error "'upx ${opts[*]} --threads=$threads $f' FAILED"; continue
+        fi
+        let num_checks+=1 || true
+        if ! cmp -s "./t1/$name" "./tn/$name"; then
+            error "$(basename "$f") ${opts[*]}: --threads=1 and --threads=$threads differ"
+        fi
+    done
+    # all files at once; the output names are given by the input names
+    rm -f ./jobs/*
+    for f in "${packable[@]}"; do cp -p "$f" "./jobs/$(basename "$f").$i"; done
+    if ! "$upx_exe" -qq "${opts[@]}" --jobs="$threads" --threads="$threads" ./jobs/*; then
+        error "'upx ${opts[*]} --jobs=$threads' FAILED"; continue
+    fi
+    for f in "${packable[@]}"; do
+        name="$(basename "$f").$i"
+        [[ -f ./t1/$name ]] || continue
+        let num_checks+=1 || true
+        if ! cmp -s "./t1/$name" "./jobs/$name"; then
+            error "$(basename "$f") ${opts[*]}: --jobs=$threads differs"
+        fi
+    done
+done
+
+# --search-merge must not depend on the order of the shard results
+shard_opts=( -5 --all-methods --all-filters --no-lzma )
+for f in "${packable[@]}"; do
+    name=$(basename "$f")
+    s=./shards/$name
+    ok=1
+    for shard in 0 1; do
+        rm -f "$s.r$shard"
+        "$upx_exe" -qq "${shard_opts[@]}" --search-shard=$shard/2 --search-result="$s.r$shard" \
+            "$f" --force-overwrite -o "$s.p$shard" || ok=0
+    done
+    if [[ $ok != 1 ]]; then error "'upx --search-shard $f' FAILED"; continue; fi
+    cat "$s.r0" "$s.r1" > "$s.r01"
+    cat "$s.r1" "$s.r0" > "$s.r10"
+    for order in 01 10; do
+        "$upx_exe" -qq "${shard_opts[@]}" --threads="$threads" --search-merge="$s.r$order" \
+            "$f" --force-overwrite -o "$s.m$order" || ok=0
+    done
+    "$upx_exe" -qq "${shard_opts[@]}" --threads=1 "$f" --force-overwrite -o "$s.full" || ok=0
+    if [[ $ok != 1 ]]; then error "'upx --search-merge $f' FAILED"; continue; fi
+    let num_checks+=2 || true
+    if ! cmp -s "$s.m01" "$s.m10"; then
+        error "$name: --search-merge depends on the order of the shard results"
+    fi
+    if ! cmp -s "$s.m01" "$s.full"; then
+        error "$name: --search-merge differs from the unsharded search"
+    fi
+done
+
+echo "$num_checks comparisons of ${#packable[@]} file(s) with ${#option_sets[@]} option set(s)"
+if [[ $num_errors != 0 ]]; then
+    echo "UPX-ERROR: $num_errors error(s)"
+    exit 1
+fi
+rm -rf ./t1 ./tn ./jobs ./shards
+exit 0
@@ -0,0 +1,163 @@
+#! /usr/bin/env bash
+## vim:set ts=4 sw=4 et:
+set -e; set -o pipefail
+argv0=$0; argv0abs=$(readlink -fn "$argv0"); argv0dir=$(dirname "$argv0abs")
+
+#
+# Copyright (C) Markus Franz Xaver Johannes Oberhumer
+#
+# measure the startup cost of packed executables:
+# pack each given executable with each method, run the packed and the
+# original program N times, and report the wall-clock time of a run,
+# the page faults and the peak RSS
+#
+# usage:
+#   upx_startup_bench.sh FILE...
+#
+# Every FILE must be a program that can run on this machine (or under
+# $upx_bench_runner) and exit quickly with $upx_bench_args, so that the
+# time of a run is dominated by exec-to-main: the difference between the
+# packed and the original program is the cost of the stub and of the
+# decompression.
+#
+# requires:
+#   $upx_exe                (required, but with convenience fallback "./upx")
+#
+# optional settings:
+#   $upx_bench_runner       (e.g. "qemu-aarch64"; used to run the programs, not upx)
+#   $upx_bench_args         (arguments for each program, default "--version")
+#   $upx_bench_methods      (default "--nrv2b --nrv2d --nrv2e --lzma")
+#   $UPX_BENCH_RUNS         (default 20)
+#   $UPX_BENCH_BUILDDIR     (default "./tmp-upx-startup-bench")
+#
+# output: a human readable table, and a CSV file "startup.csv" in the
+# build directory
+#
+
+#***********************************************************************
+# init & checks
+#***********************************************************************
+
+# upx_exe
+[[ -z $upx_exe && -f ./upx && -x ./upx ]] && upx_exe=./upx # convenience fallback
+if [[ -z $upx_exe ]]; then echo "UPX-ERROR: please set \$upx_exe"; exit 1; fi
+if [[ ! -f $upx_exe ]]; then echo "UPX-ERROR: file '$upx_exe' does not exist"; exit 1; fi
+upx_exe=$(readlink -fn "$upx_exe") # make absolute
+[[ -f $upx_exe ]] || exit 1
+if ! "$upx_exe" --version-short >/dev/null; then echo "UPX-ERROR: FATAL: upx --version-short FAILED"; exit 1; fi
+
+if [[ $# == 0 ]]; then echo "usage: $argv0 FILE..."; exit 1; fi
+
+bench_run=()
+if [[ -n $upx_bench_runner ]]; then
+    IFS=' ' read -r -a bench_run <<< "$upx_bench_runner" # split at spaces into array
+fi
+bench_args=()
+IFS=' ' read -r -a bench_args <<< "${upx_bench_args---version}"
+methods=()
+IFS=' ' read -r -a methods <<< "${upx_bench_methods:---nrv2b --nrv2d --nrv2e --lzma}"
+runs=${UPX_BENCH_RUNS:-20}
+[[ $runs -ge 1 ]] || exit 1
+
+# GNU time is optional and only needed for the page faults and the peak RSS
+gnu_time=
+if [[ -x /usr/bin/time ]] && /usr/bin/time -f '%R' true >/dev/null 2>&1; then
+    gnu_time=/usr/bin/time
+fi
+
+if [[ -z $UPX_BENCH_BUILDDIR ]]; then
+    UPX_BENCH_BUILDDIR="./tmp-upx-startup-bench"
+fi
+mkdir -p "$UPX_BENCH_BUILDDIR" || exit 1
+UPX_BENCH_BUILDDIR=$(readlink -fn "$UPX_BENCH_BUILDDIR") # make absolute
+[[ -d $UPX_BENCH_BUILDDIR ]] || exit 1
+
+export UPX="--no-color --no-progress"
+export UPX_DEBUG_DISABLE_GITREV_WARNING=1
+
+#***********************************************************************
+# support functions
+#***********************************************************************
+
+now_ns() {
+    date +%s%N
+}
+
+# run "$@" $runs times; sets t_median_us, t_min_us
+bench_time() {
+    local i t0 t1 ts=()
+    "${bench_run[@]}" "$@" "${bench_args[@]}" </dev/null >/dev/null 2>&1 || return 1 # warm up
+    for ((i = 0; i < runs; i++)); do
+        t0=$(now_ns)
+        "${bench_run[@]}" "$@" "${bench_args[@]}" </dev/null >/dev/null 2>&1 || return 1
+        t1=$(now_ns)
+        ts+=( $(( (t1 - t0) / 1000 )) )
+    done
+    mapfile -t ts < <(printf '%s\n' "${ts[@]}" | LC_ALL=C sort -n)
+    t_min_us=${ts[0]}
+    t_median_us=${ts[$(( runs / 2 ))]}
+}
+
+# run "$@" once under GNU time; sets minflt, majflt, maxrss_kb
+bench_faults() {
+    minflt=-; majflt=-; maxrss_kb=-
+    [[ -n $gnu_time ]] || return 0
+    local out="$UPX_BENCH_BUILDDIR/.time.out"
+    "$gnu_time" -o "$out" -f '%R %F %M' "${bench_run[@]}" "$@" "${bench_args[@]}" </dev/null >/dev/null 2>&1 || return 1
+    read -r minflt majflt maxrss_kb < <(tail -n 1 "$out")
+}
+
+# print and record one result line
+bench_report() {
+    local f=$1 method=$2 size=$3
+    printf '%-24s %-10s %10s %10d %10d %8s %8s %10s\n' "$(basename "$f")" "$method" "$size" \
+        "$t_median_us" "$t_min_us" "$minflt" "$majflt" "$maxrss_kb"
+    echo "$(basename "$f"),$method,$size,$runs,$t_median_us,$t_min_us,$minflt,$majflt,$maxrss_kb" >> "$csv"
+}
+
+#***********************************************************************
+# main
+#***********************************************************************
+
+csv="$UPX_BENCH_BUILDDIR/startup.csv"
+echo "file,method,size,runs,median_us,min_us,minor_faults,major_faults,max_rss_kb" > "$csv"
+printf '%-24s %-10s %10s %10s %10s %8s %8s %10s\n' file method size median_us min_us minflt majflt maxrss_kb
+
+num_errors=0
+for f in "$@"; do
+    if [[ ! -f $f || ! -x $f ]]; then
+        echo "UPX-ERROR: '$f' is not an executable file"
+        let num_errors+=1 || true
+        continue
+    fi
+    f=$(readlink -fn "$f")
+    if ! bench_time "$f" || ! bench_faults "$f"; then
+        echo "UPX-ERROR: '$f' cannot be run"
+        let num_errors+=1 || true
+        continue
+    fi
+    bench_report "$f" original "$(stat -c %s "$f")"
+    for m in "${methods[@]}"; do
+        p="$UPX_BENCH_BUILDDIR/$(basename "$f")${m//-/_}"
+        rm -f "$p"
+        if ! "$upx_exe" -qq "$m" "$f" -o "$p"; then
+            echo "UPX-ERROR: '$upx_exe $m $f' FAILED"
+            let num_errors+=1 || true
+            continue
+        fi
+        if ! bench_time "$p" || ! bench_faults "$p"; then
+            echo "UPX-ERROR: packed '$p' cannot be run"
+            let num_errors+=1 || true
+            continue
+        fi
+        bench_report "$f" "${m#--}" "$(stat -c %s "$p")"
+    done
+done
+
+echo
+echo "results written to '$csv'"
+if [[ $num_errors != 0 ]]; then
+    echo "UPX-ERROR: $num_errors error(s)"
+    exit 1
+fi
+exit 0
@@ -0,0 +1,194 @@
+#! /usr/bin/env bash
+## vim:set ts=4 sw=4 et:
+set -e; set -o pipefail
+argv0=$0; argv0abs=$(readlink -fn "$argv0"); argv0dir=$(dirname "$argv0abs")
+
+#
+# Copyright (C) Markus Franz Xaver Johannes Oberhumer
+#
+# guard against speed regressions of the packers:
+# pack and unpack each file of a pinned corpus with each method, check
+# that the round trip gives back the very same file, and record the
+# pack and unpack throughput and the packed size; then compare against
+# a stored baseline and fail if anything got slower or bigger than the
+# allowed thresholds
+#
+# usage:
+#   upx_throughput_gate.sh FILE...
+#   upx_throughput_gate.sh DIRECTORY    (all files in DIRECTORY, sorted)
+#
+# The corpus should contain one or more programs of every format that
+# matters (e.g. linux/amd64, linux/arm64, win32/pe, win64/pe, macho,
+# vmlinuz); its files must not change, or the baseline becomes useless.
+#
+# requires:
+#   $upx_exe                (required, but with convenience fallback "./upx")
+#
+# optional settings:
+#   $upx_bench_methods      (default "--nrv2b --nrv2e --lzma")
+#   $UPX_BENCH_RUNS         (default 3; the fastest run counts)
+#   $UPX_BENCH_BASELINE     (CSV file of an earlier run; no gating if unset)
+#   $UPX_BENCH_THRESHOLD    (allowed slowdown in percent, default 10)
+#   $UPX_BENCH_SIZE_SLACK   (allowed growth of a packed file in permille, default 0)
+#   $UPX_BENCH_BUILDDIR     (default "./tmp-upx-throughput-gate")
+#
+# output: a human readable table, and a CSV file "throughput.csv" in the
+# build directory; to update the baseline, just copy that file
+#
+
+#***********************************************************************
+# init & checks
+#***********************************************************************
+
+# upx_exe
+[[ -z $upx_exe && -f ./upx && -x ./upx ]] && upx_exe=./upx # convenience fallback
+if [[ -z $upx_exe ]]; then echo "UPX-ERROR: please set \$upx_exe"; exit 1; fi
+if [[ ! -f $upx_exe ]]; then echo "UPX-ERROR: file '$upx_exe' does not exist"; exit 1; fi
+upx_exe=$(readlink -fn "$upx_exe") # make absolute
+[[ -f $upx_exe ]] || exit 1
+if ! "$upx_exe" --version-short >/dev/null; then echo "UPX-ERROR: FATAL: upx --version-short FAILED"; exit 1; fi
+
+if [[ $# == 0 ]]; then echo "usage: $argv0 FILE... | DIRECTORY"; exit 1; fi
+files=()
+if [[ $# == 1 && -d $1 ]]; then
+    mapfile -t files < <(find "$1" -maxdepth 1 -type f | LC_ALL=C sort)
+else
+    files=( "$@" )
+fi
+
+methods=()
+IFS=' ' read -r -a methods <<< "${upx_bench_methods:---nrv2b --nrv2e --lzma}"
+runs=${UPX_BENCH_RUNS:-3}
+[[ $runs -ge 1 ]] || exit 1
+threshold=${UPX_BENCH_THRESHOLD:-10}
+size_slack=${UPX_BENCH_SIZE_SLACK:-0}
+baseline=
+if [[ -n $UPX_BENCH_BASELINE ]]; then
+    baseline=$(readlink -fn "$UPX_BENCH_BASELINE")
+    if [[ ! -f $baseline ]]; then echo "UPX-ERROR: baseline '$UPX_BENCH_BASELINE' does not exist"; exit 1; fi
+fi
+
+if [[ -z $UPX_BENCH_BUILDDIR ]]; then
+    UPX_BENCH_BUILDDIR="./tmp-upx-throughput-gate"
+fi
+mkdir -p "$UPX_BENCH_BUILDDIR" || exit 1
+UPX_BENCH_BUILDDIR=$(readlink -fn "$UPX_BENCH_BUILDDIR") # make absolute
+[[ -d $UPX_BENCH_BUILDDIR ]] || exit 1
+
+export UPX="--no-color --no-progress"
+export UPX_DEBUG_DISABLE_GITREV_WARNING=1
+
+#***********************************************************************
+# support functions
+#***********************************************************************
+
+now_ns() {
+    date +%s%N
+}
+
+# run "$@" $runs times; sets t_min_us
+bench_time() {
+    local i t0 t1 t
+    t_min_us=
+    for ((i = 0; i < runs; i++)); do
+        t0=$(now_ns)
+        "$@" </dev/null >/dev/null 2>&1 || return 1
+        t1=$(now_ns)
+        t=$(( (t1 - t0) / 1000 ))
+        [[ $t -ge 1 ]] || t=1
+        if [[ -z $t_min_us || $t -lt $t_min_us ]]; then t_min_us=$t; fi
+    done
+}
+
+# KiB per second of $1 bytes in $2 microseconds
+kib_per_sec() {
+    echo $(( $1 * 1000000 / ($2 * 1024) ))
+}
+
+# compare one result with the baseline; sets gate_msg
+gate_check() {
+    local name=$1 method=$2 packed=$3 pack_kibs=$4 unpack_kibs=$5
+    local line b_packed b_pack b_unpack
+    gate_msg=
+    [[ -n $baseline ]] || return 0
+    line=$(awk -F, -v n="$name" -v m="$method" '$1 == n && $2 == m { print; exit }' "$baseline")
+    if [[ -z $line ]]; then gate_msg="(new)"; return 0; fi
+    IFS=, read -r _ _ _ b_packed b_pack b_unpack <<< "$line"
+    if [[ $(( packed * 1000 )) -gt $(( b_packed * (1000 + size_slack) )) ]]; then
+        gate_msg+=" SIZE $b_packed->$packed"
+    fi
+    if [[ $(( pack_kibs * 100 )) -lt $(( b_pack * (100 - threshold) )) ]]; then
+        gate_msg+=" PACK $b_pack->$pack_kibs"
+    fi
+    if [[ $(( unpack_kibs * 100 )) -lt $(( b_unpack * (100 - threshold) )) ]]; then
+        gate_msg+=" UNPACK $b_unpack->$unpack_kibs"
+    fi
+    [[ -z $gate_msg ]]
+}
+
+#***********************************************************************
+# main
+#***********************************************************************
+
+csv="$UPX_BENCH_BUILDDIR/throughput.csv"
+echo "file,method,size,packed_size,pack_kib_s,unpack_kib_s" > "$csv"
+printf '%-24s %-8s %10s %10s %6s %10s %10s\n' file method size packed ratio pack_KiB/s unpack_KiB/s
+
+num_errors=0
+num_regressions=0
+for f in "${files[@]}"; do
+    if [[ ! -f $f ]]; then
+        echo "UPX-ERROR: '$f' is not a file"
+        let num_errors+=1 || true
+        continue
+    fi
+    f=$(readlink -fn "$f")
+    name=$(basename "$f")
+    size=$(stat -c %s "$f")
+    [[ $size -ge 1 ]] || continue
+    for m in "${methods[@]}"; do
+        p="$UPX_BENCH_BUILDDIR/$name${m//-/_}.packed"
+        u="$UPX_BENCH_BUILDDIR/$name${m//-/_}.unpacked"
+        if ! bench_time "$upx_exe" -qq "$m" "$f" --force-overwrite -o "$p"; then
+            echo "UPX-ERROR: '$upx_exe $m $f' FAILED"
+            let num_errors+=1 || true
+            continue
+        fi
+        pack_kibs=$(kib_per_sec "$size" "$t_min_us")
+        if ! bench_time "$upx_exe" -qq -d "$p" --force-overwrite -o "$u"; then
+            echo "UPX-ERROR: '$upx_exe -d $p' FAILED"
+            let num_errors+=1 || true
+            continue
+        fi
+        unpack_kibs=$(kib_per_sec "$size" "$t_min_us")
+        if ! cmp -s "$f" "$u"; then
+            echo "UPX-ERROR: '$name' $m: the round trip does not give back the same file"
+            let num_errors+=1 || true
+            continue
+        fi
+        packed=$(stat -c %s "$p")
+        rm -f "$p" "$u"
+        echo "$name,${m#--},$size,$packed,$pack_kibs,$unpack_kibs" >> "$csv"
+        gate_msg=
+        if ! gate_check "$name" "${m#--}" "$packed" "$pack_kibs" "$unpack_kibs"; then
+            gate_msg="REGRESSION:$gate_msg"
+            let num_regressions+=1 || true
+        fi
+        printf '%-24s %-8s %10d %10d %5d%% %10d %10d %s\n' "$name" "${m#--}" "$size" "$packed" \
+            $(( packed * 100 / size )) "$pack_kibs" "$unpack_kibs" "$gate_msg"
+    done
+done
+
+echo
+echo "results written to '$csv'"
+if [[ $num_regressions != 0 ]]; then
+    echo "UPX-ERROR: $num_regressions regression(s) against '$baseline'"
+    echo "  (threshold ${threshold}% slower, ${size_slack} permille bigger)"
+fi
+if [[ $num_errors != 0 ]]; then
+    echo "UPX-ERROR: $num_errors error(s)"
+fi
+if [[ $num_regressions != 0 || $num_errors != 0 ]]; then
+    exit 1
+fi
+exit 0
@@ -0,0 +1,540 @@
+/* bench.cpp -- speed measurements of filters and compression methods
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+// The "upx_bench" CMake target builds the regular sources with
+// UPX_CONFIG_BENCH_MAIN=1, so that main() runs upx_bench_main() instead
+// of upx_main(); nothing here ends up in the normal upx executable.
+//
+// usage: upx_bench [--quick] [--min-time=SECONDS] [FILE...]
+//
+// Every measurement is printed to stdout as a single line of JSON, so the
+// output of two releases on the same machine can be compared by a script.
+//
+// On amd64 and arm64 Linux the decompressors of the stubs themselves are
+// measured as well ("stub_decompress"): their sections get linked from the
+// stub image like a packer does it, and the result is called in place.
+
+#include "../conf.h"
+
+#if (UPX_CONFIG_BENCH_MAIN)
+
+#include <chrono>
+#include "../compress/compress.h"
+#include "../filter.h"
+#include "../util/membuffer.h"
+
+#if (ACC_ARCH_AMD64 || ACC_ARCH_ARM64) && defined(__linux__)
+#define BENCH_STUB_DECODERS 1
+#include <sys/mman.h>
+#include "../linker.h"
+#if (ACC_ARCH_AMD64)
+static const CLANG_FORMAT_DUMMY_STATEMENT
+#include "../stub/amd64-linux.elf-entry.h"
+#else
+static const CLANG_FORMAT_DUMMY_STATEMENT
+#include "../stub/arm64-linux.elf-entry.h"
+#endif
+#endif
+
+namespace {
+
+struct BenchCorpus final {
+    char name[32];
+    MemBuffer mb;
+    unsigned len = 0;
+};
+
+// fixed pseudo-random corpus; keep this stable across releases
+struct BenchRandom final {
+    upx_uint32_t state;
+    explicit BenchRandom(upx_uint32_t seed) noexcept : state(seed) {}
+    unsigned next() noexcept {
+        state = state * 1103515245u + 12345u;
+        return state >> 16;
+    }
+};
+
+void make_code_corpus(byte *p, unsigned len) {
+    // x86-ish: opcode bytes, small immediates and near e8/e9 calls
+    BenchRandom rnd(1);
+    for (unsigned i = 0; i < len; i++) {
+        const unsigned r = rnd.next() % 32;
+        if (r < 3 && i + 5 <= len) {
+            p[i] = (byte) (r == 0 ? 0xe9 : 0xe8);
+            set_le32(p + i + 1, (rnd.next() % 65536) - 32768);
+            i += 4;
+        } else if (r < 12)
+            p[i] = (byte) (0x40 + rnd.next() % 16);
+        else if (r < 20)
+            p[i] = 0;
+        else
+            p[i] = (byte) rnd.next();
+    }
+}
+
+void make_text_corpus(byte *p, unsigned len) {
+    static const char *const words[] = {
+        "the ", "upx ", "packer ", "of ", "and ", "filter ", "section ", "to ",
+        "compress ", "a ", "in ", "executable ", "data ", "is ", "\n", ", ",
+    };
+    BenchRandom rnd(2);
+    unsigned i = 0;
+    while (i < len) {
+        const char *w = words[rnd.next() % TABLESIZE(words)];
+        while (*w && i < len)
+            p[i++] = (byte) *w++;
+    }
+}
+
+void make_mixed_corpus(byte *p, unsigned len) {
+    // runs of zeros, runs of noise and repeated blocks
+    BenchRandom rnd(3);
+    unsigned i = 0;
+    while (i < len) {
+        unsigned n = UPX_MIN(len - i, 16 + rnd.next() % 4096);
+        const unsigned kind = rnd.next() % 3;
+        if (kind == 0)
+            memset(p + i, 0, n);
+        else if (kind == 1 || i < 8192)
+            for (unsigned j = 0; j < n; j++)
+                p[i + j] = (byte) rnd.next();
+        else
+            memmove(p + i, p + i - 1 - rnd.next() % 8192, n);
+        i += n;
+    }
+}
+
+bool load_file(BenchCorpus &c, const char *fn) {
+    FILE *f = fopen(fn, "rb");
+    if (f == nullptr)
+        return false;
+    constexpr long MAX_LEN = 64 * 1024 * 1024;
+    long len = -1;
+    if (fseek(f, 0, SEEK_END) == 0)
+        len = ftell(f);
+    if (len <= 0 || len > MAX_LEN || fseek(f, 0, SEEK_SET) != 0) {
+        fclose(f);
+        return false;
+    }
+    c.mb.alloc(len);
+    c.len = (unsigned) len;
+    const bool ok = fread(c.mb.getVoidPtr(), 1, c.len, f) == c.len;
+    fclose(f);
+    upx_safe_snprintf(c.name, sizeof(c.name), "%s", fn_basename(fn));
+    return ok;
+}
+
+typedef std::chrono::steady_clock BenchClock;
+
+double seconds_since(const BenchClock::time_point &t0) noexcept {
+    return std::chrono::duration<double>(BenchClock::now() - t0).count();
+}
+
+double mbps(upx_uint64_t bytes, double secs) noexcept {
+    return secs > 0 ? double(bytes) / secs / 1e6 : 0.0;
+}
+
+// report the JSON string values without any escaping
+void emit_begin(const char *kind, const BenchCorpus &c) {
+    printf("{\"kind\":\"%s\",\"corpus\":\"%s\",\"bytes\":%u", kind, c.name, c.len);
+}
+void emit_end(bool ok, double secs, unsigned iterations, upx_uint64_t bytes) {
+    printf(",\"ok\":%s,\"iterations\":%u,\"seconds\":%.6f,\"mbps\":%.2f}\n", ok ? "true" : "false",
+           iterations, secs, mbps(bytes, secs));
+    fflush(stdout);
+}
+
+struct BenchMethod final {
+    int method;
+    const char *name;
+};
+
+const BenchMethod bench_methods[] = {
+#if (WITH_UCL) || (WITH_NRV)
+    {M_NRV2B_LE32, "nrv2b_le32"}, {M_NRV2B_8, "nrv2b_8"},   {M_NRV2B_LE16, "nrv2b_le16"},
+    {M_NRV2D_LE32, "nrv2d_le32"}, {M_NRV2D_8, "nrv2d_8"},   {M_NRV2D_LE16, "nrv2d_le16"},
+    {M_NRV2E_LE32, "nrv2e_le32"}, {M_NRV2E_8, "nrv2e_8"},   {M_NRV2E_LE16, "nrv2e_le16"},
+#endif
+#if (WITH_LZMA)
+    {M_LZMA, "lzma"},
+#endif
+#if (WITH_ZSTD)
+    {M_ZSTD, "zstd"},
+#endif
+};
+
+struct BenchOptions final {
+    bool quick = false;
+    double min_time = 0.25;
+};
+
+/*************************************************************************
+// the decompressors of the stubs, as host-callable code
+**************************************************************************/
+
+// the C calling convention of "decompress" in the stubs; returns 0 if
+// exactly lsrc bytes were used, and stores the length of the output
+typedef int (*stub_decompress_fn)(const byte *src, size_t lsrc, byte *dst, unsigned *ldst,
+                                  unsigned method);
+
+struct StubDecoder final {
+    int method = 0;
+    void *code = nullptr; // a read-only and executable copy of the linked sections
+    size_t code_size = 0;
+    stub_decompress_fn fn = nullptr;
+    ~StubDecoder() noexcept {
+#if (BENCH_STUB_DECODERS)
+        if (code != nullptr)
+            (void) ::munmap(code, code_size);
+#endif
+    }
+};
+
+#if (BENCH_STUB_DECODERS)
+
+template <class T>
+struct BenchLinker final : public T {
+    using ElfLinker::relocate;
+};
+
+#if (ACC_ARCH_AMD64)
+// the part of ELFMAINX in front of NRV_HEAD and LZMA_ELF00 in the stub:
+//   push %rbp; push %rbx; push %rcx; push %rdx; add %rdi,%rsi; push %rsi; sub %rdi,%rsi
+const byte stub_entry_amd64[] = {0x55, 0x53, 0x51, 0x52, 0x48, 0x01,
+                                 0xfe, 0x56, 0x48, 0x29, 0xfe};
+#endif
+
+// returns false if the stub of the host has no decompressor for method
+bool link_stub_decoder(StubDecoder &sd, int method) {
+    const char *sections = nullptr;
+    byte *loader = nullptr;
+    int len = 0;
+    try {
+#if (ACC_ARCH_AMD64)
+        BenchLinker<ElfLinkerAMD64> linker;
+        linker.init(stub_amd64_linux_elf_entry, sizeof(stub_amd64_linux_elf_entry));
+        linker.addSection("BENCH_ENTRY", stub_entry_amd64, sizeof(stub_entry_amd64), 0);
+        // the same order as PackLinuxElf::addStubEntrySections()
+        if (method == M_NRV2B_LE32)
+            sections = "BENCH_ENTRY,NRV_HEAD,NRV2B,NRV_TAIL,ELFMAINY";
+        else if (method == M_NRV2D_LE32)
+            sections = "BENCH_ENTRY,NRV_HEAD,NRV2D,NRV_TAIL,ELFMAINY";
+        else if (method == M_NRV2E_LE32)
+            sections = "BENCH_ENTRY,NRV_HEAD,NRV2E,NRV_TAIL,ELFMAINY";
+        else if (method == M_LZMA)
+            sections = "BENCH_ENTRY,LZMA_ELF00,LZMA_DEC20,LZMA_DEC30,ELFMAINY";
+#else
+        BenchLinker<ElfLinkerArm64LE> linker;
+        linker.init(stub_arm64_linux_elf_entry, sizeof(stub_arm64_linux_elf_entry));
+        // each NRV section is a complete function there; LZMA_ELF00 is not
+        if (method == M_NRV2B_LE32)
+            sections = "NRV2B";
+        else if (method == M_NRV2D_LE32)
+            sections = "NRV2D";
+        else if (method == M_NRV2E_LE32)
+            sections = "NRV2E";
+#endif
+        if (sections == nullptr)
+            return false;
+        linker.addLoader(sections);
+        linker.relocate();
+        loader = linker.getLoader(&len);
+        if (loader == nullptr || len <= 0)
+            return false;
+        const size_t size = ALIGN_UP(size_t(len), size_t(65536)); // a multiple of any page size
+        void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return false;
+        memcpy(p, loader, len);
+        if (::mprotect(p, size, PROT_READ | PROT_EXEC) != 0) {
+            (void) ::munmap(p, size);
+            return false;
+        }
+        __builtin___clear_cache((char *) p, (char *) p + len);
+        sd.method = method;
+        sd.code = p;
+        sd.code_size = size;
+        sd.fn = reinterpret_cast<stub_decompress_fn>(reinterpret_cast<upx_uintptr_t>(p));
+    } catch (const Throwable &) {
+        return false; // a section is missing
+    }
+    return true;
+}
+
+#endif // BENCH_STUB_DECODERS
+
+const char *stub_arch() noexcept {
+#if (ACC_ARCH_AMD64)
+    return "amd64";
+#else
+    return "arm64";
+#endif
+}
+
+// the rate is about the uncompressed bytes, as for "decompress"
+void bench_stub_decoder(const BenchOptions &bo, const BenchCorpus &c, const BenchMethod &bm,
+                        int level, const StubDecoder &sd, const byte *cbuf, unsigned c_len) {
+    MemBuffer dbuf;
+    dbuf.allocForDecompression(c.len);
+    double secs = 0;
+    unsigned n = 0;
+    int r = 0;
+    unsigned d_len;
+    do {
+        d_len = c.len; // the output limit for LZMA
+        const BenchClock::time_point t0 = BenchClock::now();
+        r = sd.fn(cbuf, c_len, dbuf, &d_len, unsigned(bm.method));
+        secs += seconds_since(t0);
+        n++;
+    } while (r == 0 && secs < bo.min_time);
+    const bool ok = r == 0 && d_len == c.len && memcmp(dbuf, c.mb, c.len) == 0;
+    emit_begin("stub_decompress", c);
+    printf(",\"method\":\"%s\",\"method_id\":%d,\"level\":%d,\"arch\":\"%s\"", bm.name,
+           bm.method, level, stub_arch());
+    emit_end(ok, secs, n, upx_uint64_t(c.len) * n);
+    if (!ok)
+        throwInternalError("upx_bench: stub decompression mismatch");
+}
+
+void bench_filters(const BenchOptions &bo, const BenchCorpus &c) {
+    MemBuffer work(c.len);
+    for (int id = 1; id <= 255; id++) {
+        if (!Filter::isValidFilter(id))
+            continue;
+        // level 1 skips the adler32 of Filter::filter(), so only the kernel is timed
+        Filter ft(1);
+        double t_filter = 0, t_unfilter = 0;
+        unsigned n = 0, calls = 0;
+        bool ok = true;
+        do {
+            memcpy(work, c.mb, c.len);
+            ft.init(id, 0);
+            BenchClock::time_point t0 = BenchClock::now();
+            ok = ft.filter(work, c.len);
+            t_filter += seconds_since(t0);
+            if (!ok)
+                break;
+            calls = ft.calls;
+            t0 = BenchClock::now();
+            ft.unfilter(work, c.len);
+            t_unfilter += seconds_since(t0);
+            n++;
+        } while (t_filter + t_unfilter < bo.min_time);
+        if (ok && memcmp(work, c.mb, c.len) != 0)
+            throwInternalError("upx_bench: unfilter mismatch");
+        emit_begin("filter", c);
+        printf(",\"filter\":\"0x%02x\",\"calls\":%u", id, calls);
+        emit_end(ok, t_filter, n, upx_uint64_t(c.len) * n);
+        if (ok) {
+            emit_begin("unfilter", c);
+            printf(",\"filter\":\"0x%02x\"", id);
+            emit_end(true, t_unfilter, n, upx_uint64_t(c.len) * n);
+        }
+    }
+}
+
+void bench_method(const BenchOptions &bo, const BenchCorpus &c, const BenchMethod &bm, int level,
+                  const StubDecoder *sd) {
+    upx_compress_config_t cconf;
+    cconf.reset();
+    upx_compress_result_t cresult;
+    MemBuffer cbuf;
+    cbuf.allocForCompression(c.len);
+    MemBuffer dbuf;
+    dbuf.allocForDecompression(c.len);
+
+    // compress
+    unsigned c_len = 0;
+    int r = UPX_E_OK;
+    double secs = 0;
+    unsigned n = 0;
+    do {
+        c_len = 0; // use the whole buffer
+        const BenchClock::time_point t0 = BenchClock::now();
+        r = upx_compress(c.mb, c.len, cbuf, &c_len, nullptr, bm.method, level, &cconf, &cresult);
+        secs += seconds_since(t0);
+        n++;
+    } while (r == UPX_E_OK && secs < bo.min_time);
+    bool ok = r == UPX_E_OK && c_len < c.len;
+    emit_begin("compress", c);
+    printf(",\"method\":\"%s\",\"method_id\":%d,\"level\":%d,\"c_len\":%u", bm.name, bm.method,
+           level, ok ? c_len : 0);
+    emit_end(ok, secs, n, upx_uint64_t(c.len) * n);
+    if (!ok)
+        return;
+
+    // decompress; the rate is about the uncompressed bytes
+    secs = 0;
+    n = 0;
+    unsigned d_len;
+    do {
+        d_len = c.len;
+        const BenchClock::time_point t0 = BenchClock::now();
+        r = upx_decompress(cbuf, c_len, dbuf, &d_len, bm.method, &cresult);
+        secs += seconds_since(t0);
+        n++;
+    } while (r == UPX_E_OK && secs < bo.min_time);
+    ok = r == UPX_E_OK && d_len == c.len && memcmp(dbuf, c.mb, c.len) == 0;
+    emit_begin("decompress", c);
+    printf(",\"method\":\"%s\",\"method_id\":%d,\"level\":%d", bm.name, bm.method, level);
+    emit_end(ok, secs, n, upx_uint64_t(c.len) * n);
+    if (!ok)
+        throwInternalError("upx_bench: decompression mismatch");
+    if (sd != nullptr)
+        bench_stub_decoder(bo, c, bm, level, *sd, cbuf, c_len);
+
+    // test_overlap with a generous overlap_overhead, i.e. a single probe
+    // of Packer::findOverlapOverhead(); the compressed data sits at the end
+    const unsigned overhead = c.len / 8 + 256;
+    const unsigned src_off = c.len + overhead - c_len;
+    MemBuffer obuf(src_off + c_len);
+    memcpy(obuf + src_off, cbuf, c_len);
+    secs = 0;
+    n = 0;
+    do {
+        d_len = c.len;
+        const BenchClock::time_point t0 = BenchClock::now();
+        r = upx_test_overlap(obuf, c.mb, src_off, c_len, &d_len, bm.method, &cresult);
+        secs += seconds_since(t0);
+        n++;
+    } while (r == UPX_E_OK && secs < bo.min_time);
+    ok = r == UPX_E_OK && d_len == c.len;
+    emit_begin("test_overlap", c);
+    printf(",\"method\":\"%s\",\"method_id\":%d,\"level\":%d,\"overlap_overhead\":%u", bm.name,
+           bm.method, level, overhead);
+    emit_end(ok, secs, n, upx_uint64_t(c.len) * n);
+}
+
+// sorting 32-bit relocation offsets: libc qsort() with a callback versus the
+// inlined comparison of upx_sort() and the radix sort of upx_radix_sort_le32()
+void bench_sort(const BenchOptions &bo) {
+    constexpr unsigned N = 256 * 1024;
+    BenchCorpus c;
+    c.mb.alloc(4 * N);
+    c.len = 4 * N;
+    upx_safe_snprintf(c.name, sizeof(c.name), "%s", "relocs");
+    // mostly ascending offsets below 16 MiB with some disorder, like real fixups
+    BenchRandom rnd(4);
+    for (unsigned i = 0; i < N; i++)
+        set_le32(c.mb + 4 * i, (i * 48 + rnd.next() % 4096) & 0xffffff);
+    MemBuffer work(c.len);
+    MemBuffer expected(c.len);
+    memcpy(expected, c.mb, c.len);
+    upx_qsort(expected, N, 4, le32_compare);
+    static const char *const names[] = {"upx_qsort", "upx_sort", "upx_radix_sort_le32"};
+    for (unsigned k = 0; k < TABLESIZE(names); k++) {
+        double secs = 0;
+        unsigned n = 0;
+        do {
+            memcpy(work, c.mb, c.len);
+            const BenchClock::time_point t0 = BenchClock::now();
+            if (k == 0)
+                upx_qsort(work, N, 4, le32_compare);
+            else if (k == 1)
+                upx_sort((LE32 *) work.getVoidPtr(), N,
+                         [](const LE32 &a, const LE32 &b) { return a < b; });
+            else
+                upx_radix_sort_le32(work, N);
+            secs += seconds_since(t0);
+            n++;
+        } while (secs < bo.min_time);
+        const bool ok = memcmp(work, expected, c.len) == 0;
+        emit_begin("sort", c);
+        printf(",\"algorithm\":\"%s\"", names[k]);
+        emit_end(ok, secs, n, upx_uint64_t(c.len) * n);
+    }
+}
+
+} // namespace
+
+int upx_bench_main(int argc, char *argv[]) may_throw {
+    upx_compiler_sanity_check();
+    opt->reset();
+    assert(upx_lzma_init() == 0);
+#if (WITH_NRV)
+    assert(upx_nrv_init() == 0);
+#endif
+    assert(upx_ucl_init() == 0);
+    assert(upx_zlib_init() == 0);
+#if (WITH_ZSTD)
+    assert(upx_zstd_init() == 0);
+#endif
+
+    BenchOptions bo;
+    constexpr unsigned MAX_CORPORA = 16;
+    BenchCorpus corpora[MAX_CORPORA];
+    unsigned ncorpora = 0;
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (strcmp(a, "--quick") == 0)
+            bo.quick = true;
+        else if (strncmp(a, "--min-time=", 11) == 0)
+            bo.min_time = atof(a + 11);
+        else if (a[0] == '-' || ncorpora == MAX_CORPORA ||
+                 !load_file(corpora[ncorpora++], a)) {
+            fprintf(stderr, "usage: %s [--quick] [--min-time=SECONDS] [FILE...]\n", argv[0]);
+            return EXIT_USAGE;
+        }
+    }
+    if (ncorpora == 0) {
+        constexpr unsigned CORPUS_LEN = 256 * 1024;
+        void (*const makers[])(byte *, unsigned) = {make_code_corpus, make_text_corpus,
+                                                    make_mixed_corpus};
+        const char *const names[] = {"code", "text", "mixed"};
+        for (unsigned i = 0; i < 3; i++) {
+            BenchCorpus &c = corpora[ncorpora++];
+            c.mb.alloc(CORPUS_LEN);
+            c.len = CORPUS_LEN;
+            makers[i](c.mb, c.len);
+            upx_safe_snprintf(c.name, sizeof(c.name), "%s", names[i]);
+        }
+    }
+
+    StubDecoder stub_decoders[TABLESIZE(bench_methods)];
+#if (BENCH_STUB_DECODERS)
+    for (size_t k = 0; k < TABLESIZE(bench_methods); k++)
+        (void) link_stub_decoder(stub_decoders[k], bench_methods[k].method);
+#endif
+
+    bench_sort(bo);
+    for (unsigned i = 0; i < ncorpora; i++) {
+        const BenchCorpus &c = corpora[i];
+        bench_filters(bo, c);
+        for (size_t k = 0; k < TABLESIZE(bench_methods); k++) {
+            const BenchMethod &bm = bench_methods[k];
+            const StubDecoder *sd = stub_decoders[k].fn ? &stub_decoders[k] : nullptr;
+            for (int level = 1; level <= 10; level++)
+                if (!bo.quick || level == 1 || level == 7 || level == 10)
+                    bench_method(bo, c, bm, level, sd);
+        }
+    }
+    return EXIT_OK;
+}
+
+#endif // UPX_CONFIG_BENCH_MAIN
+
+/* vim:set ts=4 sw=4 et: */
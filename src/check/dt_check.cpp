@@ -25,6 +25,11 @@
  */
 
 #include "../conf.h"
+#include "../util/decision_cache.h" // get_cache_path(), DecisionHasher
+#include "../util/cpu_features.h"   // upx::cpu_features()
+#if defined(__linux__)
+#include <sys/stat.h>
+#endif
 
 /*************************************************************************
 // upx_doctest_check()
@@ -32,10 +37,70 @@
 // honors environment variables:
 //   UPX_DEBUG_DOCTEST_DISABLE
 //   UPX_DEBUG_DOCTEST_VERBOSE
+//   UPX_DEBUG_DOCTEST_CACHE
 //
 // HINT: set "UPX_DEBUG_DOCTEST_DISABLE=1" for improved debugging experience
 **************************************************************************/
 
+#if !defined(DOCTEST_CONFIG_DISABLE)
+// Running all checks costs some time on every start of upx, which adds up
+// when a build calls upx many thousand times. So once all checks passed,
+// remember this for the very same executable file in the cache directory,
+// and skip them on the next starts. Set "UPX_DEBUG_DOCTEST_CACHE=0" to
+// always run them.
+static bool doctest_cache_key(char *key, size_t key_size) noexcept {
+#if defined(__linux__)
+    const char *e = getenv("UPX_DEBUG_DOCTEST_CACHE");
+    if (e && strcmp(e, "0") == 0)
+        return false;
+    struct stat st;
+    if (stat("/proc/self/exe", &st) != 0)
+        return false;
+    upx::DecisionHasher h;
+    h.add((upx_uint64_t) st.st_dev);
+    h.add((upx_uint64_t) st.st_ino);
+    h.add((upx_uint64_t) st.st_size);
+    h.add((upx_uint64_t) st.st_mtime);
+    h.add(UPX_VERSION_STRING, strlen(UPX_VERSION_STRING));
+    h.add(gitrev, strlen(gitrev));
+    // the checks of the CPU specific kernels depend on the host CPU
+    h.add((upx_uint64_t) upx::cpu_features());
+    const upx::DecisionCacheKey k = h.get();
+    snprintf(key, key_size, "%016llx%016llx\n", (unsigned long long) k.h[0],
+             (unsigned long long) k.h[1]);
+    return true;
+#else
+    UNUSED(key);
+    UNUSED(key_size);
+    return false;
+#endif
+}
+
+static bool doctest_cache_hit(const char *key) noexcept {
+    char fn[1024];
+    if (!upx::get_cache_path(fn, sizeof(fn), "doctest-ok.txt", false))
+        return false;
+    FILE *f = fopen(fn, "rb");
+    if (f == nullptr)
+        return false;
+    char line[64];
+    const bool hit = fgets(line, sizeof(line), f) != nullptr && strcmp(line, key) == 0;
+    fclose(f);
+    return hit;
+}
+
+static void doctest_cache_store(const char *key) noexcept {
+    char fn[1024];
+    if (!upx::get_cache_path(fn, sizeof(fn), "doctest-ok.txt", true))
+        return;
+    FILE *f = fopen(fn, "wb");
+    if (f == nullptr)
+        return;
+    fputs(key, f);
+    fclose(f); // errors are harmless; the checks just run again next time
+}
+#endif // DOCTEST_CONFIG_DISABLE
+
 int upx_doctest_check(int argc, char **argv) {
 #if defined(DOCTEST_CONFIG_DISABLE)
     UNUSED(argc);
@@ -69,6 +134,16 @@ int upx_doctest_check(int argc, char **argv) {
             success = true;
         }
     }
+    // only cache the quiet default run; "--dt-XXX" options select other runs
+    char key[64];
+    bool use_cache = minimal && !duration && !success;
+    for (int i = 1; use_cache && i < argc && argv != nullptr; i++)
+        if (argv[i] && strncmp(argv[i], "--dt-", 5) == 0)
+            use_cache = false;
+    if (use_cache)
+        use_cache = doctest_cache_key(key, sizeof(key));
+    if (use_cache && doctest_cache_hit(key))
+        return 0;
     doctest::Context context;
     if (minimal)
         context.setOption("dt-minimal", true);
@@ -84,6 +159,8 @@ int upx_doctest_check(int argc, char **argv) {
         return 1;
     if (context.shouldExit())
         return 2;
+    if (use_cache)
+        doctest_cache_store(key);
     return 0;
 #endif // DOCTEST_CONFIG_DISABLE
 }
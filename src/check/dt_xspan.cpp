@@ -28,6 +28,14 @@
 
 #include "../conf.h"
 
+// without XSPAN_CONFIG_CHECK_ARITHMETIC an out-of-range pointer is only
+// detected when it gets used
+#if XSPAN_CONFIG_CHECK_ARITHMETIC
+#define CHECK_THROWS_ARITH(expr) CHECK_THROWS(expr)
+#else
+#define CHECK_THROWS_ARITH(expr) ((void) 0)
+#endif
+
 /*************************************************************************
 // raw_bytes
 **************************************************************************/
@@ -289,10 +297,10 @@ TEST_CASE("PtrOrSpanOrNull") {
     CHECK_NOTHROW(Span0(base_buf, 4, base_buf));
     CHECK_NOTHROW(Span0(base_buf, 0, base_buf));
     CHECK_NOTHROW(Span0(base_buf, 0, base_buf) - 0);
-    CHECK_THROWS(Span0(base_buf, 0, base_buf) + 1);
-    CHECK_THROWS(Span0(base_buf, 0, base_buf) - 1);
+    CHECK_THROWS_ARITH(Span0(base_buf, 0, base_buf) + 1);
+    CHECK_THROWS_ARITH(Span0(base_buf, 0, base_buf) - 1);
     CHECK_NOTHROW(Span0(base_buf, 4, base_buf) + 4);
-    CHECK_THROWS(Span0(base_buf, 4, base_buf) + 5);
+    CHECK_THROWS_ARITH(Span0(base_buf, 4, base_buf) + 5);
     CHECK_THROWS(Span0(base_buf - 1, 4, base_buf));
     CHECK_THROWS(Span0(base_buf + 1, 0, base_buf));
     // basic same base
@@ -394,10 +402,10 @@ TEST_CASE("PtrOrSpan") {
     CHECK_NOTHROW(SpanP(base_buf, 4, base_buf));
     CHECK_NOTHROW(SpanP(base_buf, 0, base_buf));
     CHECK_NOTHROW(SpanP(base_buf, 0, base_buf) - 0);
-    CHECK_THROWS(SpanP(base_buf, 0, base_buf) + 1);
-    CHECK_THROWS(SpanP(base_buf, 0, base_buf) - 1);
+    CHECK_THROWS_ARITH(SpanP(base_buf, 0, base_buf) + 1);
+    CHECK_THROWS_ARITH(SpanP(base_buf, 0, base_buf) - 1);
     CHECK_NOTHROW(SpanP(base_buf, 4, base_buf) + 4);
-    CHECK_THROWS(SpanP(base_buf, 4, base_buf) + 5);
+    CHECK_THROWS_ARITH(SpanP(base_buf, 4, base_buf) + 5);
     CHECK_THROWS(SpanP(base_buf - 1, 4, base_buf));
     CHECK_THROWS(SpanP(base_buf + 1, 0, base_buf));
     // basic same base
@@ -500,10 +508,10 @@ TEST_CASE("Span") {
     CHECK_NOTHROW(SpanS(base_buf, 4, base_buf));
     CHECK_NOTHROW(SpanS(base_buf, 0, base_buf));
     CHECK_NOTHROW(SpanS(base_buf, 0, base_buf) - 0);
-    CHECK_THROWS(SpanS(base_buf, 0, base_buf) + 1);
-    CHECK_THROWS(SpanS(base_buf, 0, base_buf) - 1);
+    CHECK_THROWS_ARITH(SpanS(base_buf, 0, base_buf) + 1);
+    CHECK_THROWS_ARITH(SpanS(base_buf, 0, base_buf) - 1);
     CHECK_NOTHROW(SpanS(base_buf, 4, base_buf) + 4);
-    CHECK_THROWS(SpanS(base_buf, 4, base_buf) + 5);
+    CHECK_THROWS_ARITH(SpanS(base_buf, 4, base_buf) + 5);
     CHECK_THROWS(SpanS(base_buf - 1, 4, base_buf));
     CHECK_THROWS(SpanS(base_buf + 1, 0, base_buf));
     // basic same base
@@ -862,6 +870,7 @@ TEST_CASE("PtrOrSpan int") {
     CHECK_THROWS(get_le32(a));
 #endif
     CHECK_THROWS(raw_bytes(a, 1));
+#if XSPAN_CONFIG_CHECK_ARITHMETIC
     CHECK_THROWS(a++);
     CHECK_THROWS(++a);
     CHECK_THROWS(a += 1);
@@ -872,6 +881,9 @@ TEST_CASE("PtrOrSpan int") {
     CHECK_THROWS(a -= 1);
     CHECK_THROWS(a += 9);
     CHECK(a == buf);
+#else
+    a = buf;
+#endif
     a += 8;
     CHECK(a == buf + 8);
 }
@@ -26,21 +26,94 @@
 
 #include "../conf.h"
 #include "compress.h"
+#include "../util/cpu_features.h"
 #include "../util/membuffer.h"
 
 /*************************************************************************
-//
+// adler32 - AVX2 version for amd64 with runtime CPU dispatch;
+// the result is the same as from the scalar UCL or zlib versions
 **************************************************************************/
 
+#if (ACC_ARCH_AMD64) && (ACC_CC_CLANG >= 0x030800 || ACC_CC_GNUC >= 0x040900) && !defined(_MSC_VER)
+#define UPX_ADLER32_AVX2 1
+#include <immintrin.h>
+
+namespace {
+
+constexpr unsigned ADLER_BASE = 65521;
+// the largest multiple of 32 so that s2 cannot overflow, see NMAX in zlib
+constexpr unsigned ADLER_NMAX = 5536;
+
+__attribute__((__target__("avx2"))) unsigned adler32_avx2(const byte *p, size_t len,
+                                                           unsigned adler) noexcept {
+    unsigned s1 = adler & 0xffff;
+    unsigned s2 = adler >> 16;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i weights =
+        _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15,
+                         14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    while (len >= 32) {
+        const size_t n = len < ADLER_NMAX ? (len & ~size_t(31)) : ADLER_NMAX;
+        len -= n;
+        __m256i vs1 = _mm256_setr_epi32((int) s1, 0, 0, 0, 0, 0, 0, 0);
+        __m256i vs2 = _mm256_setr_epi32((int) s2, 0, 0, 0, 0, 0, 0, 0);
+        __m256i vs1_sum = zero; // sum of s1 before each 32-byte step
+        for (const byte *end = p + n; p != end; p += 32) {
+            const __m256i v = _mm256_loadu_si256((const __m256i *) (const void *) p);
+            vs1_sum = _mm256_add_epi32(vs1_sum, vs1);
+            vs1 = _mm256_add_epi32(vs1, _mm256_sad_epu8(v, zero));
+            vs2 = _mm256_add_epi32(vs2,
+                                   _mm256_madd_epi16(_mm256_maddubs_epi16(v, weights), ones));
+        }
+        vs2 = _mm256_add_epi32(vs2, _mm256_slli_epi32(vs1_sum, 5));
+        // horizontal sums
+        alignas(32) unsigned a1[8], a2[8];
+        _mm256_store_si256((__m256i *) (void *) a1, vs1);
+        _mm256_store_si256((__m256i *) (void *) a2, vs2);
+        upx_uint64_t t1 = 0, t2 = 0;
+        for (int i = 0; i < 8; i++) {
+            t1 += a1[i];
+            t2 += a2[i];
+        }
+        s1 = (unsigned) (t1 % ADLER_BASE);
+        s2 = (unsigned) (t2 % ADLER_BASE);
+    }
+    adler = (s2 << 16) | s1;
+    if (len != 0)
+        adler = upx_ucl_adler32(p, (unsigned) len, adler);
+    return adler;
+}
+
+} // namespace
+#endif // UPX_ADLER32_AVX2
+
+namespace {
+typedef unsigned (*adler32_fn)(const byte *p, size_t len, unsigned adler);
+
+unsigned adler32_portable(const byte *p, size_t len, unsigned adler) noexcept {
+#if 1
+    return upx_ucl_adler32(p, (unsigned) len, adler);
+#else
+    return upx_zlib_adler32(p, (unsigned) len, adler);
+#endif
+}
+
+const upx::CpuKernel<adler32_fn> adler32_kernels[] = {
+#if (UPX_ADLER32_AVX2)
+    {upx::CPU_AVX2, adler32_avx2},
+#endif
+    {0, adler32_portable},
+};
+} // namespace
+
 unsigned upx_adler32(const void *buf, unsigned len, unsigned adler) {
     if (len == 0)
         return adler;
     assert(buf != nullptr);
-#if 1
-    return upx_ucl_adler32(buf, len, adler);
-#else
-    return upx_zlib_adler32(buf, len, adler);
-#endif
+    if (len < 64) // not worth a vector loop
+        return adler32_portable((const byte *) buf, len, adler);
+    return upx::cpu_select(adler32_kernels)((const byte *) buf, len, adler);
 }
 
 #if 0 // UNUSED
@@ -93,6 +166,12 @@ int upx_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned
 #endif
 
     const unsigned orig_dst_len = *dst_len;
+    // A caller that only wants a result of at most max_c_len bytes: tell the
+    // compressor so that it can stop early. Note that not all compressors
+    // check *dst_len, so dst still must have room for the full result.
+    const unsigned max_c_len = cconf ? cconf->max_c_len : 0;
+    if (max_c_len != 0 && max_c_len < *dst_len)
+        *dst_len = max_c_len;
     if (__acc_cte(false)) {
     }
 #if (WITH_BZIP2)
@@ -124,9 +203,62 @@ int upx_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned
     cresult->debug.c_len = *dst_len;
 #endif
     assert_noexcept(*dst_len <= orig_dst_len);
+    if (max_c_len != 0) {
+        if (r == UPX_E_OK ? *dst_len > max_c_len
+                          : (r == UPX_E_NOT_COMPRESSIBLE || r == UPX_E_OUTPUT_OVERRUN))
+            r = UPX_E_OVER_BUDGET;
+    }
+    // report the exact overlap bound while the compressed data is still hot in the cache
+    if (r == UPX_E_OK && *dst_len < src_len &&
+        (M_IS_NRV2B(method) || M_IS_NRV2D(method) || M_IS_NRV2E(method))) {
+        if (upx_find_overlap(dst, *dst_len, src_len, method, &cresult->overlap) == UPX_E_OK)
+            cresult->have_overlap = true;
+    }
     return r;
 }
 
+// An upper bound for the memory that the compressor itself allocates for
+// src_len bytes, beyond the src and dst buffers.
+upx_uint64_t upx_compress_work_memory(unsigned src_len, int method, int level,
+                                      const upx_compress_config_t *cconf) {
+    UNUSED(src_len);
+    UNUSED(level);
+    UNUSED(cconf);
+#if (WITH_LZMA)
+    if (M_IS_LZMA(method))
+        return upx_lzma_work_memory(src_len, level, cconf);
+#endif
+    UNUSED(method);
+    // UCL/NRV, zlib and zstd use fixed size windows and hash tables
+    return 16 * 1024 * 1024;
+}
+
+/*************************************************************************
+// streaming compression, see compress.h
+**************************************************************************/
+
+CompressStream *upx_compress_stream_open(int method, int level,
+                                         const upx_compress_config_t *cconf,
+                                         CompressStream::write_func_t write, void *user) {
+    assert(method > 0);
+    assert(level > 0);
+    assert(write != nullptr);
+    UNUSED(level);
+    UNUSED(cconf);
+    UNUSED(user);
+    if (__acc_cte(false)) {
+    }
+#if (WITH_ZLIB)
+    else if (M_IS_DEFLATE(method))
+        return upx_zlib_compress_stream_open(level, cconf, write, user);
+#endif
+#if (WITH_ZSTD)
+    else if (M_IS_ZSTD(method))
+        return upx_zstd_compress_stream_open(level, cconf, write, user);
+#endif
+    return nullptr;
+}
+
 /*************************************************************************
 //
 **************************************************************************/
@@ -223,4 +355,37 @@ int upx_test_overlap(const upx_bytep buf, const upx_bytep tbuf, unsigned src_off
     return r;
 }
 
+/*************************************************************************
+// doctest checks
+**************************************************************************/
+
+TEST_CASE("upx_compress max_c_len") {
+    constexpr unsigned N = 65536;
+    MemBuffer u(N), c(MemBuffer::getSizeForCompression(N));
+    for (unsigned i = 0; i < N; i++)
+        u[i] = (byte) ("upx packs executables"[i % 21] + (i % 7 == 0) * (i >> 12));
+    static const int methods[] = {M_NRV2B_LE32, M_NRV2E_8,
+#if (WITH_LZMA)
+                                  M_LZMA,
+#endif
+    };
+    for (int method : methods) {
+        upx_compress_config_t cconf;
+        cconf.reset();
+        unsigned c_len = 0;
+        CHECK(upx_compress(u, N, c, &c_len, nullptr, method, 1, &cconf, nullptr) == UPX_E_OK);
+        const unsigned full_len = c_len;
+        // a limit of exactly the result size is fine
+        cconf.max_c_len = full_len;
+        c_len = 0;
+        CHECK(upx_compress(u, N, c, &c_len, nullptr, method, 1, &cconf, nullptr) == UPX_E_OK);
+        CHECK(c_len == full_len);
+        // one byte less is not
+        cconf.max_c_len = full_len - 1;
+        c_len = 0;
+        CHECK(upx_compress(u, N, c, &c_len, nullptr, method, 1, &cconf, nullptr) ==
+              UPX_E_OVER_BUDGET);
+    }
+}
+
 /* vim:set ts=4 sw=4 et: */
@@ -62,6 +62,8 @@ int upx_lzma_compress      ( const upx_bytep src, unsigned  src_len,
                                    int method, int level,
                              const upx_compress_config_t *cconf,
                                    upx_compress_result_t *cresult );
+upx_uint64_t upx_lzma_work_memory ( unsigned src_len, int level,
+                                    const upx_compress_config_t *cconf );
 int upx_lzma_decompress    ( const upx_bytep src, unsigned  src_len,
                                    upx_bytep dst, unsigned *dst_len,
                                    int method,
@@ -72,6 +74,11 @@ int upx_lzma_test_overlap  ( const upx_bytep buf,
                                    unsigned *dst_len,
                                    int method,
                              const upx_compress_result_t *cresult );
+// compress_lzma_dec.cpp
+int upx_lzma_decode_fast   ( const upx_bytep src, unsigned  src_len,
+                                   upx_bytep dst, unsigned  dst_len,
+                                   unsigned lc, unsigned lp, unsigned pb,
+                                   upx_uint16_t *probs, unsigned *src_used );
 #endif
 
 #if (WITH_NRV)
@@ -114,6 +121,27 @@ int upx_ucl_test_overlap   ( const upx_bytep buf,
                                    unsigned *dst_len,
                                    int method,
                              const upx_compress_result_t *cresult );
+// compress_ucl_fast.cpp: the encoder of upx_ucl_compress() for levels 1 and 2;
+// with dict_len, the dict_len bytes before src are the history of the stream
+// (for example the end of the previous block), which matches may reference
+int upx_ucl_fast_compress  ( const upx_bytep src, unsigned  src_len,
+                                   upx_bytep dst, unsigned *dst_len,
+                                   upx_callback_t *cb,
+                                   int method, int level,
+                                   unsigned max_offset, unsigned max_match,
+                                   ucl_uint *result, unsigned dict_len = 0 );
+// compress_ucl_fast.cpp: the optimal parse of "--nrv-parallel"
+int upx_ucl_parallel_compress(const upx_bytep src, unsigned  src_len,
+                                   upx_bytep dst, unsigned *dst_len,
+                                   upx_callback_t *cb,
+                                   int method, int level,
+                                   unsigned max_offset, unsigned max_match,
+                                   ucl_uint *result );
+// compress_ucl_dec.cpp: the fast path of upx_ucl_decompress(); dict_len
+// bytes of history before dst, see upx_ucl_fast_compress()
+int upx_ucl_decode_fast    ( const upx_bytep src, unsigned  src_len,
+                                   upx_bytep dst, unsigned *dst_len,
+                                   int method, unsigned dict_len = 0 );
 unsigned upx_ucl_adler32(const void *buf, unsigned len, unsigned adler);
 unsigned upx_ucl_crc32  (const void *buf, unsigned len, unsigned crc);
 #endif
@@ -162,4 +190,55 @@ int upx_zstd_test_overlap  ( const upx_bytep buf,
                              const upx_compress_result_t *cresult );
 #endif
 
+/*************************************************************************
+// streaming compression - feed() the input in pieces as it is read, and
+// get the compressed bytes through the write callback instead of staging
+// the whole input and a worst-case output buffer; finish() flushes the
+// rest. The result is the same format as from upx_compress(), so
+// upx_decompress() can decompress it.
+// upx_compress_stream_open() returns nullptr if the method cannot stream;
+// currently M_DEFLATE and M_ZSTD can.
+**************************************************************************/
+
+class CompressStream {
+public:
+    // may throw, for example if the output file is full
+    typedef void (*write_func_t)(const upx_bytep buf, unsigned len, void *user);
+
+    virtual ~CompressStream() noexcept {}
+    // both return UPX_E_OK or an error code
+    virtual int feed(const upx_bytep src, unsigned src_len) = 0;
+    virtual int finish() = 0;
+
+    upx_uint64_t total_in = 0;
+    upx_uint64_t total_out = 0;
+
+protected:
+    CompressStream(write_func_t w, void *u) noexcept : write_func(w), write_user(u) {}
+    void output(const upx_bytep buf, unsigned len) {
+        if (len != 0) {
+            write_func(buf, len, write_user);
+            total_out += len;
+        }
+    }
+    enum { OBUF_SIZE = 64 * 1024 };
+
+private:
+    write_func_t write_func;
+    void *write_user;
+    UPX_CXX_DISABLE_COPY_MOVE(CompressStream)
+};
+
+CompressStream *upx_compress_stream_open(int method, int level,
+                                         const upx_compress_config_t *cconf,
+                                         CompressStream::write_func_t write, void *user);
+#if (WITH_ZLIB)
+CompressStream *upx_zlib_compress_stream_open(int level, const upx_compress_config_t *cconf,
+                                              CompressStream::write_func_t write, void *user);
+#endif
+#if (WITH_ZSTD)
+CompressStream *upx_zstd_compress_stream_open(int level, const upx_compress_config_t *cconf,
+                                              CompressStream::write_func_t write, void *user);
+#endif
+
 /* vim:set ts=4 sw=4 et: */
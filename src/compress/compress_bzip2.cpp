@@ -25,6 +25,7 @@
  */
 
 #include "../headers.h"
+#include <vector>
 #if WITH_BZIP2
 #include <bzip2/bzlib.h>
 #endif
@@ -35,6 +36,7 @@ void bzip2_compress_config_t::reset() noexcept { mem_clear(this); }
 #if WITH_BZIP2
 #include "compress.h"
 #include "../util/membuffer.h"
+#include "../util/threads.h"
 
 #if defined(BZ_NO_STDIO) || 1
 // we need to supply bz_internal_error() when building with BZ_NO_STDIO
@@ -50,13 +52,166 @@ static int convert_errno_from_bzip2(int r) {
         return UPX_E_OK;
     case BZ_MEM_ERROR:
         return UPX_E_OUT_OF_MEMORY;
-    // TODO later: convert to UPX_E_INPUT_OVERRUN, UPX_E_OUTPUT_OVERRUN
+    case BZ_OUTBUFF_FULL:
+        return UPX_E_OUTPUT_OVERRUN;
+    // TODO later: convert to UPX_E_INPUT_OVERRUN
     default:
         break;
     }
     return UPX_E_ERROR;
 }
 
+/*************************************************************************
+// multi-block streams
+//
+// The blocks of a bzip2 stream are independent, so big inputs are split
+// into chunks that are compressed in parallel (much like pbzip2), each
+// into a stream of its own with exactly one block. The blocks are then
+// spliced into a single stream. The blocks are not byte-aligned, so this
+// needs a bit-level copy, and the combined CRC of the stream is
+// recomputed from the CRCs of the blocks.
+//
+// The chunk size only depends on the block size and not on the number of
+// threads, so the compressed output is always the same.
+**************************************************************************/
+
+namespace {
+
+// The first run-length stage of bzip2 turns 4 equal bytes into 5, so a
+// chunk of this size always fits into a single block (see nblockMAX in
+// compress.c of libbzip2).
+unsigned bzip2_chunk_size(int blockSize100k) {
+    const unsigned nblock_max = 100000u * blockSize100k - 19;
+    return (nblock_max - 5) / 5 * 4;
+}
+
+constexpr upx_uint64_t BZIP2_BLOCK_MAGIC = 0x314159265359ull;
+constexpr upx_uint64_t BZIP2_EOS_MAGIC = 0x177245385090ull;
+
+// read n <= 48 bits at bit offset pos, msb first
+upx_uint64_t bzip2_get_bits(const byte *buf, unsigned pos, unsigned n) {
+    upx_uint64_t v = 0;
+    for (unsigned i = 0; i < n; i++, pos++)
+        v = (v << 1) | ((buf[pos >> 3] >> (7 - (pos & 7))) & 1);
+    return v;
+}
+
+struct Bzip2Writer final {
+    byte *out;
+    unsigned out_len;
+    unsigned len = 0;
+    upx_uint64_t bitbuf = 0;
+    unsigned bitcnt = 0;
+    bool overflow = false;
+
+    void putBits(upx_uint64_t v, unsigned n) { // n <= 32
+        bitbuf = (bitbuf << n) | (v & ((upx_uint64_t(1) << n) - 1));
+        bitcnt += n;
+        while (bitcnt >= 8) {
+            bitcnt -= 8;
+            if very_unlikely (len >= out_len) {
+                overflow = true;
+                return;
+            }
+            out[len++] = byte(bitbuf >> bitcnt);
+        }
+    }
+    // copy the bits [pos, end) of buf
+    void copyBits(const byte *buf, unsigned pos, unsigned end) {
+        for (; pos + 8 <= end && !overflow; pos += 8) {
+            const unsigned sh = pos & 7;
+            unsigned v = buf[pos >> 3];
+            if (sh != 0)
+                v = ((v << 8) | buf[(pos >> 3) + 1]) >> (8 - sh);
+            putBits(v, 8);
+        }
+        if (pos < end)
+            putBits(bzip2_get_bits(buf, pos, end - pos), end - pos);
+    }
+    void flush() {
+        if (bitcnt > 0)
+            putBits(0, 8 - bitcnt);
+    }
+};
+
+// Find the end-of-stream marker of a single-block stream; on success *eos is
+// its bit offset and *block_crc the CRC of the block.
+bool bzip2_parse_stream(const byte *buf, unsigned len, unsigned *eos, unsigned *block_crc) {
+    if (len < 4 + 10 + 10 || buf[0] != 'B' || buf[1] != 'Z' || buf[2] != 'h')
+        return false;
+    if (bzip2_get_bits(buf, 32, 48) != BZIP2_BLOCK_MAGIC)
+        return false;
+    const unsigned crc = (unsigned) bzip2_get_bits(buf, 32 + 48, 32);
+    for (unsigned pad = 0; pad < 8; pad++) {
+        const unsigned pos = len * 8 - pad - 80;
+        if (bzip2_get_bits(buf, pos, 48) != BZIP2_EOS_MAGIC)
+            continue;
+        if (pad && bzip2_get_bits(buf, len * 8 - pad, pad) != 0)
+            continue;
+        // with one block the combined CRC of the stream is the CRC of the block,
+        // so this also catches a chunk that did not fit into a single block
+        if ((unsigned) bzip2_get_bits(buf, pos + 48, 32) != crc)
+            return false;
+        *eos = pos;
+        *block_crc = crc;
+        return true;
+    }
+    return false;
+}
+
+struct Bzip2Chunk final {
+    MemBuffer buf;
+    unsigned len = 0;
+    int r = UPX_E_ERROR;
+};
+
+int bzip2_compress_chunks(const byte *src, unsigned src_len, byte *dst, unsigned *dst_len,
+                          int blockSize100k) {
+    const unsigned chunk_size = bzip2_chunk_size(blockSize100k);
+    const unsigned nchunks = (src_len + chunk_size - 1) / chunk_size;
+    std::vector<Bzip2Chunk> chunks(nchunks);
+    upx::parallel_for(nchunks, upx::get_num_threads(nchunks), [&](size_t j) {
+        Bzip2Chunk &c = chunks[j];
+        const unsigned off = unsigned(j) * chunk_size;
+        const unsigned n = UPX_MIN(chunk_size, src_len - off);
+        c.buf.allocForCompression(n);
+        c.len = c.buf.getSize();
+        char *source = (char *) const_cast<byte *>(src + off);
+        c.r = BZ2_bzBuffToBuffCompress((char *) raw_bytes(c.buf, c.len), &c.len, source, n,
+                                       blockSize100k, 0, 0);
+    });
+
+    Bzip2Writer w;
+    w.out = dst;
+    w.out_len = *dst_len;
+    w.putBits('B', 8);
+    w.putBits('Z', 8);
+    w.putBits('h', 8);
+    w.putBits('0' + blockSize100k, 8);
+    unsigned combined_crc = 0;
+    for (unsigned j = 0; j < nchunks; j++) {
+        const Bzip2Chunk &c = chunks[j];
+        if (c.r != BZ_OK)
+            return convert_errno_from_bzip2(c.r);
+        const byte *const b = raw_bytes(c.buf, c.len);
+        unsigned eos = 0, crc = 0;
+        if (!bzip2_parse_stream(b, c.len, &eos, &crc) || b[3] != w.out[3])
+            return UPX_E_ERROR;
+        combined_crc = ((combined_crc << 1) | (combined_crc >> 31)) ^ crc;
+        w.copyBits(b, 32, eos);
+    }
+    w.putBits(BZIP2_EOS_MAGIC >> 24, 24);
+    w.putBits(BZIP2_EOS_MAGIC, 24);
+    w.putBits(combined_crc, 32);
+    w.flush();
+    if (w.overflow)
+        return UPX_E_OUTPUT_OVERRUN;
+    *dst_len = w.len;
+    return UPX_E_OK;
+}
+
+} // namespace
+
 /*************************************************************************
 //
 **************************************************************************/
@@ -83,6 +238,8 @@ int upx_bzip2_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, uns
     if (level <= 3 && blockSize100k > level)
         blockSize100k = level;
 
+    if (src_len > bzip2_chunk_size(blockSize100k))
+        return bzip2_compress_chunks(src, src_len, dst, dst_len, blockSize100k);
     char *dest = (char *) dst;
     char *source = (char *) const_cast<byte *>(src);
     r = BZ2_bzBuffToBuffCompress(dest, dst_len, source, src_len, blockSize100k, 0, 0);
@@ -184,6 +341,26 @@ static bool check_bzip2(const int method, const int level, const unsigned expect
 
 TEST_CASE("compress_bzip2") { CHECK(check_bzip2(M_BZIP2, 9, 46)); }
 
+TEST_CASE("compress_bzip2 multi-block") {
+    // level 1 uses 100k blocks, so this is spliced from 4 chunks
+    const unsigned u_len = 256 * 1024;
+    MemBuffer u_buf(u_len), c_buf, d_buf;
+    for (unsigned i = 0; i < u_len; i++)
+        u_buf[i] = byte((i / 4) ^ (i >> 13)); // runs of 4: the worst case for the block size
+    c_buf.allocForCompression(u_len);
+    d_buf.allocForDecompression(u_len);
+    upx_compress_result_t cresult;
+    unsigned c_len = c_buf.getSize();
+    int r = upx_bzip2_compress(raw_bytes(u_buf, u_len), u_len, raw_bytes(c_buf, c_len), &c_len,
+                               nullptr, M_BZIP2, 1, NULL_cconf, &cresult);
+    CHECK(r == 0);
+    unsigned d_len = d_buf.getSize();
+    r = upx_bzip2_decompress(raw_bytes(c_buf, c_len), c_len, raw_bytes(d_buf, d_len), &d_len,
+                             M_BZIP2, nullptr);
+    CHECK((r == 0 && d_len == u_len));
+    CHECK(memcmp(u_buf, d_buf, u_len) == 0);
+}
+
 #endif // DEBUG
 
 TEST_CASE("upx_bzip2_decompress") {
@@ -0,0 +1,516 @@
+/* compress_inflate.cpp -- whole-buffer deflate decoder
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer
+   <markus@oberhumer.com>
+ */
+
+#include "../conf.h"
+#include "compress.h"
+#include "../util/membuffer.h"
+
+/*************************************************************************
+// UPX always has the whole compressed input and the whole output buffer
+// in memory, so unlike zlib's inflate() this decoder does not need to be
+// able to suspend and resume. That allows a much simpler and faster
+// design (much like libdeflate):
+//   - a 64-bit bit buffer that is refilled with a single unaligned load,
+//     so that one refill is enough for a whole length/distance pair
+//   - Huffman tables that resolve a symbol together with the base value
+//     and the number of extra bits of its length or distance
+//   - match copies in 8-byte words where the distance allows it
+**************************************************************************/
+
+namespace {
+
+// table entry: value << 16 | extra_bits << 8 | kind << 4 | code_bits;
+// an entry of 0 marks an unused code of an incomplete code set
+enum : unsigned { K_INVALID = 0, K_LITERAL = 1, K_LENGTH = 2, K_EOB = 3, K_SUBTABLE = 4 };
+
+constexpr unsigned LITLEN_ROOT = 10;
+constexpr unsigned DIST_ROOT = 8;
+constexpr unsigned MAX_CODE_BITS = 15;
+// upper limits of the table sizes: every subtable is addressed by a
+// distinct root index, and has at most 2**(MAX_CODE_BITS - root) entries
+constexpr unsigned LITLEN_TABLE_SIZE = (1u << LITLEN_ROOT) + 288 * (1u << (15 - LITLEN_ROOT));
+constexpr unsigned DIST_TABLE_SIZE = (1u << DIST_ROOT) + 32 * (1u << (15 - DIST_ROOT));
+constexpr unsigned PRECODE_TABLE_SIZE = 1u << 7;
+
+forceinline unsigned make_entry(unsigned value, unsigned extra, unsigned kind, unsigned nbits) {
+    return (value << 16) | (extra << 8) | (kind << 4) | nbits;
+}
+
+const upx_uint16_t length_base[29] = {3,  4,  5,  6,   7,   8,   9,   10,  11, 13,
+                                     15, 17, 19, 23,  27,  31,  35,  43,  51, 59,
+                                     67, 83, 99, 115, 131, 163, 195, 227, 258};
+const upx_uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                     2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const upx_uint16_t dist_base[30] = {1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+                                   33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+                                   1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const upx_uint8_t dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                   6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// the order of the code lengths of the code length alphabet
+const upx_uint8_t precode_order[19] = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                      11, 4,  12, 3, 13, 2, 14, 1, 15};
+
+// The entry of a symbol of the literal/length alphabet (is_litlen),
+// the distance alphabet, or the code length alphabet.
+inline unsigned symbol_entry(unsigned sym, bool is_litlen, bool is_dist, unsigned nbits) {
+    if (is_litlen) {
+        if (sym < 256)
+            return make_entry(sym, 0, K_LITERAL, nbits);
+        if (sym == 256)
+            return make_entry(0, 0, K_EOB, nbits);
+        if (sym - 257 >= 29)
+            return 0; // symbols 286 and 287 never occur
+        return make_entry(length_base[sym - 257], length_extra[sym - 257], K_LENGTH, nbits);
+    }
+    if (is_dist) {
+        if (sym >= 30)
+            return 0; // symbols 30 and 31 never occur
+        return make_entry(dist_base[sym], dist_extra[sym], K_LENGTH, nbits);
+    }
+    return make_entry(sym, 0, K_LITERAL, nbits);
+}
+
+// Build a decoding table with (1 << root) entries indexed by the next
+// root bits of the input, plus subtables for the longer codes.
+// Returns false if the code set is over-subscribed.
+bool build_table(upx_uint32_t *table, unsigned table_size, unsigned root, const upx_uint8_t *lens,
+                 unsigned nsyms, bool is_litlen, bool is_dist) {
+    unsigned count[MAX_CODE_BITS + 1] = {};
+    for (unsigned i = 0; i < nsyms; i++)
+        count[lens[i]]++;
+    count[0] = 0;
+    int left = 1;
+    for (unsigned len = 1; len <= MAX_CODE_BITS; len++) {
+        left = 2 * left - int(count[len]);
+        if (left < 0)
+            return false; // over-subscribed
+    }
+    // incomplete code sets are allowed; unused codes keep a 0 entry
+    unsigned next_code[MAX_CODE_BITS + 2];
+    next_code[1] = 0;
+    for (unsigned len = 1; len <= MAX_CODE_BITS; len++)
+        next_code[len + 1] = (next_code[len] + count[len]) << 1;
+
+    const unsigned root_size = 1u << root;
+    memset(table, 0, sizeof(table[0]) * root_size);
+    // longest code below each root index, to size the subtables
+    upx_uint8_t sub_bits[1u << LITLEN_ROOT] = {};
+    // assign the canonical codes (in bit-reversed order, as deflate sends
+    // the codes msb first into an lsb-first bit stream)
+    unsigned codes[288];
+    for (unsigned sym = 0; sym < nsyms; sym++) {
+        const unsigned len = lens[sym];
+        if (len == 0)
+            continue;
+        unsigned code = next_code[len]++;
+        unsigned rev = 0;
+        for (unsigned i = 0; i < len; i++, code >>= 1)
+            rev = (rev << 1) | (code & 1);
+        codes[sym] = rev;
+        if (len > root) {
+            const unsigned idx = rev & (root_size - 1);
+            if (len - root > sub_bits[idx])
+                sub_bits[idx] = upx_uint8_t(len - root);
+        }
+    }
+    // allocate the subtables
+    unsigned used = root_size;
+    for (unsigned idx = 0; idx < root_size; idx++) {
+        if (sub_bits[idx] == 0)
+            continue;
+        const unsigned n = 1u << sub_bits[idx];
+        if (used + n > table_size)
+            return false; // cannot happen
+        table[idx] = make_entry(used, sub_bits[idx], K_SUBTABLE, root);
+        memset(table + used, 0, sizeof(table[0]) * n);
+        used += n;
+    }
+    // fill the entries
+    for (unsigned sym = 0; sym < nsyms; sym++) {
+        const unsigned len = lens[sym];
+        if (len == 0)
+            continue;
+        const unsigned rev = codes[sym];
+        if (len <= root) {
+            const unsigned e = symbol_entry(sym, is_litlen, is_dist, len);
+            for (unsigned i = rev; i < root_size; i += 1u << len)
+                table[i] = e;
+        } else {
+            const unsigned sub = table[rev & (root_size - 1)];
+            const unsigned bits = (sub >> 8) & 0xff;
+            const unsigned e = symbol_entry(sym, is_litlen, is_dist, len - root);
+            for (unsigned i = rev >> root; i < (1u << bits); i += 1u << (len - root))
+                table[(sub >> 16) + i] = e;
+        }
+    }
+    return true;
+}
+
+struct Inflater final {
+    const byte *in;
+    const byte *in_end;
+    byte *const out_begin;
+    byte *out;
+    byte *const out_end;
+    upx_uint64_t bitbuf = 0;
+    unsigned bitcnt = 0;
+    unsigned overrun = 0; // number of zero bytes fed in after the end of the input
+
+    upx_uint32_t *litlen_table;
+    upx_uint32_t *dist_table;
+
+    Inflater(const byte *src, unsigned src_len, byte *dst, unsigned dst_len)
+        : in(src), in_end(src + src_len), out_begin(dst), out(dst), out_end(dst + dst_len) {}
+
+    // make sure that there are at least 56 bits in bitbuf
+    forceinline void refill() {
+        if very_likely (in_end - in >= 8) {
+            bitbuf |= get_le64(in) << bitcnt;
+            in += (63 - bitcnt) >> 3;
+            bitcnt |= 56;
+            return;
+        }
+        while (bitcnt <= 56) {
+            if (in < in_end)
+                bitbuf |= upx_uint64_t(*in++) << bitcnt;
+            else
+                overrun++;
+            bitcnt += 8;
+        }
+    }
+    forceinline unsigned peek(unsigned n) const { return unsigned(bitbuf) & ((1u << n) - 1); }
+    forceinline void consume(unsigned n) {
+        bitbuf >>= n;
+        bitcnt -= n;
+    }
+    forceinline unsigned getBits(unsigned n) { // n <= 32, needs a refill() before
+        const unsigned v = unsigned(bitbuf & ((upx_uint64_t(1) << n) - 1));
+        consume(n);
+        return v;
+    }
+    // more bits consumed than the input has?
+    bool overrunInput() const { return overrun * 8 > bitcnt; }
+    // number of whole input bytes that are still unused in bitbuf
+    unsigned bufferedBytes() const { return (bitcnt >> 3) - overrun; }
+
+    // decode one entry; returns 0 for an unused code
+    forceinline unsigned decode(const upx_uint32_t *table, unsigned root) {
+        unsigned e = table[peek(root)];
+        if ((e >> 4 & 0xf) == K_SUBTABLE) {
+            consume(root);
+            e = table[(e >> 16) + peek((e >> 8) & 0xff)];
+        }
+        consume(e & 0xf);
+        return e;
+    }
+
+    int storedBlock();
+    int dynamicTables();
+    void fixedTables();
+    int huffmanBlock();
+    int run();
+};
+
+int Inflater::storedBlock() {
+    // go back to a byte boundary, and return the buffered bytes to the input
+    consume(bitcnt & 7);
+    if (overrunInput())
+        return UPX_E_INPUT_OVERRUN;
+    in -= bufferedBytes();
+    bitbuf = 0;
+    bitcnt = 0;
+    overrun = 0;
+    if (in_end - in < 4)
+        return UPX_E_INPUT_OVERRUN;
+    const unsigned len = get_le16(in);
+    const unsigned nlen = get_le16(in + 2);
+    in += 4;
+    if (len != (~nlen & 0xffff))
+        return UPX_E_ERROR;
+    if (unsigned(in_end - in) < len)
+        return UPX_E_INPUT_OVERRUN;
+    if (unsigned(out_end - out) < len)
+        return UPX_E_OUTPUT_OVERRUN;
+    memcpy(out, in, len);
+    in += len;
+    out += len;
+    return UPX_E_OK;
+}
+
+void Inflater::fixedTables() {
+    upx_uint8_t lens[288 + 32];
+    unsigned i = 0;
+    for (; i < 144; i++)
+        lens[i] = 8;
+    for (; i < 256; i++)
+        lens[i] = 9;
+    for (; i < 280; i++)
+        lens[i] = 7;
+    for (; i < 288; i++)
+        lens[i] = 8;
+    for (; i < 288 + 32; i++)
+        lens[i] = 5;
+    (void) build_table(litlen_table, LITLEN_TABLE_SIZE, LITLEN_ROOT, lens, 288, true, false);
+    (void) build_table(dist_table, DIST_TABLE_SIZE, DIST_ROOT, lens + 288, 32, false, true);
+}
+
+int Inflater::dynamicTables() {
+    refill();
+    const unsigned hlit = getBits(5) + 257;
+    const unsigned hdist = getBits(5) + 1;
+    const unsigned hclen = getBits(4) + 4;
+    if (hlit > 286 || hdist > 30)
+        return UPX_E_ERROR;
+    upx_uint8_t precode_lens[19] = {};
+    for (unsigned i = 0; i < hclen; i++) {
+        if (bitcnt < 3)
+            refill();
+        precode_lens[precode_order[i]] = upx_uint8_t(getBits(3));
+    }
+    upx_uint32_t precode_table[PRECODE_TABLE_SIZE];
+    if (!build_table(precode_table, PRECODE_TABLE_SIZE, 7, precode_lens, 19, false, false))
+        return UPX_E_ERROR;
+
+    upx_uint8_t lens[286 + 30];
+    const unsigned n = hlit + hdist;
+    for (unsigned i = 0; i < n;) {
+        refill();
+        const unsigned e = decode(precode_table, 7);
+        if (((e >> 4) & 0xf) != K_LITERAL)
+            return UPX_E_ERROR;
+        const unsigned sym = e >> 16;
+        if (sym < 16) {
+            lens[i++] = upx_uint8_t(sym);
+            continue;
+        }
+        unsigned rep;
+        upx_uint8_t v = 0;
+        if (sym == 16) {
+            if (i == 0)
+                return UPX_E_ERROR;
+            v = lens[i - 1];
+            rep = 3 + getBits(2);
+        } else if (sym == 17)
+            rep = 3 + getBits(3);
+        else
+            rep = 11 + getBits(7);
+        if (rep > n - i)
+            return UPX_E_ERROR;
+        memset(lens + i, v, rep);
+        i += rep;
+    }
+    if (overrunInput())
+        return UPX_E_INPUT_OVERRUN;
+    if (lens[256] == 0)
+        return UPX_E_ERROR; // no end-of-block code
+    if (!build_table(litlen_table, LITLEN_TABLE_SIZE, LITLEN_ROOT, lens, hlit, true, false))
+        return UPX_E_ERROR;
+    if (!build_table(dist_table, DIST_TABLE_SIZE, DIST_ROOT, lens + hlit, hdist, false, true))
+        return UPX_E_ERROR;
+    return UPX_E_OK;
+}
+
+int Inflater::huffmanBlock() {
+    for (;;) {
+        // one refill gives at least 56 bits, enough for a literal/length code (15),
+        // its extra bits (5), a distance code (15) and its extra bits (13)
+        refill();
+        if very_unlikely (overrun > 8)
+            return UPX_E_INPUT_OVERRUN;
+        unsigned e = decode(litlen_table, LITLEN_ROOT);
+        if (((e >> 4) & 0xf) == K_LITERAL) {
+            if very_unlikely (out >= out_end)
+                return UPX_E_OUTPUT_OVERRUN;
+            *out++ = byte(e >> 16);
+            // usually two more literals still fit into the bit buffer
+            if (bitcnt < 2 * MAX_CODE_BITS)
+                continue;
+            e = decode(litlen_table, LITLEN_ROOT);
+            if (((e >> 4) & 0xf) == K_LITERAL) {
+                if very_unlikely (out >= out_end)
+                    return UPX_E_OUTPUT_OVERRUN;
+                *out++ = byte(e >> 16);
+                e = decode(litlen_table, LITLEN_ROOT);
+                if (((e >> 4) & 0xf) == K_LITERAL) {
+                    if very_unlikely (out >= out_end)
+                        return UPX_E_OUTPUT_OVERRUN;
+                    *out++ = byte(e >> 16);
+                    continue;
+                }
+            }
+            // not a literal, so refill again for the length and distance
+            refill();
+        }
+        const unsigned kind = (e >> 4) & 0xf;
+        if very_unlikely (kind != K_LENGTH)
+            return kind == K_EOB ? (overrunInput() ? UPX_E_INPUT_OVERRUN : UPX_E_OK)
+                                 : UPX_E_ERROR;
+        const unsigned len = (e >> 16) + getBits((e >> 8) & 0xff);
+        const unsigned d = decode(dist_table, DIST_ROOT);
+        if very_unlikely (((d >> 4) & 0xf) != K_LENGTH)
+            return UPX_E_ERROR;
+        const unsigned dist = (d >> 16) + getBits((d >> 8) & 0xff);
+        if very_unlikely (dist > ptr_udiff_bytes(out, out_begin))
+            return UPX_E_ERROR;
+        if very_unlikely (len > ptr_udiff_bytes(out_end, out))
+            return UPX_E_OUTPUT_OVERRUN;
+        byte *const end = out + len;
+        const byte *from = out - dist;
+        if (dist >= 8 && ptr_udiff_bytes(out_end, end) >= 8) {
+            // each 8-byte word only reads bytes which are already written
+            do {
+                upx_memcpy_inline(out, from, 8);
+                out += 8;
+                from += 8;
+            } while (out < end);
+            out = end;
+        } else if (dist == 1) {
+            memset(out, *from, len);
+            out = end;
+        } else {
+            do
+                *out++ = *from++;
+            while (out < end);
+        }
+    }
+}
+
+int Inflater::run() {
+    int r;
+    bool final;
+    do {
+        refill();
+        final = getBits(1);
+        const unsigned type = getBits(2);
+        if (type == 0)
+            r = storedBlock();
+        else if (type == 1) {
+            fixedTables();
+            r = huffmanBlock();
+        } else if (type == 2) {
+            r = dynamicTables();
+            if (r == UPX_E_OK)
+                r = huffmanBlock();
+        } else
+            r = UPX_E_ERROR;
+        if (r == UPX_E_OK && overrunInput())
+            r = UPX_E_INPUT_OVERRUN;
+        if (r != UPX_E_OK)
+            return r;
+    } while (!final);
+    return UPX_E_OK;
+}
+
+} // namespace
+
+/*************************************************************************
+// Decode the raw deflate stream at src into dst. On return *dst_len is the
+// number of decoded bytes, and *src_used (if not nullptr) the number of
+// input bytes up to the end of the final block; trailing input is not an
+// error here.
+**************************************************************************/
+
+int upx_inflate(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned *dst_len,
+                unsigned *src_used) {
+    MemBuffer tables(mem_size(sizeof(upx_uint32_t), LITLEN_TABLE_SIZE + DIST_TABLE_SIZE));
+    Inflater z(src, src_len, dst, *dst_len);
+    z.litlen_table = (upx_uint32_t *) tables.getVoidPtr();
+    z.dist_table = z.litlen_table + LITLEN_TABLE_SIZE;
+    const int r = z.run();
+    *dst_len = ptr_udiff_bytes(z.out, dst);
+    if (src_used != nullptr)
+        *src_used = ptr_udiff_bytes(z.in, src) - (r == UPX_E_OK ? z.bufferedBytes() : 0);
+    return r;
+}
+
+/*************************************************************************
+// Decode the gzip member at src (RFC 1952), and check its CRC and size.
+**************************************************************************/
+
+int upx_gunzip(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned *dst_len,
+               unsigned *src_used) {
+    const unsigned dst_size = *dst_len;
+    *dst_len = 0;
+    if (src_len < 18 || src[0] != 0x1f || src[1] != 0x8b || src[2] != 8 || (src[3] & 0xe0))
+        return UPX_E_ERROR;
+    const unsigned flags = src[3];
+    unsigned pos = 10;
+    if (flags & 4) { // FEXTRA
+        pos += 2 + get_le16(src + pos);
+        if (pos > src_len)
+            return UPX_E_INPUT_OVERRUN;
+    }
+    for (unsigned f = 8; f <= 16; f <<= 1) { // FNAME, FCOMMENT
+        if (!(flags & f))
+            continue;
+        while (pos < src_len && src[pos] != 0)
+            pos++;
+        if (++pos > src_len)
+            return UPX_E_INPUT_OVERRUN;
+    }
+    if (flags & 2) // FHCRC
+        pos += 2;
+    if (pos + 8 > src_len)
+        return UPX_E_INPUT_OVERRUN;
+    unsigned used = 0;
+    *dst_len = dst_size;
+    int r = upx_inflate(src + pos, src_len - pos - 8, dst, dst_len, &used);
+    if (r != UPX_E_OK)
+        return r;
+    pos += used;
+    if (get_le32(src + pos) != upx_zlib_crc32(dst, *dst_len, 0) ||
+        get_le32(src + pos + 4) != *dst_len)
+        return UPX_E_ERROR;
+    if (src_used != nullptr)
+        *src_used = pos + 8;
+    return UPX_E_OK;
+}
+
+/*************************************************************************
+// doctest checks
+**************************************************************************/
+
+TEST_CASE("upx_inflate") {
+    // the same data as in TEST_CASE("upx_zlib_decompress")
+    const byte *c_data = (const byte *) "\xfb\xff\x1f\x15\x00\x00";
+    byte d_buf[16];
+    unsigned d_len = 16;
+    unsigned used = 0;
+    CHECK(upx_inflate(c_data, 6, d_buf, &d_len, &used) == UPX_E_OK);
+    CHECK((d_len == 16 && used == 6));
+    d_len = 16;
+    CHECK(upx_inflate(c_data, 5, d_buf, &d_len, nullptr) == UPX_E_INPUT_OVERRUN);
+    d_len = 15;
+    CHECK(upx_inflate(c_data, 6, d_buf, &d_len, nullptr) == UPX_E_OUTPUT_OVERRUN);
+    // a stored block
+    c_data = (const byte *) "\x01\x03\x00\xfc\xff" "abc";
+    d_len = 16;
+    CHECK(upx_inflate(c_data, 8, d_buf, &d_len, &used) == UPX_E_OK);
+    CHECK((d_len == 3 && used == 8 && memcmp(d_buf, "abc", 3) == 0));
+}
+
+/* vim:set ts=4 sw=4 et: */
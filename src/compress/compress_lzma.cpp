@@ -27,6 +27,9 @@
 #include "../conf.h"
 #include "compress.h"
 #include "../util/membuffer.h"
+#if defined(COMPRESS_MF_MT)
+#include "../util/threads.h"
+#endif
 
 #if (ACC_CC_CLANG)
 #pragma clang diagnostic ignored "-Wshadow"
@@ -294,11 +297,16 @@ struct ProgressInfo final : public ICompressProgressInfo, public CMyUnknownImp {
     MY_UNKNOWN_IMP
     STDMETHOD(SetRatioInfo)(const UInt64 *inSize, const UInt64 *outSize) override;
     upx_callback_t *cb = nullptr;
+    UInt64 out_limit = ~(UInt64) 0; // the OutStream size
 };
 
 STDMETHODIMP ProgressInfo::SetRatioInfo(const UInt64 *inSize, const UInt64 *outSize) {
     if (cb && cb->nprogress)
         cb->nprogress(cb, (unsigned) *inSize, (unsigned) *outSize);
+    // *outSize includes the data that is still buffered in the range encoder,
+    // so this notices an overflow long before OutStream::Write() does
+    if (outSize != nullptr && *outSize > out_limit)
+        return E_ABORT;
     return S_OK;
 }
 
@@ -316,6 +324,48 @@ STDMETHODIMP ProgressInfo::SetRatioInfo(const UInt64 *inSize, const UInt64 *outS
 #include <lzma-sdk/C/7zip/Compress/RangeCoder/RangeCoderBit.cpp>
 #undef RC_NORMALIZE
 
+// The encoder (and its match-finder and hash tables, which are only
+// re-allocated when dict_size or num_fast_bytes change) is kept per thread
+// and reused across calls.
+// Its working memory is accounted with the MemBuffers, see "--memory-limit".
+namespace {
+struct LzmaEncoderContext final {
+    NCompress::NLZMA::CEncoder *enc = nullptr;
+    size_t work_memory = 0; // estimate, see lzma_work_memory()
+    LzmaEncoderContext() noexcept = default;
+    ~LzmaEncoderContext() noexcept { release(); }
+    void release() noexcept {
+        delete enc;
+        enc = nullptr;
+        set_work_memory(0);
+    }
+    void set_work_memory(size_t bytes) noexcept {
+        if (bytes > work_memory)
+            MemBuffer::addWorkMemory(bytes - work_memory);
+        else if (bytes < work_memory)
+            MemBuffer::subWorkMemory(work_memory - bytes);
+        work_memory = bytes;
+    }
+    UPX_CXX_DISABLE_COPY_MOVE(LzmaEncoderContext)
+};
+upx_thread_local LzmaEncoderContext lzma_encoder_context;
+
+// the "BT4" match finder needs about 1.5x the dictionary for its window and
+// 8x for its binary tree, plus 4 MiB of hash tables and the encoder state
+upx_uint64_t lzma_work_memory(unsigned dict_size) noexcept {
+    return upx_uint64_t(dict_size) * 19 / 2 + 6 * 1024 * 1024;
+}
+} // namespace
+
+upx_uint64_t upx_lzma_work_memory(unsigned src_len, int level,
+                                  const upx_compress_config_t *cconf) {
+    lzma_compress_result_t res;
+    res.reset();
+    if (!prepare_result(&res, src_len, M_LZMA, level, cconf ? &cconf->conf_lzma : nullptr))
+        return lzma_work_memory(src_len);
+    return lzma_work_memory(res.dict_size);
+}
+
 int upx_lzma_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned *dst_len,
                       upx_callback_t *cb, int method, int level,
                       const upx_compress_config_t *cconf_parm, upx_compress_result_t *cresult) {
@@ -338,9 +388,21 @@ int upx_lzma_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsi
     MyLzma::ProgressInfo progress;
     progress.AddRef();
     progress.cb = cb; // progress.Init()
-
-    NCompress::NLZMA::CEncoder enc;
-    const PROPID propIDs[8] = {
+    progress.out_limit = *dst_len;
+
+    if (lzma_encoder_context.enc == nullptr)
+        lzma_encoder_context.enc = new NCompress::NLZMA::CEncoder;
+    NCompress::NLZMA::CEncoder &enc = *lzma_encoder_context.enc;
+#if defined(COMPRESS_MF_MT)
+    // With "--threads" the multi-threaded binary-tree match finder of the SDK
+    // runs ahead of the encoder in a second thread. It finds exactly the same
+    // matches as "BT4", so the stream (and the lzma_d stubs) are unchanged.
+    const bool mf_mt = src_len >= 4 * 1024 * 1024 && upx::get_num_threads(2) >= 2;
+    const unsigned nprops = 9;
+#else
+    const unsigned nprops = 8;
+#endif
+    const PROPID propIDs[9] = {
         NCoderPropID::kPosStateBits,      // 0  pb    _posStateBits(2)
         NCoderPropID::kLitPosBits,        // 1  lp    _numLiteralPosStateBits(0)
         NCoderPropID::kLitContextBits,    // 2  lc    _numLiteralContextBits(3)
@@ -348,12 +410,20 @@ int upx_lzma_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsi
         NCoderPropID::kAlgorithm,         // 4  fm    _fastmode
         NCoderPropID::kNumFastBytes,      // 5  fb
         NCoderPropID::kMatchFinderCycles, // 6  mfc   _matchFinderCycles, _cutValue
-        NCoderPropID::kMatchFinder        // 7  mf
+        NCoderPropID::kMatchFinder,       // 7  mf
+        NCoderPropID::kMultiThread        // 8  mt    _multiThread (COMPRESS_MF_MT only)
     };
-    PROPVARIANT pr[8];
-    const unsigned nprops = 8;
+    PROPVARIANT pr[9];
     if (!prepare_result(res, src_len, method, level, lcconf))
         goto error;
+    if (opt->memory_limit) {
+        // trade compression ratio for a smaller dictionary instead of running out of memory
+        const upx_uint64_t avail =
+            MemBuffer::getAvailableBytes() + lzma_encoder_context.work_memory;
+        while (res->dict_size > 64 * 1024 && lzma_work_memory(res->dict_size) > avail)
+            res->dict_size >>= 1;
+    }
+    lzma_encoder_context.set_work_memory(size_t(lzma_work_memory(res->dict_size)));
     pr[0].vt = pr[1].vt = pr[2].vt = pr[3].vt = pr[4].vt = pr[5].vt = pr[6].vt = VT_UI4;
     pr[7].vt = VT_BSTR;
     pr[0].uintVal = res->pos_bits;
@@ -366,6 +436,10 @@ int upx_lzma_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsi
     static const wchar_t matchfinder[] = L"BT4";
     assert(NCompress::NLZMA::FindMatchFinder(matchfinder) >= 0);
     pr[7].bstrVal = ACC_PCAST(BSTR, ACC_UNCONST_CAST(wchar_t *, matchfinder));
+#if defined(COMPRESS_MF_MT)
+    pr[8].vt = VT_BOOL;
+    pr[8].boolVal = mf_mt ? VARIANT_TRUE : VARIANT_FALSE;
+#endif
 
     try {
         if (enc.SetCoderProperties(propIDs, pr, nprops) != S_OK)
@@ -392,6 +466,7 @@ int upx_lzma_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsi
 
     } catch (...) {
         rh = E_OUTOFMEMORY;
+        lzma_encoder_context.release(); // do not reuse a possibly inconsistent encoder
     }
 
     assert(is.b_pos <= src_len);
@@ -402,6 +477,8 @@ int upx_lzma_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsi
         assert(os.b_pos == *dst_len);
         // r = UPX_E_OUTPUT_OVERRUN;
         r = UPX_E_NOT_COMPRESSIBLE;
+    } else if (rh == E_ABORT) { // see ProgressInfo::SetRatioInfo()
+        r = UPX_E_NOT_COMPRESSIBLE;
     } else if (rh == S_OK) {
         assert(is.b_pos == src_len);
         r = UPX_E_OK;
@@ -427,8 +504,9 @@ error:
 #include <lzma-sdk/C/7zip/Compress/LZMA_C/LzmaDecode.h>
 #include <lzma-sdk/C/7zip/Compress/LZMA_C/LzmaDecode.c>
 
-int upx_lzma_decompress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned *dst_len,
-                        int method, const upx_compress_result_t *cresult) {
+// use_fast: try upx_lzma_decode_fast() first; see compress_lzma_dec.cpp
+static int lzma_decompress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned *dst_len,
+                           int method, const upx_compress_result_t *cresult, bool use_fast) {
     assert(M_IS_LZMA(method));
     // see res->num_probs above
     COMPILE_TIME_ASSERT(sizeof(CProb) == 2)
@@ -477,6 +555,18 @@ int upx_lzma_decompress(const upx_bytep src, unsigned src_len, upx_bytep dst, un
         r = UPX_E_OUT_OF_MEMORY;
         goto error;
     }
+    if (use_fast) {
+        unsigned src_used = 0;
+        if (upx_lzma_decode_fast(src, src_len, dst, *dst_len, s.Properties.lc, s.Properties.lp,
+                                 s.Properties.pb, (upx_uint16_t *) s.Probs,
+                                 &src_used) == UPX_E_OK) {
+            src_out = src_used;
+            dst_out = *dst_len;
+            r = (src_out == src_len) ? UPX_E_OK : UPX_E_INPUT_NOT_CONSUMED;
+            goto error;
+        }
+        // not a good stream: let the LZMA SDK decoder find out what is wrong
+    }
     rh = LzmaDecode(&s, src, src_len, &src_out, dst, *dst_len, &dst_out);
     assert(src_out <= src_len);
     assert(dst_out <= *dst_len);
@@ -495,6 +585,11 @@ error:
     return r;
 }
 
+int upx_lzma_decompress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned *dst_len,
+                        int method, const upx_compress_result_t *cresult) {
+    return lzma_decompress(src, src_len, dst, dst_len, method, cresult, true);
+}
+
 /*************************************************************************
 // test_overlap - see <ucl/ucl.h> for semantics
 **************************************************************************/
@@ -551,4 +646,44 @@ TEST_CASE("upx_lzma_decompress") {
     UNUSED(r);
 }
 
+TEST_CASE("upx_lzma_decompress fast") {
+    // upx_lzma_decode_fast() must give the same results as the LZMA SDK decoder
+    const unsigned u_len = 64 * 1024;
+    MemBuffer u_buf(u_len), c_buf, d_buf, e_buf;
+    unsigned x = 12345;
+    for (unsigned i = 0; i < u_len; i++) {
+        x = x * 1103515245 + 12345;
+        if ((i >> 12) % 3 == 0) // text-like
+            u_buf[i] = byte('a' + (x >> 16) % 8);
+        else if ((i >> 12) % 3 == 1) // random
+            u_buf[i] = byte(x >> 24);
+        else // repeats at many distances
+            u_buf[i] = u_buf[i - 1 - (x >> 16) % 3000];
+    }
+    c_buf.allocForCompression(u_len);
+    d_buf.allocForDecompression(u_len);
+    e_buf.allocForDecompression(u_len);
+    for (int level = 1; level <= 9; level += 4) {
+        upx_compress_result_t cresult;
+        unsigned c_len = c_buf.getSize();
+        int r = upx_lzma_compress(raw_bytes(u_buf, u_len), u_len, raw_bytes(c_buf, c_len), &c_len,
+                                  nullptr, M_LZMA, level, NULL_cconf, &cresult);
+        CHECK(r == 0);
+        // a good stream, a truncated stream, and a too small output buffer
+        const unsigned c_lens[3] = {c_len, c_len - 1, c_len};
+        const unsigned d_lens[3] = {u_len, u_len, u_len - 1};
+        for (unsigned k = 0; k < 3; k++) {
+            unsigned d_len = d_lens[k], e_len = d_lens[k];
+            int rd = lzma_decompress(raw_bytes(c_buf, c_lens[k]), c_lens[k],
+                                     raw_bytes(d_buf, d_len), &d_len, M_LZMA, nullptr, true);
+            int re = lzma_decompress(raw_bytes(c_buf, c_lens[k]), c_lens[k],
+                                     raw_bytes(e_buf, e_len), &e_len, M_LZMA, nullptr, false);
+            CHECK((rd == re && d_len == e_len));
+            CHECK(memcmp(d_buf, e_buf, e_len) == 0);
+            if (k == 0)
+                CHECK((rd == 0 && d_len == u_len && memcmp(u_buf, d_buf, u_len) == 0));
+        }
+    }
+}
+
 /* vim:set ts=4 sw=4 et: */
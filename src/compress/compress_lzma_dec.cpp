@@ -0,0 +1,318 @@
+/* compress_lzma_dec.cpp -- whole-buffer LZMA decoder
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer
+   <markus@oberhumer.com>
+ */
+
+#include "../conf.h"
+#include "compress.h"
+
+/*************************************************************************
+// UPX always decodes a whole LZMA stream of known size from memory into
+// memory, so this decoder can keep the complete range coder and match
+// state in local variables and use the output buffer as the dictionary.
+// It only handles the good case: a stream that is corrupt, truncated,
+// too long, or that has an end marker makes it give up, and then
+// upx_lzma_decompress() runs the LZMA SDK decoder to get the exact result,
+// so all error codes stay the same.
+//   - the input bounds are checked once per packet instead of once per
+//     byte; the last bytes of the input are decoded from a padded copy
+//   - bit trees and direct bits are decoded with conditional moves
+//   - match copies in 8-byte words where the distance allows it
+**************************************************************************/
+
+#if (WITH_LZMA)
+
+namespace {
+
+typedef upx_uint16_t Prob;
+
+constexpr unsigned kTopValue = 1u << 24;
+constexpr unsigned kNumBitModelTotalBits = 11;
+constexpr unsigned kBitModelTotal = 1u << kNumBitModelTotalBits;
+constexpr unsigned kNumMoveBits = 5;
+
+constexpr unsigned kNumStates = 12;
+constexpr unsigned kNumLitStates = 7;
+constexpr unsigned kNumPosBitsMax = 4;
+constexpr unsigned kStartPosModelIndex = 4;
+constexpr unsigned kEndPosModelIndex = 14;
+constexpr unsigned kNumFullDistances = 1u << (kEndPosModelIndex >> 1);
+constexpr unsigned kNumAlignBits = 4;
+constexpr unsigned kNumLenToPosStates = 4;
+constexpr unsigned kMatchMinLen = 2;
+
+// length coder
+constexpr unsigned LenChoice = 0;
+constexpr unsigned LenChoice2 = 1;
+constexpr unsigned LenLow = 2;
+constexpr unsigned LenMid = LenLow + (1u << (kNumPosBitsMax + 3));
+constexpr unsigned LenHigh = LenMid + (1u << (kNumPosBitsMax + 3));
+constexpr unsigned kNumLenProbs = LenHigh + 256;
+
+// same layout of the probabilities as in LzmaDecode.h
+constexpr unsigned IsMatch = 0;
+constexpr unsigned IsRep = IsMatch + (kNumStates << kNumPosBitsMax);
+constexpr unsigned IsRepG0 = IsRep + kNumStates;
+constexpr unsigned IsRepG1 = IsRepG0 + kNumStates;
+constexpr unsigned IsRepG2 = IsRepG1 + kNumStates;
+constexpr unsigned IsRep0Long = IsRepG2 + kNumStates;
+constexpr unsigned PosSlot = IsRep0Long + (kNumStates << kNumPosBitsMax);
+constexpr unsigned SpecPos = PosSlot + (kNumLenToPosStates << 6);
+constexpr unsigned Align = SpecPos + kNumFullDistances - kEndPosModelIndex;
+constexpr unsigned LenCoder = Align + (1u << kNumAlignBits);
+constexpr unsigned RepLenCoder = LenCoder + kNumLenProbs;
+constexpr unsigned Literal = RepLenCoder + kNumLenProbs;
+static_assert(Literal == 1846); // LZMA_BASE_SIZE
+
+// upper limit of the input bytes of one packet (a literal, or a match
+// with its length and distance): a packet has much less than 64 bits,
+// and every bit reads at most one byte
+constexpr unsigned kMaxPacketInput = 64;
+
+struct RangeDecoder final {
+    unsigned range;
+    unsigned code;
+    const byte *in;
+
+    forceinline void normalize() {
+        if (range < kTopValue) {
+            range <<= 8;
+            code = (code << 8) | *in++;
+        }
+    }
+    // for the flag bits that are mostly predictable
+    forceinline bool bit(Prob *p) {
+        normalize();
+        const unsigned v = *p;
+        const unsigned bound = (range >> kNumBitModelTotalBits) * v;
+        if (code < bound) {
+            range = bound;
+            *p = Prob(v + ((kBitModelTotal - v) >> kNumMoveBits));
+            return false;
+        }
+        range -= bound;
+        code -= bound;
+        *p = Prob(v - (v >> kNumMoveBits));
+        return true;
+    }
+    // for the bits of literals, lengths and distances
+    forceinline unsigned treeBit(Prob *p) {
+        normalize();
+        const unsigned v = *p;
+        const unsigned bound = (range >> kNumBitModelTotalBits) * v;
+        const unsigned b = code >= bound;
+        range = b ? range - bound : bound;
+        code = b ? code - bound : code;
+        *p = Prob(b ? v - (v >> kNumMoveBits) : v + ((kBitModelTotal - v) >> kNumMoveBits));
+        return b;
+    }
+    forceinline unsigned tree(Prob *p, unsigned nbits) {
+        unsigned m = 1;
+        for (unsigned i = 0; i < nbits; i++)
+            m = (m << 1) | treeBit(p + m);
+        return m - (1u << nbits);
+    }
+    forceinline unsigned reverseTree(Prob *p, unsigned nbits) {
+        unsigned m = 1, r = 0;
+        for (unsigned i = 0; i < nbits; i++) {
+            const unsigned b = treeBit(p + m);
+            m = (m << 1) | b;
+            r |= b << i;
+        }
+        return r;
+    }
+    forceinline unsigned directBits(unsigned nbits) {
+        unsigned r = 0;
+        do {
+            normalize();
+            range >>= 1;
+            code -= range;
+            const unsigned t = 0u - (code >> 31); // all ones if the bit is 0
+            code += range & t;
+            r = (r << 1) + (t + 1);
+        } while (--nbits != 0);
+        return r;
+    }
+    forceinline unsigned len(Prob *p, unsigned pos_state) {
+        if (!bit(p + LenChoice))
+            return tree(p + LenLow + (pos_state << 3), 3);
+        if (!bit(p + LenChoice2))
+            return 8 + tree(p + LenMid + (pos_state << 3), 3);
+        return 16 + tree(p + LenHigh, 8);
+    }
+};
+
+} // namespace
+
+// decode exactly dst_len bytes; probs must have room for
+// LZMA_BASE_SIZE + (LZMA_LIT_SIZE << (lc + lp)) entries
+int upx_lzma_decode_fast(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned dst_len,
+                         unsigned lc, unsigned lp, unsigned pb, upx_uint16_t *probs,
+                         unsigned *src_used) {
+    if (lc > 8 || lp > 4 || pb > 4 || src_len < 5)
+        return UPX_E_ERROR;
+    const unsigned num_probs = Literal + (0x300u << (lc + lp));
+    for (unsigned i = 0; i < num_probs; i++)
+        probs[i] = Prob(kBitModelTotal >> 1);
+
+    RangeDecoder rc;
+    rc.range = 0xffffffff;
+    rc.code = 0;
+    for (unsigned i = 0; i < 5; i++)
+        rc.code = (rc.code << 8) | src[i];
+    rc.in = src + 5;
+    // in_limit: the last position where a whole packet can be decoded
+    // without checking the input
+    const byte *in_end = src + src_len;
+    const byte *in_limit = src_len >= kMaxPacketInput ? in_end - kMaxPacketInput : src;
+    byte tail[2 * kMaxPacketInput];
+    unsigned tail_offset = 0; // input position of tail[0], if in use
+
+    const unsigned pos_mask = (1u << pb) - 1;
+    const unsigned lit_pos_mask = (1u << lp) - 1;
+    unsigned state = 0, rep0 = 1, rep1 = 1, rep2 = 1, rep3 = 1;
+    unsigned prev = 0; // previous byte
+    unsigned pos = 0;
+    while (pos < dst_len) {
+        if very_unlikely (rc.in > in_limit) {
+            if (tail_offset == 0) {
+                // switch to a zero-padded copy of the rest of the input
+                const unsigned rest = ptr_udiff_bytes(in_end, rc.in);
+                tail_offset = ptr_udiff_bytes(rc.in, src);
+                memset(tail, 0, sizeof(tail));
+                memcpy(tail, rc.in, rest);
+                rc.in = tail;
+                in_end = in_limit = tail + rest;
+            } else
+                return UPX_E_ERROR; // input overrun
+        }
+        const unsigned pos_state = pos & pos_mask;
+        if (!rc.bit(probs + IsMatch + (state << kNumPosBitsMax) + pos_state)) {
+            Prob *const lit =
+                probs + Literal + 0x300 * (((pos & lit_pos_mask) << lc) + (prev >> (8 - lc)));
+            unsigned sym = 1;
+            if (state >= kNumLitStates) {
+                unsigned match_byte = dst[pos - rep0];
+                do {
+                    const unsigned match_bit = (match_byte >> 7) & 1;
+                    match_byte <<= 1;
+                    const unsigned b = rc.treeBit(lit + 0x100 + (match_bit << 8) + sym);
+                    sym = (sym << 1) | b;
+                    if (match_bit != b)
+                        break;
+                } while (sym < 0x100);
+            }
+            while (sym < 0x100)
+                sym = (sym << 1) | rc.treeBit(lit + sym);
+            prev = sym & 0xff;
+            dst[pos++] = byte(prev);
+            state = state < 4 ? 0 : (state < 10 ? state - 3 : state - 6);
+            continue;
+        }
+        unsigned len;
+        if (rc.bit(probs + IsRep + state)) {
+            if (!rc.bit(probs + IsRepG0 + state)) {
+                if (!rc.bit(probs + IsRep0Long + (state << kNumPosBitsMax) + pos_state)) {
+                    // short rep: a single byte at distance rep0
+                    if (pos == 0)
+                        return UPX_E_ERROR;
+                    state = state < kNumLitStates ? 9 : 11;
+                    prev = dst[pos - rep0];
+                    dst[pos++] = byte(prev);
+                    continue;
+                }
+            } else {
+                unsigned dist;
+                if (!rc.bit(probs + IsRepG1 + state))
+                    dist = rep1;
+                else {
+                    if (!rc.bit(probs + IsRepG2 + state))
+                        dist = rep2;
+                    else {
+                        dist = rep3;
+                        rep3 = rep2;
+                    }
+                    rep2 = rep1;
+                }
+                rep1 = rep0;
+                rep0 = dist;
+            }
+            len = rc.len(probs + RepLenCoder, pos_state);
+            state = state < kNumLitStates ? 8 : 11;
+        } else {
+            rep3 = rep2;
+            rep2 = rep1;
+            rep1 = rep0;
+            len = rc.len(probs + LenCoder, pos_state);
+            state = state < kNumLitStates ? 7 : 10;
+            const unsigned len_state = len < kNumLenToPosStates ? len : kNumLenToPosStates - 1;
+            const unsigned slot = rc.tree(probs + PosSlot + (len_state << 6), 6);
+            if (slot >= kStartPosModelIndex) {
+                const unsigned nbits = (slot >> 1) - 1;
+                unsigned dist = (2 | (slot & 1)) << nbits;
+                if (slot < kEndPosModelIndex)
+                    dist += rc.reverseTree(probs + SpecPos + dist - slot - 1, nbits);
+                else {
+                    dist += rc.directBits(nbits - kNumAlignBits) << kNumAlignBits;
+                    dist += rc.reverseTree(probs + Align, kNumAlignBits);
+                }
+                rep0 = dist;
+            } else
+                rep0 = slot;
+            if (++rep0 == 0)
+                return UPX_E_ERROR; // end marker
+        }
+        len += kMatchMinLen;
+        if (rep0 > pos || len > dst_len - pos)
+            return UPX_E_ERROR;
+        byte *op = dst + pos;
+        const byte *from = op - rep0;
+        if (rep0 >= 8 && len + 8 <= dst_len - pos) {
+            // may copy up to 7 bytes too much, which get overwritten later
+            const byte *const op_end = op + len;
+            do {
+                memcpy(op, from, 8);
+                op += 8;
+                from += 8;
+            } while (op < op_end);
+        } else {
+            for (unsigned i = 0; i < len; i++)
+                op[i] = from[i];
+        }
+        pos += len;
+        prev = dst[pos - 1];
+    }
+    rc.normalize();
+    if (rc.in > in_end)
+        return UPX_E_ERROR; // input overrun
+    if (tail_offset != 0)
+        *src_used = tail_offset + ptr_udiff_bytes(rc.in, tail);
+    else
+        *src_used = ptr_udiff_bytes(rc.in, src);
+    return UPX_E_OK;
+}
+
+#endif // WITH_LZMA
+
+/* vim:set ts=4 sw=4 et: */
@@ -0,0 +1,288 @@
+/* compress_overlap.cpp -- single-pass overlap computation
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+#include "../conf.h"
+
+/*************************************************************************
+// For in-place decompression the compressed data is stored at the end of
+// the output buffer, and the decompressor must never write over input
+// bytes which it has not yet read. Instead of testing this by repeated
+// decompression (see Packer::findOverlapOverhead) we can walk through the
+// compressed stream once, and keep track of the maximum distance by which
+// the output position runs ahead of the input position.
+//
+// Only the token structure of the stream is needed for that, so no data
+// actually gets decompressed. The bit-buffer variants (8/LE16/LE32) must
+// consume the input exactly like the real decompressors, because bit-buffer
+// refills advance the input position as well.
+**************************************************************************/
+
+namespace {
+
+struct NrvScanner final {
+    const upx_bytep src;
+    unsigned src_len;
+    unsigned dst_len;
+    unsigned ilen = 0;
+    unsigned olen = 0;
+    unsigned max_ahead = 0; // max(olen - ilen)
+    bool error = false;
+
+    // bit-buffer
+    unsigned bb = 0;
+    unsigned bc = 0; // LE32 only
+
+    forceinline unsigned getbyte() {
+        if very_unlikely (ilen >= src_len) {
+            error = true;
+            return 0;
+        }
+        return src[ilen++];
+    }
+    forceinline unsigned getbit_8() {
+        bb = (bb & 0x7f) ? bb * 2 : getbyte() * 2 + 1;
+        return (bb >> 8) & 1;
+    }
+    forceinline unsigned getbit_le16() {
+        bb *= 2;
+        if (bb & 0xffff)
+            return (bb >> 16) & 1;
+        const unsigned lo = getbyte();
+        bb = (lo + getbyte() * 256) * 2 + 1;
+        return (bb >> 16) & 1;
+    }
+    forceinline unsigned getbit_le32() {
+        if (bc > 0)
+            return (bb >> --bc) & 1;
+        if very_unlikely (src_len - ilen < 4 || ilen > src_len) {
+            error = true;
+            return 0;
+        }
+        bb = get_le32(src + ilen);
+        ilen += 4;
+        bc = 31;
+        return (bb >> 31) & 1;
+    }
+    forceinline void update(unsigned n) {
+        olen += n;
+        if (olen > ilen && olen - ilen > max_ahead)
+            max_ahead = olen - ilen;
+    }
+
+    template <int N>
+    unsigned getbit();
+    template <int M, int N>
+    bool scan();
+};
+
+template <>
+forceinline unsigned NrvScanner::getbit<8>() {
+    return getbit_8();
+}
+template <>
+forceinline unsigned NrvScanner::getbit<16>() {
+    return getbit_le16();
+}
+template <>
+forceinline unsigned NrvScanner::getbit<32>() {
+    return getbit_le32();
+}
+
+// M is 'b', 'd' or 'e' for nrv2b, nrv2d and nrv2e; N is the bit-buffer size
+template <int M, int N>
+bool NrvScanner::scan() {
+    unsigned last_m_off = 1;
+    for (;;) {
+        while (getbit<N>()) {
+            (void) getbyte();
+            update(1); // literal
+            if very_unlikely (error || olen > dst_len)
+                return false;
+        }
+        unsigned m_off = 1;
+        unsigned m_len;
+        if (M == 'b') {
+            do {
+                m_off = m_off * 2 + getbit<N>();
+                if very_unlikely (error || m_off > 0xffffff + 3)
+                    return false;
+            } while (!getbit<N>());
+        } else {
+            for (;;) {
+                m_off = m_off * 2 + getbit<N>();
+                if very_unlikely (error || m_off > 0xffffff + 3)
+                    return false;
+                if (getbit<N>())
+                    break;
+                m_off = (m_off - 1) * 2 + getbit<N>();
+            }
+        }
+        if (m_off == 2) {
+            m_off = last_m_off;
+            m_len = (M == 'b') ? 0 : getbit<N>();
+        } else {
+            m_off = (m_off - 3) * 256 + getbyte();
+            if (m_off == 0xffffffffu)
+                break; // end-of-stream marker
+            if (M == 'b') {
+                m_len = 0;
+            } else {
+                m_len = (m_off ^ 0xffffffffu) & 1;
+                m_off >>= 1;
+            }
+            last_m_off = ++m_off;
+        }
+        if (M == 'e') {
+            if (m_len)
+                m_len = 1 + getbit<N>();
+            else if (getbit<N>())
+                m_len = 3 + getbit<N>();
+            else {
+                m_len++;
+                do {
+                    m_len = m_len * 2 + getbit<N>();
+                    if very_unlikely (error || m_len > dst_len)
+                        return false;
+                } while (!getbit<N>());
+                m_len += 3;
+            }
+        } else {
+            m_len = m_len * 2 + getbit<N>();
+            if (M == 'b')
+                m_len = m_len * 2 + getbit<N>();
+            if (m_len == 0) {
+                m_len++;
+                do {
+                    m_len = m_len * 2 + getbit<N>();
+                    if very_unlikely (error || m_len > dst_len)
+                        return false;
+                } while (!getbit<N>());
+                m_len += 2;
+            }
+        }
+        m_len += (m_off > (M == 'b' ? 0xd00u : 0x500u));
+        if very_unlikely (error || m_off > olen || m_len + 1 > dst_len - olen)
+            return false;
+        update(m_len + 1); // match
+    }
+    return !error && olen == dst_len && ilen == src_len;
+}
+
+} // namespace
+
+/*************************************************************************
+// Compute the smallest "overlap" value so that the decompressor can run
+// with the src_len bytes of compressed data at offset
+// (dst_len + overlap - src_len) of the output buffer.
+// The meaning is the same as the overlap_overhead used for upx_test_overlap(),
+// but without any decompressor specific extra safety margin.
+// Returns UPX_E_ERROR if the method is not supported or the data is corrupt;
+// callers then have to fall back to upx_test_overlap().
+**************************************************************************/
+
+int upx_find_overlap(const upx_bytep src, unsigned src_len, unsigned dst_len, int method,
+                     unsigned *overlap) {
+    assert(overlap != nullptr);
+    *overlap = 0;
+    if (src == nullptr || src_len == 0 || src_len >= dst_len)
+        return UPX_E_ERROR;
+    NrvScanner s;
+    s.src = src;
+    s.src_len = src_len;
+    s.dst_len = dst_len;
+    bool ok = false;
+    switch (method) {
+    case M_NRV2B_8:
+        ok = s.scan<'b', 8>();
+        break;
+    case M_NRV2B_LE16:
+        ok = s.scan<'b', 16>();
+        break;
+    case M_NRV2B_LE32:
+        ok = s.scan<'b', 32>();
+        break;
+    case M_NRV2D_8:
+        ok = s.scan<'d', 8>();
+        break;
+    case M_NRV2D_LE16:
+        ok = s.scan<'d', 16>();
+        break;
+    case M_NRV2D_LE32:
+        ok = s.scan<'d', 32>();
+        break;
+    case M_NRV2E_8:
+        ok = s.scan<'e', 8>();
+        break;
+    case M_NRV2E_LE16:
+        ok = s.scan<'e', 16>();
+        break;
+    case M_NRV2E_LE32:
+        ok = s.scan<'e', 32>();
+        break;
+    default:
+        break;
+    }
+    if (!ok)
+        return UPX_E_ERROR;
+    // src_off must be >= max_ahead, and overlap == src_off + src_len - dst_len
+    assert(s.max_ahead >= dst_len - src_len);
+    *overlap = s.max_ahead - (dst_len - src_len);
+    return UPX_E_OK;
+}
+
+/*************************************************************************
+// doctest checks
+**************************************************************************/
+
+TEST_CASE("upx_find_overlap") {
+    const byte *c_data;
+    unsigned overlap;
+    int r;
+
+    // same test data as in compress_ucl.cpp: 16 zero bytes, i.e. one literal
+    // followed by a long match; that match runs ahead of the input
+    c_data = (const byte *) "\x92\xff\x10\x00\x00\x00\x00\x00\x48\xff";
+    r = upx_find_overlap(c_data, 10, 16, M_NRV2B_8, &overlap);
+    CHECK((r == UPX_E_OK && overlap == 7));
+    CHECK(upx_find_overlap(c_data, 9, 16, M_NRV2B_8, &overlap) == UPX_E_ERROR);
+    CHECK(upx_find_overlap(c_data, 10, 15, M_NRV2B_8, &overlap) == UPX_E_ERROR);
+
+    c_data = (const byte *) "\x92\xff\x10\x92\x49\x24\x92\xa0\xff";
+    r = upx_find_overlap(c_data, 9, 16, M_NRV2D_8, &overlap);
+    CHECK((r == UPX_E_OK && overlap == 6));
+    CHECK(upx_find_overlap(c_data, 8, 16, M_NRV2D_8, &overlap) == UPX_E_ERROR);
+
+    c_data = (const byte *) "\x90\xff\xb0\x92\x49\x24\x92\xa0\xff";
+    r = upx_find_overlap(c_data, 9, 16, M_NRV2E_8, &overlap);
+    CHECK((r == UPX_E_OK && overlap == 6));
+    CHECK(upx_find_overlap(c_data, 9, 15, M_NRV2E_8, &overlap) == UPX_E_ERROR);
+
+    // unsupported methods
+    CHECK(upx_find_overlap(c_data, 9, 16, M_LZMA, &overlap) == UPX_E_ERROR);
+}
+
+/* vim:set ts=4 sw=4 et: */
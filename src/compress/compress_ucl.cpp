@@ -128,6 +128,21 @@ int upx_ucl_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsig
     else if (level == 4 && cconf.max_offset == UCL_UINT_MAX)
         cconf.max_offset = 32 * 1024 - 1;
 
+    if (level <= 2) {
+        // much faster, at the cost of some compression ratio
+        r = upx_ucl_fast_compress(src, src_len, dst, dst_len, cb_parm, method, level,
+                                  cconf.max_offset, cconf.max_match, res);
+        if (res[6] == 0)
+            res[6] = 1;
+        return r;
+    }
+    if (level >= 8 && opt->nrv_parallel) {
+        r = upx_ucl_parallel_compress(src, src_len, dst, dst_len, cb_parm, method, level,
+                                      cconf.max_offset, cconf.max_match, res);
+        if (res[6] == 0)
+            res[6] = 1;
+        return r;
+    }
     if M_IS_NRV2B (method)
         r = ucl_nrv2b_99_compress(src, src_len, dst, dst_len, &cb, level, &cconf, res);
     else if M_IS_NRV2D (method)
@@ -154,6 +169,18 @@ int upx_ucl_decompress(const upx_bytep src, unsigned src_len, upx_bytep dst, uns
                        int method, const upx_compress_result_t *cresult) {
     int r;
 
+    // try the fast decoder first, see compress_ucl_dec.cpp
+    unsigned fast_len = *dst_len;
+    r = upx_ucl_decode_fast(src, src_len, dst, &fast_len, method);
+    if (r == UPX_E_OK) {
+        *dst_len = fast_len;
+        return UPX_E_OK;
+    }
+    // in-place decompression has already overwritten the input, so the safe
+    // decoder cannot start over; else it finds out what exactly is wrong
+    if (uintptr_t(src) < uintptr_t(dst + *dst_len) && uintptr_t(dst) < uintptr_t(src + src_len))
+        return UPX_E_ERROR;
+
     switch (method) {
     case M_NRV2B_8:
         r = ucl_nrv2b_decompress_safe_8(src, src_len, dst, dst_len, nullptr);
@@ -326,6 +353,47 @@ TEST_CASE("compress_ucl") {
     CHECK(check_ucl(M_NRV2E_LE32, 34));
 }
 
+TEST_CASE("upx_ucl_decode_fast") {
+    const unsigned u_len = 65536;
+    MemBuffer u_buf(u_len), c_buf, d_buf;
+    c_buf.allocForCompression(u_len);
+    d_buf.allocForDecompression(u_len);
+    unsigned x = 1;
+    for (unsigned i = 0; i < u_len; i++) {
+        x = x * 1103515245 + 12345;
+        // literals, runs and matches with short and far offsets
+        u_buf[i] = (i & 0x3000) == 0x1000 ? (byte) (x >> 24)
+                   : (i & 0x3000) == 0x2000 ? (byte) (i >> 9)
+                                            : (byte) ("upx packs executables"[i % 21] + (x >> 30));
+    }
+    static const int methods[] = {M_NRV2B_8, M_NRV2B_LE16, M_NRV2B_LE32,
+                                  M_NRV2D_8, M_NRV2D_LE16, M_NRV2D_LE32,
+                                  M_NRV2E_8, M_NRV2E_LE16, M_NRV2E_LE32};
+    for (int method : methods) {
+        unsigned c_len = c_buf.getSize();
+        upx_compress_result_t cresult;
+        CHECK(upx_ucl_compress(raw_bytes(u_buf, u_len), u_len, raw_bytes(c_buf, c_len), &c_len,
+                               nullptr, method, 3, NULL_cconf, &cresult) == UPX_E_OK);
+        unsigned d_len = u_len;
+        CHECK(upx_ucl_decode_fast(c_buf, c_len, d_buf, &d_len, method) == UPX_E_OK);
+        CHECK((d_len == u_len && memcmp(u_buf, d_buf, u_len) == 0));
+        // in-place, with the input at the end of the output buffer
+        memcpy(d_buf + (d_buf.getSize() - c_len), c_buf, c_len);
+        d_len = u_len;
+        CHECK(upx_ucl_decode_fast(d_buf + (d_buf.getSize() - c_len), c_len, d_buf, &d_len,
+                                  method) == UPX_E_OK);
+        CHECK((d_len == u_len && memcmp(u_buf, d_buf, u_len) == 0));
+        // the fast path gives up, the safe decoder reports the error
+        d_len = u_len - 1;
+        CHECK(upx_ucl_decode_fast(c_buf, c_len, d_buf, &d_len, method) != UPX_E_OK);
+        d_len = u_len;
+        CHECK(upx_ucl_decode_fast(c_buf, c_len - 1, d_buf, &d_len, method) != UPX_E_OK);
+        d_len = u_len;
+        CHECK(upx_ucl_decompress(c_buf, c_len - 1, d_buf, &d_len, method, nullptr) ==
+              UPX_E_INPUT_OVERRUN);
+    }
+}
+
 #endif // DEBUG
 
 TEST_CASE("upx_ucl_decompress") {
@@ -0,0 +1,277 @@
+/* compress_ucl_dec.cpp -- fast decoder for the nrv2b, nrv2d and nrv2e streams
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer
+   <markus@oberhumer.com>
+ */
+
+#include "../conf.h"
+#include "compress.h"
+
+/*************************************************************************
+// The ucl_nrv2?_decompress_safe_* functions check the input and output
+// bounds for every single byte, and copy matches byte by byte.
+// This decoder instead
+//   - checks the input once per literal or match: as long as a whole token
+//     fits into the rest of the input no further checks are needed, and
+//     only the last few tokens are decoded with checked reads
+//   - copies matches in 16-byte words (or with memset() for runs), when
+//     neither the output buffer end nor unread input gets overwritten
+// It only handles the good case: for a stream that is corrupt, truncated
+// or too long it gives up, and upx_ucl_decompress() runs the safe UCL
+// decoder to get the exact result, so all error codes stay the same.
+// See the NrvScanner in compress_overlap.cpp for the format.
+**************************************************************************/
+
+#if (WITH_UCL)
+
+namespace {
+
+// upper limit of the input bytes of one literal or match: the gamma codes
+// are bounded by the checks below, and a token has less than 200 bits
+constexpr unsigned kMaxTokenInput = 64;
+
+// M is 'b', 'd' or 'e' for nrv2b, nrv2d and nrv2e; N is the bit-buffer size
+template <int M, int N>
+struct NrvDecoder final {
+    const byte *ip;
+    const byte *ip_end;
+    byte *op;
+    byte *const op_begin;
+    byte *const op_end;
+    const byte *const op_history; // matches may reach back to here
+    // the input is part of the output buffer, as for in-place decompression
+    const bool in_place;
+    bool error = false;
+    unsigned last_m_off = 1;
+    // bit-buffer
+    unsigned bb = 0;
+    unsigned bc = 0; // LE32 only
+
+    NrvDecoder(const byte *src, unsigned src_len, byte *dst, unsigned dst_len, unsigned dict_len)
+        : ip(src), ip_end(src + src_len), op(dst), op_begin(dst), op_end(dst + dst_len),
+          op_history(dst - dict_len),
+          in_place(uintptr_t(src) < uintptr_t(dst + dst_len) &&
+                   uintptr_t(dst) < uintptr_t(src + src_len)) {}
+
+    template <bool Checked>
+    forceinline unsigned getbyte() {
+        if (Checked && very_unlikely(ip >= ip_end)) {
+            error = true;
+            return 0;
+        }
+        return *ip++;
+    }
+    template <bool Checked>
+    forceinline unsigned getbit() {
+        if (N == 8) {
+            bb = (bb & 0x7f) ? bb * 2 : getbyte<Checked>() * 2 + 1;
+            return (bb >> 8) & 1;
+        } else if (N == 16) {
+            bb *= 2;
+            if (bb & 0xffff)
+                return (bb >> 16) & 1;
+            const unsigned lo = getbyte<Checked>();
+            bb = (lo + getbyte<Checked>() * 256) * 2 + 1;
+            return (bb >> 16) & 1;
+        } else {
+            if (bc > 0)
+                return (bb >> --bc) & 1;
+            if (Checked && very_unlikely(ip_end - ip < 4)) {
+                error = true;
+                return 0;
+            }
+            bb = get_le32(ip);
+            ip += 4;
+            bc = 31;
+            return (bb >> 31) & 1;
+        }
+    }
+
+    // decode one literal or match; returns false at the end-of-stream marker
+    // or on error
+    template <bool Checked>
+    forceinline bool token() {
+        if (getbit<Checked>()) {
+            const unsigned b = getbyte<Checked>();
+            if very_unlikely (error || op >= op_end)
+                return (error = true), false;
+            *op++ = byte(b);
+            return true;
+        }
+        unsigned m_off = 1;
+        unsigned m_len;
+        if (M == 'b') {
+            do {
+                m_off = m_off * 2 + getbit<Checked>();
+                if very_unlikely (m_off > 0xffffff + 3)
+                    return (error = true), false;
+            } while (!getbit<Checked>());
+        } else {
+            for (;;) {
+                m_off = m_off * 2 + getbit<Checked>();
+                if very_unlikely (m_off > 0xffffff + 3)
+                    return (error = true), false;
+                if (getbit<Checked>())
+                    break;
+                m_off = (m_off - 1) * 2 + getbit<Checked>();
+            }
+        }
+        if (m_off == 2) {
+            m_off = last_m_off;
+            m_len = (M == 'b') ? 0 : getbit<Checked>();
+        } else {
+            m_off = (m_off - 3) * 256 + getbyte<Checked>();
+            if (m_off == 0xffffffffu)
+                return false; // end-of-stream marker
+            if (M == 'b') {
+                m_len = 0;
+            } else {
+                m_len = (m_off ^ 0xffffffffu) & 1;
+                m_off >>= 1;
+            }
+            last_m_off = ++m_off;
+        }
+        const unsigned max_len = unsigned(op_end - op);
+        if (M == 'e') {
+            if (m_len)
+                m_len = 1 + getbit<Checked>();
+            else if (getbit<Checked>())
+                m_len = 3 + getbit<Checked>();
+            else {
+                m_len++;
+                do {
+                    m_len = m_len * 2 + getbit<Checked>();
+                    if very_unlikely (m_len > max_len)
+                        return (error = true), false;
+                } while (!getbit<Checked>());
+                m_len += 3;
+            }
+        } else {
+            m_len = m_len * 2 + getbit<Checked>();
+            if (M == 'b')
+                m_len = m_len * 2 + getbit<Checked>();
+            if (m_len == 0) {
+                m_len++;
+                do {
+                    m_len = m_len * 2 + getbit<Checked>();
+                    if very_unlikely (m_len > max_len)
+                        return (error = true), false;
+                } while (!getbit<Checked>());
+                m_len += 2;
+            }
+        }
+        m_len += (m_off > (M == 'b' ? 0xd00u : 0x500u));
+        const unsigned n = m_len + 1;
+        if very_unlikely (error || m_off > unsigned(op - op_history) || n > max_len)
+            return (error = true), false;
+        copyMatch<Checked>(m_off, n);
+        return true;
+    }
+
+    template <bool Checked>
+    forceinline void copyMatch(unsigned m_off, unsigned n) {
+        const byte *m_pos = op - m_off;
+        if (m_off == 1) {
+            memset(op, *m_pos, n);
+            op += n;
+            return;
+        }
+        // a wide copy may write up to 15 bytes too much, which get
+        // overwritten later; that must not hit input that is still unread
+        const byte *const limit = (in_place && ip < op_end) ? ip : op_end;
+        if (!Checked && m_off >= 16 && limit - op >= ptrdiff_t(n) + 16) {
+            byte *const end = op + n;
+            do {
+                memcpy(op, m_pos, 16);
+                op += 16;
+                m_pos += 16;
+            } while (op < end);
+            op = end;
+            return;
+        }
+        do
+            *op++ = *m_pos++;
+        while (--n > 0);
+    }
+
+    int decode(unsigned *dst_used) {
+        const byte *const ip_safe =
+            (ip_end - ip >= ptrdiff_t(kMaxTokenInput)) ? ip_end - kMaxTokenInput : ip;
+        for (;;) {
+            if (ip < ip_safe) {
+                if (!token<false>())
+                    break;
+            } else {
+                if (!token<true>())
+                    break;
+            }
+        }
+        if (error || ip != ip_end)
+            return UPX_E_ERROR;
+        *dst_used = unsigned(op - op_begin);
+        return UPX_E_OK;
+    }
+};
+
+template <int M, int N>
+static int nrv_decode(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned *dst_len,
+                      unsigned dict_len) {
+    NrvDecoder<M, N> d(src, src_len, dst, *dst_len, dict_len);
+    return d.decode(dst_len);
+}
+
+} // namespace
+
+// decode a complete stream that uses all src_len bytes; on success *dst_len
+// is set to the output length, else UPX_E_ERROR is returned and the contents
+// of dst are undefined
+int upx_ucl_decode_fast(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned *dst_len,
+                        int method, unsigned dict_len) {
+    switch (method) {
+    case M_NRV2B_8:
+        return nrv_decode<'b', 8>(src, src_len, dst, dst_len, dict_len);
+    case M_NRV2B_LE16:
+        return nrv_decode<'b', 16>(src, src_len, dst, dst_len, dict_len);
+    case M_NRV2B_LE32:
+        return nrv_decode<'b', 32>(src, src_len, dst, dst_len, dict_len);
+    case M_NRV2D_8:
+        return nrv_decode<'d', 8>(src, src_len, dst, dst_len, dict_len);
+    case M_NRV2D_LE16:
+        return nrv_decode<'d', 16>(src, src_len, dst, dst_len, dict_len);
+    case M_NRV2D_LE32:
+        return nrv_decode<'d', 32>(src, src_len, dst, dst_len, dict_len);
+    case M_NRV2E_8:
+        return nrv_decode<'e', 8>(src, src_len, dst, dst_len, dict_len);
+    case M_NRV2E_LE16:
+        return nrv_decode<'e', 16>(src, src_len, dst, dst_len, dict_len);
+    case M_NRV2E_LE32:
+        return nrv_decode<'e', 32>(src, src_len, dst, dst_len, dict_len);
+    default:
+        break;
+    }
+    return UPX_E_ERROR;
+}
+
+#endif // WITH_UCL
+
+/* vim:set ts=4 sw=4 et: */
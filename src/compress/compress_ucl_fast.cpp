@@ -0,0 +1,675 @@
+/* compress_ucl_fast.cpp -- fast encoder for the UCL nrv2b/nrv2d/nrv2e streams
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+#include "../conf.h"
+#include <vector>
+#include "compress.h"
+#include "../util/membuffer.h"
+#include "../util/threads.h"
+
+/*************************************************************************
+// A fast greedy (level 1) or lazy (level 2) encoder for the nrv2b, nrv2d
+// and nrv2e streams, with a single-entry hash table instead of the binary
+// tree of ucl_nrv2?_99_compress(). The output is decoded by the very same
+// decompressors, see the NrvScanner in compress_overlap.cpp for the format.
+**************************************************************************/
+
+#if (WITH_UCL)
+
+namespace {
+
+constexpr unsigned HASH_BITS = 15;
+
+forceinline unsigned nrv_hash(const byte *p) noexcept {
+    return ((get_le32(p) & 0xffffff) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// number of bits of putGamma(v) and putGamma12(v)
+forceinline unsigned gamma_bits(unsigned v) noexcept {
+    unsigned n = 0;
+    for (; v >= 2; v >>= 1)
+        n += 2;
+    return n;
+}
+forceinline unsigned gamma12_bits(unsigned v) noexcept {
+    unsigned n = 2;
+    for (unsigned m = v >> 1; m >= 2; m = ((m >> 1) + 1) >> 1)
+        n += 3;
+    return n;
+}
+
+struct NrvWriter final {
+    byte *out;
+    byte *const out_end;
+    const unsigned bb_size; // 8, 16 or 32
+    byte *bb_p = nullptr;
+    unsigned bb_b = 0;
+    unsigned bb_k = bb_size; // no bits left in the current bit-buffer
+    bool overflow = false;
+
+    forceinline void putByte(unsigned b) noexcept {
+        if very_unlikely (out >= out_end) {
+            overflow = true;
+            return;
+        }
+        *out++ = (byte) b;
+    }
+    void flushBits() noexcept {
+        if (bb_p == nullptr)
+            return;
+        const unsigned v = bb_b << (bb_size - bb_k);
+        if (bb_size == 8)
+            bb_p[0] = (byte) v;
+        else if (bb_size == 16)
+            set_le16(bb_p, v);
+        else
+            set_le32(bb_p, v);
+        bb_p = nullptr;
+    }
+    forceinline void putBit(unsigned bit) noexcept {
+        if very_unlikely (bb_k == bb_size) {
+            // reserve the next bit-buffer at the current position, just like
+            // the decompressor reads it when it needs the next bit
+            flushBits();
+            bb_k = 0;
+            bb_b = 0;
+            if very_unlikely (ptr_udiff_bytes(out_end, out) < bb_size / 8) {
+                overflow = true;
+            } else {
+                bb_p = out;
+                out += bb_size / 8;
+            }
+        }
+        bb_b = (bb_b << 1) | bit;
+        bb_k++;
+    }
+    // nrv2b offsets and all lengths: the bits of v >= 2 after its leading 1,
+    // each followed by 1 for the last bit, or 0
+    void putGamma(unsigned v) noexcept {
+        unsigned t = 1;
+        while (t <= v / 2)
+            t <<= 1;
+        for (t >>= 1; t != 0; t >>= 1) {
+            putBit((v & t) ? 1 : 0);
+            putBit(t == 1 ? 1 : 0);
+        }
+    }
+    // nrv2d/nrv2e offsets: the decompressor does m = m * 2 + bit, and then
+    // stops on a 1 bit, or continues with m = (m - 1) * 2 + bit
+    void putGamma12(unsigned v) noexcept {
+        unsigned bits[32];
+        unsigned n = 0;
+        for (unsigned m = v >> 1; m >= 2; m = ((m >> 1) + 1) >> 1)
+            bits[n++] = ((((m >> 1) + 1) & 1) << 1) | (m & 1);
+        while (n != 0) {
+            const unsigned ac = bits[--n];
+            putBit(ac >> 1);
+            putBit(0);
+            putBit(ac & 1);
+        }
+        putBit(v & 1);
+        putBit(1);
+    }
+};
+
+// the statistics of upx_compress_result_t::result_ucl
+struct NrvStats final {
+    unsigned min_off = ~0u, max_off = 0, min_len = ~0u, max_len = 0, first_off = 0;
+    unsigned run = 0, min_run = ~0u, max_run = 0;
+
+    forceinline void literal() noexcept { run++; }
+    void endRun() noexcept {
+        if (run != 0) {
+            min_run = UPX_MIN(min_run, run);
+            max_run = UPX_MAX(max_run, run);
+            run = 0;
+        }
+    }
+    void match(unsigned m_off, unsigned m_len) noexcept {
+        endRun();
+        if (first_off == 0)
+            first_off = m_off;
+        min_off = UPX_MIN(min_off, m_off);
+        max_off = UPX_MAX(max_off, m_off);
+        min_len = UPX_MIN(min_len, m_len);
+        max_len = UPX_MAX(max_len, m_len);
+    }
+    void get(ucl_uint *res) noexcept {
+        endRun();
+        res[0] = max_off ? min_off : 0;
+        res[1] = max_off;
+        res[2] = max_len ? min_len : 0;
+        res[3] = max_len;
+        res[4] = max_run ? min_run : 0;
+        res[5] = max_run;
+        res[6] = first_off;
+    }
+};
+
+// M is 'b', 'd' or 'e'
+template <int M>
+struct NrvCoder final {
+    static constexpr unsigned M2_MAX_OFFSET = (M == 'b') ? 0xd00 : 0x500;
+
+    static forceinline unsigned minLength(unsigned m_off) noexcept {
+        return 2 + (m_off > M2_MAX_OFFSET);
+    }
+    // exact number of bits of putMatch()
+    static unsigned matchBits(unsigned m_off, unsigned m_len, unsigned last_m_off) noexcept {
+        const unsigned len = m_len - 1 - (m_off > M2_MAX_OFFSET);
+        unsigned n = 1; // no more literals
+        if (M == 'b') {
+            n += (m_off == last_m_off) ? 2 : gamma_bits(3 + ((m_off - 1) >> 8)) + 8;
+            return n + (len < 4 ? 2 : 2 + gamma_bits(len - 2));
+        }
+        n += (m_off == last_m_off) ? 3 : gamma12_bits(3 + ((m_off - 1) >> 7)) + 8;
+        if (M == 'd')
+            return n + (len < 4 ? 1 : 1 + gamma_bits(len - 2));
+        return n + (len <= 2 ? 1 : len <= 4 ? 2 : 1 + gamma_bits(len - 3));
+    }
+    static void putMatch(NrvWriter &w, unsigned m_off, unsigned m_len, unsigned last_m_off) {
+        const unsigned len = m_len - 1 - (m_off > M2_MAX_OFFSET);
+        w.putBit(0); // no more literals
+        if (M == 'b') {
+            if (m_off == last_m_off) {
+                w.putBit(0);
+                w.putBit(1);
+            } else {
+                w.putGamma(3 + ((m_off - 1) >> 8));
+                w.putByte((m_off - 1) & 0xff);
+            }
+            if (len < 4) {
+                w.putBit(len >> 1);
+                w.putBit(len & 1);
+            } else {
+                w.putBit(0);
+                w.putBit(0);
+                w.putGamma(len - 2);
+            }
+            return;
+        }
+        // the first bit of the length is part of the offset code
+        const unsigned lb = (M == 'd') ? (len < 4 ? len >> 1 : 0) : (len <= 2 ? 1 : 0);
+        if (m_off == last_m_off) {
+            w.putGamma12(2);
+            w.putBit(lb);
+        } else {
+            const unsigned raw = ((m_off - 1) << 1) | (lb ^ 1);
+            w.putGamma12(3 + (raw >> 8));
+            w.putByte(raw & 0xff);
+        }
+        if (M == 'd') {
+            if (len < 4)
+                w.putBit(len & 1);
+            else {
+                w.putBit(0);
+                w.putGamma(len - 2);
+            }
+        } else if (lb) {
+            w.putBit(len - 1);
+        } else if (len <= 4) {
+            w.putBit(1);
+            w.putBit(len - 3);
+        } else {
+            w.putBit(0);
+            w.putGamma(len - 3);
+        }
+    }
+    static void putEof(NrvWriter &w) {
+        w.putBit(0);
+        if (M == 'b')
+            w.putGamma(0x1000002);
+        else
+            w.putGamma12(0x1000002);
+        w.putByte(0xff);
+        w.flushBits();
+    }
+
+    static int compress(const upx_bytep block, unsigned block_len, unsigned dict_len,
+                        NrvWriter &w, upx_callback_t *cb, int level, unsigned max_offset,
+                        unsigned max_match, ucl_uint *res);
+    static int compressOptimal(const upx_bytep src, unsigned src_len, NrvWriter &w,
+                               upx_callback_t *cb, int level, unsigned max_offset,
+                               unsigned max_match, ucl_uint *res);
+};
+
+// the dict_len bytes before block are the history: matches may reach back
+// into them, but they are not part of the output
+template <int M>
+int NrvCoder<M>::compress(const upx_bytep block, unsigned block_len, unsigned dict_len,
+                          NrvWriter &w, upx_callback_t *cb, int level, unsigned max_offset,
+                          unsigned max_match, ucl_uint *res) {
+    MemBuffer head_buf(mem_size(sizeof(unsigned), 1u << HASH_BITS));
+    unsigned *const head = (unsigned *) head_buf.getVoidPtr();
+    memset(head, 0xff, head_buf.getSize()); // unsigned(-1) means "no position"
+    const byte *const dst = w.out;
+    const upx_bytep const src = block - dict_len;
+    const unsigned src_len = (unsigned) mem_size(1, dict_len, block_len);
+
+    unsigned last_m_off = 1;
+    NrvStats stats;
+    unsigned next_progress = 0;
+
+    // the best match at pos; returns its length, or 0
+    auto const find = [&](unsigned pos, unsigned *m_off, bool insert) -> unsigned {
+        const unsigned limit = UPX_MIN(max_match, src_len - pos);
+        unsigned best_len = 0, best_off = 0;
+        if (limit < 2)
+            return 0;
+        // the last offset has the cheapest code
+        if (last_m_off <= pos && src[pos - last_m_off] == src[pos]) {
+            unsigned len = 1;
+            while (len < limit && src[pos - last_m_off + len] == src[pos + len])
+                len++;
+            if (len >= minLength(last_m_off)) {
+                best_len = len;
+                best_off = last_m_off;
+            }
+        }
+        if (pos + 4 <= src_len) {
+            const unsigned h = nrv_hash(src + pos);
+            const unsigned cand = head[h];
+            if (insert)
+                head[h] = pos;
+            if (cand < pos && pos - cand <= max_offset && pos - cand != best_off) {
+                unsigned len = 0;
+                while (len < limit && src[cand + len] == src[pos + len])
+                    len++;
+                // prefer the last offset on a tie
+                if (len > best_len && len >= minLength(pos - cand)) {
+                    best_len = len;
+                    best_off = pos - cand;
+                }
+            }
+        }
+        // only use a match if it is cheaper than literals
+        if (best_len && matchBits(best_off, best_len, last_m_off) >= 9 * best_len)
+            return 0;
+        *m_off = best_off;
+        return best_len;
+    };
+
+    unsigned pos = 0;
+    for (; pos < dict_len; pos++)
+        if (pos + 4 <= src_len)
+            head[nrv_hash(src + pos)] = pos;
+    while (pos < src_len) {
+        unsigned m_off = 0;
+        unsigned m_len = find(pos, &m_off, true);
+        if (m_len != 0 && level >= 2 && pos + 1 < src_len) {
+            // lazy matching: a literal and a longer match at pos + 1 is better
+            unsigned m_off2 = 0;
+            const unsigned m_len2 = find(pos + 1, &m_off2, false);
+            if (m_len2 > m_len + 1)
+                m_len = 0;
+        }
+        if (m_len == 0) {
+            w.putBit(1);
+            w.putByte(src[pos++]);
+            stats.literal();
+        } else {
+            putMatch(w, m_off, m_len, last_m_off);
+            stats.match(m_off, m_len);
+            last_m_off = m_off;
+            for (const unsigned end = pos + m_len; ++pos < end;)
+                if (pos + 4 <= src_len)
+                    head[nrv_hash(src + pos)] = pos;
+        }
+        if very_unlikely (w.overflow)
+            return UPX_E_NOT_COMPRESSIBLE;
+        if (cb && cb->nprogress && pos >= next_progress) {
+            cb->nprogress(cb, pos - dict_len, (unsigned) ptr_udiff_bytes(w.out, dst));
+            next_progress = pos + 64 * 1024;
+        }
+    }
+    putEof(w);
+    if (w.overflow)
+        return UPX_E_NOT_COMPRESSIBLE;
+    stats.get(res);
+    return UPX_E_OK;
+}
+
+/*************************************************************************
+// compressOptimal - "--nrv-parallel": the input is split into segments of
+// SEGMENT_SIZE, and each segment is parsed on its own thread by a forward
+// dynamic programming over the exact bit costs of putMatch(). The hash
+// chains of a segment also cover the window before it, so matches reach
+// back across segment boundaries. The last offset of the best path to
+// each position is used for the cheap "same offset" code.
+// Then all segments are written serially into one stream. The parse only
+// depends on the data, so the output does not depend on the number of
+// threads.
+**************************************************************************/
+
+constexpr unsigned SEGMENT_SIZE = 1024 * 1024;
+constexpr unsigned OPT_WINDOW = 1024 * 1024;
+constexpr unsigned OPT_HASH_BITS = 16;
+
+struct NrvParseBuffers final {
+    MemBuffer head;     // [1 << OPT_HASH_BITS], absolute positions
+    MemBuffer prev;     // [OPT_WINDOW + SEGMENT_SIZE], hash chains from base
+    MemBuffer price;    // [SEGMENT_SIZE + 1], bits; then the token list
+    MemBuffer from_len; // [SEGMENT_SIZE + 1], 0 for a literal
+    MemBuffer last_off; // [SEGMENT_SIZE + 1]
+
+    void alloc() {
+        if (head.getVoidPtr() != nullptr)
+            return;
+        head.alloc(mem_size(sizeof(unsigned), 1u << OPT_HASH_BITS));
+        prev.alloc(mem_size(sizeof(unsigned), OPT_WINDOW + SEGMENT_SIZE));
+        price.alloc(mem_size(sizeof(unsigned), SEGMENT_SIZE + 1));
+        from_len.alloc(mem_size(sizeof(unsigned), SEGMENT_SIZE + 1));
+        last_off.alloc(mem_size(sizeof(unsigned), SEGMENT_SIZE + 1));
+    }
+};
+
+forceinline unsigned nrv_opt_hash(const byte *p) noexcept {
+    return ((get_le32(p) & 0xffffff) * 2654435761u) >> (32 - OPT_HASH_BITS);
+}
+
+// parse [s, s + n); afterwards price[p] is the end of the token at p
+template <int M>
+static void nrv_parse_segment(const byte *src, unsigned src_len, unsigned s, unsigned n,
+                              unsigned window, unsigned max_match, unsigned max_chain,
+                              unsigned nice_len, NrvParseBuffers &pb) {
+    typedef NrvCoder<M> Coder;
+    unsigned *const head = (unsigned *) pb.head.getVoidPtr();
+    unsigned *const prev = (unsigned *) pb.prev.getVoidPtr();
+    unsigned *const price = (unsigned *) pb.price.getVoidPtr();
+    unsigned *const from_len = (unsigned *) pb.from_len.getVoidPtr();
+    unsigned *const last_off = (unsigned *) pb.last_off.getVoidPtr();
+    const unsigned base = s > window ? s - window : 0;
+    memset(head, 0xff, pb.head.getSize()); // unsigned(-1) means "no position"
+    auto const insert = [&](unsigned pos) noexcept -> unsigned {
+        if (pos + 4 > src_len)
+            return ~0u;
+        const unsigned h = nrv_opt_hash(src + pos);
+        const unsigned cand = head[h];
+        prev[pos - base] = cand;
+        head[h] = pos;
+        return cand;
+    };
+    for (unsigned pos = base; pos < s; pos++)
+        insert(pos);
+
+    for (unsigned p = 0; p <= n; p++)
+        price[p] = ~0u;
+    price[0] = 0;
+    from_len[0] = 0;
+    last_off[0] = (s == 0) ? 1 : 0; // unknown at a segment boundary
+    auto const relax = [&](unsigned p, unsigned q, unsigned bits, unsigned len, unsigned off) {
+        if (price[p] + bits < price[q]) {
+            price[q] = price[p] + bits;
+            from_len[q] = len;
+            last_off[q] = len ? off : last_off[p];
+        }
+    };
+
+    for (unsigned p = 0; p < n; p++) {
+        const unsigned pos = s + p;
+        const unsigned limit = UPX_MIN(max_match, n - p);
+        relax(p, p + 1, 9, 0, 0); // literal
+        unsigned cand = insert(pos);
+        if (limit < 2)
+            continue;
+        unsigned best_len = 1; // lengths up to best_len are already covered
+        // the last offset of the best path to p
+        const unsigned rep = last_off[p];
+        if (rep != 0 && rep <= pos) {
+            unsigned len = 0;
+            while (len < limit && src[pos - rep + len] == src[pos + len])
+                len++;
+            for (unsigned l = Coder::minLength(rep); l <= UPX_MIN(len, nice_len); l++)
+                relax(p, p + l, Coder::matchBits(rep, l, rep), l, rep);
+            if (len >= nice_len) {
+                // long enough - take it and skip ahead
+                relax(p, p + len, Coder::matchBits(rep, len, rep), len, rep);
+                for (unsigned q = 1; q < len; q++)
+                    insert(pos + q);
+                p += len - 1;
+                continue;
+            }
+        }
+        // the hash chain yields longer matches at larger offsets; each
+        // candidate only covers the lengths that no nearer one could
+        unsigned long_len = 0, long_off = 0;
+        for (unsigned depth = max_chain; depth != 0 && cand != ~0u && cand >= base &&
+                                         pos - cand <= window;
+             depth--, cand = prev[cand - base]) {
+            if (best_len >= limit)
+                break;
+            if (src[cand + best_len] != src[pos + best_len])
+                continue;
+            unsigned len = 0;
+            while (len < limit && src[cand + len] == src[pos + len])
+                len++;
+            if (len <= best_len)
+                continue;
+            const unsigned off = pos - cand;
+            const unsigned l0 = UPX_MAX(best_len + 1, Coder::minLength(off));
+            for (unsigned l = l0; l <= UPX_MIN(len, nice_len); l++)
+                relax(p, p + l, Coder::matchBits(off, l, rep), l, off);
+            best_len = len;
+            if (len >= nice_len) {
+                long_len = len;
+                long_off = off;
+                break;
+            }
+        }
+        if (long_len != 0) {
+            relax(p, p + long_len, Coder::matchBits(long_off, long_len, rep), long_len, long_off);
+            for (unsigned q = 1; q < long_len; q++)
+                insert(pos + q);
+            p += long_len - 1;
+        }
+    }
+
+    // link the tokens of the best path from the start
+    for (unsigned q = n; q != 0;) {
+        const unsigned p = q - (from_len[q] ? from_len[q] : 1);
+        price[p] = q;
+        q = p;
+    }
+}
+
+template <int M>
+int NrvCoder<M>::compressOptimal(const upx_bytep src, unsigned src_len, NrvWriter &w,
+                                 upx_callback_t *cb, int level, unsigned max_offset,
+                                 unsigned max_match, ucl_uint *res) {
+    const unsigned window = UPX_MIN(max_offset, OPT_WINDOW);
+    const unsigned max_chain = level >= 10 ? 256 : level >= 9 ? 64 : 16;
+    const unsigned nice_len = level >= 10 ? 128 : level >= 9 ? 64 : 32;
+    const unsigned nsegments = (src_len + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+    const unsigned num_threads = upx::get_num_threads(nsegments);
+    std::vector<NrvParseBuffers> pbs(num_threads);
+    const byte *const dst = w.out;
+
+    unsigned last_m_off = 1;
+    NrvStats stats;
+    for (unsigned k0 = 0; k0 < nsegments; k0 += num_threads) {
+        const unsigned batch = UPX_MIN(nsegments - k0, num_threads);
+        upx::parallel_for(batch, num_threads, [&](size_t j) {
+            const unsigned s = (k0 + unsigned(j)) * SEGMENT_SIZE;
+            pbs[j].alloc();
+            nrv_parse_segment<M>(src, src_len, s, UPX_MIN(SEGMENT_SIZE, src_len - s), window,
+                                 max_match, max_chain, nice_len, pbs[j]);
+        });
+        // write the tokens in serial order
+        for (unsigned j = 0; j < batch; j++) {
+            const unsigned s = (k0 + j) * SEGMENT_SIZE;
+            const unsigned n = UPX_MIN(SEGMENT_SIZE, src_len - s);
+            const unsigned *const next = (const unsigned *) pbs[j].price.getVoidPtr();
+            const unsigned *const from_len = (const unsigned *) pbs[j].from_len.getVoidPtr();
+            const unsigned *const last_off = (const unsigned *) pbs[j].last_off.getVoidPtr();
+            for (unsigned p = 0; p < n; p = next[p]) {
+                const unsigned m_len = from_len[next[p]];
+                if (m_len == 0) {
+                    w.putBit(1);
+                    w.putByte(src[s + p]);
+                    stats.literal();
+                    continue;
+                }
+                const unsigned m_off = last_off[next[p]];
+                putMatch(w, m_off, m_len, last_m_off);
+                stats.match(m_off, m_len);
+                last_m_off = m_off;
+            }
+            if very_unlikely (w.overflow)
+                return UPX_E_NOT_COMPRESSIBLE;
+        }
+        if (cb && cb->nprogress) {
+            const unsigned done = UPX_MIN(src_len, (k0 + batch) * SEGMENT_SIZE);
+            cb->nprogress(cb, done, (unsigned) ptr_udiff_bytes(w.out, dst));
+        }
+    }
+    putEof(w);
+    if (w.overflow)
+        return UPX_E_NOT_COMPRESSIBLE;
+    stats.get(res);
+    return UPX_E_OK;
+}
+
+} // namespace
+
+/*************************************************************************
+// called by upx_ucl_compress() for the low levels
+**************************************************************************/
+
+int upx_ucl_fast_compress(const upx_bytep src, unsigned src_len, upx_bytep dst,
+                          unsigned *dst_len, upx_callback_t *cb, int method, int level,
+                          unsigned max_offset, unsigned max_match, ucl_uint *res,
+                          unsigned dict_len) {
+    assert(level > 0);
+    static const upx_uint8_t sizes[3] = {32, 8, 16};
+    if (method < M_NRV2B_LE32 || method > M_NRV2E_LE16)
+        throwInternalError("unknown compression method");
+    NrvWriter w{dst, dst + *dst_len, sizes[(method - M_NRV2B_LE32) % 3]};
+    int r;
+    if M_IS_NRV2B (method)
+        r = NrvCoder<'b'>::compress(src, src_len, dict_len, w, cb, level, max_offset,
+                                      max_match, res);
+    else if M_IS_NRV2D (method)
+        r = NrvCoder<'d'>::compress(src, src_len, dict_len, w, cb, level, max_offset,
+                                      max_match, res);
+    else
+        r = NrvCoder<'e'>::compress(src, src_len, dict_len, w, cb, level, max_offset,
+                                      max_match, res);
+    *dst_len = (unsigned) ptr_udiff_bytes(w.out, dst);
+    return r;
+}
+
+int upx_ucl_parallel_compress(const upx_bytep src, unsigned src_len, upx_bytep dst,
+                              unsigned *dst_len, upx_callback_t *cb, int method, int level,
+                              unsigned max_offset, unsigned max_match, ucl_uint *res) {
+    assert(level > 0);
+    static const upx_uint8_t sizes[3] = {32, 8, 16};
+    if (method < M_NRV2B_LE32 || method > M_NRV2E_LE16)
+        throwInternalError("unknown compression method");
+    NrvWriter w{dst, dst + *dst_len, sizes[(method - M_NRV2B_LE32) % 3]};
+    int r;
+    if M_IS_NRV2B (method)
+        r = NrvCoder<'b'>::compressOptimal(src, src_len, w, cb, level, max_offset, max_match, res);
+    else if M_IS_NRV2D (method)
+        r = NrvCoder<'d'>::compressOptimal(src, src_len, w, cb, level, max_offset, max_match, res);
+    else
+        r = NrvCoder<'e'>::compressOptimal(src, src_len, w, cb, level, max_offset, max_match, res);
+    *dst_len = (unsigned) ptr_udiff_bytes(w.out, dst);
+    return r;
+}
+
+/*************************************************************************
+// doctest checks
+**************************************************************************/
+
+TEST_CASE("upx_ucl_fast_compress") {
+    constexpr unsigned N = 65536;
+    MemBuffer u(N), c(MemBuffer::getSizeForCompression(N)), d(N);
+    unsigned x = 1;
+    for (unsigned i = 0; i < N; i++) {
+        x = x * 1103515245 + 12345;
+        // text with some noise, some runs and some far repeats
+        const byte text = (byte) ("upx packs executables"[i % 21] + ((x >> 28) == 0));
+        u[i] = (i & 0x3000) == 0x1000 ? (byte) (x >> 24)
+               : (i & 0x3000) == 0x2000 ? (byte) (i >> 9)
+                                        : text;
+    }
+    static const int methods[] = {M_NRV2B_8, M_NRV2B_LE16, M_NRV2B_LE32,
+                                  M_NRV2D_8, M_NRV2D_LE16, M_NRV2D_LE32,
+                                  M_NRV2E_8, M_NRV2E_LE16, M_NRV2E_LE32};
+    static const int levels[] = {1, 2, 8, 10};
+    for (int method : methods) {
+        for (int level : levels) {
+            ucl_uint res[8] = {};
+            unsigned c_len = c.getSize();
+            if (level <= 2)
+                CHECK(upx_ucl_fast_compress(u, N, c, &c_len, nullptr, method, level, 8191, ~0u,
+                                            res) == UPX_E_OK);
+            else
+                CHECK(upx_ucl_parallel_compress(u, N, c, &c_len, nullptr, method, level, 8191,
+                                                ~0u, res) == UPX_E_OK);
+            CHECK(c_len < N / 2);
+            CHECK((res[1] <= 8191 && res[3] <= N));
+            unsigned d_len = N;
+            CHECK(upx_ucl_decompress(c, c_len, d, &d_len, method, nullptr) == UPX_E_OK);
+            CHECK(d_len == N);
+            CHECK(memcmp(u, d, N) == 0);
+            unsigned overlap = 0;
+            CHECK(upx_find_overlap(c, c_len, N, method, &overlap) == UPX_E_OK);
+        }
+    }
+}
+
+TEST_CASE("upx_ucl_fast_compress dict_len") {
+    // the second half repeats the first one; with the first half as history
+    // it must compress much better than alone, and decode right behind it
+    constexpr unsigned N = 16384;
+    MemBuffer u(2 * N), c(MemBuffer::getSizeForCompression(N)), d(2 * N);
+    unsigned x = 1;
+    for (unsigned i = 0; i < N; i++) {
+        x = x * 1103515245 + 12345;
+        u[i] = u[N + i] = (byte) (x >> 24);
+    }
+    memcpy(d, u, N);
+    for (int method : {M_NRV2B_8, M_NRV2D_LE32, M_NRV2E_8}) {
+        ucl_uint res[8] = {};
+        unsigned c_len = c.getSize();
+        CHECK(upx_ucl_fast_compress(u + N, N, c, &c_len, nullptr, method, 2, N, ~0u, res, N) ==
+              UPX_E_OK);
+        CHECK(c_len < N / 16);
+        unsigned d_len = N;
+        CHECK(upx_ucl_decode_fast(c, c_len, d + N, &d_len, method, N) == UPX_E_OK);
+        CHECK(d_len == N);
+        CHECK(memcmp(u, d, 2 * N) == 0);
+        // without the history, the references are out of bounds
+        d_len = N;
+        CHECK(upx_ucl_decode_fast(c, c_len, d + N, &d_len, method) != UPX_E_OK);
+    }
+}
+
+#endif // WITH_UCL
+
+/* vim:set ts=4 sw=4 et: */
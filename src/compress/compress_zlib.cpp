@@ -74,19 +74,8 @@ static int convert_errno_from_zlib(int zr) {
 //
 **************************************************************************/
 
-int upx_zlib_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned *dst_len,
-                      upx_callback_t *cb_parm, int method, int level,
-                      const upx_compress_config_t *cconf_parm, upx_compress_result_t *cresult) {
-    assert(method == M_DEFLATE);
-    assert(level > 0);
-    assert(cresult != nullptr);
-    UNUSED(cb_parm);
-    int r = UPX_E_ERROR;
-    int zr;
-    const zlib_compress_config_t *const lcconf = cconf_parm ? &cconf_parm->conf_zlib : nullptr;
-    zlib_compress_result_t *const res = &cresult->result_zlib;
-    res->reset();
-
+// raw deflate with the cconf overrides, as used by UPX
+static int zlib_deflate_init(z_stream *s, int level, const zlib_compress_config_t *lcconf) {
     if (level == 10)
         level = 9;
 
@@ -100,6 +89,25 @@ int upx_zlib_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsi
         oassign(strategy, lcconf->strategy);
     }
 
+    int zr = (int) deflateInit2(s, level, Z_DEFLATED, 0 - (int) window_bits, mem_level, strategy);
+    if (zr == Z_OK)
+        assert(s->state->level == level);
+    return zr;
+}
+
+int upx_zlib_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned *dst_len,
+                      upx_callback_t *cb_parm, int method, int level,
+                      const upx_compress_config_t *cconf_parm, upx_compress_result_t *cresult) {
+    assert(method == M_DEFLATE);
+    assert(level > 0);
+    assert(cresult != nullptr);
+    UNUSED(cb_parm);
+    int r = UPX_E_ERROR;
+    int zr;
+    const zlib_compress_config_t *const lcconf = cconf_parm ? &cconf_parm->conf_zlib : nullptr;
+    zlib_compress_result_t *const res = &cresult->result_zlib;
+    res->reset();
+
     z_stream s;
     s.zalloc = (alloc_func) nullptr;
     s.zfree = (free_func) nullptr;
@@ -109,11 +117,12 @@ int upx_zlib_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsi
     s.avail_out = *dst_len;
     s.total_in = s.total_out = 0;
 
-    zr = (int) deflateInit2(&s, level, Z_DEFLATED, 0 - (int) window_bits, mem_level, strategy);
+    zr = zlib_deflate_init(&s, level, lcconf);
     if (zr != Z_OK)
         goto error;
-    assert(s.state->level == level);
     zr = deflate(&s, Z_FINISH);
+    if (zr == Z_OK && s.avail_out == 0)
+        zr = Z_BUF_ERROR; // output buffer is full
     if (zr != Z_STREAM_END)
         goto error;
     zr = deflateEnd(&s);
@@ -137,6 +146,77 @@ done:
     return r;
 }
 
+/*************************************************************************
+// streaming compression, see compress.h
+**************************************************************************/
+
+namespace {
+class ZlibCompressStream final : public CompressStream {
+public:
+    ZlibCompressStream(write_func_t w, void *u) noexcept : CompressStream(w, u) {
+        mem_clear(&s);
+    }
+    virtual ~ZlibCompressStream() noexcept override {
+        if (initialized)
+            (void) deflateEnd(&s);
+    }
+    int init(int level, const zlib_compress_config_t *lcconf) {
+        s.zalloc = (alloc_func) nullptr;
+        s.zfree = (free_func) nullptr;
+        int zr = zlib_deflate_init(&s, level, lcconf);
+        initialized = zr == Z_OK;
+        return convert_errno_from_zlib(zr);
+    }
+    virtual int feed(const upx_bytep src, unsigned src_len) override {
+        s.next_in = src;
+        s.avail_in = src_len;
+        total_in += src_len;
+        while (s.avail_in != 0) {
+            int zr = run(Z_NO_FLUSH);
+            if (zr != Z_OK)
+                return convert_errno_from_zlib(zr);
+        }
+        return UPX_E_OK;
+    }
+    virtual int finish() override {
+        s.next_in = nullptr;
+        s.avail_in = 0;
+        for (;;) {
+            int zr = run(Z_FINISH);
+            if (zr == Z_STREAM_END)
+                return UPX_E_OK;
+            if (zr != Z_OK)
+                return convert_errno_from_zlib(zr);
+        }
+    }
+
+private:
+    int run(int flush) {
+        s.next_out = obuf;
+        s.avail_out = OBUF_SIZE;
+        int zr = deflate(&s, flush);
+        output(obuf, OBUF_SIZE - s.avail_out);
+        if (zr == Z_BUF_ERROR && s.avail_out != 0)
+            zr = Z_OK; // no progress possible, but not an error
+        return zr;
+    }
+    z_stream s;
+    bool initialized = false;
+    byte obuf[OBUF_SIZE];
+};
+} // namespace
+
+CompressStream *upx_zlib_compress_stream_open(int level, const upx_compress_config_t *cconf,
+                                              CompressStream::write_func_t write, void *user) {
+    std::unique_ptr<ZlibCompressStream> cs(new ZlibCompressStream(write, user));
+    int r = cs->init(level, cconf ? &cconf->conf_zlib : nullptr);
+    if (r == UPX_E_OUT_OF_MEMORY)
+        throwOutOfMemoryException();
+    if (r != UPX_E_OK)
+        throwInternalError("zlib stream init failed");
+    return cs.release();
+}
+
 /*************************************************************************
 //
 **************************************************************************/
@@ -146,45 +226,12 @@ int upx_zlib_decompress(const upx_bytep src, unsigned src_len, upx_bytep dst, un
     assert(method == M_DEFLATE);
     UNUSED(method);
     UNUSED(cresult);
-    int r = UPX_E_ERROR;
-    int zr;
-
-    z_stream s;
-    s.zalloc = (alloc_func) nullptr;
-    s.zfree = (free_func) nullptr;
-    s.next_in = src;
-    s.avail_in = src_len;
-    s.next_out = dst;
-    s.avail_out = *dst_len;
-    s.total_in = s.total_out = 0;
-
-    zr = inflateInit2(&s, -15);
-    if (zr != Z_OK)
-        goto error;
-    zr = inflate(&s, Z_FINISH);
-    if (zr != Z_STREAM_END) {
-        if (zr == Z_BUF_ERROR && s.avail_in == 0)
-            zr = -7; // UPX extra
-        goto error;
-    }
-    zr = inflateEnd(&s);
-    if (zr != Z_OK)
-        goto error;
-    r = UPX_E_OK;
-    goto done;
-error:
-    (void) inflateEnd(&s);
-    r = convert_errno_from_zlib(zr);
-    if (r == UPX_E_OK)
-        r = UPX_E_ERROR;
-done:
-    if (r == UPX_E_OK) {
-        if (s.avail_in != 0 || s.total_in != src_len)
-            r = UPX_E_INPUT_NOT_CONSUMED;
-    }
-    assert(s.total_in <= src_len);
-    assert(s.total_out <= *dst_len);
-    *dst_len = s.total_out;
+    // the whole input and output are in memory, so use the faster
+    // single-call decoder of compress_inflate.cpp instead of inflate()
+    unsigned src_used = 0;
+    int r = upx_inflate(src, src_len, dst, dst_len, &src_used);
+    if (r == UPX_E_OK && src_used != src_len)
+        r = UPX_E_INPUT_NOT_CONSUMED;
     return r;
 }
 
@@ -307,4 +354,37 @@ TEST_CASE("upx_zlib_decompress") {
     UNUSED(r);
 }
 
+TEST_CASE("upx_zlib_compress_stream_open") {
+    // feed the input in odd pieces; the output must decompress in one call
+    constexpr unsigned u_len = 300000;
+    MemBuffer u_buf(u_len), c_buf, d_buf(u_len);
+    for (unsigned i = 0; i < u_len; i++)
+        u_buf[i] = (byte) ((i * 7) ^ (i >> 9));
+    c_buf.allocForCompression(u_len);
+    struct Sink {
+        byte *p;
+        unsigned len;
+    } sink = {c_buf, 0};
+    auto write = [](const upx_bytep buf, unsigned len, void *user) {
+        Sink *k = (Sink *) user;
+        memcpy(k->p + k->len, buf, len);
+        k->len += len;
+    };
+    std::unique_ptr<CompressStream> cs(
+        upx_compress_stream_open(M_DEFLATE, 6, nullptr, write, &sink));
+    CHECK(cs != nullptr);
+    if (!cs)
+        return;
+    for (unsigned off = 0, step = 1; off < u_len; off += step, step = step * 3 + 1)
+        CHECK(cs->feed(u_buf + off, UPX_MIN(step, u_len - off)) == UPX_E_OK);
+    CHECK(cs->finish() == UPX_E_OK);
+    CHECK(cs->total_in == u_len);
+    CHECK(cs->total_out == sink.len);
+    unsigned d_len = u_len;
+    int r = upx_zlib_decompress(c_buf, sink.len, d_buf, &d_len, M_DEFLATE, nullptr);
+    CHECK((r == UPX_E_OK && d_len == u_len));
+    CHECK(memcmp(u_buf, d_buf, u_len) == 0);
+    UNUSED(r);
+}
+
 /* vim:set ts=4 sw=4 et: */
@@ -32,7 +32,13 @@
 #endif
 #include "../conf.h"
 
-void zstd_compress_config_t::reset() noexcept { mem_clear(this); }
+void zstd_compress_config_t::reset() noexcept {
+    mem_clear(this);
+    level.reset();
+    window_log.reset();
+    long_distance.reset();
+    strategy.reset();
+}
 
 #if WITH_ZSTD
 #include "compress.h"
@@ -54,9 +60,83 @@ static int convert_errno_from_zstd(size_t zr) {
 }
 
 /*************************************************************************
-// TODO later: use advanced compression API for compression finetuning
+// per-thread contexts; these are reused across calls so that repeated
+// compression (e.g. in brute mode or for many blocks) does not have to
+// allocate and initialize the zstd tables each time
+**************************************************************************/
+
+namespace {
+struct ZstdContexts final {
+    ZSTD_CCtx *cctx = nullptr;
+    ZSTD_DCtx *dctx = nullptr;
+    ZstdContexts() noexcept = default;
+    ~ZstdContexts() noexcept {
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    }
+    UPX_CXX_DISABLE_COPY_MOVE(ZstdContexts)
+};
+upx_thread_local ZstdContexts zstd_contexts;
+} // namespace
+
+static ZSTD_CCtx *get_zstd_cctx() noexcept {
+    if (zstd_contexts.cctx == nullptr)
+        zstd_contexts.cctx = ZSTD_createCCtx();
+    return zstd_contexts.cctx;
+}
+
+static ZSTD_DCtx *get_zstd_dctx() noexcept {
+    if (zstd_contexts.dctx == nullptr) {
+        zstd_contexts.dctx = ZSTD_createDCtx();
+        // accept every windowLog that "--crp-zstd-wl" can produce
+        if (zstd_contexts.dctx != nullptr) {
+            const ZSTD_bounds b = ZSTD_dParam_getBounds(ZSTD_d_windowLogMax);
+            if (!ZSTD_isError(b.error))
+                (void) ZSTD_DCtx_setParameter(zstd_contexts.dctx, ZSTD_d_windowLogMax,
+                                              b.upperBound);
+        }
+    }
+    return zstd_contexts.dctx;
+}
+
+/*************************************************************************
+// map UPX level 1..10 to zstd-level 1..22; levels 1..3 are the fast
+// zstd levels, 10 is "--ultra" (and the same as zstd-level 22)
 **************************************************************************/
 
+static int get_zstd_level(int level) noexcept {
+    static const signed char levels[10 + 1] = {0, 1, 2, 3, 5, 7, 9, 12, 16, 19, 22};
+    return levels[level < 1 ? 1 : (level > 10 ? 10 : level)];
+}
+
+// reset cctx and set the parameters for level with the cconf overrides
+static size_t zstd_setup_cctx(ZSTD_CCtx *cctx, int level, const zstd_compress_config_t *lcconf) {
+    int zlevel = get_zstd_level(level);
+    zstd_compress_config_t::window_log_t window_log;
+    zstd_compress_config_t::long_distance_t long_distance;
+    zstd_compress_config_t::strategy_t strategy;
+    // cconf overrides
+    if (lcconf) {
+        if (lcconf->level.is_set)
+            zlevel = (int) lcconf->level;
+        oassign(window_log, lcconf->window_log);
+        oassign(long_distance, lcconf->long_distance);
+        oassign(strategy, lcconf->strategy);
+    }
+
+    size_t zr = ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+    if (!ZSTD_isError(zr))
+        zr = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, zlevel);
+    if (!ZSTD_isError(zr) && window_log.is_set)
+        zr = ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, (int) window_log);
+    if (!ZSTD_isError(zr) && long_distance.is_set)
+        zr = ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching,
+                                    long_distance ? 1 /*ZSTD_ps_enable*/ : 2 /*ZSTD_ps_disable*/);
+    if (!ZSTD_isError(zr) && strategy.is_set)
+        zr = ZSTD_CCtx_setParameter(cctx, ZSTD_c_strategy, (int) strategy);
+    return zr;
+}
+
 int upx_zstd_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsigned *dst_len,
                       upx_callback_t *cb_parm, int method, int level,
                       const upx_compress_config_t *cconf_parm, upx_compress_result_t *cresult) {
@@ -70,16 +150,12 @@ int upx_zstd_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsi
     zstd_compress_result_t *const res = &cresult->result_zstd;
     res->reset();
 
-    // TODO later: map level 1..10 to zstd-level 1..22
-    if (level == 10)
-        level = 22;
-
-    // cconf overrides
-    if (lcconf) {
-        UNUSED(lcconf);
-    }
-
-    zr = ZSTD_compress(dst, *dst_len, src, src_len, level);
+    ZSTD_CCtx *const cctx = get_zstd_cctx();
+    if (cctx == nullptr)
+        return UPX_E_OUT_OF_MEMORY;
+    zr = zstd_setup_cctx(cctx, level, lcconf);
+    if (!ZSTD_isError(zr))
+        zr = ZSTD_compress2(cctx, dst, *dst_len, src, src_len);
     if (ZSTD_isError(zr)) {
         *dst_len = 0; // TODO ???
         r = convert_errno_from_zstd(zr);
@@ -93,6 +169,67 @@ int upx_zstd_compress(const upx_bytep src, unsigned src_len, upx_bytep dst, unsi
     return r;
 }
 
+/*************************************************************************
+// streaming compression, see compress.h; uses its own context, as other
+// compression calls on this thread may happen between feed() and finish()
+**************************************************************************/
+
+namespace {
+class ZstdCompressStream final : public CompressStream {
+public:
+    ZstdCompressStream(write_func_t w, void *u) noexcept : CompressStream(w, u) {}
+    virtual ~ZstdCompressStream() noexcept override { ZSTD_freeCCtx(cctx); }
+    int init(int level, const zstd_compress_config_t *lcconf) {
+        cctx = ZSTD_createCCtx();
+        if (cctx == nullptr)
+            return UPX_E_OUT_OF_MEMORY;
+        size_t zr = zstd_setup_cctx(cctx, level, lcconf);
+        return ZSTD_isError(zr) ? convert_errno_from_zstd(zr) : UPX_E_OK;
+    }
+    virtual int feed(const upx_bytep src, unsigned src_len) override {
+        ZSTD_inBuffer in = {src, src_len, 0};
+        total_in += src_len;
+        while (in.pos < in.size) {
+            size_t zr = run(&in, ZSTD_e_continue);
+            if (ZSTD_isError(zr))
+                return convert_errno_from_zstd(zr);
+        }
+        return UPX_E_OK;
+    }
+    virtual int finish() override {
+        ZSTD_inBuffer in = {nullptr, 0, 0};
+        for (;;) {
+            size_t zr = run(&in, ZSTD_e_end);
+            if (ZSTD_isError(zr))
+                return convert_errno_from_zstd(zr);
+            if (zr == 0) // fully flushed
+                return UPX_E_OK;
+        }
+    }
+
+private:
+    size_t run(ZSTD_inBuffer *in, ZSTD_EndDirective mode) {
+        ZSTD_outBuffer out = {obuf, OBUF_SIZE, 0};
+        size_t zr = ZSTD_compressStream2(cctx, &out, in, mode);
+        output(obuf, (unsigned) out.pos);
+        return zr;
+    }
+    ZSTD_CCtx *cctx = nullptr;
+    byte obuf[OBUF_SIZE];
+};
+} // namespace
+
+CompressStream *upx_zstd_compress_stream_open(int level, const upx_compress_config_t *cconf,
+                                              CompressStream::write_func_t write, void *user) {
+    std::unique_ptr<ZstdCompressStream> cs(new ZstdCompressStream(write, user));
+    int r = cs->init(level, cconf ? &cconf->conf_zstd : nullptr);
+    if (r == UPX_E_OUT_OF_MEMORY)
+        throwOutOfMemoryException();
+    if (r != UPX_E_OK)
+        throwInternalError("zstd stream init failed");
+    return cs.release();
+}
+
 /*************************************************************************
 //
 **************************************************************************/
@@ -105,7 +242,11 @@ int upx_zstd_decompress(const upx_bytep src, unsigned src_len, upx_bytep dst, un
     int r = UPX_E_ERROR;
     size_t zr;
 
-    zr = ZSTD_decompress(dst, *dst_len, src, src_len);
+    ZSTD_DCtx *const dctx = get_zstd_dctx();
+    if (dctx != nullptr)
+        zr = ZSTD_decompressDCtx(dctx, dst, *dst_len, src, src_len);
+    else
+        zr = ZSTD_decompress(dst, *dst_len, src, src_len);
     if (ZSTD_isError(zr)) {
         *dst_len = 0; // TODO ???
         r = convert_errno_from_zstd(zr);
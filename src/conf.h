@@ -82,7 +82,7 @@ ACC_COMPILE_TIME_ASSERT_HEADER((char) (-1) == 255)
 #endif // UPX_CONFIG_DISABLE_WERROR
 #endif // UPX_CONFIG_DISABLE_WSTRICT
 
-// multithreading (UPX currently does not use multithreading)
+// multithreading (optional; see UPX_CONFIG_DISABLE_THREADS in CMakeLists.txt)
 #if (WITH_THREADS)
 #define upx_thread_local     thread_local
 #define upx_std_atomic(Type) std::atomic<Type>
@@ -511,6 +511,7 @@ using upx::tribool;
 #define UPX_E_INPUT_NOT_CONSUMED  (-8)
 #define UPX_E_NOT_YET_IMPLEMENTED (-9)
 #define UPX_E_INVALID_ARGUMENT    (-10)
+#define UPX_E_OVER_BUDGET         (-11) /* output exceeds upx_compress_config_t::max_c_len */
 
 // Executable formats (info: big endian types are >= 128); DO NOT CHANGE
 #define UPX_F_DOS_COM             1
@@ -684,7 +685,15 @@ struct zlib_compress_config_t final {
 };
 
 struct zstd_compress_config_t final {
-    unsigned dummy;
+    typedef OptVar<unsigned, 3u, 1u, 22u> level_t;         // lv  (overrides the UPX level)
+    typedef OptVar<unsigned, 23u, 10u, 31u> window_log_t;  // wl
+    typedef OptVar<unsigned, 0u, 0u, 1u> long_distance_t; // ldm
+    typedef OptVar<unsigned, 1u, 1u, 9u> strategy_t;       // st  (ZSTD_strategy)
+
+    level_t level;                 // lv
+    window_log_t window_log;       // wl
+    long_distance_t long_distance; // ldm
+    strategy_t strategy;           // st
 
     void reset() noexcept;
 };
@@ -695,6 +704,9 @@ struct upx_compress_config_t final {
     ucl_compress_config_t conf_ucl;
     zlib_compress_config_t conf_zlib;
     zstd_compress_config_t conf_zstd;
+    // if not 0 then a bigger result is useless for the caller, and
+    // upx_compress() may give up early with UPX_E_OVER_BUDGET
+    unsigned max_c_len;
 
     void reset() noexcept {
         conf_bzip2.reset();
@@ -702,6 +714,7 @@ struct upx_compress_config_t final {
         conf_ucl.reset();
         conf_zlib.reset();
         conf_zstd.reset();
+        max_c_len = 0;
     }
 };
 
@@ -763,7 +776,14 @@ struct upx_compress_result_t final {
     zlib_compress_result_t result_zlib;
     zstd_compress_result_t result_zstd;
 
+    // the smallest overlap for in-place decompression as computed by
+    // upx_find_overlap() right after compression; only valid if have_overlap
+    bool have_overlap;
+    unsigned overlap;
+
     void reset() noexcept {
+        have_overlap = false;
+        overlap = 0;
         debug.reset();
         result_bzip2.reset();
         result_lzma.reset();
@@ -792,6 +812,9 @@ noinline void upx_compiler_sanity_check() noexcept;
 noinline int upx_doctest_check(int argc, char **argv);
 int upx_doctest_check();
 
+// check/bench.cpp; only with UPX_CONFIG_BENCH_MAIN
+int upx_bench_main(int argc, char *argv[]) may_throw;
+
 // main.cpp
 extern const char *progname;
 bool main_set_exit_code(int ec);
@@ -814,8 +837,17 @@ void infoHeader();
 void infoWriting(const char *what, upx_int64_t size);
 
 // work.cpp
-void do_one_file(const char *iname, char *oname) may_throw;
+// same_as: the already processed file with the same contents, see process_files()
+void do_one_file(const char *iname, char *oname, const char *same_as = nullptr) may_throw;
 int do_files(int i, int argc, char *argv[]) may_throw;
+int do_tree(const char *dir) may_throw;
+void do_upgrades() noexcept;
+
+// server.cpp
+typedef int (*upx_server_job_func_t)(int argc, char *argv[]);
+int upx_server_listen(const char *socket_name, upx_server_job_func_t job) may_throw;
+int upx_server_connect(const char *socket_name, int argc, char *argv[]) may_throw;
+void upx_server_job_exit(int exit_code) noexcept; // does not return within a job
 
 // help.cpp
 extern const char gitrev[];
@@ -847,6 +879,20 @@ int upx_test_overlap       ( const upx_bytep buf,
                                    unsigned *dst_len,
                                    int method,
                              const upx_compress_result_t *cresult );
+// estimated working memory of upx_compress(), see "--memory-limit"
+upx_uint64_t upx_compress_work_memory ( unsigned src_len, int method, int level,
+                                        const upx_compress_config_t *cconf );
+// compress/compress_overlap.cpp
+int upx_find_overlap       ( const upx_bytep src, unsigned  src_len,
+                                   unsigned  dst_len,
+                                   int method, unsigned *overlap );
+// compress/compress_inflate.cpp
+int upx_inflate            ( const upx_bytep src, unsigned  src_len,
+                                   upx_bytep dst, unsigned *dst_len,
+                                   unsigned *src_used );
+int upx_gunzip             ( const upx_bytep src, unsigned  src_len,
+                                   upx_bytep dst, unsigned *dst_len,
+                                   unsigned *src_used );
 // clang-format on
 
 #include "util/snprintf.h" // must get included first!
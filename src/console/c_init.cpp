@@ -122,20 +122,173 @@ static bool intro(FILE *f) {
 
 console_t console_init = {init, set_fg, nullptr, intro};
 
+#endif /* USE_CONSOLE */
+
+/*************************************************************************
+// output
+**************************************************************************/
+
+#if WITH_THREADS
+// serialize output of parallel jobs; also protects the lazy init
+static std::mutex print_mutex;
+#endif
+
+// the caller holds print_mutex
+static void con_write_locked(FILE *f, const char *s, size_t len, bool raw) noexcept {
+#if (USE_CONSOLE)
+    if (!raw) {
+        if (con == me)
+            init(f, -1, -1);
+        assert_noexcept(con != me);
+        // print0() wants a string; the records of a ConsoleJob are not terminated
+        char buf[80 * 25 + 1];
+        while (len > 0) {
+            size_t n = len < sizeof(buf) - 1 ? len : sizeof(buf) - 1;
+            memcpy(buf, s, n);
+            buf[n] = 0;
+            con->print0(f, buf);
+            s += n;
+            len -= n;
+        }
+        return;
+    }
+#else
+    UNUSED(raw);
+#endif
+    (void) fwrite(s, 1, len, f);
+}
+
+static void con_write(FILE *f, const char *s, bool raw) noexcept {
+    if (ConsoleJob::add(f, s, raw))
+        return;
+#if WITH_THREADS
+    std::lock_guard<std::mutex> lock(print_mutex);
+#endif
+    con_write_locked(f, s, strlen(s), raw);
+}
+
 void con_fprintf(FILE *f, const char *format, ...) {
-    va_list args;
+    va_list args, args_copy;
     char buf[80 * 25];
 
     va_start(args, format);
-    upx_safe_vsnprintf(buf, sizeof(buf), format, args);
+    va_copy(args_copy, args);
+    int len = upx_safe_vsnprintf(nullptr, 0, format, args_copy);
+    va_end(args_copy);
+    if (size_t(len) < sizeof(buf)) {
+        upx_safe_vsnprintf(buf, sizeof(buf), format, args);
+        con_write(f, buf, false);
+    } else { // long texts like the help screen
+        char *p = nullptr;
+        if (upx_safe_vasprintf(&p, format, args) >= 0 && p != nullptr)
+            con_write(f, p, false);
+        ::free(p);
+    }
     va_end(args);
+}
 
-    if (con == me)
-        init(f, -1, -1);
-    assert(con != me);
-    con->print0(f, buf);
+void con_fputs_raw(FILE *f, const char *s) noexcept { con_write(f, s, true); }
+
+/*************************************************************************
+// ConsoleJob
+**************************************************************************/
+
+namespace {
+struct JobRecord final {
+    FILE *f;
+    size_t len;
+    bool raw;
+};
+upx_thread_local ConsoleJob *current_job = nullptr;
+} // namespace
+
+ConsoleJob::ConsoleJob(bool enabled) noexcept {
+    if (enabled && current_job == nullptr) {
+        current_job = this;
+        active = true;
+    }
 }
 
-#endif /* USE_CONSOLE */
+ConsoleJob::~ConsoleJob() noexcept {
+    if (active) {
+        flush();
+        current_job = nullptr;
+    }
+    ::free(buf);
+}
+
+/*static*/ bool ConsoleJob::add(FILE *f, const char *s, bool raw) noexcept {
+    ConsoleJob *job = current_job;
+    if (job == nullptr)
+        return false;
+    const size_t len = strlen(s);
+    if (len == 0)
+        return true;
+    JobRecord r;
+    bool extend = false;
+    if (job->buf_len > 0) { // append to the previous record if it is for the same file
+        memcpy(&r, job->buf + job->last_record, sizeof(r));
+        extend = r.f == f && r.raw == raw;
+    }
+    const size_t need = job->buf_len + (extend ? 0 : sizeof(r)) + len;
+    if (need > job->buf_size) {
+        size_t new_size = job->buf_size ? job->buf_size : 1024;
+        while (new_size < need)
+            new_size *= 2;
+        char *p = (char *) ::realloc(job->buf, new_size);
+        if (p == nullptr) { // out of memory: write what we have, then this directly
+            job->flush();
+            job->active = false;
+            current_job = nullptr;
+            con_write(f, s, raw);
+            return true;
+        }
+        job->buf = p;
+        job->buf_size = new_size;
+    }
+    if (extend) {
+        r.len += len;
+    } else {
+        job->last_record = job->buf_len;
+        r.f = f;
+        r.len = len;
+        r.raw = raw;
+        job->buf_len += sizeof(r);
+    }
+    memcpy(job->buf + job->last_record, &r, sizeof(r));
+    memcpy(job->buf + job->buf_len, s, len);
+    job->buf_len += len;
+    return true;
+}
+
+void ConsoleJob::flush() noexcept {
+    if (buf_len == 0)
+        return;
+    bool used_stdout = false, used_stderr = false;
+    {
+#if WITH_THREADS
+        std::lock_guard<std::mutex> lock(print_mutex);
+#endif
+        for (size_t pos = 0; pos < buf_len;) {
+            JobRecord r;
+            memcpy(&r, buf + pos, sizeof(r));
+            pos += sizeof(r);
+            con_write_locked(r.f, buf + pos, r.len, r.raw);
+            pos += r.len;
+            if (r.f == stdout)
+                used_stdout = true;
+            else if (r.f == stderr)
+                used_stderr = true;
+            else
+                (void) fflush(r.f);
+        }
+        if (used_stdout)
+            (void) fflush(stdout);
+        if (used_stderr)
+            (void) fflush(stderr);
+    }
+    buf_len = 0;
+    last_record = 0;
+}
 
 /* vim:set ts=4 sw=4 et: */
@@ -109,8 +109,6 @@ typedef struct {
     bool (*intro)(FILE *f);
 } console_t;
 
-void con_fprintf(FILE *f, const char *format, ...) attribute_format(2, 3);
-
 #define FG_BLACK     0x00
 #define FG_BLUE      0x01
 #define FG_GREEN     0x02
@@ -162,8 +160,35 @@ extern console_t console_screen;
 #else
 
 #define con_fg(f, x) 0
-#define con_fprintf  fprintf
 
 #endif /* USE_CONSOLE */
 
+void con_fprintf(FILE *f, const char *format, ...) attribute_format(2, 3);
+// like fputs(), but bypasses the console driver; goes into a ConsoleJob as well
+void con_fputs_raw(FILE *f, const char *s) noexcept;
+
+/*************************************************************************
+// "--jobs": while a ConsoleJob is alive in a thread, the output of that
+// thread's con_fprintf() calls is collected, and then written in one piece
+// by its destructor. So the lines of parallel jobs do not get mixed up,
+// and a worker only takes the console lock once per file.
+**************************************************************************/
+
+class ConsoleJob final : private noncopyable {
+public:
+    explicit ConsoleJob(bool enabled = true) noexcept;
+    ~ConsoleJob() noexcept;
+    void flush() noexcept; // write what has been collected so far
+    // append S to the ConsoleJob of the current thread; false if there is none
+    static bool add(FILE *f, const char *s, bool raw) noexcept;
+
+private:
+    // records of {FILE *f; bool raw; size_t len; char text[len]}
+    char *buf = nullptr;
+    size_t buf_len = 0;
+    size_t buf_size = 0;
+    size_t last_record = 0; // where the record of the previous add() starts
+    bool active = false;    // false if disabled, or inside another ConsoleJob
+};
+
 /* vim:set ts=4 sw=4 et: */
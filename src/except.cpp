@@ -78,7 +78,7 @@ void throwCantPack(const char *msg) {
         throw CantPackException(msg);
     else if (opt->cmd == CMD_COMPRESS)
         throw CantPackException(msg);
-    else if (opt->cmd == CMD_FILEINFO)
+    else if (opt->cmd == CMD_FILEINFO || opt->cmd == CMD_ANALYZE)
         throw CantPackException(msg);
     else
         throw CantUnpackException(msg);
@@ -25,8 +25,27 @@
    <markus@oberhumer.com>               <ezerotven+github@gmail.com>
  */
 
+#define WANT_WINDOWS_LEAN_H 1 // CreateFileW, WriteFile
 #include "conf.h"
 #include "file.h"
+#include "util/membuffer.h"
+
+#if defined(__linux__) && defined(O_TMPFILE) && defined(AT_FDCWD) && defined(AT_SYMLINK_FOLLOW)
+#define USE_O_TMPFILE 1
+#endif
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 27)
+#define USE_COPY_FILE_RANGE 1
+#endif
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__DJGPP__)
+#define USE_PWRITE 1
+#endif
+#if defined(__linux__)
+#define USE_POSIX_FALLOCATE 1
+#endif
+#if (ACC_OS_WIN32 || ACC_OS_WIN64) && defined(_WIN32) && !defined(__CYGWIN__)
+#define USE_WIN32_FILE 1
+#include <io.h> // _open_osfhandle, _get_osfhandle
+#endif
 
 /*************************************************************************
 // static file-related util functions; will throw on error
@@ -82,8 +101,93 @@ FileBase::~FileBase() may_throw {
         close_noexcept(); // currently in exception unwinding, use noexcept variant
 }
 
+// Windows: open the file with CreateFileW() instead of the sopen() of the
+// CRT, so that input files get FILE_FLAG_SEQUENTIAL_SCAN: the cache manager
+// then reads ahead much further, which matters most for files on SMB shares.
+// The handle is wrapped into a CRT fd, so everything else stays the same.
+// Returns false if the CRT shall open the file instead.
+static bool win32_sopen(const char *name, int flags, int shflags, int mode, int &fd) {
+#if USE_WIN32_FILE
+    if (flags & (O_APPEND | O_TEXT))
+        return false;
+    wchar_t wname[ACC_FN_PATH_MAX + 1];
+    if (MultiByteToWideChar(CP_ACP, 0, name, -1, wname, (int) TABLESIZE(wname)) <= 0)
+        return false;
+    const int acc_mode = flags & (O_RDONLY | O_WRONLY | O_RDWR);
+    DWORD access = GENERIC_READ;
+    if (acc_mode == O_RDWR)
+        access = GENERIC_READ | GENERIC_WRITE;
+    else if (acc_mode == O_WRONLY)
+        access = GENERIC_WRITE;
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE; // same as SH_DENYNO
+#if defined(SH_DENYRW) && defined(SH_DENYWR)
+    if (shflags == SH_DENYRW)
+        share = 0;
+    else if (shflags == SH_DENYWR)
+        share = FILE_SHARE_READ;
+#else
+    UNUSED(shflags);
+#endif
+    DWORD create = OPEN_EXISTING;
+    if ((flags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+        create = CREATE_NEW;
+    else if ((flags & (O_CREAT | O_TRUNC)) == (O_CREAT | O_TRUNC))
+        create = CREATE_ALWAYS;
+    else if (flags & O_CREAT)
+        create = OPEN_ALWAYS;
+    else if (flags & O_TRUNC)
+        create = TRUNCATE_EXISTING;
+    DWORD attr = FILE_ATTRIBUTE_NORMAL;
+    if ((flags & O_CREAT) && !(mode & S_IWRITE)) // like the CRT
+        attr = FILE_ATTRIBUTE_READONLY;
+    if (acc_mode == O_RDONLY)
+        attr |= FILE_FLAG_SEQUENTIAL_SCAN;
+    HANDLE h = CreateFileW(wname, access, share, nullptr, create, attr, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        switch (GetLastError()) {
+        case ERROR_FILE_NOT_FOUND:
+        case ERROR_PATH_NOT_FOUND:
+            errno = ENOENT;
+            break;
+        case ERROR_FILE_EXISTS:
+        case ERROR_ALREADY_EXISTS:
+            errno = EEXIST;
+            break;
+        case ERROR_ACCESS_DENIED:
+        case ERROR_SHARING_VIOLATION:
+        case ERROR_LOCK_VIOLATION:
+            errno = EACCES;
+            break;
+        case ERROR_TOO_MANY_OPEN_FILES:
+            errno = EMFILE;
+            break;
+        default:
+            errno = EIO;
+            break;
+        }
+        fd = -1;
+        return true;
+    }
+    fd = _open_osfhandle((intptr_t) h, acc_mode == O_RDONLY ? O_RDONLY : 0);
+    if (fd < 0) {
+        (void) CloseHandle(h);
+        errno = EMFILE;
+    }
+    return true;
+#else
+    UNUSED(name);
+    UNUSED(flags);
+    UNUSED(shflags);
+    UNUSED(mode);
+    UNUSED(fd);
+    return false;
+#endif
+}
+
 bool FileBase::do_sopen() {
-    if (_shflags < 0)
+    if (win32_sopen(_name, _flags, _shflags, _mode, _fd)) {
+        // done
+    } else if (_shflags < 0)
         _fd = ::open(_name, _flags, _mode);
     else {
 #if (ACC_OS_DOS32) && defined(__DJGPP__)
@@ -104,17 +208,85 @@ bool FileBase::do_sopen() {
     return true;
 }
 
+upx_off_t FileBase::do_lseek(upx_off_t off, int whence) const {
+    if (!_is_memory)
+        return ::lseek(_fd, off, whence);
+    if (whence == SEEK_CUR)
+        off += _mem_pos;
+    else if (whence == SEEK_END)
+        off += _mem_size;
+    if (off < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    _mem_pos = off;
+    return off;
+}
+
+long FileBase::do_read(void *buf, long len) const {
+    if (!_is_memory)
+        return acc_safe_hread(_fd, buf, len);
+    const upx_off_t avail = _mem_size - _mem_pos;
+    const long l = avail <= 0 ? 0 : avail < len ? (long) avail : len;
+    if (l > 0)
+        memcpy(buf, _mem + _mem_pos, l);
+    _mem_pos += l;
+    return l;
+}
+
+long FileBase::do_write(const void *buf, long len) {
+    if (!_is_memory)
+        return acc_safe_hwrite(_fd, buf, len);
+    const upx_off_t end = _mem_pos + len;
+    if (end > _mem_capacity) {
+        upx_off_t cap = _mem_capacity < 65536 ? 65536 : _mem_capacity;
+        while (cap < end)
+            cap *= 2;
+        byte *p = mem_size_valid_bytes(cap) ? (byte *) ::realloc(_mem, (size_t) cap) : nullptr;
+        if (p == nullptr) {
+            errno = ENOMEM;
+            return -1;
+        }
+        _mem = p;
+        _mem_capacity = cap;
+    }
+    if (_mem_pos > _mem_size) // seek() beyond the end leaves a hole
+        memset(_mem + _mem_size, 0, (size_t) (_mem_pos - _mem_size));
+    memcpy(_mem + _mem_pos, buf, len);
+    _mem_pos = end;
+    if (_mem_size < end)
+        _mem_size = end;
+    return len;
+}
+
+upx_off_t FileBase::do_fsize() const {
+    if (_is_memory)
+        return _mem_size;
+    struct stat my_st;
+    my_st.st_size = 0;
+    if (::fstat(_fd, &my_st) != 0)
+        return -1;
+    return my_st.st_size;
+}
+
 bool FileBase::close_noexcept() noexcept {
     bool ok = true;
-    if (isOpen() && _fd != STDIN_FILENO && _fd != STDOUT_FILENO && _fd != STDERR_FILENO)
+    if (_fd >= 0 && _fd != STDIN_FILENO && _fd != STDOUT_FILENO && _fd != STDERR_FILENO)
         if (::close(_fd) == -1)
             ok = false;
+    if (_mem_capacity > 0) // only an OutputFile owns its memory
+        ::free(_mem);
     _fd = -1;
     _flags = 0;
     _mode = 0;
     _name = nullptr;
     _offset = 0;
     _length = 0;
+    _is_memory = false;
+    _mem = nullptr;
+    _mem_size = 0;
+    _mem_capacity = 0;
+    _mem_pos = 0;
     return ok;
 }
 
@@ -140,7 +312,7 @@ upx_off_t FileBase::seek(upx_off_t off, int whence) {
     } else if (whence == SEEK_CUR) {
     } else
         throwInternalError("bad seek: whence");
-    upx_off_t l = ::lseek(_fd, off, whence);
+    upx_off_t l = do_lseek(off, whence);
     if (l < 0)
         throwIOException("seek error", errno);
     return l - _offset;
@@ -149,7 +321,7 @@ upx_off_t FileBase::seek(upx_off_t off, int whence) {
 upx_off_t FileBase::tell() const {
     if (!isOpen())
         throwIOException("bad tell");
-    upx_off_t l = ::lseek(_fd, 0, SEEK_CUR);
+    upx_off_t l = do_lseek(0, SEEK_CUR);
     if (l < 0)
         throwIOException("tell error", errno);
     return l - _offset;
@@ -166,8 +338,13 @@ upx_off_t FileBase::st_size() const { return _length; }
 // InputFile
 **************************************************************************/
 
+// here, as ReadCache is an incomplete type in file.h
+InputFile::InputFile() noexcept = default;
+InputFile::~InputFile() may_throw {}
+
 void InputFile::sopen(const char *name, int flags, int shflags) {
     closex();
+    read_cache.reset();
     _name = name;
     _flags = flags;
     _shflags = shflags;
@@ -185,12 +362,81 @@ void InputFile::sopen(const char *name, int flags, int shflags) {
     _length_orig = _length;
 }
 
+void InputFile::openMemory(const char *name, const void *buf, upx_off_t len) {
+    closex();
+    read_cache.reset();
+    if (len < 0 || (len > 0 && buf == nullptr) || !mem_size_valid_bytes(len))
+        throwIOException("bad openMemory");
+    _name = name;
+    _is_memory = true;
+    _mem = (byte *) const_cast<void *>(buf);
+    _mem_size = len;
+    _length = len;
+    _length_orig = len;
+    mem_clear(&st);
+    st.st_mode = S_IFREG | 0755;
+    st.st_size = len;
+}
+
+struct InputFile::ReadCache final {
+    enum { BLOCK_SIZE = 16384, ALIGN = 4096 };
+    struct Block {
+        upx_off_t off = -1; // absolute file offset
+        unsigned len = 0;
+        byte data[BLOCK_SIZE];
+    } blocks[2]; // [0] is the head of the file, [1] the most recent other block
+};
+
+// returns -1 if the read could not be served from the cache
+int InputFile::readCached(byte *buf, int len) {
+    static_assert(ReadCache::ALIGN + ReadCache::BLOCK_SIZE / 2 <= ReadCache::BLOCK_SIZE);
+    if (len > ReadCache::BLOCK_SIZE / 2)
+        return -1;
+    const upx_off_t pos = do_lseek(0, SEEK_CUR);
+    if (pos < 0)
+        return -1;
+    if (!read_cache)
+        read_cache.reset(new ReadCache);
+    ReadCache::Block *bp = nullptr;
+    for (ReadCache::Block &b : read_cache->blocks)
+        if (b.off >= 0 && pos >= b.off && pos + len <= b.off + b.len)
+            bp = &b;
+    const upx_off_t off = pos - pos % ReadCache::ALIGN;
+    if (bp == nullptr)
+        bp = &read_cache->blocks[off == 0 ? 0 : 1];
+    ReadCache::Block &b = *bp;
+    if (!(pos >= b.off && pos + len <= b.off + b.len) && b.off != off) {
+        // fill the block
+        b.off = -1;
+        if (do_lseek(off, SEEK_SET) != off)
+            throwIOException("seek error", errno);
+        errno = 0;
+        long l = do_read(b.data, ReadCache::BLOCK_SIZE);
+        if (errno)
+            throwIOException("read error", errno);
+        b.off = off;
+        b.len = (unsigned) l;
+    }
+    const upx_off_t avail = b.off + b.len - pos; // < len only at EOF
+    const int l = avail <= 0 ? 0 : avail < len ? (int) avail : len;
+    if (l > 0)
+        memcpy(buf, b.data + (pos - b.off), l);
+    if (do_lseek(pos + l, SEEK_SET) != pos + l)
+        throwIOException("seek error", errno);
+    return l;
+}
+
 int InputFile::read(SPAN_P(void) buf, upx_int64_t blen) {
     if (!isOpen() || blen < 0)
         throwIOException("bad read");
     int len = (int) mem_size(1, blen); // sanity check
+    if (len > 0 && !_is_memory) {
+        int l = readCached((byte *) raw_bytes(buf, len), len);
+        if (l >= 0)
+            return l;
+    }
     errno = 0;
-    long l = acc_safe_hread(_fd, raw_bytes(buf, len), len);
+    long l = do_read(raw_bytes(buf, len), len);
     if (errno)
         throwIOException("read error", errno);
     return (int) l;
@@ -203,6 +449,18 @@ int InputFile::readx(SPAN_P(void) buf, upx_int64_t blen) {
     return l;
 }
 
+void InputFile::mapx(MemBuffer &mb, upx_off_t off, upx_int64_t len) {
+    if (!isOpen() || off < 0 || len <= 0 || off > _length || len > _length - off)
+        throwIOException("bad mapx");
+    if (!_is_memory && mb.allocMapped(_fd, _offset + off, len)) {
+        seek(off + len, SEEK_SET);
+        return;
+    }
+    mb.alloc(len);
+    seek(off, SEEK_SET);
+    readx(mb, len);
+}
+
 upx_off_t InputFile::seek(upx_off_t off, int whence) {
     upx_off_t pos = super::seek(off, whence);
     if (_length < pos)
@@ -216,8 +474,14 @@ upx_off_t InputFile::st_size_orig() const { return _length_orig; }
 // OutputFile
 **************************************************************************/
 
+OutputFile::~OutputFile() may_throw {
+    if (std::uncaught_exceptions() == 0)
+        flush(); // may_throw
+}
+
 void OutputFile::sopen(const char *name, int flags, int shflags, int mode) {
     closex();
+    is_tmpfile = false;
     _name = name;
     _flags = flags;
     _shflags = shflags;
@@ -240,6 +504,7 @@ void OutputFile::sopen(const char *name, int flags, int shflags, int mode) {
 
 bool OutputFile::openStdout(int flags, bool force) {
     closex();
+    is_tmpfile = false;
     int fd = STDOUT_FILENO;
     if (!force && acc_isatty(fd))
         return false;
@@ -255,6 +520,74 @@ bool OutputFile::openStdout(int flags, bool force) {
     return true;
 }
 
+void OutputFile::openMemory(const char *name) {
+    closex();
+    is_tmpfile = false;
+    _name = name;
+    _flags = 0;
+    _shflags = -1;
+    _mode = 0;
+    _offset = 0;
+    _length = 0;
+    _is_memory = true;
+}
+
+bool OutputFile::openTmpfile(const char *name, int mode) {
+    closex();
+    is_tmpfile = false;
+#if USE_O_TMPFILE
+    // linkTmpfile() needs /proc, as AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH
+    if (::access("/proc/self/fd", X_OK) != 0)
+        return false;
+    char dir[ACC_FN_PATH_MAX + 1];
+    if (strlen(name) >= sizeof(dir))
+        return false;
+    strcpy(dir, name);
+    char *base = fn_basename(dir);
+    if (base == dir)
+        strcpy(dir, ".");
+    else
+        base[-1] = 0;
+    if (!dir[0]) // a file in "/"; not worth a special case
+        return false;
+    int fd = ::open(dir, O_TMPFILE | O_WRONLY | O_BINARY, mode);
+    if (fd < 0)
+        return false; // EISDIR or EOPNOTSUPP: kernel or file system without O_TMPFILE
+    if (::fstat(fd, &st) != 0) {
+        int e = errno;
+        (void) ::close(fd);
+        throwIOException(name, e);
+    }
+    _fd = fd;
+    _name = name;
+    _flags = O_WRONLY | O_BINARY;
+    _shflags = -1;
+    _mode = mode;
+    _offset = 0;
+    _length = 0;
+    is_tmpfile = true;
+    return true;
+#else
+    UNUSED(name);
+    UNUSED(mode);
+    return false;
+#endif
+}
+
+void OutputFile::linkTmpfile(const char *name) {
+    if (!is_tmpfile)
+        return;
+#if USE_O_TMPFILE
+    char proc_name[64];
+    snprintf(proc_name, sizeof(proc_name), "/proc/self/fd/%d", _fd);
+    if (::linkat(AT_FDCWD, proc_name, AT_FDCWD, name, AT_SYMLINK_FOLLOW) != 0)
+        throwIOException(name, errno);
+#else
+    UNUSED(name);
+#endif
+    is_tmpfile = false;
+}
+
 void OutputFile::write(SPAN_0(const void) buf, upx_int64_t blen) {
     if (!isOpen() || blen < 0)
         throwIOException("bad write");
@@ -267,9 +600,19 @@ void OutputFile::write(SPAN_0(const void) buf, upx_int64_t blen) {
     NO_fprintf(stderr, "write %p %zd (%p) %d\n", buf.raw_ptr(), buf.raw_size_in_bytes(),
                buf.raw_base(), len);
 #endif
-    long l = acc_safe_hwrite(_fd, raw_bytes(buf, len), len);
-    if (l != len)
-        throwIOException("write error", errno);
+    if (_is_memory || (unsigned) len >= wbuf_size) {
+        flush();
+        long l = do_write(raw_bytes(buf, len), len);
+        if (l != len)
+            throwIOException("write error", errno);
+    } else {
+        if (wbuf_len + len > wbuf_size)
+            flush();
+        if (!wbuf)
+            wbuf.reset(new byte[wbuf_size]);
+        memcpy(wbuf.get() + wbuf_len, raw_bytes(buf, len), len);
+        wbuf_len += len;
+    }
     bytes_written += len;
 #if TESTING && 0
     static upx_std_atomic(bool) dumping;
@@ -284,15 +627,99 @@ void OutputFile::write(SPAN_0(const void) buf, upx_int64_t blen) {
 #endif
 }
 
+void OutputFile::flush() {
+    if (wbuf_len == 0)
+        return;
+    const long len = wbuf_len;
+    wbuf_len = 0;
+    errno = 0;
+    long l = do_write(wbuf.get(), len);
+    if (l != len)
+        throwIOException("write error", errno);
+}
+
+void OutputFile::closex() {
+    if (isOpen())
+        flush();
+    super::closex();
+}
+
+void OutputFile::setWriteBufferSize(unsigned size) {
+    flush();
+    wbuf.reset();
+    wbuf_size = size;
+}
+
+upx_off_t OutputFile::tell() const { return super::tell() + wbuf_len; }
+
+bool OutputFile::canWriteAt() const noexcept {
+#if USE_PWRITE || USE_WIN32_FILE
+    return _fd >= 0 && !_is_memory && !opt->to_stdout;
+#else
+    return false;
+#endif
+}
+
+void OutputFile::preallocate(upx_off_t pos, upx_off_t len) noexcept {
+#if USE_POSIX_FALLOCATE
+    // just a hint for the file system; EOPNOTSUPP and the like are fine
+    if (canWriteAt() && pos >= 0 && len > 0)
+        (void) ::posix_fallocate(_fd, _offset + pos, len);
+#else
+    UNUSED(pos);
+    UNUSED(len);
+#endif
+}
+
+void OutputFile::writeAt(upx_off_t pos, SPAN_0(const void) buf, unsigned len) {
+    if (!canWriteAt() || pos < 0)
+        throwIOException("bad write");
+#if USE_PWRITE
+    const byte *p = (const byte *) raw_bytes(buf, len);
+    upx_off_t off = _offset + pos;
+    while (len > 0) {
+        ssize_t l = ::pwrite(_fd, p, len, off);
+        if (l < 0 && errno == EINTR)
+            continue;
+        if (l <= 0)
+            throwIOException("write error", l < 0 ? errno : EIO);
+        p += l;
+        off += l;
+        len -= (unsigned) l;
+    }
+#elif USE_WIN32_FILE
+    // WriteFile() with an offset in the OVERLAPPED; on a synchronous handle
+    // this also moves the file position, which is why the caller seeks after
+    const HANDLE h = (HANDLE) _get_osfhandle(_fd);
+    const byte *p = (const byte *) raw_bytes(buf, len);
+    upx_uint64_t off = upx_uint64_t(_offset + pos);
+    while (len > 0) {
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof(ov));
+        ov.Offset = DWORD(off);
+        ov.OffsetHigh = DWORD(off >> 32);
+        DWORD l = 0;
+        if (!WriteFile(h, p, len, &l, &ov) || l == 0)
+            throwIOException("write error", EIO);
+        p += l;
+        off += l;
+        len -= l;
+    }
+#else
+    UNUSED(buf);
+#endif
+}
+
 upx_off_t OutputFile::st_size() const {
     if (opt->to_stdout) {     // might be a pipe ==> .st_size is invalid
         return bytes_written; // too big if seek()+write() instead of rewrite()
     }
-    struct stat my_st;
-    my_st.st_size = 0;
-    if (::fstat(_fd, &my_st) != 0)
+    upx_off_t size = do_fsize();
+    if (size < 0)
         throwIOException(_name, errno);
-    return my_st.st_size;
+    if (wbuf_len > 0) // the pending bytes may extend the file
+        size = UPX_MAX(size, _offset + tell());
+    return size;
 }
 
 void OutputFile::rewrite(SPAN_P(const void) buf, int len) {
@@ -304,6 +731,7 @@ void OutputFile::rewrite(SPAN_P(const void) buf, int len) {
 upx_off_t OutputFile::seek(upx_off_t off, int whence) {
     mem_size_assert(1, off >= 0 ? off : -off); // sanity check
     assert(!opt->to_stdout);
+    flush();
     switch (whence) {
     case SEEK_SET: {
         if (bytes_written < off) {
@@ -330,17 +758,21 @@ upx_off_t OutputFile::seek(upx_off_t off, int whence) {
 //}
 
 void OutputFile::set_extent(upx_off_t offset, upx_off_t length) {
+    flush();
     super::set_extent(offset, length);
     bytes_written = 0;
     if (0 == offset && 0xffffffffLL == length) { // TODO: check all callers of this method
-        if (::fstat(_fd, &st) != 0)
+        if (_is_memory)
+            st.st_size = _mem_size;
+        else if (::fstat(_fd, &st) != 0)
             throwIOException(_name, errno);
         _length = st.st_size - offset;
     }
 }
 
 upx_off_t OutputFile::unset_extent() {
-    upx_off_t l = ::lseek(_fd, 0, SEEK_END);
+    flush();
+    upx_off_t l = do_lseek(0, SEEK_END);
     if (l < 0)
         throwIOException("lseek error", errno);
     _offset = 0;
@@ -349,6 +781,74 @@ upx_off_t OutputFile::unset_extent() {
     return _length;
 }
 
+// Linux: copy blen bytes from the current position of fi to the current
+// position within the kernel, without a round trip through user space.
+// Returns the number of bytes copied; if that is less than blen (maybe 0,
+// e.g. memory files, pipes or EXDEV) then the caller copies the rest.
+// NOTE: macOS sendfile() can only write to a socket, so there is no such
+// shortcut there.
+upx_int64_t OutputFile::copyInKernel(InputFile &fi, upx_int64_t blen) {
+#if USE_COPY_FILE_RANGE
+    if (_is_memory || fi.isMemory() || opt->to_stdout)
+        return 0;
+    flush();
+    upx_int64_t copied = 0;
+    while (copied < blen) {
+        const size_t len = (size_t) UPX_MIN(blen - copied, upx_int64_t(1024 * 1024 * 1024));
+        ssize_t l = ::copy_file_range(fi.getFd(), nullptr, _fd, nullptr, len, 0);
+        if (l < 0 && errno == EINTR)
+            continue;
+        if (l <= 0) {
+            if (copied == 0 && l < 0) // EXDEV, ENOSYS, EINVAL, ...: not supported here
+                return 0;
+            throwIOException(_name, l < 0 ? errno : EIO);
+        }
+        copied += l;
+        bytes_written += l;
+    }
+    return copied;
+#else
+    UNUSED(fi);
+    UNUSED(blen);
+    return 0;
+#endif
+}
+
+void OutputFile::copyThroughBuffer(InputFile &fi, upx_int64_t blen, MemBuffer &buf) {
+    if (blen <= 0)
+        return;
+    // get buffer size, align to improve i/o speed
+    unsigned buf_size = buf.getSize();
+    if (buf_size > 65536)
+        buf_size = ALIGN_DOWN(buf_size, 4096u);
+    assert((int) buf_size > 0);
+    while (blen > 0) {
+        const unsigned len = (unsigned) UPX_MIN(blen, upx_int64_t(buf_size));
+        fi.readx(buf, len);
+        write(buf, len);
+        blen -= len;
+    }
+}
+
+void OutputFile::copyRangeFrom(InputFile &fi, upx_off_t off, upx_int64_t blen) {
+    if (!isOpen() || !fi.isOpen() || off < 0 || blen < 0)
+        throwIOException("bad write");
+    fi.seek(off, SEEK_SET);
+    blen -= copyInKernel(fi, blen);
+    if (blen > 0) {
+        MemBuffer buf(UPX_MIN(blen, upx_int64_t(1024 * 1024)));
+        copyThroughBuffer(fi, blen, buf);
+    }
+}
+
+void OutputFile::copyRangeFrom(InputFile &fi, upx_off_t off, upx_int64_t blen, MemBuffer &buf) {
+    if (!isOpen() || !fi.isOpen() || off < 0 || blen < 0)
+        throwIOException("bad write");
+    fi.seek(off, SEEK_SET);
+    blen -= copyInKernel(fi, blen);
+    copyThroughBuffer(fi, blen, buf);
+}
+
 /*static*/ void OutputFile::dump(const char *name, SPAN_P(const void) buf, int len, int flags) {
     if (flags < 0)
         flags = O_CREAT | O_TRUNC;
@@ -374,4 +874,35 @@ TEST_CASE("file") {
     CHECK(fo.getBytesWritten() == 0);
 }
 
+TEST_CASE("file memory") {
+    static const char data[] = "0123456789";
+    InputFile fi;
+    fi.openMemory("<memory>", data, 10);
+    CHECK(fi.isOpen());
+    CHECK(fi.isMemory());
+    CHECK(fi.st_size() == 10);
+    byte buf[16];
+    CHECK(fi.read(buf, 4) == 4);
+    CHECK(memcmp(buf, "0123", 4) == 0);
+    CHECK(fi.seek(-2, SEEK_END) == 8);
+    CHECK(fi.read(buf, 16) == 2);
+    CHECK(memcmp(buf, "89", 2) == 0);
+    CHECK_THROWS(fi.readx(buf, 1));
+    fi.closex();
+    CHECK(!fi.isOpen());
+
+    OutputFile fo;
+    fo.openMemory("<memory>");
+    fo.write(data, 10);
+    fo.seek(12, SEEK_SET);
+    fo.write(data, 2);
+    fo.seek(0, SEEK_SET);
+    fo.rewrite(data + 5, 1);
+    CHECK(fo.getMemorySize() == 14);
+    CHECK(fo.st_size() == 14);
+    CHECK(memcmp(fo.getMemory(), "5123456789\0\0" "01", 14) == 0);
+    fo.closex();
+    CHECK(fo.getMemory() == nullptr);
+}
+
 /* vim:set ts=4 sw=4 et: */
@@ -39,12 +39,13 @@ protected:
 public:
     bool close_noexcept() noexcept;
     void closex() may_throw;
-    bool isOpen() const noexcept { return _fd >= 0; }
-    int getFd() const noexcept { return _fd; }
+    bool isOpen() const noexcept { return _fd >= 0 || _is_memory; }
+    bool isMemory() const noexcept { return _is_memory; }
+    int getFd() const noexcept { return _fd; } // -1 for a memory file
     const char *getName() const noexcept { return _name; }
 
     virtual upx_off_t seek(upx_off_t off, int whence);
-    upx_off_t tell() const;
+    virtual upx_off_t tell() const;
     virtual upx_off_t st_size() const; // { return _length; }
     virtual void set_extent(upx_off_t offset, upx_off_t length);
 
@@ -57,6 +58,12 @@ public:
 
 protected:
     bool do_sopen();
+    // all I/O goes through these, so that a file can also live in memory;
+    // same return values as ::lseek(), ::read(), ::write() and errno on error
+    upx_off_t do_lseek(upx_off_t off, int whence) const;
+    long do_read(void *buf, long len) const;
+    long do_write(const void *buf, long len);
+    upx_off_t do_fsize() const;
     int _fd = -1;
     int _flags = 0;
     int _shflags = 0;
@@ -64,6 +71,12 @@ protected:
     const char *_name = nullptr;
     upx_off_t _offset = 0;
     upx_off_t _length = 0;
+    // memory file, see InputFile::openMemory() and OutputFile::openMemory()
+    bool _is_memory = false;
+    byte *_mem = nullptr; // owned by OutputFile only
+    upx_off_t _mem_size = 0;
+    upx_off_t _mem_capacity = 0;
+    mutable upx_off_t _mem_pos = 0;
 
 public:
     struct stat st = {};
@@ -77,19 +90,33 @@ class InputFile final : public FileBase {
     typedef FileBase super;
 
 public:
-    explicit InputFile() noexcept = default;
+    explicit InputFile() noexcept;
+    virtual ~InputFile() may_throw override;
 
     void sopen(const char *name, int flags, int shflags);
     void open(const char *name, int flags) { sopen(name, flags, -1); }
+    // read from [buf, +len) instead of a file; buf must stay valid until closed
+    void openMemory(const char *name, const void *buf, upx_off_t len);
 
     int read(SPAN_P(void) buf, upx_int64_t blen);
     int readx(SPAN_P(void) buf, upx_int64_t blen);
+    // get [off, +len) into an unallocated MemBuffer; maps the file copy-on-write
+    // if possible, else falls back to readx(); the file position ends up at off + len
+    void mapx(MemBuffer &mb, upx_off_t off, upx_int64_t len);
 
     virtual upx_off_t seek(upx_off_t off, int whence) override;
     upx_off_t st_size_orig() const;
 
 protected:
     upx_off_t _length_orig = 0;
+
+    // Small reads are served from two cached blocks of the file: the format
+    // probes of PackMaster read the same headers over and over again, and
+    // on a network file system every ::read() is a round-trip.
+    // The file position of the fd is always kept up-to-date.
+    struct ReadCache;
+    std::unique_ptr<ReadCache> read_cache;
+    int readCached(byte *buf, int len);
 };
 
 /*************************************************************************
@@ -101,21 +128,48 @@ class OutputFile final : public FileBase {
 
 public:
     explicit OutputFile() noexcept = default;
+    virtual ~OutputFile() may_throw override;
 
     void sopen(const char *name, int flags, int shflags, int mode);
     void open(const char *name, int flags, int mode) { sopen(name, flags, -1, mode); }
     bool openStdout(int flags = 0, bool force = false);
+    // Linux: create an unnamed file in the directory of "name" with O_TMPFILE,
+    // so that nothing is left behind on errors; returns false if not supported
+    bool openTmpfile(const char *name, int mode);
+    bool isTmpfile() const noexcept { return is_tmpfile; }
+    // give an unnamed file its final name; does nothing for other files
+    void linkTmpfile(const char *name);
+    // write into a growing buffer instead of a file, see getMemory()
+    void openMemory(const char *name);
+    const byte *getMemory() const noexcept { return _mem; } // valid until closed
+    upx_off_t getMemorySize() const noexcept { return _mem_size; }
 
     // info: allow nullptr if blen == 0
     void write(SPAN_0(const void) buf, upx_int64_t blen);
+    // small writes are collected in a buffer; flush() then does one ::write()
+    void flush() may_throw;
+    void closex() may_throw; // flush() and close
+    void setWriteBufferSize(unsigned size) may_throw; // 0 means unbuffered
 
     virtual upx_off_t seek(upx_off_t off, int whence) override;
+    virtual upx_off_t tell() const override;
     virtual upx_off_t st_size() const override; // { return _length; }
     virtual void set_extent(upx_off_t offset, upx_off_t length) override;
     upx_off_t unset_extent(); // returns actual length
+    // write [off, +blen) of fi; within the kernel if possible, else through
+    // buf or a temporary buffer; fi ends up at off + blen
+    void copyRangeFrom(InputFile &fi, upx_off_t off, upx_int64_t blen);
+    void copyRangeFrom(InputFile &fi, upx_off_t off, upx_int64_t blen, MemBuffer &buf);
 
     upx_off_t getBytesWritten() const { return bytes_written; }
 
+    // positional writes for the parallel unpackers: writeAt() writes at pos of
+    // the extent, and several threads may write disjoint ranges at once. The
+    // file position is unspecified afterwards, so the caller seek()s past the end.
+    bool canWriteAt() const noexcept; // a regular file, not memory or stdout
+    void preallocate(upx_off_t pos, upx_off_t len) noexcept; // best effort
+    void writeAt(upx_off_t pos, SPAN_0(const void) buf, unsigned len) may_throw;
+
     // FIXME - this won't work when using the '--stdout' option
     void rewrite(SPAN_P(const void) buf, int len);
 
@@ -124,6 +178,17 @@ public:
 
 protected:
     upx_off_t bytes_written = 0;
+    bool is_tmpfile = false;
+    // the pending bytes always go to the current file position
+    std::unique_ptr<byte[]> wbuf;
+#if defined(_WIN32)
+    unsigned wbuf_size = 1024 * 1024; // each WriteFile() to an SMB share is a round-trip
+#else
+    unsigned wbuf_size = 64 * 1024;
+#endif
+    unsigned wbuf_len = 0;
+    upx_int64_t copyInKernel(InputFile &fi, upx_int64_t blen);
+    void copyThroughBuffer(InputFile &fi, upx_int64_t blen, MemBuffer &buf);
 };
 
 /* vim:set ts=4 sw=4 et: */
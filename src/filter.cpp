@@ -26,8 +26,11 @@
  */
 
 #include "conf.h"
+#include <vector>
 #include "filter.h"
 #include "file.h"
+#include "util/threads.h"
+#include "util/trace.h"
 
 /*************************************************************************
 // util
@@ -40,6 +43,43 @@ static void initFilter(Filter *f, byte *buf, unsigned buf_len) noexcept {
     f->calls = f->wrongcalls = f->noncalls = f->firstcall = f->lastcall = 0;
 }
 
+/*************************************************************************
+// The arm calltricks 0x50..0x52 handle each aligned 32-bit word on its own,
+// so a big buffer can be split into chunks that are filtered in parallel.
+// A word is only handled if 4 more bytes follow it (see CT24ARM_LE), hence
+// every chunk but the last one overlaps the next one by 4 bytes.
+// All other filters carry state along the buffer: x86 calltricks skip the
+// bytes of a match, and cto filters need the cto byte of the whole buffer.
+**************************************************************************/
+
+static int callFilterFunc(Filter *f, int (*func)(Filter *)) may_throw {
+    constexpr unsigned CHUNK_SIZE = 4 * 1024 * 1024; // a multiple of 4
+    if (f->id < 0x50 || f->id > 0x52 || f->buf_len < 2 * CHUNK_SIZE)
+        return func(f);
+    const unsigned nchunks = f->buf_len / CHUNK_SIZE; // the last chunk takes the rest
+    const unsigned num_threads = upx::get_num_threads(nchunks);
+    if (num_threads < 2)
+        return func(f);
+    std::vector<Filter> chunks(nchunks, *f);
+    upx::parallel_for(nchunks, num_threads, [&](size_t i) {
+        Filter &c = chunks[i];
+        const unsigned off = unsigned(i) * CHUNK_SIZE;
+        c.buf = f->buf + off;
+        c.buf_len = (i + 1 == nchunks) ? f->buf_len - off : CHUNK_SIZE + 4;
+        c.addvalue = f->addvalue + off / 4; // as if filtered from f->buf
+        c.calls = c.lastcall = 0;
+        if (func(&c) != 0)
+            throwInternalError("chunked filter failed");
+    });
+    // merge the statistics
+    for (unsigned i = 0; i < nchunks; i++) {
+        f->calls += chunks[i].calls;
+        if (chunks[i].lastcall != 0)
+            f->lastcall = i * CHUNK_SIZE + chunks[i].lastcall;
+    }
+    return 0;
+}
+
 /*************************************************************************
 // get a FilterEntry
 **************************************************************************/
@@ -107,6 +147,8 @@ void Filter::init(int id_, unsigned addvalue_) noexcept {
 bool Filter::filter(SPAN_0(byte) xbuf, unsigned buf_len_) {
     byte *const buf_ = raw_bytes(xbuf, buf_len_);
     initFilter(this, buf_, buf_len_);
+    const bool known_adler = this->adler_is_known;
+    this->adler_is_known = false; // only valid for this call
 
     const FilterImpl::FilterEntry *const fe = FilterImpl::getFilter(id);
     if (fe == nullptr)
@@ -119,15 +161,20 @@ bool Filter::filter(SPAN_0(byte) xbuf, unsigned buf_len_) {
         return false;
     if (!fe->do_filter)
         throwInternalError("filter-2");
+    char trace_detail[8];
+    upx_safe_snprintf(trace_detail, sizeof(trace_detail), "0x%02x", fe->id);
+    upx::TraceScope trace_scope("filter", buf_len, trace_detail);
 
     // save checksum
-    this->adler = 0;
-    if (clevel != 1)
-        this->adler = upx_adler32(this->buf, this->buf_len);
+    if (!known_adler) {
+        this->adler = 0;
+        if (clevel != 1)
+            this->adler = upx_adler32(this->buf, this->buf_len);
+    }
 
     NO_printf("filter: %02x %p %d\n", this->id, this->buf, this->buf_len);
     // OutputFile::dump("filter.dat", buf, buf_len);
-    int r = (*fe->do_filter)(this);
+    int r = callFilterFunc(this, fe->do_filter);
     NO_printf("filter: %02x %d\n", fe->id, r);
     if (r > 0)
         throwFilterException();
@@ -151,9 +198,12 @@ void Filter::unfilter(SPAN_0(byte) xbuf, unsigned buf_len_, bool verify_checksum
         return;
     if (!fe->do_unfilter)
         throwInternalError("unfilter-2");
+    char trace_detail[8];
+    upx_safe_snprintf(trace_detail, sizeof(trace_detail), "0x%02x", fe->id);
+    upx::TraceScope trace_scope("unfilter", buf_len, trace_detail);
 
     NO_printf("unfilter: %02x %p %d\n", this->id, this->buf, this->buf_len);
-    int r = (*fe->do_unfilter)(this);
+    int r = callFilterFunc(this, fe->do_unfilter);
     NO_printf("unfilter: %02x %d\n", fe->id, r);
     if (r != 0)
         throwInternalError("unfilter-3");
@@ -201,7 +251,7 @@ bool Filter::scan(SPAN_0(const byte) xbuf, unsigned buf_len_) {
         throwInternalError("scan-2");
 
     NO_printf("filter: %02x %p %d\n", this->id, this->buf, this->buf_len);
-    int r = (*fe->do_scan)(this);
+    int r = callFilterFunc(this, fe->do_scan);
     NO_printf("filter: %02x %d\n", fe->id, r);
     if (r > 0)
         throwFilterException();
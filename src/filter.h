@@ -66,6 +66,10 @@ public:
     // Checksum of the buffer before applying the filter
     // or after un-applying the filter.
     unsigned adler;
+    // If set then the next filter() takes "adler" as the checksum of its
+    // buffer instead of computing it; this is about the buffer and not
+    // the filter, so init() keeps it. Cleared by every filter().
+    bool adler_is_known = false;
 
     // Input parameters used by various filters.
     unsigned addvalue;
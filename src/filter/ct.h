@@ -29,126 +29,127 @@
 // 16-bit calltrick ("naive")
 **************************************************************************/
 
-#define CT16(f, cond, addvalue, get, set)                                                          \
-    byte *b = f->buf;                                                                              \
+#define CT16(f, cond, delta, get, set)                                                             \
+    byte *const buf = f->buf;                                                                      \
+    const unsigned addvalue = f->addvalue;                                                         \
+    UNUSED(addvalue); /* "scan" does not use it */                                                 \
+    unsigned calls = f->calls, lastcall = f->lastcall;                                             \
+    byte *b = buf;                                                                                 \
     byte *b_end = b + f->buf_len - 3;                                                              \
     do {                                                                                           \
+        b = find_e8e9(b, b_end); /* cond implies 0xe8 or 0xe9 */                                   \
+        if (b == b_end)                                                                            \
+            break;                                                                                 \
         if (cond) {                                                                                \
             b += 1;                                                                                \
-            unsigned a = (unsigned) (b - f->buf);                                                  \
-            f->lastcall = a;                                                                       \
-            set(b, get(b) + (addvalue));                                                           \
-            f->calls++;                                                                            \
+            unsigned a = (unsigned) (b - buf);                                                     \
+            lastcall = a;                                                                          \
+            set(b, get(b) + (delta));                                                              \
+            calls++;                                                                               \
             b += 2 - 1;                                                                            \
         }                                                                                          \
     } while (++b < b_end);                                                                         \
-    if (f->lastcall)                                                                               \
-        f->lastcall += 2;                                                                          \
+    if (lastcall)                                                                                  \
+        lastcall += 2;                                                                             \
+    f->calls = calls;                                                                              \
+    f->lastcall = lastcall;                                                                        \
     return 0;
 
 // filter: e8, e9, e8e9
-static int f_ct16_e8(Filter *f) { CT16(f, (*b == 0xe8), a + f->addvalue, get_le16, set_le16) }
+static int f_ct16_e8(Filter *f) { CT16(f, (*b == 0xe8), a + addvalue, get_le16, set_le16) }
 
-static int f_ct16_e9(Filter *f) { CT16(f, (*b == 0xe9), a + f->addvalue, get_le16, set_le16) }
+static int f_ct16_e9(Filter *f) { CT16(f, (*b == 0xe9), a + addvalue, get_le16, set_le16) }
 
 static int f_ct16_e8e9(Filter *f) {
-    CT16(f, (*b == 0xe8 || *b == 0xe9), a + f->addvalue, get_le16, set_le16)
+    CT16(f, (*b == 0xe8 || *b == 0xe9), a + addvalue, get_le16, set_le16)
 }
 
 // unfilter: e8, e9, e8e9
-static int u_ct16_e8(Filter *f) { CT16(f, (*b == 0xe8), 0 - a - f->addvalue, get_le16, set_le16) }
+static int u_ct16_e8(Filter *f) { CT16(f, (*b == 0xe8), 0 - a - addvalue, get_le16, set_le16) }
 
-static int u_ct16_e9(Filter *f) { CT16(f, (*b == 0xe9), 0 - a - f->addvalue, get_le16, set_le16) }
+static int u_ct16_e9(Filter *f) { CT16(f, (*b == 0xe9), 0 - a - addvalue, get_le16, set_le16) }
 
 static int u_ct16_e8e9(Filter *f) {
-    CT16(f, (*b == 0xe8 || *b == 0xe9), 0 - a - f->addvalue, get_le16, set_le16)
+    CT16(f, (*b == 0xe8 || *b == 0xe9), 0 - a - addvalue, get_le16, set_le16)
 }
 
 // scan: e8, e9, e8e9
-static int s_ct16_e8(Filter *f) { CT16(f, (*b == 0xe8), a + f->addvalue, get_le16, set_dummy) }
+static int s_ct16_e8(Filter *f) { CT16(f, (*b == 0xe8), a + addvalue, get_le16, set_dummy) }
 
-static int s_ct16_e9(Filter *f) { CT16(f, (*b == 0xe9), a + f->addvalue, get_le16, set_dummy) }
+static int s_ct16_e9(Filter *f) { CT16(f, (*b == 0xe9), a + addvalue, get_le16, set_dummy) }
 
 static int s_ct16_e8e9(Filter *f) {
-    CT16(f, (*b == 0xe8 || *b == 0xe9), a + f->addvalue, get_le16, set_dummy)
+    CT16(f, (*b == 0xe8 || *b == 0xe9), a + addvalue, get_le16, set_dummy)
 }
 
 // filter: e8, e9, e8e9 with bswap le->be
-static int f_ct16_e8_bswap_le(Filter *f) {
-    CT16(f, (*b == 0xe8), a + f->addvalue, get_le16, set_be16)
-}
+static int f_ct16_e8_bswap_le(Filter *f) { CT16(f, (*b == 0xe8), a + addvalue, get_le16, set_be16) }
 
-static int f_ct16_e9_bswap_le(Filter *f) {
-    CT16(f, (*b == 0xe9), a + f->addvalue, get_le16, set_be16)
-}
+static int f_ct16_e9_bswap_le(Filter *f) { CT16(f, (*b == 0xe9), a + addvalue, get_le16, set_be16) }
 
 static int f_ct16_e8e9_bswap_le(Filter *f) {
-    CT16(f, (*b == 0xe8 || *b == 0xe9), a + f->addvalue, get_le16, set_be16)
+    CT16(f, (*b == 0xe8 || *b == 0xe9), a + addvalue, get_le16, set_be16)
 }
 
 // unfilter: e8, e9, e8e9 with bswap le->be
 static int u_ct16_e8_bswap_le(Filter *f) {
-    CT16(f, (*b == 0xe8), 0 - a - f->addvalue, get_be16, set_le16)
+    CT16(f, (*b == 0xe8), 0 - a - addvalue, get_be16, set_le16)
 }
 
 static int u_ct16_e9_bswap_le(Filter *f) {
-    CT16(f, (*b == 0xe9), 0 - a - f->addvalue, get_be16, set_le16)
+    CT16(f, (*b == 0xe9), 0 - a - addvalue, get_be16, set_le16)
 }
 
 static int u_ct16_e8e9_bswap_le(Filter *f) {
-    CT16(f, (*b == 0xe8 || *b == 0xe9), 0 - a - f->addvalue, get_be16, set_le16)
+    CT16(f, (*b == 0xe8 || *b == 0xe9), 0 - a - addvalue, get_be16, set_le16)
 }
 
 // scan: e8, e9, e8e9 with bswap le->be
 static int s_ct16_e8_bswap_le(Filter *f) {
-    CT16(f, (*b == 0xe8), a + f->addvalue, get_be16, set_dummy)
+    CT16(f, (*b == 0xe8), a + addvalue, get_be16, set_dummy)
 }
 
 static int s_ct16_e9_bswap_le(Filter *f) {
-    CT16(f, (*b == 0xe9), a + f->addvalue, get_be16, set_dummy)
+    CT16(f, (*b == 0xe9), a + addvalue, get_be16, set_dummy)
 }
 
 static int s_ct16_e8e9_bswap_le(Filter *f) {
-    CT16(f, (*b == 0xe8 || *b == 0xe9), a + f->addvalue, get_be16, set_dummy)
+    CT16(f, (*b == 0xe8 || *b == 0xe9), a + addvalue, get_be16, set_dummy)
 }
 
 // filter: e8, e9, e8e9 with bswap be->le
-static int f_ct16_e8_bswap_be(Filter *f) {
-    CT16(f, (*b == 0xe8), a + f->addvalue, get_be16, set_le16)
-}
+static int f_ct16_e8_bswap_be(Filter *f) { CT16(f, (*b == 0xe8), a + addvalue, get_be16, set_le16) }
 
-static int f_ct16_e9_bswap_be(Filter *f) {
-    CT16(f, (*b == 0xe9), a + f->addvalue, get_be16, set_le16)
-}
+static int f_ct16_e9_bswap_be(Filter *f) { CT16(f, (*b == 0xe9), a + addvalue, get_be16, set_le16) }
 
 static int f_ct16_e8e9_bswap_be(Filter *f) {
-    CT16(f, (*b == 0xe8 || *b == 0xe9), a + f->addvalue, get_be16, set_le16)
+    CT16(f, (*b == 0xe8 || *b == 0xe9), a + addvalue, get_be16, set_le16)
 }
 
 // unfilter: e8, e9, e8e9 with bswap be->le
 static int u_ct16_e8_bswap_be(Filter *f) {
-    CT16(f, (*b == 0xe8), 0 - a - f->addvalue, get_le16, set_be16)
+    CT16(f, (*b == 0xe8), 0 - a - addvalue, get_le16, set_be16)
 }
 
 static int u_ct16_e9_bswap_be(Filter *f) {
-    CT16(f, (*b == 0xe9), 0 - a - f->addvalue, get_le16, set_be16)
+    CT16(f, (*b == 0xe9), 0 - a - addvalue, get_le16, set_be16)
 }
 
 static int u_ct16_e8e9_bswap_be(Filter *f) {
-    CT16(f, (*b == 0xe8 || *b == 0xe9), 0 - a - f->addvalue, get_le16, set_be16)
+    CT16(f, (*b == 0xe8 || *b == 0xe9), 0 - a - addvalue, get_le16, set_be16)
 }
 
 // scan: e8, e9, e8e9 with bswap be->le
 static int s_ct16_e8_bswap_be(Filter *f) {
-    CT16(f, (*b == 0xe8), a + f->addvalue, get_le16, set_dummy)
+    CT16(f, (*b == 0xe8), a + addvalue, get_le16, set_dummy)
 }
 
 static int s_ct16_e9_bswap_be(Filter *f) {
-    CT16(f, (*b == 0xe9), a + f->addvalue, get_le16, set_dummy)
+    CT16(f, (*b == 0xe9), a + addvalue, get_le16, set_dummy)
 }
 
 static int s_ct16_e8e9_bswap_be(Filter *f) {
-    CT16(f, (*b == 0xe8 || *b == 0xe9), a + f->addvalue, get_le16, set_dummy)
+    CT16(f, (*b == 0xe8 || *b == 0xe9), a + addvalue, get_le16, set_dummy)
 }
 
 #undef CT16
@@ -157,126 +158,127 @@ static int s_ct16_e8e9_bswap_be(Filter *f) {
 // 32-bit calltrick ("naive")
 **************************************************************************/
 
-#define CT32(f, cond, addvalue, get, set)                                                          \
-    byte *b = f->buf;                                                                              \
+#define CT32(f, cond, delta, get, set)                                                             \
+    byte *const buf = f->buf;                                                                      \
+    const unsigned addvalue = f->addvalue;                                                         \
+    UNUSED(addvalue); /* "scan" does not use it */                                                 \
+    unsigned calls = f->calls, lastcall = f->lastcall;                                             \
+    byte *b = buf;                                                                                 \
     byte *b_end = b + f->buf_len - 5;                                                              \
     do {                                                                                           \
+        b = find_e8e9(b, b_end); /* cond implies 0xe8 or 0xe9 */                                   \
+        if (b == b_end)                                                                            \
+            break;                                                                                 \
         if (cond) {                                                                                \
             b += 1;                                                                                \
-            unsigned a = (unsigned) (b - f->buf);                                                  \
-            f->lastcall = a;                                                                       \
-            set(b, get(b) + (addvalue));                                                           \
-            f->calls++;                                                                            \
+            unsigned a = (unsigned) (b - buf);                                                     \
+            lastcall = a;                                                                          \
+            set(b, get(b) + (delta));                                                              \
+            calls++;                                                                               \
             b += 4 - 1;                                                                            \
         }                                                                                          \
     } while (++b < b_end);                                                                         \
-    if (f->lastcall)                                                                               \
-        f->lastcall += 4;                                                                          \
+    if (lastcall)                                                                                  \
+        lastcall += 4;                                                                             \
+    f->calls = calls;                                                                              \
+    f->lastcall = lastcall;                                                                        \
     return 0;
 
 // filter: e8, e9, e8e9
-static int f_ct32_e8(Filter *f) { CT32(f, (*b == 0xe8), a + f->addvalue, get_le32, set_le32) }
+static int f_ct32_e8(Filter *f) { CT32(f, (*b == 0xe8), a + addvalue, get_le32, set_le32) }
 
-static int f_ct32_e9(Filter *f) { CT32(f, (*b == 0xe9), a + f->addvalue, get_le32, set_le32) }
+static int f_ct32_e9(Filter *f) { CT32(f, (*b == 0xe9), a + addvalue, get_le32, set_le32) }
 
 static int f_ct32_e8e9(Filter *f) {
-    CT32(f, (*b == 0xe8 || *b == 0xe9), a + f->addvalue, get_le32, set_le32)
+    CT32(f, (*b == 0xe8 || *b == 0xe9), a + addvalue, get_le32, set_le32)
 }
 
 // unfilter: e8, e9, e8e9
-static int u_ct32_e8(Filter *f) { CT32(f, (*b == 0xe8), 0 - a - f->addvalue, get_le32, set_le32) }
+static int u_ct32_e8(Filter *f) { CT32(f, (*b == 0xe8), 0 - a - addvalue, get_le32, set_le32) }
 
-static int u_ct32_e9(Filter *f) { CT32(f, (*b == 0xe9), 0 - a - f->addvalue, get_le32, set_le32) }
+static int u_ct32_e9(Filter *f) { CT32(f, (*b == 0xe9), 0 - a - addvalue, get_le32, set_le32) }
 
 static int u_ct32_e8e9(Filter *f) {
-    CT32(f, (*b == 0xe8 || *b == 0xe9), 0 - a - f->addvalue, get_le32, set_le32)
+    CT32(f, (*b == 0xe8 || *b == 0xe9), 0 - a - addvalue, get_le32, set_le32)
 }
 
 // scan: e8, e9, e8e9
-static int s_ct32_e8(Filter *f) { CT32(f, (*b == 0xe8), a + f->addvalue, get_le32, set_dummy) }
+static int s_ct32_e8(Filter *f) { CT32(f, (*b == 0xe8), a + addvalue, get_le32, set_dummy) }
 
-static int s_ct32_e9(Filter *f) { CT32(f, (*b == 0xe9), a + f->addvalue, get_le32, set_dummy) }
+static int s_ct32_e9(Filter *f) { CT32(f, (*b == 0xe9), a + addvalue, get_le32, set_dummy) }
 
 static int s_ct32_e8e9(Filter *f) {
-    CT32(f, (*b == 0xe8 || *b == 0xe9), a + f->addvalue, get_le32, set_dummy)
+    CT32(f, (*b == 0xe8 || *b == 0xe9), a + addvalue, get_le32, set_dummy)
 }
 
 // filter: e8, e9, e8e9 with bswap le->be
-static int f_ct32_e8_bswap_le(Filter *f) {
-    CT32(f, (*b == 0xe8), a + f->addvalue, get_le32, set_be32)
-}
+static int f_ct32_e8_bswap_le(Filter *f) { CT32(f, (*b == 0xe8), a + addvalue, get_le32, set_be32) }
 
-static int f_ct32_e9_bswap_le(Filter *f) {
-    CT32(f, (*b == 0xe9), a + f->addvalue, get_le32, set_be32)
-}
+static int f_ct32_e9_bswap_le(Filter *f) { CT32(f, (*b == 0xe9), a + addvalue, get_le32, set_be32) }
 
 static int f_ct32_e8e9_bswap_le(Filter *f) {
-    CT32(f, (*b == 0xe8 || *b == 0xe9), a + f->addvalue, get_le32, set_be32)
+    CT32(f, (*b == 0xe8 || *b == 0xe9), a + addvalue, get_le32, set_be32)
 }
 
 // unfilter: e8, e9, e8e9 with bswap le->be
 static int u_ct32_e8_bswap_le(Filter *f) {
-    CT32(f, (*b == 0xe8), 0 - a - f->addvalue, get_be32, set_le32)
+    CT32(f, (*b == 0xe8), 0 - a - addvalue, get_be32, set_le32)
 }
 
 static int u_ct32_e9_bswap_le(Filter *f) {
-    CT32(f, (*b == 0xe9), 0 - a - f->addvalue, get_be32, set_le32)
+    CT32(f, (*b == 0xe9), 0 - a - addvalue, get_be32, set_le32)
 }
 
 static int u_ct32_e8e9_bswap_le(Filter *f) {
-    CT32(f, (*b == 0xe8 || *b == 0xe9), 0 - a - f->addvalue, get_be32, set_le32)
+    CT32(f, (*b == 0xe8 || *b == 0xe9), 0 - a - addvalue, get_be32, set_le32)
 }
 
 // scan: e8, e9, e8e9 with bswap le->be
 static int s_ct32_e8_bswap_le(Filter *f) {
-    CT32(f, (*b == 0xe8), a + f->addvalue, get_be32, set_dummy)
+    CT32(f, (*b == 0xe8), a + addvalue, get_be32, set_dummy)
 }
 
 static int s_ct32_e9_bswap_le(Filter *f) {
-    CT32(f, (*b == 0xe9), a + f->addvalue, get_be32, set_dummy)
+    CT32(f, (*b == 0xe9), a + addvalue, get_be32, set_dummy)
 }
 
 static int s_ct32_e8e9_bswap_le(Filter *f) {
-    CT32(f, (*b == 0xe8 || *b == 0xe9), a + f->addvalue, get_be32, set_dummy)
+    CT32(f, (*b == 0xe8 || *b == 0xe9), a + addvalue, get_be32, set_dummy)
 }
 
 // filter: e8, e9, e8e9 with bswap be->le
-static int f_ct32_e8_bswap_be(Filter *f) {
-    CT32(f, (*b == 0xe8), a + f->addvalue, get_be32, set_le32)
-}
+static int f_ct32_e8_bswap_be(Filter *f) { CT32(f, (*b == 0xe8), a + addvalue, get_be32, set_le32) }
 
-static int f_ct32_e9_bswap_be(Filter *f) {
-    CT32(f, (*b == 0xe9), a + f->addvalue, get_be32, set_le32)
-}
+static int f_ct32_e9_bswap_be(Filter *f) { CT32(f, (*b == 0xe9), a + addvalue, get_be32, set_le32) }
 
 static int f_ct32_e8e9_bswap_be(Filter *f) {
-    CT32(f, (*b == 0xe8 || *b == 0xe9), a + f->addvalue, get_be32, set_le32)
+    CT32(f, (*b == 0xe8 || *b == 0xe9), a + addvalue, get_be32, set_le32)
 }
 
 // unfilter: e8, e9, e8e9 with bswap be->le
 static int u_ct32_e8_bswap_be(Filter *f) {
-    CT32(f, (*b == 0xe8), 0 - a - f->addvalue, get_le32, set_be32)
+    CT32(f, (*b == 0xe8), 0 - a - addvalue, get_le32, set_be32)
 }
 
 static int u_ct32_e9_bswap_be(Filter *f) {
-    CT32(f, (*b == 0xe9), 0 - a - f->addvalue, get_le32, set_be32)
+    CT32(f, (*b == 0xe9), 0 - a - addvalue, get_le32, set_be32)
 }
 
 static int u_ct32_e8e9_bswap_be(Filter *f) {
-    CT32(f, (*b == 0xe8 || *b == 0xe9), 0 - a - f->addvalue, get_le32, set_be32)
+    CT32(f, (*b == 0xe8 || *b == 0xe9), 0 - a - addvalue, get_le32, set_be32)
 }
 
 // scan: e8, e9, e8e9 with bswap be->le
 static int s_ct32_e8_bswap_be(Filter *f) {
-    CT32(f, (*b == 0xe8), a + f->addvalue, get_le32, set_dummy)
+    CT32(f, (*b == 0xe8), a + addvalue, get_le32, set_dummy)
 }
 
 static int s_ct32_e9_bswap_be(Filter *f) {
-    CT32(f, (*b == 0xe9), a + f->addvalue, get_le32, set_dummy)
+    CT32(f, (*b == 0xe9), a + addvalue, get_le32, set_dummy)
 }
 
 static int s_ct32_e8e9_bswap_be(Filter *f) {
-    CT32(f, (*b == 0xe8 || *b == 0xe9), a + f->addvalue, get_le32, set_dummy)
+    CT32(f, (*b == 0xe8 || *b == 0xe9), a + addvalue, get_le32, set_dummy)
 }
 
 #undef CT32
@@ -285,66 +287,78 @@ static int s_ct32_e8e9_bswap_be(Filter *f) {
 // 24-bit ARM calltrick ("naive")
 **************************************************************************/
 
-#define CT24ARM_LE(f, cond, addvalue, get, set)                                                    \
-    byte *b = f->buf;                                                                              \
+#define CT24ARM_LE(f, cond, delta, get, set)                                                       \
+    byte *const buf = f->buf;                                                                      \
+    const unsigned addvalue = f->addvalue;                                                         \
+    UNUSED(addvalue); /* "scan" does not use it */                                                 \
+    unsigned calls = f->calls, lastcall = f->lastcall;                                             \
+    byte *b = buf;                                                                                 \
     byte *b_end = b + f->buf_len - 4;                                                              \
     do {                                                                                           \
         if (cond) {                                                                                \
-            unsigned a = (unsigned) (b - f->buf);                                                  \
-            f->lastcall = a;                                                                       \
-            set(b, get(b) + (addvalue));                                                           \
-            f->calls++;                                                                            \
+            unsigned a = (unsigned) (b - buf);                                                     \
+            lastcall = a;                                                                          \
+            set(b, get(b) + (delta));                                                              \
+            calls++;                                                                               \
         }                                                                                          \
         b += 4;                                                                                    \
     } while (b < b_end);                                                                           \
-    if (f->lastcall)                                                                               \
-        f->lastcall += 4;                                                                          \
+    if (lastcall)                                                                                  \
+        lastcall += 4;                                                                             \
+    f->calls = calls;                                                                              \
+    f->lastcall = lastcall;                                                                        \
     return 0;
 
 #define ARMCT_COND_le (((b[3] & 0x0f) == 0x0b))
 
 static int f_ct24arm_le(Filter *f) {
-    CT24ARM_LE(f, ARMCT_COND_le, a / 4 + f->addvalue, get_le24, set_le24)
+    CT24ARM_LE(f, ARMCT_COND_le, a / 4 + addvalue, get_le24, set_le24)
 }
 
 static int u_ct24arm_le(Filter *f) {
-    CT24ARM_LE(f, ARMCT_COND_le, 0 - a / 4 - f->addvalue, get_le24, set_le24)
+    CT24ARM_LE(f, ARMCT_COND_le, 0 - a / 4 - addvalue, get_le24, set_le24)
 }
 
 static int s_ct24arm_le(Filter *f) {
-    CT24ARM_LE(f, ARMCT_COND_le, a + f->addvalue, get_le24, set_dummy)
+    CT24ARM_LE(f, ARMCT_COND_le, a + addvalue, get_le24, set_dummy)
 }
 
 #undef CT24ARM_LE
 
-#define CT24ARM_BE(f, cond, addvalue, get, set)                                                    \
-    byte *b = f->buf;                                                                              \
+#define CT24ARM_BE(f, cond, delta, get, set)                                                       \
+    byte *const buf = f->buf;                                                                      \
+    const unsigned addvalue = f->addvalue;                                                         \
+    UNUSED(addvalue); /* "scan" does not use it */                                                 \
+    unsigned calls = f->calls, lastcall = f->lastcall;                                             \
+    byte *b = buf;                                                                                 \
     byte *b_end = b + f->buf_len - 4;                                                              \
     do {                                                                                           \
         if (cond) {                                                                                \
-            unsigned a = (unsigned) (b - f->buf);                                                  \
-            f->lastcall = a;                                                                       \
-            set(1 + b, get(1 + b) + (addvalue));                                                   \
-            f->calls++;                                                                            \
+            unsigned a = (unsigned) (b - buf);                                                     \
+            lastcall = a;                                                                          \
+            set(1 + b, get(1 + b) + (delta));                                                      \
+            calls++;                                                                               \
         }                                                                                          \
         b += 4;                                                                                    \
     } while (b < b_end);                                                                           \
-    if (f->lastcall)                                                                               \
-        f->lastcall += 4;                                                                          \
+    if (lastcall)                                                                                  \
+        lastcall += 4;                                                                             \
+    f->calls = calls;                                                                              \
+    f->lastcall = lastcall;                                                                        \
     return 0;
 
 #define ARMCT_COND_be (((b[0] & 0x0f) == 0x0b))
 
 static int f_ct24arm_be(Filter *f) {
-    CT24ARM_BE(f, ARMCT_COND_be, a / 4 + f->addvalue, get_be24, set_be24)
+    CT24ARM_BE(f, ARMCT_COND_be, a / 4 + addvalue, get_be24, set_be24)
 }
 
 static int u_ct24arm_be(Filter *f) {
-    CT24ARM_BE(f, ARMCT_COND_be, 0 - a / 4 - f->addvalue, get_be24, set_be24)
+    CT24ARM_BE(f, ARMCT_COND_be, 0 - a / 4 - addvalue, get_be24, set_be24)
 }
 
 static int s_ct24arm_be(Filter *f) {
-    CT24ARM_BE(f, ARMCT_COND_be, a + f->addvalue, get_be24, set_dummy)
+    CT24ARM_BE(f, ARMCT_COND_be, a + addvalue, get_be24, set_dummy)
 }
 
 #undef CT24ARM_BE
@@ -355,35 +369,39 @@ static int s_ct24arm_be(Filter *f) {
 **************************************************************************/
 
 #if 1 //{ old reliable
-#define CT26ARM_LE(f, cond, addvalue, get, set)                                                    \
-    byte *b = f->buf;                                                                              \
+#define CT26ARM_LE(f, cond, delta, get, set)                                                       \
+    byte *const buf = f->buf;                                                                      \
+    const unsigned addvalue = f->addvalue;                                                         \
+    UNUSED(addvalue); /* "scan" does not use it */                                                 \
+    unsigned calls = f->calls, lastcall = f->lastcall;                                             \
+    byte *b = buf;                                                                                 \
     byte *b_end = b + f->buf_len - 4;                                                              \
     do {                                                                                           \
         if (cond) {                                                                                \
-            unsigned a = (unsigned) (b - f->buf);                                                  \
-            f->lastcall = a;                                                                       \
-            set(b, get(b) + (addvalue));                                                           \
-            f->calls++;                                                                            \
+            unsigned a = (unsigned) (b - buf);                                                     \
+            lastcall = a;                                                                          \
+            set(b, get(b) + (delta));                                                              \
+            calls++;                                                                               \
         }                                                                                          \
         b += 4;                                                                                    \
     } while (b < b_end);                                                                           \
-    if (f->lastcall)                                                                               \
-        f->lastcall += 4;                                                                          \
+    if (lastcall)                                                                                  \
+        lastcall += 4;                                                                             \
+    f->calls = calls;                                                                              \
+    f->lastcall = lastcall;                                                                        \
     return 0;
 
 #define ARMCT_COND (((b[3] & 0x7C) == 0x14))
 
 static int f_ct26arm_le(Filter *f) {
-    CT26ARM_LE(f, ARMCT_COND, a / 4 + f->addvalue, get_le26, set_le26)
+    CT26ARM_LE(f, ARMCT_COND, a / 4 + addvalue, get_le26, set_le26)
 }
 
 static int u_ct26arm_le(Filter *f) {
-    CT26ARM_LE(f, ARMCT_COND, 0 - a / 4 - f->addvalue, get_le26, set_le26)
+    CT26ARM_LE(f, ARMCT_COND, 0 - a / 4 - addvalue, get_le26, set_le26)
 }
 
-static int s_ct26arm_le(Filter *f) {
-    CT26ARM_LE(f, ARMCT_COND, a + f->addvalue, get_le26, set_dummy)
-}
+static int s_ct26arm_le(Filter *f) { CT26ARM_LE(f, ARMCT_COND, a + addvalue, get_le26, set_dummy) }
 
 #else //}{ new enhanced but DIFFERENT; need new filter type!
 
@@ -129,21 +129,26 @@ static int U(Filter *f) {
     byte *b = f->buf;
     const unsigned size5 = f->buf_len - 5;
     const unsigned addvalue = f->addvalue;
-    const unsigned cto = (unsigned) f->cto << 24;
-    //    unsigned lastcall = 0;    // lastcall is not used in COND macro
+    const unsigned char cto8 = f->cto;
+    const unsigned cto = (unsigned) cto8 << 24;
+    // keep the counters in registers; the stores into b[] might alias *f
+    unsigned calls = f->calls, noncalls = f->noncalls, lastcall = f->lastcall;
     unsigned ic, jc;
 
     for (ic = 0; ic < size5; ic++)
         if (COND(b, ic, lastcall)) {
             jc = get_be32(b + ic + 1);
-            if (b[ic + 1] == f->cto) {
+            if (b[ic + 1] == cto8) {
                 set_le32(b + ic + 1, jc - ic - 1 - addvalue - cto);
-                f->calls++;
+                calls++;
                 ic += 4;
-                f->lastcall = ic + 1;
+                lastcall = ic + 1;
             } else
-                f->noncalls++;
+                noncalls++;
         }
+    f->calls = calls;
+    f->noncalls = noncalls;
+    f->lastcall = lastcall;
     return 0;
 }
 #endif
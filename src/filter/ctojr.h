@@ -73,6 +73,35 @@ static void update_mru(const unsigned jc,   // destination address
     }
     mru[hand] = jc;
 }
+
+// Return the smallest k such that mru[(hand + k) % N_MRU] == jc, or N_MRU
+// if jc is not in mru[]. Same as the linear search from mru[hand], but
+// all slots are compared at once and the hit is found in a bit mask.
+static forceinline int find_mru(const unsigned jc, const unsigned mru[N_MRU], const int hand) {
+    static_assert(N_MRU == 32); // one bit per slot
+    upx_uint32_t m = 0;         // bit kh is set if mru[kh] == jc
+#if (defined(__SSE2__) || defined(_M_X64)) && (ACC_ARCH_AMD64 || ACC_ARCH_I386)
+    const __m128i key = _mm_set1_epi32((int) jc);
+    for (int i = 0; i < N_MRU; i += 4) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (const void *) &mru[i]);
+        m |= (upx_uint32_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, key))) << i;
+    }
+#else
+    for (int i = 0; i < N_MRU; i++)
+        m |= upx_uint32_t(mru[i] == jc) << i;
+#endif
+    if (m == 0)
+        return N_MRU;
+    m = (m >> hand) | (m << ((N_MRU - hand) & 31)); // now bit k is slot hand + k
+#if defined(__GNUC__)
+    return __builtin_ctz(m);
+#else
+    int k = 0;
+    for (; !(m & 1); m >>= 1)
+        k++;
+    return k;
+#endif
+}
 #endif //}
 
 static int F(Filter *f) {
@@ -152,19 +181,15 @@ static int F(Filter *f) {
                 // Recode the destination: narrower mru indices
                 // should compress better than wider addresses.
                 // (But not when offset of match is unlimited?)
-                int k;
-                for (k = 0; k < N_MRU; ++k) {
+                const int k = find_mru(jc, mru, hand);
+                if (k < N_MRU) { // destination was seen recently
                     int kh = hand + k;
                     if (N_MRU <= kh) {
                         kh -= N_MRU;
                     }
-                    if (mru[kh] == jc) { // destination was seen recently
-                        set_be32(b + ic + 1, ((k << 1) | 0) + cto);
-                        update_mru(jc, kh, mru, hand, tail);
-                        break;
-                    }
-                }
-                if (k == N_MRU) { // loop failed; jc is not in mru[]
+                    set_be32(b + ic + 1, ((k << 1) | 0) + cto);
+                    update_mru(jc, kh, mru, hand, tail);
+                } else { // jc is not in mru[]
                     set_be32(b + ic + 1, ((jc << 1) | 1) + cto);
                     // Adaptively remember recent destinations.
                     if (0 > --hand) {
@@ -236,8 +261,11 @@ static int U(Filter *f) {
 
     byte *const b = f->buf;
     const unsigned size5 = f->buf_len - 5;
-    const unsigned cto = (unsigned) f->cto << 24;
+    const unsigned char cto8 = f->cto;
+    const unsigned cto = (unsigned) cto8 << 24;
     unsigned lastcall = 0;
+    // keep the counters in registers; the stores into b[] might alias *f
+    unsigned calls = f->calls, noncalls = f->noncalls;
     int hand = 0, tail = 0;
     const unsigned f_call = f80_call(f);
     const unsigned f_jmp1 = f80_jmp1(f);
@@ -251,7 +279,7 @@ static int U(Filter *f) {
         if (CONDU(which, b, ic, lastcall)) {
             unsigned f_on = 0;
             jc = get_be32(b + ic + 1) - cto;
-            if (b[ic + 1] == f->cto) {
+            if (b[ic + 1] == cto8) {
                 if ((0 == which && MRUFLT == f_call) || (1 == which && MRUFLT == f_jmp1) ||
                     (2 == which && MRUFLT == f_jcc2)) {
                     f_on = 1;
@@ -287,14 +315,18 @@ static int U(Filter *f) {
                 }
 
                 if (f_on) {
-                    f->calls++;
+                    calls++;
                     ic += 4;
-                    f->lastcall = lastcall = ic + 1;
+                    lastcall = ic + 1;
                 }
             } else
-                f->noncalls++;
+                noncalls++;
         }
     }
+    f->calls = calls;
+    f->noncalls = noncalls;
+    if (lastcall != 0) // else unchanged
+        f->lastcall = lastcall;
     return 0;
 }
 #endif
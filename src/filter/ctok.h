@@ -130,23 +130,30 @@ static int U(Filter *f) {
     byte *b = f->buf;
     const unsigned size5 = f->buf_len - 5;
     const unsigned addvalue = f->addvalue;
-    const unsigned cto = (unsigned) f->cto << 24;
+    const unsigned char cto8 = f->cto;
+    const unsigned cto = (unsigned) cto8 << 24;
     const unsigned id = f->id;
     unsigned lastcall = 0;
+    // keep the counters in registers; the stores into b[] might alias *f
+    unsigned calls = f->calls, noncalls = f->noncalls;
 
     unsigned ic, jc;
 
     for (ic = 0; ic < size5; ic++)
         if (COND(b, ic, lastcall, id)) {
             jc = get_be32(b + ic + 1);
-            if (b[ic + 1] == f->cto) {
+            if (b[ic + 1] == cto8) {
                 set_le32(b + ic + 1, jc - ic - 1 - addvalue - cto);
-                f->calls++;
+                calls++;
                 ic += 4;
-                f->lastcall = lastcall = ic + 1;
+                lastcall = ic + 1;
             } else
-                f->noncalls++;
+                noncalls++;
         }
+    f->calls = calls;
+    f->noncalls = noncalls;
+    if (lastcall != 0) // else unchanged
+        f->lastcall = lastcall;
     return 0;
 }
 #endif
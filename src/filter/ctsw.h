@@ -29,55 +29,61 @@
 // 16-bit call-/swaptrick ("naive")
 **************************************************************************/
 
-#define CTSW16(f, cond1, cond2, addvalue, get, set)                                                \
-    byte *b = f->buf;                                                                              \
+#define CTSW16(f, cond1, cond2, delta, get, set)                                                   \
+    byte *const buf = f->buf;                                                                      \
+    const unsigned addvalue = f->addvalue;                                                         \
+    UNUSED(addvalue); /* "scan" does not use it */                                                 \
+    unsigned calls = f->calls, lastcall = f->lastcall;                                             \
+    byte *b = buf;                                                                                 \
     byte *b_end = b + f->buf_len - 3;                                                              \
     do {                                                                                           \
         if (cond1) {                                                                               \
             b += 1;                                                                                \
-            unsigned a = (unsigned) (b - f->buf);                                                  \
-            f->lastcall = a;                                                                       \
-            set(b, get(b) + (addvalue));                                                           \
-            f->calls++;                                                                            \
+            unsigned a = (unsigned) (b - buf);                                                     \
+            lastcall = a;                                                                          \
+            set(b, get(b) + (delta));                                                              \
+            calls++;                                                                               \
             b += 2 - 1;                                                                            \
         } else if (cond2) {                                                                        \
             b += 1;                                                                                \
-            unsigned a = (unsigned) (b - f->buf);                                                  \
-            f->lastcall = a;                                                                       \
+            unsigned a = (unsigned) (b - buf);                                                     \
+            lastcall = a;                                                                          \
             set(b, get(b));                                                                        \
-            f->calls++;                                                                            \
+            calls++;                                                                               \
             b += 2 - 1;                                                                            \
         }                                                                                          \
     } while (++b < b_end);                                                                         \
-    if (f->lastcall)                                                                               \
-        f->lastcall += 2;                                                                          \
+    if (lastcall)                                                                                  \
+        lastcall += 2;                                                                             \
+    f->calls = calls;                                                                              \
+    f->lastcall = lastcall;                                                                        \
     return 0;
 
 // filter
 static int f_ctsw16_e8_e9(Filter *f) {
-    CTSW16(f, (*b == 0xe8), (*b == 0xe9), a + f->addvalue, get_le16, set_be16)
+    CTSW16(f, (*b == 0xe8), (*b == 0xe9), a + addvalue, get_le16, set_be16)
 }
 
 static int f_ctsw16_e9_e8(Filter *f) {
-    CTSW16(f, (*b == 0xe9), (*b == 0xe8), a + f->addvalue, get_le16, set_be16)
+    CTSW16(f, (*b == 0xe9), (*b == 0xe8), a + addvalue, get_le16, set_be16)
 }
 
 // unfilter
 static int u_ctsw16_e8_e9(Filter *f) {
-    CTSW16(f, (*b == 0xe8), (*b == 0xe9), 0 - a - f->addvalue, get_be16, set_le16)
+    CTSW16(f, (*b == 0xe8), (*b == 0xe9), 0 - a - addvalue, get_be16, set_le16)
 }
 
 static int u_ctsw16_e9_e8(Filter *f) {
-    CTSW16(f, (*b == 0xe9), (*b == 0xe8), 0 - a - f->addvalue, get_be16, set_le16)
+    CTSW16(f, (*b == 0xe9), (*b == 0xe8), 0 - a - addvalue, get_be16, set_le16)
 }
 
 // scan
 static int s_ctsw16_e8_e9(Filter *f) {
-    CTSW16(f, (*b == 0xe8), (*b == 0xe9), a + f->addvalue, get_le16, set_dummy)
+    CTSW16(f, (*b == 0xe8), (*b == 0xe9), a + addvalue, get_le16, set_dummy)
 }
 
 static int s_ctsw16_e9_e8(Filter *f) {
-    CTSW16(f, (*b == 0xe9), (*b == 0xe8), a + f->addvalue, get_le16, set_dummy)
+    CTSW16(f, (*b == 0xe9), (*b == 0xe8), a + addvalue, get_le16, set_dummy)
 }
 
 #undef CTSW16
@@ -86,55 +92,61 @@ static int s_ctsw16_e9_e8(Filter *f) {
 // 32-bit call-/swaptrick ("naive")
 **************************************************************************/
 
-#define CTSW32(f, cond1, cond2, addvalue, get, set)                                                \
-    byte *b = f->buf;                                                                              \
+#define CTSW32(f, cond1, cond2, delta, get, set)                                                   \
+    byte *const buf = f->buf;                                                                      \
+    const unsigned addvalue = f->addvalue;                                                         \
+    UNUSED(addvalue); /* "scan" does not use it */                                                 \
+    unsigned calls = f->calls, lastcall = f->lastcall;                                             \
+    byte *b = buf;                                                                                 \
     byte *b_end = b + f->buf_len - 5;                                                              \
     do {                                                                                           \
         if (cond1) {                                                                               \
             b += 1;                                                                                \
-            unsigned a = (unsigned) (b - f->buf);                                                  \
-            f->lastcall = a;                                                                       \
-            set(b, get(b) + (addvalue));                                                           \
-            f->calls++;                                                                            \
+            unsigned a = (unsigned) (b - buf);                                                     \
+            lastcall = a;                                                                          \
+            set(b, get(b) + (delta));                                                              \
+            calls++;                                                                               \
             b += 4 - 1;                                                                            \
         } else if (cond2) {                                                                        \
             b += 1;                                                                                \
-            unsigned a = (unsigned) (b - f->buf);                                                  \
-            f->lastcall = a;                                                                       \
+            unsigned a = (unsigned) (b - buf);                                                     \
+            lastcall = a;                                                                          \
             set(b, get(b));                                                                        \
-            f->calls++;                                                                            \
+            calls++;                                                                               \
             b += 4 - 1;                                                                            \
         }                                                                                          \
     } while (++b < b_end);                                                                         \
-    if (f->lastcall)                                                                               \
-        f->lastcall += 4;                                                                          \
+    if (lastcall)                                                                                  \
+        lastcall += 4;                                                                             \
+    f->calls = calls;                                                                              \
+    f->lastcall = lastcall;                                                                        \
     return 0;
 
 // filter
 static int f_ctsw32_e8_e9(Filter *f) {
-    CTSW32(f, (*b == 0xe8), (*b == 0xe9), a + f->addvalue, get_le32, set_be32)
+    CTSW32(f, (*b == 0xe8), (*b == 0xe9), a + addvalue, get_le32, set_be32)
 }
 
 static int f_ctsw32_e9_e8(Filter *f) {
-    CTSW32(f, (*b == 0xe9), (*b == 0xe8), a + f->addvalue, get_le32, set_be32)
+    CTSW32(f, (*b == 0xe9), (*b == 0xe8), a + addvalue, get_le32, set_be32)
 }
 
 // unfilter
 static int u_ctsw32_e8_e9(Filter *f) {
-    CTSW32(f, (*b == 0xe8), (*b == 0xe9), 0 - a - f->addvalue, get_be32, set_le32)
+    CTSW32(f, (*b == 0xe8), (*b == 0xe9), 0 - a - addvalue, get_be32, set_le32)
 }
 
 static int u_ctsw32_e9_e8(Filter *f) {
-    CTSW32(f, (*b == 0xe9), (*b == 0xe8), 0 - a - f->addvalue, get_be32, set_le32)
+    CTSW32(f, (*b == 0xe9), (*b == 0xe8), 0 - a - addvalue, get_be32, set_le32)
 }
 
 // scan
 static int s_ctsw32_e8_e9(Filter *f) {
-    CTSW32(f, (*b == 0xe8), (*b == 0xe9), a + f->addvalue, get_le32, set_dummy)
+    CTSW32(f, (*b == 0xe8), (*b == 0xe9), a + addvalue, get_le32, set_dummy)
 }
 
 static int s_ctsw32_e9_e8(Filter *f) {
-    CTSW32(f, (*b == 0xe9), (*b == 0xe8), a + f->addvalue, get_le32, set_dummy)
+    CTSW32(f, (*b == 0xe9), (*b == 0xe8), a + addvalue, get_le32, set_dummy)
 }
 
 #undef CTSW32
@@ -40,6 +40,38 @@ static unsigned umin(const unsigned a, const unsigned b) { return (a <= b) ? a :
 
 #include "getcto.h"
 
+// Return the first position p in [b, b_end) with *p == 0xe8 or *p == 0xe9,
+// or b_end. The calltrick loops use this to jump straight to the next
+// candidate opcode; the check of the actual condition stays in the loops.
+#if (defined(__SSE2__) || defined(_M_X64)) && (ACC_ARCH_AMD64 || ACC_ARCH_I386)
+#include <emmintrin.h>
+#endif
+
+static forceinline byte *find_e8e9(byte *b, byte *const b_end) {
+#if (defined(__SSE2__) || defined(_M_X64)) && (ACC_ARCH_AMD64 || ACC_ARCH_I386)
+    const __m128i mask = _mm_set1_epi8((char) 0xfe);
+    const __m128i e8 = _mm_set1_epi8((char) 0xe8);
+    while (b_end - b >= 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (const void *) b);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v, mask), e8)) != 0)
+            break; // the byte loop below finds it
+        b += 16;
+    }
+#else
+    while (b_end - b >= 8) {
+        // SWAR: is any byte of (w & 0xfe) equal to 0xe8?
+        const upx_uint64_t t = (get_le64(b) & 0xfefefefefefefefeull) ^ 0xe8e8e8e8e8e8e8e8ull;
+        if (((t - 0x0101010101010101ull) & ~t & 0x8080808080808080ull) != 0)
+            break; // the byte loop below finds it
+        b += 8;
+    }
+#endif
+    for (; b < b_end; b++)
+        if ((*b & 0xfe) == 0xe8)
+            return b;
+    return b_end;
+}
+
 /*************************************************************************
 // simple filters: calltrick / swaptrick / delta / ...
 **************************************************************************/
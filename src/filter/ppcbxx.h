@@ -125,21 +125,27 @@ static int U(Filter *f) {
     byte *b = f->buf;
     const unsigned size4 = umin(f->buf_len - 4, 0u - (~0u << (32 - (6 + W_CTO))));
     const unsigned addvalue = f->addvalue;
+    const unsigned cto = f->cto;
+    // keep the counters in registers; the stores into b[] might alias *f
+    unsigned calls = f->calls, noncalls = f->noncalls, lastcall = f->lastcall;
 
     unsigned ic;
 
     for (ic = 0; ic <= size4; ic += 4)
         if (COND(b, ic)) {
             unsigned const word = get_be32(b + ic);
-            if ((~(~0u << W_CTO) & (word >> (24 + 2 - W_CTO))) == (unsigned) f->cto) {
+            if ((~(~0u << W_CTO) & (word >> (24 + 2 - W_CTO))) == cto) {
                 unsigned const jc = word & (~(~0u << (26 - W_CTO)) & (~0u << 2));
                 set_be32(b + ic, (0xfc000003 & word) | (0x03fffffc & (jc - ic - addvalue)));
-                f->calls++;
-                f->lastcall = ic;
+                calls++;
+                lastcall = ic;
             } else {
-                f->noncalls++;
+                noncalls++;
             }
         }
+    f->calls = calls;
+    f->noncalls = noncalls;
+    f->lastcall = lastcall;
     return 0;
 }
 #endif
@@ -30,20 +30,24 @@
 **************************************************************************/
 
 #define SW16(f, cond, get, set)                                                                    \
-    byte *b = f->buf;                                                                              \
+    byte *const buf = f->buf;                                                                      \
+    unsigned calls = f->calls, lastcall = f->lastcall;                                             \
+    byte *b = buf;                                                                                 \
     byte *b_end = b + f->buf_len - 3;                                                              \
     do {                                                                                           \
         if (cond) {                                                                                \
             b += 1;                                                                                \
-            unsigned a = (unsigned) (b - f->buf);                                                  \
-            f->lastcall = a;                                                                       \
+            unsigned a = (unsigned) (b - buf);                                                     \
+            lastcall = a;                                                                          \
             set(b, get(b));                                                                        \
-            f->calls++;                                                                            \
+            calls++;                                                                               \
             b += 2 - 1;                                                                            \
         }                                                                                          \
     } while (++b < b_end);                                                                         \
-    if (f->lastcall)                                                                               \
-        f->lastcall += 2;                                                                          \
+    if (lastcall)                                                                                  \
+        lastcall += 2;                                                                             \
+    f->calls = calls;                                                                              \
+    f->lastcall = lastcall;                                                                        \
     return 0;
 
 // filter
@@ -74,20 +78,24 @@ static int s_sw16_e8e9(Filter *f) { SW16(f, (*b == 0xe8 || *b == 0xe9), get_le16
 **************************************************************************/
 
 #define SW32(f, cond, get, set)                                                                    \
-    byte *b = f->buf;                                                                              \
+    byte *const buf = f->buf;                                                                      \
+    unsigned calls = f->calls, lastcall = f->lastcall;                                             \
+    byte *b = buf;                                                                                 \
     byte *b_end = b + f->buf_len - 5;                                                              \
     do {                                                                                           \
         if (cond) {                                                                                \
             b += 1;                                                                                \
-            unsigned a = (unsigned) (b - f->buf);                                                  \
-            f->lastcall = a;                                                                       \
+            unsigned a = (unsigned) (b - buf);                                                     \
+            lastcall = a;                                                                          \
             set(b, get(b));                                                                        \
-            f->calls++;                                                                            \
+            calls++;                                                                               \
             b += 4 - 1;                                                                            \
         }                                                                                          \
     } while (++b < b_end);                                                                         \
-    if (f->lastcall)                                                                               \
-        f->lastcall += 4;                                                                          \
+    if (lastcall)                                                                                  \
+        lastcall += 4;                                                                             \
+    f->calls = calls;                                                                              \
+    f->lastcall = lastcall;                                                                        \
     return 0;
 
 // filter
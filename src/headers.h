@@ -113,8 +113,9 @@ static_assert(sizeof(void *) == 8);
 #include <type_traits>
 #include <utility>
 // C++ system headers
-#include <memory> // std::unique_ptr
-// C++ multithreading (UPX currently does not use multithreading)
+#include <algorithm> // std::sort, see upx_sort()
+#include <memory>    // std::unique_ptr
+// C++ multithreading (optional; see UPX_CONFIG_DISABLE_THREADS in CMakeLists.txt)
 #if __STDC_NO_ATOMICS__
 #undef WITH_THREADS
 #endif
@@ -28,6 +28,7 @@
 #define WANT_WINDOWS_LEAN_H 1 // _WIN32_WINNT
 #include "conf.h"
 #include "compress/compress.h" // upx_ucl_version_string()
+#include "util/cpu_features.h"  // upx::cpu_features_name()
 // for list_all_packers():
 #include "packer.h"
 #include "packmast.h" // PackMaster::visitAllPackers
@@ -176,7 +177,9 @@ void show_help(int verbose) {
                 "  -d     decompress                        -l    list compressed file\n"
                 "  -t     test compressed file              -V    display version number\n"
                 "  -h     give %s help                    -L    display software license\n%s",
-                verbose == 0 ? "" : "  --best compress best (can be slow for big files)\n",
+                verbose == 0 ? "" : "  --best compress best (can be slow for big files)\n"
+                                    "  --fast pack fastest (for development builds)\n"
+                                    "  --analyze  predict the packing result, write nothing\n",
                 verbose == 0 ? "more" : "this", verbose == 0 ? "" : "\n");
 
     fg = con_fg(f, FG_YELLOW);
@@ -187,12 +190,17 @@ void show_help(int verbose) {
                 "  -q     be quiet                          -v    be verbose\n"
                 "  -oFILE write output to 'FILE'\n"
                 "  -f     force compression of suspicious files\n"
-                "%s%s"
+                "%s%s%s"
                 , (verbose == 0) ? "  -k     keep backup files\n" : ""
 #if 1
                 , (verbose > 0) ? "  --no-color, --mono, --color, --no-progress   change look\n" : ""
 #else
                 , ""
+#endif
+#if WITH_THREADS
+                , (verbose > 0) ? "  --jobs=N   process N files in parallel [0 = use all CPUs]\n" : ""
+#else
+                , ""
 #endif
                 );
 
@@ -205,6 +213,34 @@ void show_help(int verbose) {
                     "  --lzma              try LZMA [slower but tighter than NRV]\n"
                     "  --brute             try all available compression methods & filters [slow]\n"
                     "  --ultra-brute       try even more compression variants [very slow]\n"
+                    "  --prune-trials=N    only fully try the N best candidates of a quick test\n"
+                    "  --time-budget=SECS  stop trying more methods & filters after SECS seconds\n"
+                    "  --nrv-parallel      faster multi-threaded NRV compression for --best\n"
+                    "  --optimize-for=startup  prefer faster decompression to the smallest file\n"
+                    "  --lzma-tune         choose the LZMA parameters from a sample of the data\n"
+                    "  --decision-cache    remember the best method & filter of identical data\n"
+                    "  --pack-cache        reuse the packed file of identical input & options\n"
+                    "  --upgrade           pack like --fast now, smaller file later [background]\n"
+                    "  --upgrade-wait      like --upgrade, but wait for the smaller file\n"
+                    "  --reuse-from=FILE   copy the unchanged blocks of an older packed FILE\n"
+                    "  --search-shard=I/N  only try part I of N of the methods & filters\n"
+                    "  --search-result=FILE  append the winners of this run to FILE\n"
+                    "  --search-merge=FILE   pack with the best winners of all shards in FILE\n"
+                    "  --benchmark         report size & speed of all methods; file is unchanged\n"
+                    "  --trace=FILE        write the time of all packing phases to FILE [JSON]\n"
+                    "  --metrics=FILE      write sizes & cost of every packed file to FILE [JSON]\n"
+                    "  --perf-counters     add cycles, cache & branch misses to --trace/--metrics\n"
+                    "  --tree DIR          process all executables below DIR [use with --jobs]\n"
+                    "  --tree-manifest=FILE  write what became of every file of --tree [JSON]\n"
+                    "  --explain-search=FILE  write every method & filter tried to FILE [JSON]\n"
+                    "  --stats=alloc       report the memory used by every allocation site\n"
+                    "  --memory-limit=SIZE use less memory than SIZE [e.g. 512M]; may pack worse\n"
+                    "  --run-memory=SIZE   the packed program must run in SIZE bytes [e.g. 48M]\n"
+#if WITH_THREADS
+                    "  --threads=N         use N threads for the compression trials [0 = auto]\n"
+                    "  --numa              pin the worker threads to the NUMA nodes [Linux]\n"
+#endif
+                    "  --host-cpu=NAME     only use host CPU features up to NAME [e.g. sse2]\n"
                     "\n");
         fg = con_fg(f, FG_YELLOW);
         con_fprintf(f, "Backup options:\n");
@@ -233,6 +269,10 @@ void show_help(int verbose) {
                     "  --no-mode           do not preserve file mode (aka permissions)\n"
                     "  --no-owner          do not preserve file ownership\n"
                     "  --no-time           do not preserve file timestamp\n"
+#if defined(__unix__) || defined(__APPLE__)
+                    "  --listen=SOCKET     wait for jobs on a Unix socket [server]\n"
+                    "  --connect=SOCKET    run this command on a '--listen' server; must be first\n"
+#endif
                     "\n");
         fg = con_fg(f, FG_YELLOW);
         con_fprintf(f, "Options for djgpp2/coff:\n");
@@ -285,7 +325,10 @@ void show_help(int verbose) {
                     "  --compress-icons=2      compress all but the first icon directory [default]\n"
                     "  --compress-icons=3      compress all icons\n"
                     "  --compress-resources=0  do not compress any resources at all\n"
+                    "  --fast-imports          let Windows resolve all imports [bigger file]\n"
                     "  --keep-resource=list    do not compress resources specified by list\n"
+                    "  --keep-incompressible   do not compress already compressed resources\n"
+                    "  --keep-large-resources=SIZE  do not compress resources >= SIZE bytes\n"
                     "  --strip-relocs=0        do not strip relocations\n"
                     "  --strip-relocs=1        strip relocations [default]\n"
                     "\n");
@@ -294,6 +337,8 @@ void show_help(int verbose) {
         fg = con_fg(f, fg);
         con_fprintf(f,
                     "  --preserve-build-id     copy .gnu.note.build-id to compressed output\n"
+                    "  --split-blocks          end blocks where the content changes [slower]\n"
+                    "  --checksum-only         with -t: only check the compressed data [fast]\n"
                     "\n");
     }
     // clang-format on
@@ -557,6 +602,15 @@ void show_sysinfo(const char *options_var) {
     }
 
     // run-time
+    {
+        char s[80];
+        upx::cpu_features_name(s, sizeof(s), upx::cpu_features_detected());
+        con_fprintf(f, "\nCPU features:   %s\n", s);
+        if (upx::cpu_features() != upx::cpu_features_detected()) {
+            upx::cpu_features_name(s, sizeof(s), upx::cpu_features());
+            con_fprintf(f, "Used (--host-cpu=): %s\n", s);
+        }
+    }
 #if defined(HAVE_LOCALTIME) && defined(HAVE_GMTIME)
     {
         auto tm2str = [](char *s, size_t size, const struct tm *tmp) noexcept {
@@ -147,8 +147,7 @@ void LeFile::readImage() {
     soimage = mem_size(mps, pages); // assert size
     if (!soimage)                   // late detection, but protect against .alloc(0)
         throwCantPack("no soimage");
-    mb_iimage.alloc(soimage);
-    mb_iimage.clear();
+    mb_iimage.allocZeroed(soimage);
     iimage = mb_iimage; // => now a SPAN_S
 
     unsigned ic, jc;
@@ -0,0 +1,173 @@
+/* libupx.cpp -- in-process packing of memory buffers
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+// see libupx.h; the counterpart of do_one_file() in work.cpp
+
+#include "conf.h"
+#include "compress/compress.h" // upx_ucl_init()
+#include "file.h"
+#include "libupx.h"
+#include "packmast.h"
+#include "util/membuffer.h"
+
+/*************************************************************************
+// util
+**************************************************************************/
+
+namespace {
+
+// the startup work of upx_main(); done once
+void lib_init() noexcept {
+    static const bool done = []() noexcept {
+        upx_compiler_sanity_check();
+#if (WITH_BZIP2)
+        assert_noexcept(upx_bzip2_init() == 0);
+#endif
+        assert_noexcept(upx_lzma_init() == 0);
+#if (WITH_NRV)
+        assert_noexcept(upx_nrv_init() == 0);
+#endif
+        assert_noexcept(upx_ucl_init() == 0);
+        assert_noexcept(upx_zlib_init() == 0);
+#if (WITH_ZSTD)
+        assert_noexcept(upx_zstd_init() == 0);
+#endif
+        return true;
+    }();
+    UNUSED(done);
+}
+
+// the relevant part of check_and_update_options() in main.cpp
+void lib_setup_options(Options *lo, const Options *o, int cmd) noexcept {
+    memcpy(lo, o, sizeof(*lo)); // struct copy
+    lo->cmd = cmd;
+    if (cmd != CMD_COMPRESS) {
+        lo->method = 0;
+        lo->level = 0;
+        lo->exact = 0;
+        lo->small = 0;
+        lo->crp.reset();
+    }
+    if (lo->overlay < 0 || !(cmd == CMD_COMPRESS || cmd == CMD_DECOMPRESS))
+        lo->overlay = lo->COPY_OVERLAY;
+    // there is no file and no command line
+    lo->backup = 0;
+    lo->output_name = nullptr;
+    lo->to_stdout = false;
+    lo->preserve_link = false;
+    lo->benchmark = false;
+    lo->pack_cache = false;
+    lo->jobs = 1;
+}
+
+// fo is nullptr for CMD_TEST
+void lib_run(const void *in, size_t in_len, OutputFile *fo, const Options *o, const char *name,
+             int cmd) may_throw {
+    lib_init();
+    Options lo;
+    lib_setup_options(&lo, o, cmd);
+    InputFile fi;
+    fi.openMemory(name ? name : "<memory>", in, (upx_off_t) in_len);
+    if (fo != nullptr)
+        fo->openMemory(fi.getName());
+    PackMaster pm(&fi, &lo);
+    if (cmd == CMD_COMPRESS)
+        pm.pack(fo);
+    else if (cmd == CMD_DECOMPRESS)
+        pm.unpack(fo);
+    else
+        pm.test();
+}
+
+void lib_get_output(const OutputFile &fo, MemBuffer &out) may_throw {
+    const upx_off_t size = fo.getMemorySize();
+    if (size <= 0)
+        throwInternalError("no output");
+    out.dealloc();
+    out.alloc(size);
+    memcpy(out.getVoidPtr(), fo.getMemory(), (size_t) size);
+}
+
+} // namespace
+
+/*************************************************************************
+// public API
+**************************************************************************/
+
+void upx_lib_default_options(Options *o) noexcept {
+    o->reset();
+    o->verbose = 0;
+    o->console = CON_FILE;
+}
+
+void upx_lib_pack(const void *in, size_t in_len, MemBuffer &out, const Options *o,
+                  const char *name) may_throw {
+    OutputFile fo;
+    lib_run(in, in_len, &fo, o, name, CMD_COMPRESS);
+    lib_get_output(fo, out);
+}
+
+void upx_lib_unpack(const void *in, size_t in_len, MemBuffer &out, const Options *o,
+                    const char *name) may_throw {
+    OutputFile fo;
+    lib_run(in, in_len, &fo, o, name, CMD_DECOMPRESS);
+    lib_get_output(fo, out);
+}
+
+void upx_lib_test(const void *in, size_t in_len, const Options *o, const char *name) may_throw {
+    lib_run(in, in_len, nullptr, o, name, CMD_TEST);
+}
+
+/*************************************************************************
+// doctest checks
+**************************************************************************/
+
+TEST_CASE("upx_lib_pack") {
+    // a dos/com file; the name selects the format
+    byte in[4096];
+    for (unsigned i = 0; i < sizeof(in); i++)
+        in[i] = (byte) ("\xb4\x09\xba\x00\x01\xcd\x21\xc3"[i % 8] + (i >> 9));
+    Options o;
+    upx_lib_default_options(&o);
+    Options *const saved_opt = opt;
+    MemBuffer out;
+    upx_lib_pack(in, sizeof(in), out, &o, "test.com");
+    CHECK(opt == saved_opt); // PackMaster restored the options of this thread
+    const unsigned out_len = out.getSize();
+    CHECK((out_len > 0 && out_len < sizeof(in)));
+    // the second call frees the first output, which uses "opt"
+    upx_lib_pack(in, sizeof(in), out, &o, "test.com");
+    CHECK(opt == saved_opt);
+    CHECK(out.getSize() == out_len);
+    MemBuffer back;
+    upx_lib_unpack(out, out.getSize(), back, &o, "test.com");
+    CHECK(opt == saved_opt);
+    CHECK(back.getSize() == sizeof(in));
+    CHECK(memcmp(back, in, sizeof(in)) == 0);
+}
+
+/* vim:set ts=4 sw=4 et: */
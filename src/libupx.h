@@ -0,0 +1,56 @@
+/* libupx.h -- in-process packing of memory buffers
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+#pragma once
+
+/*************************************************************************
+// in-process API of the "upx_lib" CMake target
+//
+// Pack, unpack or test a file image that lives in memory: the input is
+// used in place, the output goes into a growing buffer, and no temporary
+// files or child processes are involved.
+//
+// Each call works with its own copy of *o instead of the global "opt", so
+// threads can process different files with different options in parallel.
+// Errors get reported by throwing an Exception like everywhere in UPX.
+**************************************************************************/
+
+class MemBuffer;
+struct Options;
+
+// the command line defaults, but quiet
+void upx_lib_default_options(Options *o) noexcept;
+
+// "name" is only used in messages; "out" gets (re-)allocated
+void upx_lib_pack(const void *in, size_t in_len, MemBuffer &out, const Options *o,
+                  const char *name = nullptr) may_throw;
+void upx_lib_unpack(const void *in, size_t in_len, MemBuffer &out, const Options *o,
+                    const char *name = nullptr) may_throw;
+void upx_lib_test(const void *in, size_t in_len, const Options *o,
+                  const char *name = nullptr) may_throw;
+
+/* vim:set ts=4 sw=4 et: */
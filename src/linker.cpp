@@ -40,6 +40,59 @@ static bool update_capacity(unsigned size, unsigned *capacity) {
     return true;
 }
 
+// Open-addressing hash tables of the Section and Symbol names, as the
+// linear strcmp() scans made linking a big stub quadratic. The tables hold
+// pointers and never have more than half of their slots in use.
+static unsigned name_hash(const char *name) {
+    unsigned h = 2166136261u; // FNV-1a
+    for (; *name; name++)
+        h = (h ^ (uchar) *name) * 16777619u;
+    return h;
+}
+
+template <class T>
+static T *name_hash_find(T *const *table, unsigned capacity, const char *name) {
+    if (capacity == 0)
+        return nullptr;
+    for (unsigned i = name_hash(name);; i++) {
+        T *const item = table[i & (capacity - 1)];
+        if (item == nullptr || strcmp(item->name, name) == 0)
+            return item;
+    }
+}
+
+template <class T>
+static void name_hash_insert1(T **table, unsigned capacity, T *item) {
+    unsigned i = name_hash(item->name);
+    while (table[i & (capacity - 1)] != nullptr)
+        i++;
+    table[i & (capacity - 1)] = item;
+}
+
+// add items[n - 1]; rebuild the table from items[] when it gets too full
+template <class T>
+static void name_hash_add(T ***table, unsigned *capacity, T *const *items, unsigned n) {
+    if (2 * n <= *capacity) {
+        name_hash_insert1(*table, *capacity, items[n - 1]);
+        return;
+    }
+    unsigned new_capacity = *capacity ? *capacity : 64;
+    while (2 * n > new_capacity)
+        new_capacity *= 2;
+    free(*table);
+    *table = static_cast<T **>(calloc(new_capacity, sizeof(T *)));
+    assert(*table != nullptr);
+    *capacity = new_capacity;
+    for (unsigned ic = 0; ic < n; ic++)
+        name_hash_insert1(*table, new_capacity, items[ic]);
+}
+
+template <class T>
+static void name_hash_clear(T **table, unsigned capacity) {
+    if (capacity != 0)
+        memset(table, 0, capacity * sizeof(T *));
+}
+
 static void internal_error(const char *format, ...) attribute_format(1, 2);
 static void internal_error(const char *format, ...) {
     static char buf[1024];
@@ -57,21 +110,9 @@ static void internal_error(const char *format, ...) {
 **************************************************************************/
 
 ElfLinker::Section::Section(const char *n, const void *i, unsigned s, unsigned a)
-    : name(nullptr), output(nullptr), size(s), offset(0), p2align(a), next(nullptr) {
-    name = strdup(n);
+    : name(n), input(i), output(nullptr), size(s), offset(0), p2align(a), next(nullptr) {
     assert(name != nullptr);
-    input = malloc(s + 1);
     assert(input != nullptr);
-    if (s != 0) {
-        assert(i != nullptr);
-        memcpy(input, i, s);
-    }
-    ((char *) input)[s] = 0;
-}
-
-ElfLinker::Section::~Section() noexcept {
-    free(name);
-    free(input);
 }
 
 /*************************************************************************
@@ -79,14 +120,11 @@ ElfLinker::Section::~Section() noexcept {
 **************************************************************************/
 
 ElfLinker::Symbol::Symbol(const char *n, Section *s, upx_uint64_t o)
-    : name(nullptr), section(s), offset(o) {
-    name = strdup(n);
+    : name(n), section(s), offset(o) {
     assert(name != nullptr);
     assert(section != nullptr);
 }
 
-ElfLinker::Symbol::~Symbol() noexcept { free(name); }
-
 /*************************************************************************
 // Relocation
 **************************************************************************/
@@ -97,6 +135,41 @@ ElfLinker::Relocation::Relocation(const Section *s, unsigned o, const char *t, c
     assert(section != nullptr);
 }
 
+/*************************************************************************
+// arena
+**************************************************************************/
+
+struct alignas(16) ElfLinker::ArenaChunk final {
+    ArenaChunk *next;
+    size_t capacity;
+    size_t used;
+    byte *data() noexcept { return reinterpret_cast<byte *>(this + 1); }
+};
+
+void *ElfLinker::arenaAlloc(size_t size, size_t align) {
+    assert(align != 0 && (align & (align - 1)) == 0 && align <= alignof(ArenaChunk));
+    size_t pos = arena ? ALIGN_UP(arena->used, align) : 0;
+    if (arena == nullptr || pos + size > arena->capacity) {
+        // start with 32 KiB, then double up to 1 MiB; enough for a big stub
+        size_t capacity = arena ? UPX_MIN(2 * arena->capacity, size_t(1024 * 1024)) : 32768;
+        capacity = UPX_MAX(capacity, size);
+        ArenaChunk *c = static_cast<ArenaChunk *>(malloc(sizeof(ArenaChunk) + capacity));
+        assert(c != nullptr);
+        c->next = arena;
+        c->capacity = capacity;
+        c->used = 0;
+        arena = c;
+        pos = 0;
+    }
+    arena->used = pos + size;
+    return arena->data() + pos;
+}
+
+const char *ElfLinker::arenaStrdup(const char *s) {
+    const size_t len = strlen(s) + 1;
+    return static_cast<const char *>(memcpy(arenaAlloc(len, 1), s, len));
+}
+
 /*************************************************************************
 // ElfLinker
 **************************************************************************/
@@ -104,22 +177,131 @@ ElfLinker::Relocation::Relocation(const Section *s, unsigned o, const char *t, c
 ElfLinker::ElfLinker(const N_BELE_RTP::AbstractPolicy *b) noexcept : bele(b) {}
 
 ElfLinker::~ElfLinker() noexcept {
-    delete[] input;
+    if (!input_shared)
+        delete[] input;
     delete[] output;
 
-    unsigned ic;
-    for (ic = 0; ic < nsections; ic++)
-        delete sections[ic];
+    // Section, Symbol and Relocation own nothing, so there is nothing to
+    // destroy but the arena
     free(sections);
-    for (ic = 0; ic < nsymbols; ic++)
-        delete symbols[ic];
+    free(section_hash);
     free(symbols);
-    for (ic = 0; ic < nrelocations; ic++)
-        delete relocations[ic];
+    free(symbol_hash);
     free(relocations);
+    while (arena != nullptr) {
+        ArenaChunk *const next = arena->next;
+        free(arena);
+        arena = next;
+    }
+}
+
+/*************************************************************************
+// parsed stubs
+//
+// Parsing the objdump text of a stub is by far the most expensive part of
+// ElfLinker::init() and the result only depends on the stub, so every stub
+// gets parsed once and kept. The parsed ElfLinker is never modified after
+// it has been stored and can be used by all threads: init() points the
+// shared input at it and rebuilds its own Sections, Symbols and
+// Relocations from it without parsing again.
+**************************************************************************/
+
+namespace {
+struct ParsedStubCache final {
+    struct Entry {
+        const void *pdata;
+        int plen;
+        const ElfLinker *stub;
+    };
+    static constexpr unsigned CAPACITY = 64; // plenty, there are only a few stubs per format
+    Entry entries[CAPACITY];
+    unsigned n = 0;
+    ~ParsedStubCache() noexcept {
+        for (unsigned i = 0; i < n; i++)
+            delete entries[i].stub;
+    }
+    const ElfLinker *find(const void *pdata, int plen) const noexcept {
+        for (unsigned i = 0; i < n; i++)
+            if (entries[i].pdata == pdata && entries[i].plen == plen)
+                return entries[i].stub;
+        return nullptr;
+    }
+};
+ParsedStubCache parsed_stub_cache;
+#if WITH_THREADS
+std::mutex parsed_stub_mutex; // protects parsed_stub_cache
+#endif
+} // namespace
+
+// static
+const ElfLinker *ElfLinker::getParsedStub(const void *pdata, int plen) {
+    {
+#if WITH_THREADS
+        std::lock_guard<std::mutex> lock(parsed_stub_mutex);
+#endif
+        const ElfLinker *stub = parsed_stub_cache.find(pdata, plen);
+        if (stub != nullptr)
+            return stub;
+    }
+    // parse outside of the lock; if another thread has been faster it wins
+    ElfLinker *stub = new ElfLinker();
+    try {
+        stub->parseStub(pdata, plen);
+    } catch (...) {
+        delete stub;
+        throw;
+    }
+#if WITH_THREADS
+    std::lock_guard<std::mutex> lock(parsed_stub_mutex);
+#endif
+    const ElfLinker *other = parsed_stub_cache.find(pdata, plen);
+    if (other != nullptr) {
+        delete stub;
+        return other;
+    }
+    if (parsed_stub_cache.n == ParsedStubCache::CAPACITY)
+        return nullptr; // cache full; the caller keeps its own copy
+    parsed_stub_cache.entries[parsed_stub_cache.n++] = {pdata, plen, stub};
+    return stub;
+}
+
+void ElfLinker::init(const void *pdata, int plen, unsigned pxtra) {
+    assert(input == nullptr && nsections == 0);
+    const ElfLinker *stub = getParsedStub(pdata, plen);
+    if (stub == nullptr) {
+        parseStub(pdata, plen);
+    } else {
+        input = stub->input; // read-only; Relocation::type points into it
+        input_shared = true;
+        inputlen = stub->inputlen;
+    }
+
+    output_capacity = (inputlen ? (inputlen + pxtra) : 0x4000);
+    assert(output_capacity <= (1 << 16)); // LE16 l_info.l_size
+    output = New(byte, output_capacity);
+    outputlen = 0;
+    NO_printf("\nElfLinker::init %d @%p\n", output_capacity, output);
+
+    if (stub != nullptr) {
+        unsigned ic;
+        for (ic = 0; ic < stub->nsections; ic++) {
+            const Section *sec = stub->sections[ic];
+            addSection(sec->name, sec->input, sec->size, sec->p2align);
+        }
+        for (ic = 0; ic < stub->nsymbols; ic++) {
+            const Symbol *sym = stub->symbols[ic];
+            addSymbol(sym->name, sym->section->name, sym->offset);
+        }
+        for (ic = 0; ic < stub->nrelocations; ic++) {
+            const Relocation *rel = stub->relocations[ic];
+            addRelocation(rel->section->name, rel->offset, rel->type, rel->value->name, rel->add);
+        }
+    }
+    if (nsections != 0) // the stub had a section table
+        addLoader("*UND*");
 }
 
-void ElfLinker::init(const void *pdata_v, int plen, unsigned pxtra) {
+void ElfLinker::parseStub(const void *pdata_v, int plen) {
     const byte *pdata = (const byte *) pdata_v;
     if (plen >= 16 && memcmp(pdata, "UPX#", 4) == 0) {
         // decompress pre-compressed stub-loader
@@ -155,19 +337,19 @@ void ElfLinker::init(const void *pdata_v, int plen, unsigned pxtra) {
     }
     input[inputlen] = 0; // NUL terminate
 
-    output_capacity = (inputlen ? (inputlen + pxtra) : 0x4000);
-    assert(output_capacity <= (1 << 16)); // LE16 l_info.l_size
-    output = New(byte, output_capacity);
-    outputlen = 0;
-    NO_printf("\nElfLinker::init %d @%p\n", output_capacity, output);
-
     // FIXME: bad compare when either symbols or relocs are absent
     if ((int) strlen("Sections:\n"
                      "SYMBOL TABLE:\n"
                      "RELOCATION RECORDS FOR ") < inputlen) {
         char const *const eof = (char const *) &input[inputlen];
         int pos = find(input, inputlen, "Sections:\n", 10);
-        assert(pos != -1);
+        if (pos == -1) {
+            // objinfo tables pre-digested by "bin2h.py --digest"
+            pos = find(input, inputlen, "UPX$OBJ\n", 8);
+            assert(pos != -1);
+            preprocessDigest(input + pos, input + inputlen);
+            return;
+        }
         char *const psections = (char *) input + pos;
 
         char *const psymbols = strstr(psections, "SYMBOL TABLE:\n");
@@ -181,12 +363,12 @@ void ElfLinker::init(const void *pdata_v, int plen, unsigned pxtra) {
             preprocessSymbols(psymbols, (prelocs ? prelocs : eof));
         if (prelocs)
             preprocessRelocations(prelocs, eof);
-        addLoader("*UND*");
     }
 }
 
 void ElfLinker::preprocessSections(char *start, char const *end) {
     char *nextl;
+    name_hash_clear(section_hash, section_hash_capacity);
     for (nsections = 0; start < end; start = 1 + nextl) {
         nextl = strchr(start, '\n');
         assert(nextl != nullptr);
@@ -208,6 +390,7 @@ void ElfLinker::preprocessSections(char *start, char const *end) {
 
 void ElfLinker::preprocessSymbols(char *start, char const *end) {
     char *nextl;
+    name_hash_clear(symbol_hash, symbol_hash_capacity);
     for (nsymbols = 0; start < end; start = 1 + nextl) {
         nextl = strchr(start, '\n');
         assert(nextl != nullptr);
@@ -297,19 +480,59 @@ void ElfLinker::preprocessRelocations(char *start, char const *end) {
     }
 }
 
+// see digest_objinfo() in src/stub/scripts/bin2h.py for the format
+void ElfLinker::preprocessDigest(const byte *start, const byte *end) {
+    assert(start + 20 <= end);
+    const unsigned ns = get_le32(start + 8);
+    const unsigned nsym = get_le32(start + 12);
+    const unsigned nrel = get_le32(start + 16);
+    const byte *p = start + 20;
+    const char *const strings = (const char *) (p + 16 * ns + 12 * nsym + 24 * nrel);
+    assert(strings < (const char *) end);
+    auto str = [strings, end](unsigned off) -> const char * {
+        assert(strings + off < (const char *) end);
+        return strings + off;
+    };
+
+    unsigned ic;
+    name_hash_clear(section_hash, section_hash_capacity);
+    for (nsections = 0, ic = 0; ic < ns; ic++, p += 16) {
+        const unsigned offset = get_le32(p + 4), size = get_le32(p + 8);
+        assert(offset <= (unsigned) inputlen && size <= inputlen - offset);
+        addSection(str(get_le32(p)), input + offset, size, get_le32(p + 12));
+    }
+    addSection("*ABS*", nullptr, 0, 0);
+    addSection("*UND*", nullptr, 0, 0);
+
+    name_hash_clear(symbol_hash, symbol_hash_capacity);
+    for (nsymbols = 0, ic = 0; ic < nsym; ic++, p += 12) {
+        const unsigned sidx = get_le32(p + 4);
+        assert(sidx < nsections);
+        addSymbol(str(get_le32(p)), sections[sidx]->name, get_le32(p + 8));
+    }
+
+    for (nrelocations = 0, ic = 0; ic < nrel; ic++, p += 24) {
+        const unsigned sidx = get_le32(p), vidx = get_le32(p + 12);
+        assert(sidx < nsections && vidx < nsymbols);
+        const upx_uint64_t add = get_le32(p + 16) | ((upx_uint64_t) get_le32(p + 20) << 32);
+        addRelocation(sections[sidx]->name, get_le32(p + 4), str(get_le32(p + 8)),
+                      symbols[vidx]->name, add);
+    }
+}
+
 ElfLinker::Section *ElfLinker::findSection(const char *name, bool fatal) const {
-    for (unsigned ic = 0; ic < nsections; ic++)
-        if (strcmp(sections[ic]->name, name) == 0)
-            return sections[ic];
+    Section *const section = name_hash_find(section_hash, section_hash_capacity, name);
+    if (section != nullptr)
+        return section;
     if (fatal)
         internal_error("unknown section %s\n", name);
     return nullptr;
 }
 
 ElfLinker::Symbol *ElfLinker::findSymbol(const char *name, bool fatal) const {
-    for (unsigned ic = 0; ic < nsymbols; ic++)
-        if (strcmp(symbols[ic]->name, name) == 0)
-            return symbols[ic];
+    Symbol *const symbol = name_hash_find(symbol_hash, symbol_hash_capacity, name);
+    if (symbol != nullptr)
+        return symbol;
     if (fatal)
         internal_error("unknown symbol %s\n", name);
     return nullptr;
@@ -328,9 +551,18 @@ ElfLinker::Section *ElfLinker::addSection(const char *sname, const void *sdata,
     assert(sname[0]);
     assert(sname[strlen(sname) - 1] != ':');
     assert(findSection(sname, false) == nullptr);
-    Section *sec = new Section(sname, sdata, slen, p2align);
+    // a copy of the data with a NUL after it, as the stub code expects
+    byte *const data = static_cast<byte *>(arenaAlloc(slen + 1, 16));
+    if (slen != 0) {
+        assert(sdata != nullptr);
+        memcpy(data, sdata, slen);
+    }
+    data[slen] = 0;
+    Section *sec = new (arenaAlloc(sizeof(Section), alignof(Section)))
+        Section(arenaStrdup(sname), data, slen, p2align);
     sec->sort_id = nsections;
     sections[nsections++] = sec;
+    name_hash_add(&section_hash, &section_hash_capacity, sections, nsections);
     return sec;
 }
 
@@ -344,8 +576,12 @@ ElfLinker::Symbol *ElfLinker::addSymbol(const char *name, const char *section,
     assert(name[0]);
     assert(name[strlen(name) - 1] != ':');
     assert(findSymbol(name, false) == nullptr);
-    Symbol *sym = new Symbol(name, findSection(section), offset);
+    Section *const sec = findSection(section);
+    // the symbol of a section shares its name
+    const char *const sym_name = strcmp(name, sec->name) == 0 ? sec->name : arenaStrdup(name);
+    Symbol *sym = new (arenaAlloc(sizeof(Symbol), alignof(Symbol))) Symbol(sym_name, sec, offset);
     symbols[nsymbols++] = sym;
+    name_hash_add(&symbol_hash, &symbol_hash_capacity, symbols, nsymbols);
     return sym;
 }
 
@@ -355,7 +591,8 @@ ElfLinker::Relocation *ElfLinker::addRelocation(const char *section, unsigned of
         relocations = static_cast<Relocation **>(
             realloc(relocations, (nrelocations_capacity) * sizeof(Relocation *)));
     assert(relocations != nullptr);
-    Relocation *rel = new Relocation(findSection(section), off, type, findSymbol(symbol), add);
+    Relocation *rel = new (arenaAlloc(sizeof(Relocation), alignof(Relocation)))
+        Relocation(findSection(section), off, type, findSymbol(symbol), add);
     relocations[nrelocations++] = rel;
     return rel;
 }
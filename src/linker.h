@@ -43,6 +43,7 @@ protected:
 
     byte *input = nullptr;
     int inputlen = 0;
+    bool input_shared = false; // input belongs to a parsed stub, see getParsedStub()
     byte *output = nullptr;
     int outputlen = 0;
     unsigned output_capacity = 0;
@@ -61,12 +62,28 @@ protected:
     unsigned nrelocations = 0;
     unsigned nrelocations_capacity = 0;
 
+    // name lookup for findSection() and findSymbol()
+    Section **section_hash = nullptr;
+    unsigned section_hash_capacity = 0; // a power of 2
+    Symbol **symbol_hash = nullptr;
+    unsigned symbol_hash_capacity = 0; // a power of 2
+
     bool reloc_done = false;
 
+    // The Sections, Symbols and Relocations, their names and the section
+    // data all live in a few big chunks, which the destructor frees at once.
+    struct ArenaChunk;
+    ArenaChunk *arena = nullptr;
+    void *arenaAlloc(size_t size, size_t align);
+    const char *arenaStrdup(const char *s);
+
 protected:
+    static const ElfLinker *getParsedStub(const void *pdata, int plen);
+    void parseStub(const void *pdata, int plen);
     void preprocessSections(char *start, char const *end);
     void preprocessSymbols(char *start, char const *end);
     void preprocessRelocations(char *start, char const *end);
+    void preprocessDigest(const byte *start, const byte *end);
     Section *findSection(const char *name, bool fatal = true) const;
     Symbol *findSymbol(const char *name, bool fatal = true) const;
 
@@ -115,8 +132,8 @@ protected:
 };
 
 struct ElfLinker::Section : private noncopyable {
-    char *name = nullptr;
-    void *input = nullptr;
+    const char *name = nullptr;
+    const void *input = nullptr;
     byte *output = nullptr;
     unsigned size = 0;
     unsigned sort_id = 0; // for qsort()
@@ -124,17 +141,17 @@ struct ElfLinker::Section : private noncopyable {
     unsigned p2align = 0; // log2
     Section *next = nullptr;
 
+    // n and i must stay valid as long as the Section, see ElfLinker::arena
     explicit Section(const char *n, const void *i, unsigned s, unsigned a = 0);
-    ~Section() noexcept;
 };
 
 struct ElfLinker::Symbol : private noncopyable {
-    char *name = nullptr;
+    const char *name = nullptr;
     Section *section = nullptr;
     upx_uint64_t offset = 0;
 
+    // n must stay valid as long as the Symbol, see ElfLinker::arena
     explicit Symbol(const char *n, Section *s, upx_uint64_t o);
-    ~Symbol() noexcept;
 };
 
 struct ElfLinker::Relocation : private noncopyable {
@@ -161,7 +178,7 @@ protected:
                            const char *type) override;
 };
 
-class ElfLinkerArm64LE final : public ElfLinker {
+class ElfLinkerArm64LE /*not_final*/ : public ElfLinker {
     typedef ElfLinker super;
 protected:
     virtual void relocate1(const Relocation *, byte *location, upx_uint64_t value,
@@ -31,6 +31,8 @@
 #include "packer.h"            // Packer::isValidCompressionMethod()
 #include "p_elf.h"             // ELFOSABI_xxx
 #include "compress/compress.h" // upx_ucl_init()
+#include "util/trace.h"        // upx::trace_open()
+#include "util/cpu_features.h" // upx::cpu_set_limit()
 
 /*************************************************************************
 // options
@@ -78,6 +80,7 @@ static void do_exit(void) {
 
     fflush(con_term);
     fflush(stderr);
+    upx_server_job_exit(exit_code); // report to the client of a "--listen" job
     exit(exit_code);
 }
 #endif
@@ -163,7 +166,7 @@ static void check_not_both(bool e1, bool e2, const char *c1, const char *c2) {
 static void check_and_update_options(int i, int argc) {
     assert(i <= argc);
 
-    if (opt->cmd != CMD_COMPRESS) {
+    if (opt->cmd != CMD_COMPRESS && opt->cmd != CMD_ANALYZE) {
         // invalidate compression options
         opt->method = 0;
         opt->level = 0;
@@ -186,6 +189,17 @@ static void check_and_update_options(int i, int argc) {
     if (!(opt->cmd == CMD_COMPRESS || opt->cmd == CMD_DECOMPRESS))
         opt->backup = 1;
 
+    if (opt->tree_dir) {
+        check_not_both(opt->to_stdout, true, "--stdout", "--tree");
+        check_not_both(opt->output_name != nullptr, true, "-o", "--tree");
+        if (i != argc) {
+            fprintf(stderr, "%s: cannot use file arguments with '--tree'\n", argv0);
+            e_usage();
+        }
+    } else if (opt->tree_manifest_name) {
+        fprintf(stderr, "%s: '--tree-manifest' needs '--tree'\n", argv0);
+        e_usage();
+    }
     check_not_both(opt->to_stdout, opt->output_name != nullptr, "--stdout", "-o");
     if (opt->to_stdout && opt->cmd == CMD_COMPRESS) {
         fprintf(stderr, "%s: cannot use '--stdout' when compressing\n", argv0);
@@ -201,6 +215,32 @@ static void check_and_update_options(int i, int argc) {
     check_not_both(opt->force_overwrite, opt->preserve_link, "--force-overwrite", "--link");
     check_not_both(opt->to_stdout, opt->preserve_link, "--stdout", "--link");
 
+    // parallel processing only makes sense for more than one file
+    if (opt->to_stdout || opt->output_name || opt->cmd == CMD_FILEINFO ||
+        opt->cmd == CMD_ANALYZE || (i + 1 >= argc && !opt->tree_dir))
+        opt->jobs = 1;
+    if (opt->cmd != CMD_COMPRESS)
+        opt->benchmark = false;
+    if (opt->benchmark) {
+        check_not_both(opt->to_stdout, true, "--stdout", "--benchmark");
+        check_not_both(opt->output_name != nullptr, true, "-o", "--benchmark");
+        opt->jobs = 1;    // keep the report of each file in one piece
+        opt->threads = 1; // and the timings free of concurrent trials
+    }
+    if (opt->cmd != CMD_COMPRESS)
+        opt->upgrade = opt->UPGRADE_NONE;
+    if (opt->upgrade) {
+        check_not_both(opt->benchmark, true, "--benchmark", "--upgrade");
+        check_not_both(opt->preserve_link, true, "--link", "--upgrade"); // it renames the file
+        check_not_both(opt->search_shards > 1, true, "--search-shard", "--upgrade");
+    }
+    if (opt->cmd != CMD_COMPRESS || opt->benchmark || opt->reuse_from)
+        opt->pack_cache = false; // "--reuse-from" output depends on the old file
+    if (opt->search_shards > 1 || opt->search_result || opt->search_merge)
+        opt->pack_cache = false; // the output of a shard is not a real result
+    if (opt->pack_cache)
+        opt->debug.disable_random_id = true; // a cached file must equal a fresh one
+
 #if defined(__unix__)
     static_assert(HAVE_LSTAT);
 #else
@@ -348,6 +388,41 @@ static int getoptvar(OptVar<T, default_value, min_value, max_value> *var, const
     return r;
 }
 
+// a size in bytes with an optional "K", "M" or "G" suffix
+static int getoptsize(upx_uint64_t *var) {
+    const char *p = mfx_optarg;
+    if (!p || !isdigit(p[0]))
+        return -1;
+    char *endptr = nullptr;
+    errno = 0;
+    upx_uint64_t n = strtoull(p, &endptr, 10);
+    unsigned shift = 0;
+    switch (*endptr) {
+    case 'K':
+    case 'k':
+        shift = 10;
+        break;
+    case 'M':
+    case 'm':
+        shift = 20;
+        break;
+    case 'G':
+    case 'g':
+        shift = 30;
+        break;
+    default:
+        break;
+    }
+    if (shift != 0)
+        endptr++;
+    if (*endptr == 'B' || *endptr == 'b')
+        endptr++; // "512MB"
+    if (*endptr != '\0' || errno != 0 || n > (~(upx_uint64_t) 0 >> shift))
+        return -2;
+    *var = n << shift;
+    return 0;
+}
+
 static int do_option(int optc, const char *arg) {
     int i = 0;
 
@@ -374,6 +449,9 @@ static int do_option(int optc, const char *arg) {
     case 909:
         set_cmd(CMD_FILEINFO);
         break;
+    case 911:
+        set_cmd(CMD_ANALYZE);
+        break;
     case 910:
         set_cmd(CMD_SYSINFO);
         break;
@@ -491,6 +569,11 @@ static int do_option(int optc, const char *arg) {
         if (!set_method(-1, 10))
             e_method(opt->method, 10);
         break;
+    case 903: // --fast, much like -1 but also cut down the filter and overlap search
+        opt->fast = true;
+        if (!set_method(-1, 1))
+            e_method(opt->method, 1);
+        break;
 
     // debug
     case 542:
@@ -542,6 +625,135 @@ static int do_option(int optc, const char *arg) {
     case 531:
         opt->preserve_link = false;
         break;
+    case 570: // --jobs=
+        getoptvar(&opt->jobs, 0u, 256u, arg);
+        break;
+    case 571: // --threads=
+        getoptvar(&opt->threads, 0u, 256u, arg);
+        break;
+    case 589: // --numa
+        opt->numa = true;
+        break;
+    case 572: // --prune-trials=
+        getoptvar(&opt->prune_trials, 0u, 65536u, arg);
+        break;
+    case 586: // --time-budget=
+        getoptvar(&opt->time_budget, 0u, 86400u, arg);
+        break;
+    case 587: // --nrv-parallel
+        opt->nrv_parallel = true;
+        break;
+    case 590: // --optimize-for=
+        if (strcmp(mfx_optarg, "size") == 0)
+            opt->optimize_startup = false;
+        else if (strcmp(mfx_optarg, "startup") == 0)
+            opt->optimize_startup = true;
+        else
+            e_optarg(arg);
+        break;
+    case 584: // --lzma-tune
+        opt->lzma_tune = true;
+        break;
+    case 573:
+        opt->decision_cache = true;
+        break;
+    case 574:
+        set_cmd(CMD_COMPRESS);
+        opt->benchmark = true;
+        break;
+    case 576:
+        opt->pack_cache = true;
+        break;
+    case 597:
+        opt->upgrade = opt->UPGRADE_BACKGROUND;
+        break;
+    case 598:
+        opt->upgrade = opt->UPGRADE_WAIT;
+        break;
+    case 577: // --listen=
+        if (!mfx_optarg || !mfx_optarg[0])
+            e_optarg(arg);
+        opt->listen_name = mfx_optarg;
+        break;
+    case 580: // --reuse-from=
+        if (!mfx_optarg || !mfx_optarg[0])
+            e_optarg(arg);
+        opt->reuse_from = mfx_optarg;
+        break;
+    case 581: // --search-shard=I/N
+    {
+        char *end = nullptr;
+        if (!mfx_optarg || !isdigit((uchar) mfx_optarg[0]))
+            e_optarg(arg);
+        unsigned long shard = strtoul(mfx_optarg, &end, 10);
+        if (*end != '/' || !isdigit((uchar) end[1]))
+            e_optval(arg);
+        unsigned long n = strtoul(end + 1, &end, 10);
+        if (*end != 0 || n < 1 || n > 65536 || shard >= n)
+            e_optval(arg);
+        opt->search_shard = (unsigned) shard;
+        opt->search_shards = (unsigned) n;
+    } break;
+    case 582: // --search-result=
+        if (!mfx_optarg || !mfx_optarg[0])
+            e_optarg(arg);
+        opt->search_result = mfx_optarg;
+        break;
+    case 583: // --search-merge=
+        if (!mfx_optarg || !mfx_optarg[0])
+            e_optarg(arg);
+        opt->search_merge = mfx_optarg;
+        break;
+    case 579: // --memory-limit=
+        if (getoptsize(&opt->memory_limit) != 0)
+            e_optval(arg);
+        break;
+    case 594: // --run-memory=
+        if (getoptsize(&opt->run_memory) != 0)
+            e_optval(arg);
+        break;
+    case 578: // --connect=
+        fflush(con_term);
+        fprintf(stderr, "%s: '--connect=' must be the first option\n", argv0);
+        e_usage();
+        break;
+    case 575: // --trace=
+        if (!mfx_optarg || !mfx_optarg[0])
+            e_optarg(arg);
+        opt->trace_name = mfx_optarg;
+        break;
+    case 591: // --tree
+        if (!mfx_optarg || !mfx_optarg[0])
+            e_optarg(arg);
+        opt->tree_dir = mfx_optarg;
+        break;
+    case 592: // --tree-manifest=
+        if (!mfx_optarg || !mfx_optarg[0])
+            e_optarg(arg);
+        opt->tree_manifest_name = mfx_optarg;
+        break;
+    case 593: // --host-cpu=
+        if (!mfx_optarg || !upx::cpu_set_limit(mfx_optarg))
+            e_optarg(arg);
+        break;
+    case 596:
+        opt->perf_counters = true;
+        break;
+    case 595: // --stats=
+        if (!mfx_optarg || strcmp(mfx_optarg, "alloc") != 0)
+            e_optarg(arg);
+        MemBuffer::enableSiteStats();
+        break;
+    case 585: // --metrics=
+        if (!mfx_optarg || !mfx_optarg[0])
+            e_optarg(arg);
+        opt->metrics_name = mfx_optarg;
+        break;
+    case 588: // --explain-search=
+        if (!mfx_optarg || !mfx_optarg[0])
+            e_optarg(arg);
+        opt->explain_name = mfx_optarg;
+        break;
     case 526:
         opt->preserve_mode = false;
         break;
@@ -625,6 +837,18 @@ static int do_option(int optc, const char *arg) {
     case 823:
         getoptvar(&opt->crp.crp_zlib.strategy, arg);
         break;
+    case 831:
+        getoptvar(&opt->crp.crp_zstd.level, arg);
+        break;
+    case 832:
+        getoptvar(&opt->crp.crp_zstd.window_log, arg);
+        break;
+    case 833:
+        getoptvar(&opt->crp.crp_zstd.long_distance, arg);
+        break;
+    case 834:
+        getoptvar(&opt->crp.crp_zstd.strategy, arg);
+        break;
     // backup
     case 'k':
         opt->backup = 1;
@@ -695,7 +919,13 @@ static int do_option(int optc, const char *arg) {
         break;
     // o_unix
     case 660:
+        if (mfx_optarg && strcmp(mfx_optarg, "auto") == 0) {
+            opt->o_unix.blocksize = 0;
+            opt->o_unix.auto_blocksize = true;
+            break;
+        }
         getoptvar(&opt->o_unix.blocksize, 8192u, ~0u, arg);
+        opt->o_unix.auto_blocksize = false;
         break;
     case 661:
         opt->o_unix.force_execve = true;
@@ -733,6 +963,12 @@ static int do_option(int optc, const char *arg) {
     case 677:
         opt->o_unix.force_pie = true;
         break;
+    case 680:
+        opt->o_unix.checksum_only = true;
+        break;
+    case 682:
+        opt->o_unix.split_blocks = true;
+        break;
     // ps1/exe
     case 670:
         opt->ps1_exe.boot_only = true;
@@ -787,6 +1023,15 @@ static int do_option(int optc, const char *arg) {
             e_optarg(arg);
         opt->win32_pe.keep_resource = mfx_optarg;
         break;
+    case 637:
+        opt->win32_pe.keep_incompressible = true;
+        break;
+    case 638:
+        getoptvar(&opt->win32_pe.keep_large_resources, 4096u, ~0u, arg);
+        break;
+    case 639:
+        opt->win32_pe.fast_imports = true;
+        break;
 
 #if !defined(DOCTEST_CONFIG_DISABLE)
     case 999: // doctest --dt-XXX option
@@ -815,9 +1060,10 @@ int main_get_options(int argc, char **argv) {
         {"brute", 0x10, N, 901},       // compress best, brute force
         {"ultra-brute", 0x10, N, 902}, // compress best, brute force
         {"decompress", 0, N, 'd'},     // decompress
-        {"fast", 0x10, N, '1'},        // compress faster
+        {"fast", 0x10, N, 903},        // compress fastest
         {"fileinfo", 0x10, N, 909},    // display info about file
         {"file-info", 0x10, N, 909},   // display info about file
+        {"analyze", 0x10, N, 911},     // report how well the file would compress
         {"help", 0, N, 'h' + 256},     // give help
         {"license", 0, N, 'L'},        // display software license
         {"list", 0, N, 'l'},           // list compressed exe
@@ -833,6 +1079,8 @@ int main_get_options(int argc, char **argv) {
         {"force-overwrite", 0x90, N, 529}, // force overwrite of output files
         {"link", 0x90, N, 530},            // preserve hard link
         {"info", 0, N, 'i'},               // info mode
+        {"jobs", 0x31, N, 570},            // --jobs=, process files in parallel
+        {"numa", 0x10, N, 589},            // pin the worker threads to the NUMA nodes
         {"no-env", 0x10, N, 519},          // no environment var
         {"no-link", 0x90, N, 531},         // do not preserve hard link [default]
         {"no-mode", 0x10, N, 526},         // do not preserve mode (permissions)
@@ -842,6 +1090,18 @@ int main_get_options(int argc, char **argv) {
         {"output", 0x21, N, 'o'},
         {"quiet", 0, N, 'q'},  // quiet mode
         {"silent", 0, N, 'q'}, // quiet mode
+        {"trace", 0x31, N, 575}, // --trace=, write timings in Chrome trace format
+        {"metrics", 0x31, N, 585}, // --metrics=, write one JSON line per packed file
+        {"perf-counters", 0x10, N, 596}, // add hardware counters to --trace and --metrics
+        {"explain-search", 0x31, N, 588}, // --explain-search=, one JSON line per candidate
+        {"stats", 0x31, N, 595}, // --stats=alloc, report the memory of all allocation sites
+        {"listen", 0x31, N, 577},  // --listen=, process jobs from a Unix socket
+        {"memory-limit", 0x31, N, 579}, // --memory-limit=, e.g. "512M"
+        {"run-memory", 0x31, N, 594},   // --run-memory=, memory budget of the packed program
+        {"connect", 0x31, N, 578}, // --connect=, send a job to a "--listen" server
+        {"tree", 0x21, N, 591},    // --tree DIR, process all executables below DIR
+        {"tree-manifest", 0x31, N, 592}, // --tree-manifest=, one JSON line per file of "--tree"
+        {"host-cpu", 0x31, N, 593}, // --host-cpu=, limit the CPU features of the host kernels
 #if 0
         // FIXME: to_stdout doesn't work because of console code mess
         {"stdout",           0x10, N, 517},     // write output on standard output
@@ -892,10 +1152,25 @@ int main_get_options(int argc, char **argv) {
         // compression settings
         {"all-filters", 0x10, N, 523},
         {"all-methods", 0x10, N, 524},
-        {"exact", 0x10, N, 525},  // user requires byte-identical decompression
-        {"filter", 0x31, N, 521}, // --filter=
+        {"benchmark", 0x10, N, 574},      // report the cost of all methods, discard the output
+        {"decision-cache", 0x10, N, 573}, // remember the best method/filter across runs
+        {"exact", 0x10, N, 525},          // user requires byte-identical decompression
+        {"filter", 0x31, N, 521},         // --filter=
+        {"lzma-tune", 0x10, N, 584}, // choose the LZMA parameters from a sample
         {"no-filter", 0x10, N, 522},
+        {"nrv-parallel", 0x10, N, 587}, // threaded optimal parse for NRV levels 8..10
+        {"optimize-for", 0x31, N, 590}, // --optimize-for=size|startup
+        {"pack-cache", 0x10, N, 576}, // reuse the packed output of identical input
+        {"prune-trials", 0x31, N, 572}, // --prune-trials=
+        {"reuse-from", 0x31, N, 580},   // --reuse-from=, reuse unchanged blocks
+        {"search-merge", 0x31, N, 583},  // --search-merge=, use the best of the shard results
+        {"search-result", 0x31, N, 582}, // --search-result=, append the winners of this run
+        {"search-shard", 0x31, N, 581},  // --search-shard=I/N, only try a part of the candidates
+        {"time-budget", 0x31, N, 586},   // --time-budget=, seconds for the method/filter search
         {"small", 0x10, N, 520},
+        {"threads", 0x31, N, 571}, // --threads=, threads used for packing a single file
+        {"upgrade", 0x10, N, 597},      // pack fast now, replace with a better file later
+        {"upgrade-wait", 0x10, N, 598}, // the same, but wait for the better file
         // CRP - Compression Runtime Parameters (undocumented and subject to change)
         {"crp-nrv-cf", 0x31, N, 801},
         {"crp-nrv-sl", 0x31, N, 802},
@@ -919,6 +1194,10 @@ int main_get_options(int argc, char **argv) {
         {"crp-zlib-ml", 0x31, N, 821},
         {"crp-zlib-wb", 0x31, N, 822},
         {"crp-zlib-st", 0x31, N, 823},
+        {"crp-zstd-lv", 0x31, N, 831},
+        {"crp-zstd-wl", 0x31, N, 832},
+        {"crp-zstd-ldm", 0x31, N, 833},
+        {"crp-zstd-st", 0x31, N, 834},
 
         // atari/tos
         {"split-segments", 0x90, N, 650},
@@ -947,6 +1226,8 @@ int main_get_options(int argc, char **argv) {
         {"preserve-build-id", 0, N, 675},
         {"android-shlib", 0, N, 676},
         {"force-pie", 0x90, N, 677},
+        {"checksum-only", 0x10, N, 680}, // quick "upx -t"
+        {"split-blocks", 0x10, N, 682},
         // ps1/exe
         {"boot-only", 0x90, N, 670},
         {"no-align", 0x90, N, 671},
@@ -962,6 +1243,9 @@ int main_get_options(int argc, char **argv) {
         {"strip-loadconf", 0x12, N, 633}, // OBSOLETE - IGNORED
         {"strip-relocs", 0x12, N, 634},
         {"keep-resource", 0x31, N, 635},
+        {"keep-incompressible", 0x10, N, 637},
+        {"keep-large-resources", 0x31, N, 638},
+        {"fast-imports", 0x10, N, 639},
 
 #if !defined(DOCTEST_CONFIG_DISABLE)
         // [doctest] Query flags - the program quits after them. Available:
@@ -1021,7 +1305,7 @@ void main_get_envoptions() {
         {"best", 0x10, N, 900},        // compress best
         {"brute", 0x10, N, 901},       // compress best, brute force
         {"ultra-brute", 0x10, N, 902}, // compress best, brute force
-        {"fast", 0x10, N, '1'},        // compress faster
+        {"fast", 0x10, N, 903},        // compress fastest
 
         // options
         {"info", 0, N, 'i'},        // info mode
@@ -1075,6 +1359,9 @@ void main_get_envoptions() {
         {"strip-loadconf", 0x12, N, 633}, // OBSOLETE - IGNORED
         {"strip-relocs", 0x12, N, 634},
         {"keep-resource", 0x31, N, 635},
+        {"keep-incompressible", 0x10, N, 637},
+        {"keep-large-resources", 0x31, N, 638},
+        {"fast-imports", 0x10, N, 639},
 
         {nullptr, 0, nullptr, 0}};
 
@@ -1181,14 +1468,34 @@ static void first_options(int argc, char **argv) {
 // main entry point
 **************************************************************************/
 
+static int upx_main_work(int argc, char *argv[]) may_throw;
+
+// a job of "--listen", running in a fork() of the server
+static int upx_server_job(int argc, char *argv[]) may_throw {
+    opt->reset();
+    set_term(stderr);
+    return upx_main_work(argc, argv);
+}
+
 int upx_main(int argc, char *argv[]) may_throw {
-    int i;
     static char default_argv0[] = "upx";
     assert(argc >= 1); // sanity check
     if (!argv[0] || !argv[0][0])
         argv[0] = default_argv0;
     argv0 = argv[0];
 
+    // "--connect=" must be the first option; skips all of the startup work
+    if (argc >= 2 && strncmp(argv[1], "--connect=", 10) == 0 && argv[1][10]) {
+        const char *socket_name = argv[1] + 10;
+        argv[1] = argv[0]; // send argv[0] and all other arguments
+        try {
+            return upx_server_connect(socket_name, argc - 1, argv + 1);
+        } catch (const Throwable &e) {
+            printErr(socket_name, e);
+            return EXIT_ERROR;
+        }
+    }
+
     upx_compiler_sanity_check();
     int dt_res = upx_doctest_check(argc, argv);
     if (dt_res != 0) {
@@ -1241,13 +1548,26 @@ int upx_main(int argc, char *argv[]) may_throw {
     assert(upx_zstd_init() == 0);
 #endif
 
+    return upx_main_work(argc, argv);
+}
+
+// everything after the startup work
+static int upx_main_work(int argc, char *argv[]) may_throw {
     /* get options */
     first_options(argc, argv);
     if (!opt->no_env)
         main_get_envoptions();
-    i = main_get_options(argc, argv);
+    int i = main_get_options(argc, argv);
     assert(i <= argc);
 
+    if (opt->listen_name) {
+        static bool in_server = false;
+        if (in_server || i < argc)
+            e_usage();
+        in_server = true;
+        return upx_server_listen(opt->listen_name, upx_server_job);
+    }
+
     set_term(nullptr);
     switch (opt->cmd) {
     case CMD_NONE:
@@ -1264,6 +1584,8 @@ int upx_main(int argc, char *argv[]) may_throw {
         break;
     case CMD_FILEINFO:
         break;
+    case CMD_ANALYZE:
+        break;
     case CMD_SYSINFO:
         show_sysinfo(OPTIONS_VAR);
         e_exit(EXIT_OK);
@@ -1291,7 +1613,7 @@ int upx_main(int argc, char *argv[]) may_throw {
     set_term(stderr);
     check_and_update_options(i, argc);
     int num_files = argc - i;
-    if (num_files < 1) {
+    if (num_files < 1 && !opt->tree_dir) {
         if (opt->verbose >= 2)
             e_help();
         else
@@ -1300,8 +1622,23 @@ int upx_main(int argc, char *argv[]) may_throw {
 
     /* start work */
     set_term(stdout);
-    if (do_files(i, argc, argv) != 0)
+    if (opt->trace_name)
+        upx::trace_open(opt->trace_name);
+    if (opt->metrics_name)
+        upx::metrics_open(opt->metrics_name);
+    if (opt->explain_name)
+        upx::explain_open(opt->explain_name);
+    if (opt->perf_counters && (opt->trace_name || opt->metrics_name) &&
+        !upx::perf_counters_enable())
+        printWarn("--perf-counters", "hardware performance counters are not available");
+    const int r = opt->tree_dir ? do_tree(opt->tree_dir) : do_files(i, argc, argv);
+    upx::explain_close();
+    upx::metrics_close();
+    upx::trace_close();
+    MemBuffer::printSiteStats(stderr);
+    if (r != 0)
         return exit_code;
+    do_upgrades(); // "--upgrade", usually in the background
 
     if (gitrev[0]) {
         // also see UPX_CONFIG_DISABLE_GITREV in CMakeLists.txt
@@ -1326,7 +1663,7 @@ int upx_main(int argc, char *argv[]) may_throw {
 // real entry point
 **************************************************************************/
 
-#if !(WITH_GUI)
+#if !(WITH_GUI) && !(UPX_CONFIG_LIBRARY)
 
 #if 1 && (ACC_OS_DOS32) && defined(__DJGPP__)
 #include <crt0.h>
@@ -1367,7 +1704,11 @@ int __acc_cdecl_main main(int argc, char *argv[]) /*noexcept*/ {
 #else
     int r;
     try {
+#if (UPX_CONFIG_BENCH_MAIN)
+        r = upx_bench_main(argc, argv); // the "upx_bench" target
+#else
         r = upx_main(argc, argv);
+#endif
     } catch (const Throwable &e) {
         printErr("unknown", e);
         std::terminate();
@@ -1382,6 +1723,6 @@ int __acc_cdecl_main main(int argc, char *argv[]) /*noexcept*/ {
     return r;
 }
 
-#endif /* !(WITH_GUI) */
+#endif /* !(WITH_GUI) && !(UPX_CONFIG_LIBRARY) */
 
 /* vim:set ts=4 sw=4 et: */
@@ -33,7 +33,8 @@
 //
 **************************************************************************/
 
-static int pr_need_nl = 0;
+// thread-local: each "--jobs" worker buffers its own console output
+static upx_thread_local int pr_need_nl = 0;
 
 void printSetNl(int need_nl) noexcept { pr_need_nl = need_nl; }
 
@@ -60,7 +61,7 @@ static void pr_print(bool c, const char *msg) noexcept {
     if (c && !opt->to_stdout)
         con_fprintf(stderr, "%s", msg);
     else
-        fprintf(stderr, "%s", msg);
+        con_fputs_raw(stderr, msg);
 }
 
 static void pr_error(const char *iname, const char *msg, bool is_warning) noexcept {
@@ -156,7 +157,7 @@ void printUnhandledException(const char *iname, const std::exception *e) noexcep
 // info
 **************************************************************************/
 
-static int info_header = 0;
+static upx_thread_local int info_header = 0; // see pr_need_nl
 
 static void info_print(const char *msg) {
     if (opt->info_mode <= 0)
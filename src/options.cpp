@@ -28,7 +28,7 @@
 #include "conf.h"
 
 static Options global_options;
-Options *opt = &global_options; // also see class PackMaster
+upx_thread_local Options *opt = &global_options; // also see class PackMaster
 
 #if WITH_THREADS
 std::mutex opt_lock_mutex;
@@ -50,6 +50,7 @@ void Options::reset() noexcept {
     o->filter = FT_NONE;
 
     o->backup = -1;
+    o->jobs = 1;
     o->overlay = -1;
     o->preserve_mode = true;
     o->preserve_ownership = true;
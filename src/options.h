@@ -28,7 +28,9 @@
 #pragma once
 
 struct Options;
-extern Options *opt;      // global options, see class PackMaster for per-file local options
+// global options, see class PackMaster for per-file local options;
+// thread-local so that worker threads can pack files in parallel
+extern upx_thread_local Options *opt;
 #define options_t Options // old name
 
 #if WITH_THREADS
@@ -47,6 +49,7 @@ enum {
     CMD_TEST,
     CMD_LIST,
     CMD_FILEINFO,
+    CMD_ANALYZE,
     CMD_SYSINFO,
     CMD_HELP,
     CMD_LICENSE,
@@ -67,12 +70,30 @@ struct Options final {
     int level;  // compression level 1..10
     int filter; // preferred filter from Packer::getFilters()
     bool ultra_brute;
+    bool fast;        // "--fast", minimize the packing time: -1, one filter, quick overlap
     bool all_methods; // try all available compression methods
     int all_methods_use_lzma;
     bool all_filters; // try all available filters
     bool no_filter;   // force no filter
     bool prefer_ucl;  // prefer UCL
     bool exact;       // user requires byte-identical decompression
+    // only fully try the best N method/filter candidates; 0 means all
+    unsigned prune_trials;
+    unsigned time_budget; // "--time-budget=", in seconds; 0 means unlimited
+    bool nrv_parallel; // "--nrv-parallel", optimal parse of NRV levels 8..10 in segments
+    bool optimize_startup; // "--optimize-for=startup", minimize the load time instead of the size
+    bool lzma_tune; // choose the LZMA lc/lp/pb parameters from a sample of the input
+    bool decision_cache; // remember the best method/filter across runs
+    bool benchmark;      // report the cost of all methods/filters; discard the output
+    bool pack_cache;     // reuse the packed output of identical input, see util/pack_cache.h
+    const char *reuse_from; // "--reuse-from=", copy unchanged blocks of an older packed file
+    unsigned search_shard;    // "--search-shard=I/N", only try every N-th candidate
+    unsigned search_shards;   // N of "--search-shard"; 0 means no sharding
+    const char *search_result; // "--search-result=", append the winners to this file
+    const char *search_merge;  // "--search-merge=", use the best winners of this file
+    // "--upgrade": pack fast now, and search for a smaller file afterwards; see work.cpp
+    enum { UPGRADE_NONE = 0, UPGRADE_BACKGROUND = 1, UPGRADE_WAIT = 2 };
+    int upgrade;
 
     // other options
     int backup;
@@ -81,14 +102,26 @@ struct Options final {
     bool force_overwrite;
     int info_mode;
     bool ignorewarn;
+    unsigned jobs; // number of files to process in parallel; 0 means auto
     bool no_env;
     bool no_progress;
     const char *output_name;
+    const char *trace_name; // "--trace=", see util/trace.h
+    const char *metrics_name; // "--metrics=", see util/trace.h
+    bool perf_counters;       // "--perf-counters", see util/trace.h
+    const char *explain_name; // "--explain-search=", see util/trace.h
+    const char *listen_name; // "--listen=", see server.cpp
+    const char *tree_dir; // "--tree", process all executables below this directory
+    const char *tree_manifest_name; // "--tree-manifest=", see work.cpp
+    upx_uint64_t memory_limit; // "--memory-limit=", in bytes; 0 means no limit
+    upx_uint64_t run_memory; // "--run-memory=", for the packed program; 0 means no limit
     bool preserve_link;
     bool preserve_mode;
     bool preserve_ownership;
     bool preserve_timestamp;
     int small;
+    unsigned threads; // number of threads used for packing a single file; 0 means auto
+    bool numa;        // "--numa": spread the worker threads over the NUMA nodes
     int verbose;
     bool to_stdout;
 
@@ -150,6 +183,7 @@ struct Options final {
     } dos_exe;
     struct {
         unsigned blocksize;
+        bool auto_blocksize;    // "--blocksize=auto": see PackUnix::getAutoBlocksize()
         bool force_execve;      // force the linux/386 execve format
         bool is_ptinterp;       // is PT_INTERP, so don't adjust auxv_t
         bool use_ptinterp;      // use PT_INTERP /opt/upx/run
@@ -159,6 +193,8 @@ struct Options final {
         bool preserve_build_id; // copy the build-id to the compressed binary
         bool android_shlib;     // keep some ElfXX_Shdr for dlopen()
         bool force_pie;         // choose DF_1_PIE instead of is_shlib
+        bool checksum_only;     // "upx -t": only verify the checksum of the compressed data
+        bool split_blocks;      // end filtered blocks where the content changes
     } o_unix;
     struct {
         bool boot_only;
@@ -176,6 +212,9 @@ struct Options final {
         upx::TriBool<upx_int8_t, true> compress_rt[25]; // 25 == RT_LAST
         int strip_relocs;
         const char *keep_resource;
+        bool keep_incompressible; // do not compress resources that look incompressible
+        unsigned keep_large_resources; // do not compress resources of at least this size
+        bool fast_imports; // let the OS loader resolve all imports
     } win32_pe;
 };
 
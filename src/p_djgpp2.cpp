@@ -66,9 +66,8 @@ const int *PackDjgpp2::getFilters() const {
     return filters;
 }
 
-unsigned PackDjgpp2::findOverlapOverhead(const byte *buf, const byte *tbuf, unsigned range,
-                                         unsigned upper_limit) const {
-    unsigned o = super::findOverlapOverhead(buf, tbuf, range, upper_limit);
+unsigned PackDjgpp2::alignOverlapOverhead(const PackHeader &xph, unsigned overhead) const {
+    unsigned o = super::alignOverlapOverhead(xph, overhead);
     o = (o + 0x3ff) & ~0x1ff;
     return o;
 }
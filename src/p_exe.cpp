@@ -398,7 +398,7 @@ void PackExe::pack(OutputFile *fo) {
             unsigned jc = get_le32(relocs + 4 * ic);
             set_le32(relocs + 4 * ic, ((jc >> 16) * 16 + (jc & 0xffff)) & 0xfffff);
         }
-        upx_qsort(raw_bytes(relocs, 4 * relocnum), relocnum, 4, le32_compare);
+        upx_radix_sort_le32(raw_bytes(relocs, 4 * relocnum), relocnum);
 
         SPAN_S_VAR(byte, image, ibuf + 0, ih_imagesize);
         SPAN_S_VAR(byte, crel, ibuf + ih_imagesize, ibuf);
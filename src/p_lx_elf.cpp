@@ -141,13 +141,17 @@ funpad4(InputFile *fi)
     return d;
 }
 
-static void alloc_file_image(MemBuffer &mb, off_t size)
+// Get [0, size) of the file into mb.  A fresh buffer is mapped
+// copy-on-write if possible, which avoids a full copy of big inputs.
+static void read_file_image(InputFile *f, MemBuffer &mb, off_t size)
 {
     assert(mem_size_valid_bytes(size));
     if (mb.getVoidPtr() == nullptr) {
-        mb.alloc(size);
+        f->mapx(mb, 0, size);
     } else {
         assert((u32_t)size <= mb.getSize());
+        f->seek(0, SEEK_SET);
+        f->readx(mb, size);
     }
 }
 
@@ -255,7 +259,8 @@ PackLinuxElf::PackLinuxElf(InputFile *f)
     xct_off(0), o_binfo(0), so_slide(0), xct_va(0), jni_onload_va(0),
     user_init_va(0), user_init_off(0),
     e_machine(0), ei_class(0), ei_data(0), ei_osabi(0), osabi_note(nullptr),
-    shstrtab(nullptr),
+    shstrtab(nullptr), shname_shdr(nullptr), shname_strtab(nullptr),
+    shname_n(0), shname_bad(~0u),
     o_elf_shnum(0)
 {
     memset(dt_table, 0, sizeof(dt_table));
@@ -321,16 +326,12 @@ PackLinuxElf32::PackLinuxElf32help1(InputFile *f)
 
     if (f && Elf32_Ehdr::ET_DYN!=e_type) {
         unsigned const len = sz_phdrs + e_phoff;
-        alloc_file_image(file_image, len);
-        f->seek(0, SEEK_SET);
-        f->readx(file_image, len);
+        read_file_image(f, file_image, len);
         phdri= (Elf32_Phdr       *)(e_phoff + file_image);  // do not free() !!
     }
     if (f && Elf32_Ehdr::ET_DYN==e_type) {
         // The DT_SYMTAB has no designated length.  Read the whole file.
-        alloc_file_image(file_image, file_size);
-        f->seek(0, SEEK_SET);
-        f->readx(file_image, file_size);
+        read_file_image(f, file_image, file_size);
         phdri= (Elf32_Phdr *)(e_phoff + file_image);  // do not free() !!
         if (opt->cmd != CMD_COMPRESS || !e_shoff ||  file_size < e_shoff) {
             shdri = nullptr;
@@ -891,6 +892,58 @@ off_t PackLinuxElf64::pack3(OutputFile *fo, Filter &ft)
     return total_out;
 }
 
+// The loader depends on the method, the unfilter and methods_used/xct_off
+// (which select the stub sections); all the rest are per-file constants.
+upx_uint64_t
+PackLinuxElf::getLoaderSizeCacheKey(Filter const *ft) const
+{
+    // the low 32 bits hold 27 bits of fields, so all 32 bits of methods_used fit above
+    upx_uint64_t key = 1;  // never 0
+    key |= (upx_uint64_t)(0 != xct_off) << 1;
+    key |= (upx_uint64_t)(ph_forced_method(ph.method) & 0xff) << 2;
+    key |= (upx_uint64_t)(ft->id & 0xff) << 10;
+    key |= (upx_uint64_t)(ft->n_mru & 0x1ff) << 18;
+    key |= (upx_uint64_t)methods_used << 32;
+    return key;
+}
+
+// "--analyze": one region per PT_LOAD
+unsigned
+PackLinuxElf32::getAnalyzeRegions(AnalyzeRegion *regions, unsigned max_regions)
+{
+    unsigned n = 0;
+    Elf32_Phdr const *phdr = phdri;
+    for (unsigned j = 0; phdr && j < e_phnum && n < max_regions; ++phdr, ++j) {
+        if (!is_LOAD32(phdr))
+            continue;
+        AnalyzeRegion &r = regions[n++];
+        snprintf(r.name, sizeof(r.name), "PT_LOAD[%u]", j);
+        r.offset = get_te32(&phdr->p_offset);
+        r.size = get_te32(&phdr->p_filesz);
+        r.mem_size = UPX_MAX(r.size, upx_uint64_t(get_te32(&phdr->p_memsz)));
+        r.prot = get_te32(&phdr->p_flags) & (Elf32_Phdr::PF_R|Elf32_Phdr::PF_W|Elf32_Phdr::PF_X);
+    }
+    return n;
+}
+
+unsigned
+PackLinuxElf64::getAnalyzeRegions(AnalyzeRegion *regions, unsigned max_regions)
+{
+    unsigned n = 0;
+    Elf64_Phdr const *phdr = phdri;
+    for (unsigned j = 0; phdr && j < e_phnum && n < max_regions; ++phdr, ++j) {
+        if (!is_LOAD64(phdr))
+            continue;
+        AnalyzeRegion &r = regions[n++];
+        snprintf(r.name, sizeof(r.name), "PT_LOAD[%u]", j);
+        r.offset = get_te64(&phdr->p_offset);
+        r.size = get_te64(&phdr->p_filesz);
+        r.mem_size = UPX_MAX(r.size, upx_uint64_t(get_te64(&phdr->p_memsz)));
+        r.prot = get_te32(&phdr->p_flags) & (Elf64_Phdr::PF_R|Elf64_Phdr::PF_W|Elf64_Phdr::PF_X);
+    }
+    return n;
+}
+
 void
 PackLinuxElf::addStubEntrySections(Filter const *, unsigned m_decompr)
 {
@@ -1032,16 +1085,12 @@ PackLinuxElf64::PackLinuxElf64help1(InputFile *f)
 
     if (f && Elf64_Ehdr::ET_DYN!=e_type) {
         unsigned const len = sz_phdrs + e_phoff;
-        alloc_file_image(file_image, len);
-        f->seek(0, SEEK_SET);
-        f->readx(file_image, len);
+        read_file_image(f, file_image, len);
         phdri= (Elf64_Phdr       *)(e_phoff + file_image);  // do not free() !!
     }
     if (f && Elf64_Ehdr::ET_DYN==e_type) {
         // The DT_SYMTAB has no designated length.  Read the whole file.
-        alloc_file_image(file_image, file_size);
-        f->seek(0, SEEK_SET);
-        f->readx(file_image, file_size);
+        read_file_image(f, file_image, file_size);
         phdri= (file_size <= (unsigned)e_phoff) ? nullptr : (Elf64_Phdr *)(e_phoff + file_image);  // do not free() !!
         if (!(opt->cmd == CMD_COMPRESS && e_shoff < (upx_uint64_t)file_size && mb_shdr.getSize() == 0)) {
             shdri = nullptr;
@@ -1495,8 +1544,8 @@ PackLinuxElf32::buildLinuxLoader(
     h.sz_unc = sz_unc;
     h.sz_cpr = mb_cprLoader.getSize();  // max that upx_compress may use
     {
-        int r = upx_compress(uncLoader, sz_unc, sizeof(h) + cprLoader, &sz_cpr,
-            nullptr, ph_forced_method(method), 10, nullptr, nullptr );
+        int r = compressLoader(uncLoader, sz_unc, sizeof(h) + cprLoader, &sz_cpr,
+            ph_forced_method(method), 10);
         h.sz_cpr = sz_cpr;  // actual length used
         if (r != UPX_E_OK || h.sz_cpr >= h.sz_unc)
             throwInternalError("loader compression failed");
@@ -1601,8 +1650,8 @@ PackLinuxElf64::buildLinuxLoader(
     h.sz_unc = sz_unc;
     h.sz_cpr = mb_cprLoader.getSize();  // max that upx_compress may use
     {
-        int r = upx_compress(uncLoader, sz_unc, sizeof(h) + cprLoader, &sz_cpr,
-            nullptr, ph_forced_method(method), 10, nullptr, nullptr );
+        int r = compressLoader(uncLoader, sz_unc, sizeof(h) + cprLoader, &sz_cpr,
+            ph_forced_method(method), 10);
         h.sz_cpr = sz_cpr;  // actual length used
         if (r != UPX_E_OK || h.sz_cpr >= h.sz_unc)
             throwInternalError("loader compression failed");
@@ -1975,16 +2024,6 @@ static unsigned const dt_keys[] = {
         0,
 };
 
-static int __acc_cdecl_qsort
-qcmp_unsigned(void const *const aa, void const *const bb)
-{
-    unsigned a = *(unsigned const *)aa;
-    unsigned b = *(unsigned const *)bb;
-    if (a < b) return -1;
-    if (a > b) return  1;
-    return  0;
-}
-
 void
 PackLinuxElf32::sort_DT32_offsets(Elf32_Dyn const *const dynp0)
 {
@@ -2022,7 +2061,7 @@ PackLinuxElf32::sort_DT32_offsets(Elf32_Dyn const *const dynp0)
         n_off += !!dt_offsets[n_off];
     }
     dt_offsets[n_off++] = file_size;  // sentinel
-    upx_qsort(dt_offsets, n_off, sizeof(dt_offsets[0]), qcmp_unsigned);
+    upx_sort(dt_offsets, n_off, [](unsigned a, unsigned b) { return a < b; });
 }
 
 unsigned PackLinuxElf32::find_dt_ndx(unsigned rva)
@@ -2280,52 +2319,76 @@ PackLinuxElf64::elf_find_ptype(unsigned type, Elf64_Phdr const *phdr, unsigned p
     return nullptr;
 }
 
-Elf32_Shdr const *PackLinuxElf32::elf_find_section_name(
-    char const *const name
-) const
+// Index of the first section called name in shdr[e_shnum], or -1.
+// A bad sh_name before that section throws, as a linear search would.
+int PackLinuxElf::find_shname(char const *name, void const *shdr, unsigned sizeof_shdr,
+    char const *what) const
 {
-    Elf32_Shdr const *shdr = shdri;
-    if (!shdr) {
-        return nullptr;
+    if (!shdr || !shstrtab) {
+        return -1;
     }
-    int j = e_shnum;
-    for (; 0 <=--j; ++shdr) {
-        unsigned const sh_name = get_te32(&shdr->sh_name);
-        if ((u32_t)file_size <= sh_name) {  // FIXME: weak
-            char msg[50]; snprintf(msg, sizeof(msg),
-                "bad Elf32_Shdr[%d].sh_name %#x",
-                -1+ e_shnum -j, sh_name);
-            throwCantPack(msg);
+    byte const *const sh = (byte const *)shdr;  // sh_name is at offset 0
+    if (shname_shdr != shdr || shname_strtab != shstrtab || shname_n != e_shnum) {
+        unsigned capacity = 64;
+        while (capacity < 2 * e_shnum) {
+            capacity <<= 1;
+        }
+        mb_shname_hash.dealloc();
+        mb_shname_hash.allocZeroed(capacity * sizeof(unsigned));
+        unsigned *const table = (unsigned *)mb_shname_hash.getVoidPtr();
+        shname_bad = ~0u;
+        for (unsigned j = 0; j < e_shnum; ++j) {
+            unsigned const sh_name = get_te32(&sh[j * sizeof_shdr]);
+            if ((u32_t)file_size <= sh_name) {  // FIXME: weak
+                shname_bad = j;  // later sections cannot be found anyway
+                break;
+            }
+            char const *const s = &shstrtab[sh_name];
+            unsigned h = gnu_hash(s);
+            for (; table[h & (capacity - 1)]; ++h) {
+                unsigned const k = -1+ table[h & (capacity - 1)];
+                if (0==strcmp(s, &shstrtab[get_te32(&sh[k * sizeof_shdr])])) {
+                    break;  // keep the first one
+                }
+            }
+            if (!table[h & (capacity - 1)]) {
+                table[h & (capacity - 1)] = 1+ j;
+            }
         }
-        if (0==strcmp(name, &shstrtab[sh_name])) {
-            return shdr;
+        shname_shdr = shdr;
+        shname_strtab = shstrtab;
+        shname_n = e_shnum;
+    }
+    unsigned const *const table = (unsigned const *)mb_shname_hash.getVoidPtr();
+    unsigned const capacity = mb_shname_hash.getSize() / sizeof(unsigned);
+    for (unsigned h = gnu_hash(name); table[h & (capacity - 1)]; ++h) {
+        unsigned const k = -1+ table[h & (capacity - 1)];
+        if (0==strcmp(name, &shstrtab[get_te32(&sh[k * sizeof_shdr])])) {
+            return k;
         }
     }
-    return nullptr;
+    if (~0u != shname_bad) {
+        char msg[50]; snprintf(msg, sizeof(msg), "bad %s[%d].sh_name %#x",
+            what, shname_bad, get_te32(&sh[shname_bad * sizeof_shdr]));
+        throwCantPack(msg);
+    }
+    return -1;
+}
+
+Elf32_Shdr const *PackLinuxElf32::elf_find_section_name(
+    char const *const name
+) const
+{
+    int const j = find_shname(name, shdri, sizeof(*shdri), "Elf32_Shdr");
+    return (j < 0) ? nullptr : &shdri[j];
 }
 
 Elf64_Shdr const *PackLinuxElf64::elf_find_section_name(
     char const *const name
 ) const
 {
-    Elf64_Shdr const *shdr = shdri;
-    if (!shdr) {
-        return nullptr;
-    }
-    int j = e_shnum;
-    for (; 0 <=--j; ++shdr) {
-        unsigned const sh_name = get_te32(&shdr->sh_name);
-        if ((u32_t)file_size <= sh_name) {  // FIXME: weak
-            char msg[50]; snprintf(msg, sizeof(msg),
-                "bad Elf64_Shdr[%d].sh_name %#x",
-                -1+ e_shnum -j, sh_name);
-            throwCantPack(msg);
-        }
-        if (0==strcmp(name, &shstrtab[sh_name])) {
-            return shdr;
-        }
-    }
-    return nullptr;
+    int const j = find_shname(name, shdri, sizeof(*shdri), "Elf64_Shdr");
+    return (j < 0) ? nullptr : &shdri[j];
 }
 
 Elf32_Shdr *PackLinuxElf32::elf_find_section_type(
@@ -2444,7 +2507,10 @@ tribool PackLinuxElf32::canUnpack() // bool, except -1: format known, but not pa
     if (get_te16(&ehdri.e_phnum) < 2) {
         throwCantUnpack("e_phnum must be >= 2");
     }
-    if (Elf32_Ehdr::ET_DYN==get_te16(&ehdri.e_type)) {
+    // "--list" and "--fileinfo" only need the PackHeader at the end of the file;
+    // PackLinuxElf32help1 would get the whole file and parse the dynamic section
+    bool const header_only = (opt->cmd == CMD_LIST || opt->cmd == CMD_FILEINFO);
+    if (Elf32_Ehdr::ET_DYN==get_te16(&ehdri.e_type) && !header_only) {
         PackLinuxElf32help1(fi);
     }
     if (super::canUnpack()) {
@@ -2641,9 +2707,7 @@ tribool PackLinuxElf32::canPack()
 
     if (Elf32_Ehdr::ET_DYN==get_te16(&ehdr->e_type)) {
         // The DT_SYMTAB has no designated length.  Read the whole file.
-        alloc_file_image(file_image, file_size);
-        fi->seek(0, SEEK_SET);
-        fi->readx(file_image, file_size);
+        read_file_image(fi, file_image, file_size);
         memcpy(&ehdri, ehdr, sizeof(Elf32_Ehdr));
         phdri= (Elf32_Phdr *)((size_t)e_phoff + file_image);  // do not free() !!
         shdri= (Elf32_Shdr *)((size_t)e_shoff + file_image);  // do not free() !!
@@ -2981,7 +3045,9 @@ proceed: ;
     // set options
     // this->blocksize: avoid over-allocating.
     // (file_size - max_offset): debug info, non-globl symbols, etc.
-    opt->o_unix.blocksize = blocksize = UPX_MAX(max_LOADsz, (unsigned)(file_size - max_offset));
+    blocksize = UPX_MAX(max_LOADsz, (unsigned)(file_size - max_offset));
+    if (!opt->o_unix.auto_blocksize)  // else PackUnix::pack() decides
+        opt->o_unix.blocksize = blocksize;
     return true;
 }
 
@@ -2993,7 +3059,10 @@ tribool PackLinuxElf64::canUnpack() // bool, except -1: format known, but not pa
     if (get_te16(&ehdri.e_phnum) < 2) {
         throwCantUnpack("e_phnum must be >= 2");
     }
-    if (Elf64_Ehdr::ET_DYN==get_te16(&ehdri.e_type)) {
+    // "--list" and "--fileinfo" only need the PackHeader at the end of the file;
+    // PackLinuxElf64help1 would get the whole file and parse the dynamic section
+    bool const header_only = (opt->cmd == CMD_LIST || opt->cmd == CMD_FILEINFO);
+    if (Elf64_Ehdr::ET_DYN==get_te16(&ehdri.e_type) && !header_only) {
         PackLinuxElf64help1(fi);
     }
     if (super::canUnpack()) {
@@ -3083,9 +3152,7 @@ tribool PackLinuxElf64::canPack()
 
     if (Elf64_Ehdr::ET_DYN==get_te16(&ehdr->e_type)) {
         // The DT_SYMTAB has no designated length.  Read the whole file.
-        alloc_file_image(file_image, file_size);
-        fi->seek(0, SEEK_SET);
-        fi->readx(file_image, file_size);
+        read_file_image(fi, file_image, file_size);
         memcpy(&ehdri, ehdr, sizeof(Elf64_Ehdr));
         phdri= (Elf64_Phdr *)((size_t)e_phoff + file_image);  // do not free() !!
         shdri= (Elf64_Shdr *)((size_t)e_shoff + file_image);  // do not free() !!
@@ -3407,7 +3474,9 @@ proceed: ;
     // set options
     // this->blocksize: avoid over-allocating.
     // (file_size - max_offset): debug info, non-globl symbols, etc.
-    opt->o_unix.blocksize = blocksize = UPX_MAX(max_LOADsz, file_size - max_offset);
+    blocksize = UPX_MAX(max_LOADsz, file_size - max_offset);
+    if (!opt->o_unix.auto_blocksize)  // else PackUnix::pack() decides
+        opt->o_unix.blocksize = blocksize;
     return true;
 }
 
@@ -4050,8 +4119,7 @@ void PackLinuxElf32::pack1(OutputFile * /*fo*/, Filter &ft)
         Elf32_Shdr const *buildid = elf_find_section_name(".note.gnu.build-id");
         if (buildid) {
             unsigned bid_sh_size = get_te32(&buildid->sh_size);
-            buildid_data.alloc(bid_sh_size);
-            buildid_data.clear();
+            buildid_data.allocZeroed(bid_sh_size);
             fi->seek(0,SEEK_SET);
             fi->seek(buildid->sh_offset,SEEK_SET);
             fi->readx((void *)buildid_data, bid_sh_size);
@@ -4940,8 +5008,7 @@ void PackLinuxElf64::pack1(OutputFile * /*fo*/, Filter &ft)
         Elf64_Shdr const *buildid = elf_find_section_name(".note.gnu.build-id");
         if (buildid) {
             unsigned bid_sh_size = get_te64(&buildid->sh_size);  // UPX_RSIZE_MAX_MEM protects us
-            buildid_data.alloc(bid_sh_size);
-            buildid_data.clear();
+            buildid_data.allocZeroed(bid_sh_size);
             fi->seek(0,SEEK_SET);
             fi->seek(buildid->sh_offset,SEEK_SET);
             fi->readx((void *)buildid_data, bid_sh_size);
@@ -5090,6 +5157,22 @@ int PackLinuxElf32::pack2(OutputFile *fo, Filter &ft)
             nk_f = k;
         }
     }
+    if (!is_shlib) {
+        // Compress the PT_LOADs that get no filter on the worker pool,
+        // while the loop below searches for the method and filter of
+        // phdri[nk_f]; packExtent() then writes them in phdri[] order.
+        // The PT_LOAD at offset 0 is different because of hdr_u_len.
+        std::unique_ptr<Extent[]> xs(new Extent[e_phnum]);
+        unsigned nxs = 0;
+        for (k = 0; k < e_phnum; ++k)
+        if (PT_LOAD32==get_te32(&phdri[k].p_type) && k != nk_f
+        &&  0 != get_te32(&phdri[k].p_offset)) {
+            xs[nxs].offset = get_te32(&phdri[k].p_offset);
+            xs[nxs].size   = get_te32(&phdri[k].p_filesz);
+            ++nxs;
+        }
+        precompressExtents(xs.get(), nxs);
+    }
     int nx = 0;
     for (k = 0; k < e_phnum; ++k)
     if (PT_LOAD32==get_te32(&phdri[k].p_type)) {
@@ -5224,6 +5307,7 @@ int PackLinuxElf32::pack2(OutputFile *fo, Filter &ft)
         }
         ++nx;
     }
+    precompressExtents(nullptr, 0);  // drop the unused ones
     sz_pack2a = fpad4(fo, total_out);  // MATCH01
     total_out = up4(total_out);
 
@@ -5348,6 +5432,22 @@ int PackLinuxElf64::pack2(OutputFile *fo, Filter &ft)
             nk_f = k;
         }
     }
+    if (!is_shlib) {
+        // Compress the PT_LOADs that get no filter on the worker pool,
+        // while the loop below searches for the method and filter of
+        // phdri[nk_f]; packExtent() then writes them in phdri[] order.
+        // The PT_LOAD at offset 0 is different because of hdr_u_len.
+        std::unique_ptr<Extent[]> xs(new Extent[e_phnum]);
+        unsigned nxs = 0;
+        for (k = 0; k < e_phnum; ++k)
+        if (PT_LOAD64==get_te32(&phdri[k].p_type) && k != nk_f
+        &&  0 != get_te64(&phdri[k].p_offset)) {
+            xs[nxs].offset = get_te64(&phdri[k].p_offset);
+            xs[nxs].size   = get_te64(&phdri[k].p_filesz);
+            ++nxs;
+        }
+        precompressExtents(xs.get(), nxs);
+    }
     int nx = 0;
     for (k = 0; k < e_phnum; ++k)
     if (PT_LOAD64==get_te32(&phdri[k].p_type)) {
@@ -5481,6 +5581,7 @@ int PackLinuxElf64::pack2(OutputFile *fo, Filter &ft)
         }
         ++nx;
     }
+    precompressExtents(nullptr, 0);  // drop the unused ones
     sz_pack2a = fpad4(fo, total_out);  // MATCH01
     total_out = up4(total_out);
 
@@ -7430,9 +7531,7 @@ void PackLinuxElf64::unpack(OutputFile *fo)
                     if (is_be) {
                         // Does the right thing for sz_unc and sz_cpr,
                         // but swaps b_method and b_extra.  Need find_be32() :-)
-                        for (unsigned k = 0; k < N_PEEK; k += sizeof(int)) {
-                            set_le32(&peek_arr[k], get_be32(&peek_arr[k]));
-                        }
+                        bswap32_array(peek_arr, N_PEEK / sizeof(int));
                     }
                     int boff = find_le32(peek_arr, sizeof(peek_arr), size);
                     if (boff < 0
@@ -7492,8 +7591,8 @@ void PackLinuxElf64::unpack(OutputFile *fo)
     if (fo && total_out != orig_file_size)
         throwEOFException();
 
-    // finally test the checksums
-    if (ph.c_adler != c_adler || ph.u_adler != u_adler)
+    // finally test the checksums; "--checksum-only" skipped the u_adler of the PT_LOADs
+    if (ph.c_adler != c_adler || (ph.u_adler != u_adler && !(!fo && opt->o_unix.checksum_only)))
         throwChecksumError();
 }
 
@@ -7935,7 +8034,7 @@ PackLinuxElf64::sort_DT64_offsets(Elf64_Dyn const *const dynp0)
         n_off += !!dt_offsets[n_off];
     }
     dt_offsets[n_off++] = file_size;  // sentinel
-    upx_qsort(dt_offsets, n_off, sizeof(dt_offsets[0]), qcmp_unsigned);
+    upx_sort(dt_offsets, n_off, [](unsigned a, unsigned b) { return a < b; });
 }
 
 unsigned PackLinuxElf64::find_dt_ndx(u64_t rva)
@@ -8597,9 +8696,7 @@ void PackLinuxElf32::unpack(OutputFile *fo)
                     if (is_be) {
                         // Does the right thing for sz_unc and sz_cpr,
                         // but swaps b_method and b_extra.  Need find_be32() :-)
-                        for (unsigned k = 0; k < N_PEEK; k += sizeof(int)) {
-                            set_le32(&peek_arr[k], get_be32(&peek_arr[k]));
-                        }
+                        bswap32_array(peek_arr, N_PEEK / sizeof(int));
                     }
                     int boff = find_le32(peek_arr, sizeof(peek_arr), size);
                     if (boff < 0) {
@@ -8658,8 +8755,8 @@ void PackLinuxElf32::unpack(OutputFile *fo)
     if (fo && total_out != orig_file_size)
         throwEOFException();
 
-    // finally test the checksums
-    if (ph.c_adler != c_adler || ph.u_adler != u_adler)
+    // finally test the checksums; "--checksum-only" skipped the u_adler of the PT_LOADs
+    if (ph.c_adler != c_adler || (ph.u_adler != u_adler && !(!fo && opt->o_unix.checksum_only)))
         throwChecksumError();
 }
 
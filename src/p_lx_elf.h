@@ -66,6 +66,7 @@ protected:
     ) = 0;
     virtual void defineSymbols(Filter const *);
     virtual void addStubEntrySections(Filter const *, unsigned m_decompr);
+    virtual upx_uint64_t getLoaderSizeCacheKey(Filter const *) const override;
     virtual void unpack(OutputFile *fo) override;
     unsigned old_data_off, old_data_len;  // un_shlib
 
@@ -122,6 +123,15 @@ protected:
 
     MemBuffer mb_shstrtab;   // via ElfXX_Shdr
     char const *shstrtab;
+    // Open-addressing hash of the section names for elf_find_section_name(),
+    // built on first use, and again after shdri, shstrtab or e_shnum change.
+    int find_shname(char const *name, void const *shdr, unsigned sizeof_shdr,
+        char const *what) const;
+    mutable MemBuffer mb_shname_hash;  // 1+ index into shdri[]; 0: empty slot
+    mutable void const *shname_shdr;
+    mutable char const *shname_strtab;
+    mutable unsigned shname_n;
+    mutable unsigned shname_bad;  // index of the first bad sh_name, or ~0u
     MemBuffer jump_slots;  // is_asl de-compression fixing
     MemBuffer buildid_data;
     MemBuffer note_body;  // concatenated contents of PT_NOTEs, if any
@@ -142,6 +152,7 @@ protected:
     virtual bool canPackOSABI(Elf32_Ehdr const *);
     virtual tribool canPack() override;
     virtual tribool canUnpack() override; // bool, except -1: format known, but not packed
+    virtual unsigned getAnalyzeRegions(AnalyzeRegion *, unsigned max_regions) override;
 
     // These ARM routines are essentially common to big/little endian,
     // but the class hierarchy splits after this class.
@@ -313,6 +324,7 @@ protected:
     virtual int checkEhdr(Elf64_Ehdr const *ehdr) const;
     virtual tribool canPack() override;
     virtual tribool canUnpack() override; // bool, except -1: format known, but not packed
+    virtual unsigned getAnalyzeRegions(AnalyzeRegion *, unsigned max_regions) override;
 
     virtual void pack1(OutputFile *, Filter &) override;  // generate executable header
     virtual void asl_pack2_Shdrs(OutputFile *, unsigned pre_xct_top);  // AndroidSharedLibrary processes Shdrs
@@ -37,6 +37,7 @@
 #include "p_mach_enum.h"
 #include "p_mach.h"
 #include "ui.h"
+#include "util/threads.h"
 
 #if (ACC_CC_CLANG)
 #  pragma clang diagnostic ignored "-Wcast-align"
@@ -467,6 +468,17 @@ void PackMachARM64EL::addStubEntrySections(Filter const * /*ft*/)
     addLoader("MACHMAINY,IDENTSTR,+40,MACHMAINZ,FOLDEXEC", nullptr);
 }
 
+// The loader only depends on the method and the unfilter.
+template <class T>
+upx_uint64_t PackMachBase<T>::getLoaderSizeCacheKey(Filter const *ft) const
+{
+    upx_uint64_t key = 1;  // never 0
+    key |= (upx_uint64_t)(ph.method & 0xff) << 8;
+    key |= (upx_uint64_t)(ft->id & 0xff) << 16;
+    key |= (upx_uint64_t)(ft->n_mru & 0x1ff) << 24;
+    return key;
+}
+
 template <class T>
 void PackMachBase<T>::defineSymbols(Filter const *)
 {
@@ -500,8 +512,8 @@ PackMachBase<T>::buildMachLoader(
     unsigned char *const cprLoader = (unsigned char *)cprLoader_buf.getVoidPtr();
   if (0 < szfold) {
     unsigned sz_cpr = 0;
-    int r = upx_compress(uncLoader, h.sz_unc, sizeof(h) + cprLoader, &sz_cpr,
-        nullptr, ph.method, 10, nullptr, nullptr );
+    int r = compressLoader(uncLoader, h.sz_unc, sizeof(h) + cprLoader, &sz_cpr,
+        ph.method, 10);
     h.sz_cpr = sz_cpr;
     if (r != UPX_E_OK || h.sz_cpr >= h.sz_unc)
         throwInternalError("loader compression failed");
@@ -1098,6 +1110,32 @@ off_t PackDylibPPC64::pack3(OutputFile *fo, Filter &ft)  // append loader
     return len;
 }
 
+// "--analyze": one region per mapped LC_SEGMENT that has file data
+template <class T>
+unsigned PackMachBase<T>::getAnalyzeRegions(AnalyzeRegion *regions, unsigned max_regions)
+{
+    unsigned const lc_seg = lc_seg_info[sizeof(Addr)>>3].segment_cmd;
+    unsigned n = 0;
+    for (unsigned j = 0; msegcmd && j < mhdri.ncmds && n < max_regions; ++j) {
+        Mach_segment_command const &seg = msegcmd[j];
+        if (lc_seg != seg.cmd || 0 == seg.initprot || 0 == seg.filesize)
+            continue;  // not a segment, or __PAGEZERO
+        AnalyzeRegion &r = regions[n++];
+        char name[sizeof(seg.segname) + 1];
+        memcpy(name, seg.segname, sizeof(seg.segname));
+        name[sizeof(seg.segname)] = 0;
+        snprintf(r.name, sizeof(r.name), "%s", name);
+        r.offset = seg.fileoff;
+        r.size = seg.filesize;
+        r.mem_size = UPX_MAX(r.size, upx_uint64_t(seg.vmsize));
+        unsigned const prot = seg.initprot;
+        r.prot = ((Mach_command::VM_PROT_READ    & prot) ? 4 : 0)
+               | ((Mach_command::VM_PROT_WRITE   & prot) ? 2 : 0)
+               | ((Mach_command::VM_PROT_EXECUTE & prot) ? 1 : 0);
+    }
+    return n;
+}
+
 // Determine length of gap between PT_LOAD phdri[k] and closest PT_LOAD
 // which follows in the file (or end-of-file).  Optimize for common case
 // where the PT_LOAD are adjacent ascending by .p_offset.  Assume no overlap.
@@ -1179,6 +1217,31 @@ int  PackMachBase<T>::pack2(OutputFile *fo, Filter &ft)  // append compressed bo
         exe_filesize_max = (unsigned) msegcmd[k].filesize;
     }
 
+    if (my_filetype!=Mach_header::MH_DYLIB) {
+        // Compress the segments that get no filter on the worker pool,
+        // while packExtent() searches for the method and filter of the
+        // largest executable segment; the segments are then written in
+        // msegcmd[] order.  The 1st segment is different because of hdr_u_len.
+        std::unique_ptr<Extent[]> xs(new Extent[n_segment]);
+        unsigned nxs = 0;
+        bool first = true, seen_filter = false;
+        for (k = 0; k < n_segment; ++k)
+        if (lc_seg==msegcmd[k].cmd
+        &&  0!=msegcmd[k].filesize ) {
+            bool const do_filter = !seen_filter
+                && (msegcmd[k].filesize==exe_filesize_max)
+                && 0!=(Mach_command::VM_PROT_EXECUTE & msegcmd[k].initprot);
+            seen_filter |= do_filter;
+            if (!first && !do_filter) {
+                xs[nxs].offset = msegcmd[k].fileoff;
+                xs[nxs].size   = msegcmd[k].filesize;
+                ++nxs;
+            }
+            first = false;
+        }
+        precompressExtents(xs.get(), nxs);
+    }
+
     int nx = 0;
     for (k = 0; k < n_segment; ++k)
     if (lc_seg==msegcmd[k].cmd
@@ -1214,6 +1277,7 @@ int  PackMachBase<T>::pack2(OutputFile *fo, Filter &ft)  // append compressed bo
             break;
         }
     }
+    precompressExtents(nullptr, 0);  // drop the unused ones
     if (my_filetype!=Mach_header::MH_DYLIB)
     for (k = 0; k < n_segment; ++k) {
         x.size = find_SEGMENT_gap(k, fi->st_size());
@@ -1555,7 +1619,9 @@ void PackMachBase<T>::unpack(OutputFile *fo)
     }
 
     // Put LC_SEGMENT together at the beginning
-    upx_qsort(msegcmd, ncmds, sizeof(*msegcmd), compare_segment_command);
+    upx_sort(msegcmd, ncmds, [](const Mach_segment_command &a, const Mach_segment_command &b) {
+        return compare_segment_command(&a, &b) < 0;
+    });
     n_segment = 0;
     for (unsigned j= 0; j < ncmds; ++j) {
         n_segment += (lc_seg==msegcmd[j].cmd);
@@ -2039,7 +2105,9 @@ tribool PackMachBase<T>::canPack()
     }
 
     // Put LC_SEGMENT together at the beginning
-    upx_qsort(msegcmd, ncmds, sizeof(*msegcmd), compare_segment_command);
+    upx_sort(msegcmd, ncmds, [](const Mach_segment_command &a, const Mach_segment_command &b) {
+        return compare_segment_command(&a, &b) < 0;
+    });
 
     if (lc_seg==msegcmd[0].cmd && 0==msegcmd[0].vmaddr
     &&  !strcmp("__PAGEZERO", msegcmd[0].segname)) {
@@ -2312,99 +2380,153 @@ const int *PackMachFat::getFilters() const
     return filters;  // sham
 }
 
+// pack one slice; fi and fo are positioned at the start of the slice
+void PackMachFat::packSlice(unsigned cputype, InputFile *fi, OutputFile *fo)
+{
+    switch (cputype) {
+    case PackMachFat::CPU_TYPE_I386: {
+        typedef N_Mach::Mach_header<MachClass_LE32::MachITypes> Mach_header;
+        Mach_header hdr;
+        fi->readx(&hdr, sizeof(hdr));
+        if (hdr.filetype==Mach_header::MH_EXECUTE) {
+            PackMachI386 packer(fi);
+            packer.initPackHeader();
+            packer.canPack();
+            packer.updatePackHeader();
+            packer.pack(fo);
+        }
+        else if (hdr.filetype==Mach_header::MH_DYLIB) {
+            PackDylibI386 packer(fi);
+            packer.initPackHeader();
+            packer.canPack();
+            packer.updatePackHeader();
+            packer.pack(fo);
+        }
+    } break;
+    case PackMachFat::CPU_TYPE_X86_64: {
+        typedef N_Mach::Mach_header<MachClass_LE64::MachITypes> Mach_header;
+        Mach_header hdr;
+        fi->readx(&hdr, sizeof(hdr));
+        if (hdr.filetype==Mach_header::MH_EXECUTE) {
+            PackMachAMD64 packer(fi);
+            packer.initPackHeader();
+            packer.canPack();
+            packer.updatePackHeader();
+            packer.pack(fo);
+        }
+        else if (hdr.filetype==Mach_header::MH_DYLIB) {
+            PackDylibAMD64 packer(fi);
+            packer.initPackHeader();
+            packer.canPack();
+            packer.updatePackHeader();
+            packer.pack(fo);
+        }
+    } break;
+    case PackMachFat::CPU_TYPE_ARM64: {
+        typedef N_Mach::Mach_header<MachClass_LE64::MachITypes> Mach_header;
+        Mach_header hdr;
+        fi->readx(&hdr, sizeof(hdr));
+        if (hdr.filetype==Mach_header::MH_EXECUTE) {
+            PackMachARM64EL packer(fi);
+            packer.initPackHeader();
+            packer.canPack();
+            packer.updatePackHeader();
+            packer.pack(fo);
+        }
+    } break;
+    case PackMachFat::CPU_TYPE_POWERPC: {
+        typedef N_Mach::Mach_header<MachClass_BE32::MachITypes> Mach_header;
+        Mach_header hdr;
+        fi->readx(&hdr, sizeof(hdr));
+        if (hdr.filetype==Mach_header::MH_EXECUTE) {
+            PackMachPPC32 packer(fi);
+            packer.initPackHeader();
+            packer.canPack();
+            packer.updatePackHeader();
+            packer.pack(fo);
+        }
+        else if (hdr.filetype==Mach_header::MH_DYLIB) {
+            PackDylibPPC32 packer(fi);
+            packer.initPackHeader();
+            packer.canPack();
+            packer.updatePackHeader();
+            packer.pack(fo);
+        }
+    } break;
+    case PackMachFat::CPU_TYPE_POWERPC64: {
+        typedef N_Mach::Mach_header<MachClass_LE64::MachITypes> Mach_header;
+        Mach_header hdr;
+        fi->readx(&hdr, sizeof(hdr));
+        if (hdr.filetype==Mach_header::MH_EXECUTE) {
+            PackMachPPC64 packer(fi);
+            packer.initPackHeader();
+            packer.canPack();
+            packer.updatePackHeader();
+            packer.pack(fo);
+        }
+        else if (hdr.filetype==Mach_header::MH_DYLIB) {
+            PackDylibPPC64 packer(fi);
+            packer.initPackHeader();
+            packer.canPack();
+            packer.updatePackHeader();
+            packer.pack(fo);
+        }
+    } break;
+    }  // switch cputype
+}
+
 void PackMachFat::pack(OutputFile *fo)
 {
     unsigned const in_size = this->file_size;
-    fo->write(&fat_head, sizeof(fat_head.fat) +
-        fat_head.fat.nfat_arch * sizeof(fat_head.arch[0]));
+    unsigned const nfat = fat_head.fat.nfat_arch;
+    fo->write(&fat_head, sizeof(fat_head.fat) + nfat * sizeof(fat_head.arch[0]));
+
+    // The slices are independent, so pack them concurrently into memory
+    // files and append the results in order.
+    unsigned max_slice = 0;
+    for (unsigned j=0; j < nfat; ++j)
+        max_slice = UPX_MAX(max_slice, (unsigned) fat_head.arch[j].size);
+    unsigned threads = upx::get_num_threads(nfat);
+    // input copy, output and the packer's own buffers
+    threads = upx::limit_threads_by_memory(threads, 4ull * max_slice);
+    bool const parallel = threads > 1 && nfat > 1 && nfat <= N_FAT_ARCH;
+    OutputFile slice_out[N_FAT_ARCH];
+    if (parallel) {
+        MemBuffer slice_in[N_FAT_ARCH];
+        for (unsigned j=0; j < nfat; ++j) {
+            unsigned const size = fat_head.arch[j].size;
+            slice_in[j].alloc(size);
+            fi->set_extent(fat_head.arch[j].offset, size);
+            fi->seek(0, SEEK_SET);
+            fi->readx(slice_in[j], size);
+        }
+        upx::parallel_for(nfat, threads, [&](size_t j) {
+            InputFile sfi;
+            sfi.openMemory(fi->getName(), slice_in[j], fat_head.arch[j].size);
+            slice_out[j].openMemory(fo->getName());
+            packSlice(fat_head.arch[j].cputype, &sfi, &slice_out[j]);
+            slice_out[j].unset_extent();
+            slice_in[j].dealloc();
+        });
+    }
+
     unsigned length = 0;
-    for (unsigned j=0; j < fat_head.fat.nfat_arch; ++j) {
+    for (unsigned j=0; j < nfat; ++j) {
         unsigned base = fo->unset_extent();  // actual length
         base += ~(~0u<<fat_head.arch[j].align) & (0-base);  // align up
         fo->seek(base, SEEK_SET);
         fo->set_extent(base, ~0u);
 
-        ph.u_file_size = fat_head.arch[j].size;
-        fi->set_extent(fat_head.arch[j].offset, fat_head.arch[j].size);
-        fi->seek(0, SEEK_SET);
-        switch (fat_head.arch[j].cputype) {
-        case PackMachFat::CPU_TYPE_I386: {
-            typedef N_Mach::Mach_header<MachClass_LE32::MachITypes> Mach_header;
-            Mach_header hdr;
-            fi->readx(&hdr, sizeof(hdr));
-            if (hdr.filetype==Mach_header::MH_EXECUTE) {
-                PackMachI386 packer(fi);
-                packer.initPackHeader();
-                packer.canPack();
-                packer.updatePackHeader();
-                packer.pack(fo);
-            }
-            else if (hdr.filetype==Mach_header::MH_DYLIB) {
-                PackDylibI386 packer(fi);
-                packer.initPackHeader();
-                packer.canPack();
-                packer.updatePackHeader();
-                packer.pack(fo);
-            }
-        } break;
-        case PackMachFat::CPU_TYPE_X86_64: {
-            typedef N_Mach::Mach_header<MachClass_LE64::MachITypes> Mach_header;
-            Mach_header hdr;
-            fi->readx(&hdr, sizeof(hdr));
-            if (hdr.filetype==Mach_header::MH_EXECUTE) {
-                PackMachAMD64 packer(fi);
-                packer.initPackHeader();
-                packer.canPack();
-                packer.updatePackHeader();
-                packer.pack(fo);
-            }
-            else if (hdr.filetype==Mach_header::MH_DYLIB) {
-                PackDylibAMD64 packer(fi);
-                packer.initPackHeader();
-                packer.canPack();
-                packer.updatePackHeader();
-                packer.pack(fo);
-            }
-        } break;
-        case PackMachFat::CPU_TYPE_POWERPC: {
-            typedef N_Mach::Mach_header<MachClass_BE32::MachITypes> Mach_header;
-            Mach_header hdr;
-            fi->readx(&hdr, sizeof(hdr));
-            if (hdr.filetype==Mach_header::MH_EXECUTE) {
-                PackMachPPC32 packer(fi);
-                packer.initPackHeader();
-                packer.canPack();
-                packer.updatePackHeader();
-                packer.pack(fo);
-            }
-            else if (hdr.filetype==Mach_header::MH_DYLIB) {
-                PackDylibPPC32 packer(fi);
-                packer.initPackHeader();
-                packer.canPack();
-                packer.updatePackHeader();
-                packer.pack(fo);
-            }
-        } break;
-        case PackMachFat::CPU_TYPE_POWERPC64: {
-            typedef N_Mach::Mach_header<MachClass_LE64::MachITypes> Mach_header;
-            Mach_header hdr;
-            fi->readx(&hdr, sizeof(hdr));
-            if (hdr.filetype==Mach_header::MH_EXECUTE) {
-                PackMachPPC64 packer(fi);
-                packer.initPackHeader();
-                packer.canPack();
-                packer.updatePackHeader();
-                packer.pack(fo);
-            }
-            else if (hdr.filetype==Mach_header::MH_DYLIB) {
-                PackDylibPPC64 packer(fi);
-                packer.initPackHeader();
-                packer.canPack();
-                packer.updatePackHeader();
-                packer.pack(fo);
-            }
-        } break;
-        }  // switch cputype
+        if (parallel) {
+            fo->write(slice_out[j].getMemory(), slice_out[j].getMemorySize());
+            slice_out[j].closex();
+        }
+        else {
+            ph.u_file_size = fat_head.arch[j].size;
+            fi->set_extent(fat_head.arch[j].offset, fat_head.arch[j].size);
+            fi->seek(0, SEEK_SET);
+            packSlice(fat_head.arch[j].cputype, fi, fo);
+        }
         fat_head.arch[j].offset = base;
         length = fo->unset_extent();
         fat_head.arch[j].size = length - base;
@@ -2413,8 +2535,7 @@ void PackMachFat::pack(OutputFile *fo)
     fi->set_extent(0, in_size);
 
     fo->seek(0, SEEK_SET);
-    fo->rewrite(&fat_head, sizeof(fat_head.fat) +
-        fat_head.fat.nfat_arch * sizeof(fat_head.arch[0]));
+    fo->rewrite(&fat_head, sizeof(fat_head.fat) + nfat * sizeof(fat_head.arch[0]));
     fo->set_extent(0, length);
 }
 
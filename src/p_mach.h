@@ -759,6 +759,7 @@ public:
 
     virtual tribool canPack() override;
     virtual tribool canUnpack() override;
+    virtual unsigned getAnalyzeRegions(AnalyzeRegion *, unsigned max_regions) override;
     virtual upx_uint64_t get_mod_init_func(Mach_segment_command const *segptr);
     virtual unsigned find_SEGMENT_gap(unsigned const k, unsigned pos_eof);
 
@@ -775,6 +776,7 @@ protected:
         Filter const *ft );
     virtual void defineSymbols(Filter const *);
     virtual void addStubEntrySections(Filter const *);
+    virtual upx_uint64_t getLoaderSizeCacheKey(Filter const *) const override;
 
     static int __acc_cdecl_qsort compare_segment_command(void const *aa, void const *bb);
 
@@ -1253,6 +1255,7 @@ public:
 protected:
     // implementation
     virtual unsigned check_fat_head();  // number of architectures
+    static void packSlice(unsigned cputype, InputFile *fi, OutputFile *fo);
     virtual void pack(OutputFile *fo) override;
     virtual void unpack(OutputFile *fo) override;
     virtual void list() override;
@@ -56,11 +56,10 @@ const int *PackTmt::getFilters() const {
     return filters;
 }
 
-unsigned PackTmt::findOverlapOverhead(const byte *buf, const byte *tbuf, unsigned range,
-                                      unsigned upper_limit) const {
+unsigned PackTmt::alignOverlapOverhead(const PackHeader &xph, unsigned overhead) const {
     // make sure the decompressor will be paragraph aligned
-    unsigned o = super::findOverlapOverhead(buf, tbuf, range, upper_limit);
-    o = ((o + 0x20) & ~0xf) - (ph.u_len & 0xf);
+    unsigned o = super::alignOverlapOverhead(xph, overhead);
+    o = ((o + 0x20) & ~0xf) - (xph.u_len & 0xf);
     return o;
 }
 
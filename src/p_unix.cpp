@@ -37,6 +37,12 @@
 #include "packer.h"
 #include "p_unix.h"
 #include "p_elf.h"
+#include "ui.h"
+#include "util/decision_cache.h"
+#include "util/threads.h"
+#include "util/trace.h"
+
+#include <vector>
 
 // do not change
 #define BLOCKSIZE       (512*1024)
@@ -261,6 +267,7 @@ off_t PackUnix::pack3(OutputFile *fo, Filter &ft)
         // If no filter, then linker is not constructed by side effect
         // of packExtent calling compressWithFilters.
         // This is typical after "/usr/bin/patchelf --set-rpath".
+        upx::TraceScope trace_scope("buildLoader");
         buildLoader(&ft);
     }
     upx_byte *p = getLoader();
@@ -280,6 +287,32 @@ void PackUnix::pack4(OutputFile *fo, Filter &)
     fo->write(&tmp, sizeof(tmp));
 }
 
+// "--blocksize=auto": bigger blocks compress better, but the blocks are
+// the unit of work for the threads, each thread needs about 3 * blocksize
+// of memory, and so does the stub for the decompression.  So aim at one
+// block per thread, as a power of 2 between 256 KiB and 4 MiB.
+unsigned PackUnix::getAutoBlocksize() const
+{
+    unsigned const min_size = 256 * 1024, max_size = 4 * 1024 * 1024;
+    unsigned const num_threads = upx::get_num_threads(256);
+    upx_uint64_t const per_thread = (file_size + num_threads - 1) / num_threads;
+    unsigned size = min_size;
+    while (size < max_size && 2ull * size <= per_thread)
+        size <<= 1;
+    if (opt->memory_limit) {
+        // "--memory-limit": the blocks of all the threads at once
+        upx_uint64_t const n = UPX_MIN(upx_uint64_t(num_threads),
+            upx_uint64_t((file_size + size - 1) / size));
+        while (size > 64 * 1024 && 3 * n * size > MemBuffer::getAvailableBytes())
+            size >>= 1;
+    }
+    if (opt->verbose >= 1)
+        con_fprintf(stdout, "%s: --blocksize=auto: %u KiB for %u thread%s\n",
+            fn_basename(fi->getName()), size >> 10, num_threads,
+            (num_threads == 1) ? "" : "s");
+    return size;
+}
+
 void PackUnix::pack(OutputFile *fo)
 {
     Filter ft(ph.level);
@@ -289,17 +322,28 @@ void PackUnix::pack(OutputFile *fo)
 
     // set options
     blocksize = opt->o_unix.blocksize;
+    if (opt->o_unix.auto_blocksize && blocksize == 0)  // not fixed by canPack()
+        blocksize = getAutoBlocksize();
     if (blocksize <= 0)
         blocksize = BLOCKSIZE;
     if ((off_t)blocksize > file_size)
         blocksize = file_size;
+    if (opt->memory_limit) {
+        // "--memory-limit": input, output and compressor memory per block
+        while (blocksize > 64 * 1024 && 3ull * blocksize > MemBuffer::getAvailableBytes())
+            blocksize >>= 1;
+    }
 
     // init compression buffers
     ibuf.alloc(blocksize);
     obuf.allocForCompression(blocksize);
+    openReuseIndex();
 
     fi->seek(0, SEEK_SET);
-    pack1(fo, ft);  // generate Elf header, etc.
+    {
+        upx::TraceScope trace_scope("pack1");
+        pack1(fo, ft);  // generate Elf header, etc.
+    }
 
     // Shlib probably did not generate Elf header yet.
     if (fo->st_size()) { // Only append if pack1 actually wrote something.
@@ -311,16 +355,25 @@ void PackUnix::pack(OutputFile *fo)
     }
 
     // append the compressed body
-    if (pack2(fo, ft)) {
-        // write block end marker (uncompressed size 0)
-        b_info hdr; memset(&hdr, 0, sizeof(hdr));
-        set_le32(&hdr.sz_cpr, UPX_MAGIC_LE32);
-        fo->write(&hdr, sizeof(hdr));
+    {
+        upx::TraceScope trace_scope("pack2", file_size);
+        if (pack2(fo, ft)) {
+            // write block end marker (uncompressed size 0)
+            b_info hdr; memset(&hdr, 0, sizeof(hdr));
+            set_le32(&hdr.sz_cpr, UPX_MAGIC_LE32);
+            fo->write(&hdr, sizeof(hdr));
+        }
     }
 
-    pack3(fo, ft);  // append loader
+    {
+        upx::TraceScope trace_scope("pack3");
+        pack3(fo, ft);  // append loader
+    }
 
-    pack4(fo, ft);  // append PackHeader and overlay_offset; update Elf header
+    {
+        upx::TraceScope trace_scope("pack4");
+        pack4(fo, ft);  // append PackHeader and overlay_offset; update Elf header
+    }
 
     // finally check the compression ratio
     if (!checkFinalCompressionRatio(fo))
@@ -346,14 +399,69 @@ void PackUnix::packExtent(
         int l = fi->readx(hdr_ibuf, hdr_u_len);
         (void)l;
     }
+    if (ft == nullptr && hdr_u_len == 0 && writePrecompressed(x, fo, b_extra)) {
+        return;
+    }
+    if (ft == nullptr && hdr_u_len == 0 && x.size > (off_t)blocksize) {
+        // independent blocks without filter
+        unsigned const num_threads = upx::get_num_threads(
+            (size_t) ((x.size + blocksize - 1) / blocksize));
+        if (num_threads >= 2) {
+            packExtentParallel(x, fo, b_extra, num_threads);
+            return;
+        }
+    }
     fi->seek(x.offset, SEEK_SET);
+
+    // Overlap the I/O with the compression: while a block gets compressed
+    // the next block is read into rbuf, and the previous compressed block is
+    // written from wbuf, each on a background thread.
+    // Likewise the in-place verify of a block runs on a copy in vbuf, while
+    // the next block gets compressed.
+    bool const pipelined = x.size > (off_t)blocksize && upx::get_num_threads(2) >= 2;
+    MemBuffer rbuf, wbuf, vbuf;
+    unsigned r_len = 0, w_len = 0;
+    PackHeader vph = ph;
+    Filter vft(ph.level);
+    bool v_filtered = false;
+    auto do_read = [&]() { fi->readx(rbuf, r_len); };
+    auto do_write = [&]() { fo->write(wbuf, w_len); };
+    auto do_verify = [&]() {
+        // same as verifyOverlappingDecompression(), but on vph and vbuf
+        unsigned const offset = (vph.u_len + vph.overlap_overhead) - vph.c_len;
+        if (offset + vph.c_len > vbuf.getSize())
+            return;
+        memmove(vbuf + offset, vbuf, vph.c_len);
+        ph_decompress(vph, vbuf + offset, vbuf, true, v_filtered ? &vft : nullptr);
+    };
+    upx::BackgroundTask reader(pipelined), writer(pipelined), verifier(pipelined);
+    if (pipelined) {
+        rbuf.alloc(blocksize);
+        wbuf.allocForCompression(blocksize);
+        vbuf.allocForCompression(blocksize);
+    }
+
+    int l = fi->readx(ibuf, UPX_MIN(x.size, (off_t)blocksize));
     for (off_t rest = x.size; 0 != rest; ) {
         int const filter_strategy = ft ? getStrategy(*ft) : 0;
-        int l = fi->readx(ibuf, UPX_MIN(rest, (off_t)blocksize));
         if (l == 0) {
             break;
         }
+        if (ft && opt->o_unix.split_blocks) {
+            // "--split-blocks": end the block where the kind of content
+            // changes, so that the rest gets its own filter and method
+            // in the next block; b_info has the filter of each block.
+            unsigned const cut = mem_content_boundary(ibuf, l);
+            if (cut < (unsigned) l) {
+                l = cut;
+                fi->seek(x.offset + (x.size - rest) + l, SEEK_SET);
+            }
+        }
         rest -= l;
+        r_len = pipelined ? (unsigned) UPX_MIN(rest, (off_t)blocksize) : 0;
+        if (r_len) {
+            reader.start(do_read);
+        }
 
         // Note: compression for a block can fail if the
         //       file is e.g. blocksize + 1 bytes long
@@ -378,6 +486,19 @@ void PackUnix::packExtent(
             compressWithFilters(ft, OVERHEAD, NULL_cconf, filter_strategy,
                                 0, 0, 0, hdr_ibuf, hdr_u_len, inhibit_compression_check);
         }
+        else if (hdr_u_len == 0 && reuseBlock(ph, ibuf, obuf)) {
+            // copied from "--reuse-from"; update the checksums as compress() would
+            ph.saved_u_adler = ph.u_adler;
+            ph.saved_c_adler = ph.c_adler;
+            ph.u_adler = upx_adler32(ibuf, ph.u_len, ph.u_adler);
+            ph.c_adler = upx_adler32(obuf, ph.c_len, ph.c_adler);
+        }
+        else if (hdr_u_len == 0 && skipCompression(ibuf, ph.u_len)) {
+            // stored as is below; update u_adler as compress() would
+            ph.saved_u_adler = ph.u_adler;
+            ph.saved_c_adler = ph.c_adler;
+            ph.u_adler = upx_adler32(ibuf, ph.u_len, ph.u_adler);
+        }
         else {
             (void) compress(ibuf, ph.u_len, obuf);    // ignore return value
         }
@@ -400,17 +521,12 @@ void PackUnix::packExtent(
         }
 
         // write block sizes
+        writer.wait();  // keep the order of the output
         b_info tmp;
         if (hdr_u_len) {
-            unsigned hdr_c_len = 0;
-            MemBuffer hdr_obuf;
-            hdr_obuf.allocForCompression(hdr_u_len);
-            int r = upx_compress(hdr_ibuf, hdr_u_len, hdr_obuf, &hdr_c_len, nullptr,
-                ph_forced_method(ph.method), 10, nullptr, nullptr);
-            if (r != UPX_E_OK)
-                throwInternalError("header compression failed");
-            if (hdr_c_len >= hdr_u_len)
-                throwInternalError("header compression size increase");
+            // usually already compressed by compressWithFilters()
+            const byte *hdr_obuf = nullptr;
+            unsigned const hdr_c_len = compressHeader(hdr_ibuf, hdr_u_len, ph.method, &hdr_obuf);
             ph.saved_u_adler = upx_adler32(hdr_ibuf, hdr_u_len, init_u_adler);
             ph.saved_c_adler = upx_adler32(hdr_obuf, hdr_c_len, init_c_adler);
             ph.u_adler = upx_adler32(ibuf, ph.u_len, ph.saved_u_adler);
@@ -449,20 +565,563 @@ void PackUnix::packExtent(
         }
         // write compressed data
         if (ph.c_len < ph.u_len) {
-            fo->write(obuf, ph.c_len);
+            if (pipelined) {
+                w_len = ph.c_len;
+                memcpy(wbuf, obuf, w_len);  // obuf gets clobbered by the verify
+                writer.start(do_write);
+            }
+            else {
+                fo->write(obuf, ph.c_len);
+            }
             total_out += ph.c_len;
-            // Checks ph.u_adler after decompression, after unfiltering
-            verifyOverlappingDecompression(ft);
+            // Checks ph.u_adler after decompression, after unfiltering.
+            // The last block is verified in obuf, as callers may look at it.
+            if (pipelined && 0 != rest && !ph_skipVerify(ph)) {
+                verifier.wait();
+                vph = ph;
+                v_filtered = ft != nullptr;
+                if (ft)
+                    vft = *ft;
+                memcpy(vbuf, obuf, ph.c_len);
+                verifier.start(do_verify);
+            }
+            else {
+                verifyOverlappingDecompression(ft);
+            }
         }
         else {
-            fo->write(ibuf, ph.u_len);
+            if (pipelined) {
+                w_len = ph.u_len;
+                memcpy(wbuf, ibuf, w_len);
+                writer.start(do_write);
+            }
+            else {
+                fo->write(ibuf, ph.u_len);
+            }
             total_out += ph.u_len;
         }
 
         total_in += ph.u_len;
+
+        // get the next block
+        if (r_len) {
+            reader.wait();
+            memcpy(ibuf, rbuf, r_len);
+            l = r_len;
+        }
+        else if (0 != rest) {
+            l = fi->readx(ibuf, UPX_MIN(rest, (off_t)blocksize));
+        }
+    }
+    verifier.wait();
+    writer.wait();
+}
+
+/*************************************************************************
+// PackedBlock - one block compressed on a worker thread, see compressBlock()
+**************************************************************************/
+
+struct PackUnix::PackedBlock {
+    MemBuffer ibuf, obuf, vbuf;  // vbuf: for verifyOverlappingDecompression()
+    PackHeader ph;
+    bool compressed;  // return value of compress()
+};
+
+bool PackUnix::skipCompression(const byte *buf, unsigned len) const
+{
+    // "--brute" asks for every last byte, even from a .zip
+    return !opt->all_methods && !opt->ultra_brute && mem_looks_incompressible(buf, len);
+}
+
+// compress and verify b.ibuf; see packExtent()
+void PackUnix::compressBlock(PackedBlock &b) const
+{
+    PackHeader &bph = b.ph;
+    bool const reused = reuseBlock(bph, b.ibuf, b.obuf);
+    if (!reused && skipCompression(b.ibuf, bph.u_len)) {
+        b.compressed = false;  // stored: (bph.c_len == bph.u_len)
+        return;
+    }
+    b.compressed = reused || compress(bph, b.ibuf, bph.u_len, b.obuf, NULL_cconf, nullptr);
+    if (bph.c_len < bph.u_len) {
+        bph.overlap_overhead = OVERHEAD;
+        if (!ph_testOverlappingDecompression(bph, b.obuf, b.ibuf, bph.overlap_overhead)) {
+            // not in-place compressible
+            bph.c_len = bph.u_len;
+        }
+    }
+    if (bph.c_len < bph.u_len && !ph_skipVerify(bph)) {
+        // like verifyOverlappingDecompression(), but keep obuf
+        unsigned const offset = (bph.u_len + bph.overlap_overhead) - bph.c_len;
+        if (offset + bph.c_len <= b.vbuf.getSize()) {
+            PackHeader vph = bph;
+            memcpy(b.vbuf + offset, b.obuf, bph.c_len);
+            ph_decompress(vph, b.vbuf + offset, b.vbuf, false, nullptr);
+            if (upx_adler32(b.vbuf, bph.u_len) != upx_adler32(b.ibuf, bph.u_len))
+                throwChecksumError();
+        }
+    }
+}
+
+// Chain the checksums of a compressed block to ph, and write it.
+// Only the fields that compressBlock() found are taken from b.ph,
+// because other fields of ph may have changed since b.ph was copied.
+void PackUnix::writePackedBlock(PackedBlock &b, OutputFile *fo, unsigned b_extra,
+    unsigned init_c_adler)
+{
+    PackHeader const &bph = b.ph;
+    if (uip->ui_pass >= 0)
+        uip->ui_pass++;
+    ph.u_len = bph.u_len;
+    ph.c_len = bph.c_len;
+    ph.compress_result = bph.compress_result;
+    ph.max_offset_found = bph.max_offset_found;
+    ph.max_match_found = bph.max_match_found;
+    ph.max_run_found = bph.max_run_found;
+    ph.first_offset_found = bph.first_offset_found;
+    ph.overlap_overhead = bph.overlap_overhead;
+    ph.saved_u_adler = ph.u_adler;
+    ph.saved_c_adler = ph.c_adler;
+    ph.u_adler = upx_adler32(b.ibuf, ph.u_len, ph.u_adler);
+    if (b.compressed)
+        ph.c_adler = upx_adler32(b.obuf, ph.c_len, ph.c_adler);
+    if (ph.c_len >= ph.u_len) {
+        // block is not compressible
+        ph.c_len = ph.u_len;
+        ph.c_adler = upx_adler32(b.ibuf, ph.u_len, init_c_adler);
+    }
+
+    // write block sizes
+    b_info tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    set_te32(&tmp.sz_unc, ph.u_len);
+    set_te32(&tmp.sz_cpr, ph.c_len);
+    if (ph.c_len < ph.u_len) {
+        tmp.b_method = (unsigned char) ph.method;
+    }
+    tmp.b_extra = b_extra;
+    fo->write(&tmp, sizeof(tmp));
+    total_out += sizeof(tmp);
+    b_len += sizeof(b_info);
+
+    // write compressed data
+    if (ph.c_len < ph.u_len) {
+        fo->write(b.obuf, ph.c_len);
+    }
+    else {
+        fo->write(b.ibuf, ph.u_len);
+    }
+    total_out += ph.c_len;
+    total_in += ph.u_len;
+}
+
+/*************************************************************************
+// packExtentParallel - same output as packExtent() without filter and
+// header, but compress num_threads blocks at once. The checksums are
+// chained in block order afterwards, and the blocks get written in order.
+**************************************************************************/
+
+void PackUnix::packExtentParallel(
+    const Extent &x,
+    OutputFile *fo,
+    unsigned b_extra,
+    unsigned num_threads
+)
+{
+    unsigned const init_c_adler = ph.c_adler;
+    std::unique_ptr<PackedBlock[]> blocks(new PackedBlock[num_threads]);
+
+    fi->seek(x.offset, SEEK_SET);
+    for (off_t rest = x.size; 0 != rest; ) {
+        // read the next batch of blocks
+        unsigned n = 0;
+        for (; n < num_threads && 0 != rest; n++) {
+            PackedBlock &b = blocks[n];
+            if (b.ibuf.getVoidPtr() == nullptr) {
+                b.ibuf.alloc(blocksize);
+                b.obuf.allocForCompression(blocksize);
+                b.vbuf.allocForCompression(blocksize);
+            }
+            int l = fi->readx(b.ibuf, UPX_MIN(rest, (off_t)blocksize));
+            rest -= l;
+            b.ph = ph;
+            b.ph.c_len = b.ph.u_len = l;
+            b.ph.overlap_overhead = 0;
+        }
+
+        upx::parallel_for(n, num_threads, [&](size_t j) { compressBlock(blocks[j]); });
+
+        // chain the checksums, and write the blocks in order
+        for (unsigned j = 0; j < n; j++) {
+            writePackedBlock(blocks[j], fo, b_extra, init_c_adler);
+        }
+        if (0 == rest) {
+            // leave the last block in ibuf, as packExtent() does
+            memcpy(ibuf, blocks[n - 1].ibuf, ph.u_len);
+        }
+    }
+}
+
+/*************************************************************************
+// precompressExtents - compress whole Extents without filter on a
+// background thread, so that for example the .rodata and .data PT_LOADs
+// of a big program get compressed while the method and filter search for
+// its .text runs.  The blocks are read right away, so that the caller
+// still owns the input file, and are kept until packExtent() asks for the
+// same Extent.  The result is only used if ph.method and ph.level did not
+// change in the meantime; otherwise packExtent() just does the work again.
+**************************************************************************/
+
+struct PackUnix::Precompressed {
+    struct Item {
+        Extent x;
+        unsigned first, count;  // range in blocks[]
+    };
+    const PackUnix *packer;
+    int method, level;
+    unsigned nitems, nblocks, num_threads;
+    std::unique_ptr<Item[]> items;
+    std::unique_ptr<PackedBlock[]> blocks;
+    upx::BackgroundTask task;  // last member: gets destroyed (i.e. waited for) first
+};
+
+void PackUnix::precompressExtents(const Extent *xs, unsigned n)
+{
+    precompressed.reset();
+    // Everything here is held in memory until packExtent() asks for it,
+    // so stop at a fixed budget; the rest streams through packExtent().
+    upx_uint64_t const max_total = 128 * 1024 * 1024;
+    unsigned nblocks = 0;
+    upx_uint64_t total = 0;
+    for (unsigned k = 0; k < n; ++k) {
+        if (xs[k].size > 0) {
+            if (total + xs[k].size > max_total) {
+                n = k;
+                break;
+            }
+            nblocks += (unsigned) ((xs[k].size + blocksize - 1) / blocksize);
+            total += xs[k].size;
+        }
+    }
+    if (nblocks == 0)
+        return;
+    // the calling thread keeps one worker busy with the other Extents
+    unsigned const num_threads = upx::get_num_threads(size_t(nblocks) + 1);
+    if (num_threads < 2)
+        return;
+    // "--memory-limit": input, output and verify buffer per block
+    if (opt->memory_limit && 3 * total > MemBuffer::getAvailableBytes())
+        return;
+
+    std::unique_ptr<Precompressed> pc(new Precompressed);
+    pc->packer = this;
+    pc->method = ph.method;
+    pc->level = ph.level;
+    pc->nitems = 0;
+    pc->nblocks = nblocks;
+    pc->num_threads = num_threads - 1;
+    pc->items.reset(new Precompressed::Item[n]);
+    pc->blocks.reset(new PackedBlock[nblocks]);
+
+    upx_off_t const pos = fi->tell();
+    unsigned j = 0;
+    for (unsigned k = 0; k < n; ++k) {
+        if (xs[k].size <= 0)
+            continue;
+        Precompressed::Item &item = pc->items[pc->nitems++];
+        item.x = xs[k];
+        item.first = j;
+        fi->seek(xs[k].offset, SEEK_SET);
+        for (off_t rest = xs[k].size; 0 != rest; ++j) {
+            PackedBlock &b = pc->blocks[j];
+            unsigned const l = (unsigned) UPX_MIN(rest, (off_t)blocksize);
+            b.ibuf.alloc(l);
+            b.obuf.allocForCompression(l);
+            b.vbuf.allocForCompression(l);
+            fi->readx(b.ibuf, l);
+            rest -= l;
+            b.ph = ph;
+            b.ph.c_len = b.ph.u_len = l;
+            b.ph.overlap_overhead = 0;
+        }
+        item.count = j - item.first;
+    }
+    fi->seek(pos, SEEK_SET);
+
+    pc->task.start([](void *user) {
+        Precompressed *const p = (Precompressed *) user;
+        upx::parallel_for(p->nblocks, p->num_threads, [p](size_t i) {
+            PackedBlock &b = p->blocks[i];
+            p->packer->compressBlock(b);
+            b.vbuf.dealloc();
+        });
+    }, pc.get());
+    precompressed = std::move(pc);
+}
+
+// packExtent() without filter and header: use the blocks of x if they
+// were compressed by precompressExtents(); re-throws their exception
+bool PackUnix::writePrecompressed(const Extent &x, OutputFile *fo, unsigned b_extra)
+{
+    Precompressed *const pc = precompressed.get();
+    if (pc == nullptr)
+        return false;
+    pc->task.wait();
+    Precompressed::Item *item = nullptr;
+    for (unsigned k = 0; k < pc->nitems; ++k) {
+        if (pc->items[k].x.offset == x.offset && pc->items[k].x.size == x.size
+        &&  pc->items[k].count != 0) {
+            item = &pc->items[k];
+            break;
+        }
+    }
+    if (item == nullptr)
+        return false;
+    unsigned const first = item->first, count = item->count;
+    item->count = 0;  // use only once
+    bool const ok = (pc->method == ph.method && pc->level == ph.level);
+    if (ok) {
+        unsigned const init_c_adler = ph.c_adler;
+        for (unsigned j = 0; j < count; ++j) {
+            writePackedBlock(pc->blocks[first + j], fo, b_extra, init_c_adler);
+        }
+        // leave the last block in ibuf, and the file position, as packExtent() does
+        memcpy(ibuf, pc->blocks[first + count - 1].ibuf, ph.u_len);
+        fi->seek(x.offset + x.size, SEEK_SET);
+    }
+    for (unsigned j = 0; j < count; ++j) {
+        pc->blocks[first + j].ibuf.dealloc();
+        pc->blocks[first + j].obuf.dealloc();
+    }
+    return ok;
+}
+
+/*************************************************************************
+// ReuseIndex - "--reuse-from=FILE": the blocks of an older packed file,
+// by a hash of their uncompressed data, so that packing a rebuilt program
+// can copy the compressed bytes of each unchanged block.  Only blocks
+// without filter are used.  Every block gets decompressed and hashed here,
+// and packExtent() still tests the overlapping decompression, so a wrong
+// FILE only costs time.
+**************************************************************************/
+
+struct PackUnix::ReuseIndex {
+    struct Entry {
+        upx::DecisionCacheKey key;  // of the uncompressed data
+        unsigned u_len;  // 0: empty slot
+        unsigned c_len;
+        unsigned offset;  // of the compressed data in old
+        int method;
+    };
+    MemBuffer old;  // the whole old file
+    std::unique_ptr<Entry[]> entries;
+    unsigned capacity;  // a power of 2, at least twice the number of entries
+};
+
+static upx::DecisionCacheKey reuse_key(const byte *buf, unsigned len)
+{
+    upx::DecisionHasher hasher;
+    hasher.add(buf, len);
+    return hasher.get();
+}
+
+void PackUnix::openReuseIndex()
+{
+    reuse.reset();
+    if (opt->reuse_from == nullptr)
+        return;
+    std::unique_ptr<ReuseIndex> ri(new ReuseIndex);
+    InputFile f;
+    f.open(opt->reuse_from, O_RDONLY | O_BINARY);
+    upx_off_t const fsize = f.st_size();
+    if (fsize < 36 || !mem_size_valid_bytes(fsize))
+        throwIOException("--reuse-from: bad file size");
+    unsigned const size = (unsigned) fsize;
+    f.mapx(ri->old, 0, size);
+    f.closex();
+    byte const *const old = ri->old;
+
+    // pack() writes l_info, p_info, and then the chain of b_info
+    auto walk = [&](unsigned pos, unsigned old_blocksize, unsigned *n) {
+        for (*n = 0; pos + sizeof(b_info) <= size; ++*n) {
+            b_info h; memcpy(&h, old + pos, sizeof(h));
+            unsigned const sz_unc = get_te32(&h.sz_unc);
+            unsigned const sz_cpr = get_te32(&h.sz_cpr);
+            if (sz_unc == 0 || sz_cpr == 0 || sz_cpr > sz_unc || sz_unc > old_blocksize
+            ||  sz_cpr > size - (pos + sizeof(h)))
+                break;
+            pos += sizeof(h) + sz_cpr;
+        }
+    };
+    unsigned first = 0, old_blocksize = 0, nblocks = 0;
+    for (unsigned off = 0; off + 36 <= size; ++off) {
+        if (get_le32(old + off + 4) != UPX_MAGIC_LE32 || old[off + 11] != getFormat())
+            continue;
+        p_info hbuf; memcpy(&hbuf, old + off + sizeof(l_info), sizeof(hbuf));
+        old_blocksize = get_te32(&hbuf.p_blocksize);
+        if (old_blocksize == 0 || !mem_size_valid_bytes(old_blocksize))
+            continue;
+        walk(off + sizeof(l_info) + sizeof(p_info), old_blocksize, &nblocks);
+        if (nblocks != 0) {
+            first = off + sizeof(l_info) + sizeof(p_info);
+            break;
+        }
+    }
+    if (nblocks == 0)
+        throwIOException("--reuse-from: no packed blocks found");
+
+    ri->capacity = 64;
+    while (ri->capacity < 2 * nblocks)
+        ri->capacity <<= 1;
+    ri->entries.reset(new ReuseIndex::Entry[ri->capacity]);
+    memset(ri->entries.get(), 0, ri->capacity * sizeof(ReuseIndex::Entry));
+    MemBuffer ubuf(old_blocksize);
+    for (unsigned pos = first, j = 0; j < nblocks; ++j) {
+        b_info h; memcpy(&h, old + pos, sizeof(h));
+        unsigned const sz_unc = get_te32(&h.sz_unc);
+        unsigned const sz_cpr = get_te32(&h.sz_cpr);
+        pos += sizeof(h);
+        unsigned new_len = sz_unc;
+        upx_compress_result_t cresult;
+        if (sz_cpr < sz_unc && h.b_ftid == 0
+        &&  UPX_E_OK == upx_decompress(old + pos, sz_cpr, ubuf, &new_len, h.b_method, &cresult)
+        &&  new_len == sz_unc) {
+            upx::DecisionCacheKey const key = reuse_key(ubuf, sz_unc);
+            for (unsigned i = (unsigned) key.h[0];; ++i) {
+                ReuseIndex::Entry &e = ri->entries[i & (ri->capacity - 1)];
+                if (e.u_len == 0) {
+                    e.key = key;
+                    e.u_len = sz_unc;
+                    e.c_len = sz_cpr;
+                    e.offset = pos;
+                    e.method = h.b_method;
+                    break;
+                }
+                if (0 == memcmp(&e.key, &key, sizeof(key)) && e.u_len == sz_unc)
+                    break;  // keep the first one
+            }
+        }
+        pos += sz_cpr;
+    }
+    reuse = std::move(ri);
+}
+
+// copy the compressed data of [in, +xph.u_len) from "--reuse-from"
+bool PackUnix::reuseBlock(PackHeader &xph, const byte *in, byte *out) const
+{
+    ReuseIndex const *const ri = reuse.get();
+    if (ri == nullptr)
+        return false;
+    upx::DecisionCacheKey const key = reuse_key(in, xph.u_len);
+    for (unsigned i = (unsigned) key.h[0];; ++i) {
+        ReuseIndex::Entry const &e = ri->entries[i & (ri->capacity - 1)];
+        if (e.u_len == 0)
+            return false;
+        if (0 != memcmp(&e.key, &key, sizeof(key)) || e.u_len != xph.u_len)
+            continue;
+        if (M_IS_LZMA(e.method) && !callsManyTimes(getFormat()))
+            return false;  // the stub uses the LZMA properties of the main method
+        if (e.method != ph_forced_method(xph.method))
+            return false;
+        memcpy(out, ri->old + e.offset, e.c_len);
+        xph.c_len = e.c_len;
+        return true;
+    }
+}
+
+/*************************************************************************
+// decompress and unfilter a batch of blocks in parallel;
+// used by unpackExtentParallel() and unpackBlocksParallel()
+**************************************************************************/
+
+namespace {
+struct UnpackBlock {
+    MemBuffer cbuf;  // compressed data
+    MemBuffer ubuf;  // decompressed data
+    const byte *cptr = nullptr;  // compressed data outside of cbuf, if not null
+    unsigned sz_unc, sz_cpr;
+    int ftid;
+    unsigned cto;
+
+    void alloc(unsigned blocksize, unsigned overhead) {
+        if (cbuf.getVoidPtr() == nullptr) {
+            cbuf.alloc(blocksize + overhead);  // see unpack()
+            ubuf.alloc(blocksize);
+        }
+    }
+    const byte *input() const { return cptr ? cptr : cbuf.raw_ptr(); }
+    const byte *data() const { return (sz_cpr < sz_unc) ? ubuf.raw_ptr() : input(); }
+};
+} // namespace
+
+struct PackUnix::BlockIndex {
+    struct Entry {
+        upx_off_t offset;  // file offset of the compressed data
+        unsigned sz_unc, sz_cpr;
+        int ftid;
+        unsigned cto;
+    };
+    std::vector<Entry> blocks;
+};
+
+// Walk the b_info chain from the current file position up to and including
+// the EOF header, but only read the headers; afterwards every block can be
+// found in O(1), and the payloads can be mapped in one go.
+// Same checks as the block loop of unpack().
+void PackUnix::readBlockIndex(BlockIndex &index)
+{
+    upx_off_t pos = fi->tell();
+    for (;;) {
+        b_info bhdr; memset(&bhdr, 0, sizeof(bhdr));
+        fi->seek(pos, SEEK_SET);
+        fi->readx(&bhdr, szb_info);
+        pos += szb_info;
+        unsigned const sz_unc = get_te32(&bhdr.sz_unc);
+        unsigned const sz_cpr = get_te32(&bhdr.sz_cpr);
+        if (sz_unc == 0) {                 // uncompressed size 0 -> EOF
+            // note: must reload sz_cpr as magic is always stored le32
+            if (get_le32(&bhdr.sz_cpr) != UPX_MAGIC_LE32)
+                throwCompressedDataViolation();
+            break;
+        }
+        if (sz_cpr == 0 || sz_cpr > sz_unc || sz_unc > blocksize)
+            throwCompressedDataViolation();
+        if (sz_cpr > fi->st_size() - pos)
+            throwCompressedDataViolation();
+        index.blocks.push_back(BlockIndex::Entry{pos, sz_unc, sz_cpr, bhdr.b_ftid, bhdr.b_cto8});
+        pos += sz_cpr;
     }
 }
 
+// If fo_at is set then each worker also writes its block right away at its
+// final position, starting at pos; see OutputFile::writeAt().
+static void decompressBlocks(const PackHeader &ph, UnpackBlock *blocks, unsigned n,
+    unsigned num_threads, OutputFile *fo_at = nullptr, upx_off_t pos = 0)
+{
+    std::vector<upx_off_t> at(fo_at ? n : 0);
+    for (unsigned j = 0; j < at.size(); j++) {
+        at[j] = pos;
+        pos += blocks[j].sz_unc;
+    }
+    upx::parallel_for(n, num_threads, [&](size_t j) {
+        UnpackBlock &b = blocks[j];
+        if (b.sz_cpr < b.sz_unc) {
+            PackHeader xph = ph;
+            xph.u_len = b.sz_unc;
+            xph.c_len = b.sz_cpr;
+            ph_decompress(xph, b.input(), b.ubuf, false, nullptr);
+            if (b.ftid) {
+                Filter ft(ph.level);
+                ft.init(b.ftid, 0);
+                ft.cto = (unsigned char) b.cto;
+                ft.unfilter(b.ubuf, b.sz_unc);
+            }
+        }
+        if (fo_at)
+            fo_at->writeAt(at[j], b.data(), b.sz_unc);
+    });
+}
+
 // Consumes b_info header block and sz_cpr data block from input file 'fi'.
 // De-compresses; appends to output file 'fo' unless rewrite or peeking.
 // For "peeking" without writing: set (fo = nullptr), (is_rewrite = -1)
@@ -473,6 +1132,15 @@ unsigned PackUnix::unpackExtent(unsigned wanted, OutputFile *fo,
     int is_rewrite // 0(false): write; 1(true): rewrite; -1: no write
 )
 {
+    // "upx -t --checksum-only": these blocks are not needed, so do not decompress them
+    bool const checksum_only = !fo && 0 == is_rewrite && opt->o_unix.checksum_only;
+    if (0 == is_rewrite && wanted > blocksize && !checksum_only) {
+        unsigned const num_threads = upx::get_num_threads(wanted / blocksize + 1);
+        if (num_threads >= 2) {
+            unpackExtentParallel(wanted, fo, c_adler, u_adler, first_PF_X, num_threads);
+            return 0;
+        }
+    }
     b_info hdr; memset(&hdr, 0, sizeof(hdr));
     unsigned inlen = 0; // output index (if-and-only-if peeking)
     while (wanted) {
@@ -497,6 +1165,12 @@ unsigned PackUnix::unpackExtent(unsigned wanted, OutputFile *fo,
         total_in += sz_cpr;
         // update checksum of compressed data
         c_adler = upx_adler32(ibuf + j, sz_cpr, c_adler);
+        if (checksum_only) {
+            if (wanted < (unsigned)sz_unc) // mismatched end-of-block
+                throwCantUnpack("corrupt b_info");
+            wanted -= sz_unc;
+            continue;
+        }
 
         if (sz_cpr < sz_unc) { // block was compressed
             decompress(ibuf+j, ibuf+inlen, false);
@@ -550,6 +1224,146 @@ unsigned PackUnix::unpackExtent(unsigned wanted, OutputFile *fo,
     return inlen;
 }
 
+// Same as unpackExtent() when writing or testing, but decompress
+// num_threads blocks at once; the checksums and writes stay in order.
+void PackUnix::unpackExtentParallel(unsigned wanted, OutputFile *fo,
+    unsigned &c_adler, unsigned &u_adler, bool first_PF_X, unsigned num_threads)
+{
+    std::unique_ptr<UnpackBlock[]> blocks(new UnpackBlock[num_threads]);
+    // the workers write their blocks themselves; only the checksums stay in order
+    OutputFile *const fo_at = (fo && fo->canWriteAt()) ? fo : nullptr;
+    upx_off_t pos = 0;
+    if (fo_at) {
+        fo->flush();
+        pos = fo->tell();
+        fo->preallocate(pos, wanted);
+    }
+    while (wanted) {
+        // read the next batch of blocks
+        unsigned n = 0;
+        for (; n < num_threads && wanted; n++) {
+            b_info hdr; memset(&hdr, 0, sizeof(hdr));
+            fi->readx(&hdr, szb_info);
+            int const sz_unc = get_te32(&hdr.sz_unc);
+            int const sz_cpr = get_te32(&hdr.sz_cpr);
+            if (sz_unc <= 0 || sz_cpr <= 0)
+                throwCantUnpack("corrupt b_info");
+            if (sz_cpr > sz_unc || sz_unc > (int)blocksize)
+                throwCantUnpack("corrupt b_info");
+            if (!fo && wanted < (unsigned)sz_unc) // mismatched end-of-block
+                throwCantUnpack("corrupt b_info");
+            UnpackBlock &b = blocks[n];
+            b.alloc(blocksize, OVERHEAD);
+            b.sz_unc = sz_unc;
+            b.sz_cpr = sz_cpr;
+            b.cto = hdr.b_cto8;
+            b.ftid = 0;
+            if (sz_cpr < sz_unc) {
+                if (12==szb_info) { // modern per-block filter
+                    b.ftid = hdr.b_ftid;
+                }
+                else if (first_PF_X) { // Elf32_Ehdr is never filtered
+                    first_PF_X = false;
+                }
+                else { // ancient per-file filter
+                    b.ftid = ph.filter;
+                }
+            }
+            fi->readx(b.cbuf, sz_cpr);
+            total_in += sz_cpr;
+            wanted -= sz_unc;
+        }
+
+        decompressBlocks(ph, blocks.get(), n, num_threads, fo_at, pos);
+
+        for (unsigned j = 0; j < n; j++) {
+            UnpackBlock const &b = blocks[j];
+            c_adler = upx_adler32(b.input(), b.sz_cpr, c_adler);
+            u_adler = upx_adler32(b.data(), b.sz_unc, u_adler);
+            if (fo_at) {
+                pos += b.sz_unc;
+                total_out += b.sz_unc;
+            }
+            else if (fo) {
+                fo->write(b.data(), b.sz_unc);
+                total_out += b.sz_unc;
+            }
+        }
+        // same state as after unpackExtent()
+        UnpackBlock const &last = blocks[n - 1];
+        ph.u_len = last.sz_unc;
+        ph.c_len = last.sz_cpr;
+        ph.filter_cto = last.cto;
+        if (wanted == 0)
+            memcpy(ibuf, last.data(), last.sz_unc);
+    }
+    if (fo_at)
+        fo->seek(pos, SEEK_SET);
+}
+
+// Same as the block loop of unpack(), but decompress num_threads blocks
+// at once; the checksums and writes stay in order.
+void PackUnix::unpackBlocksParallel(OutputFile *fo, unsigned &c_adler, unsigned &u_adler,
+    unsigned num_threads)
+{
+    // index the chain, then map all compressed data at once: the workers
+    // decompress straight from the file, with no serial read of each batch
+    BlockIndex bi;
+    readBlockIndex(bi);
+    std::vector<BlockIndex::Entry> const &index = bi.blocks;
+    if (index.empty())
+        return;
+    upx_off_t const eof_pos = fi->tell();
+    upx_off_t const first = index.front().offset;
+    MemBuffer cdata;
+    fi->mapx(cdata, first, index.back().offset + index.back().sz_cpr - first);
+    fi->seek(eof_pos, SEEK_SET);
+
+    // the final layout is known: preallocate it, and let the workers write
+    // their blocks at their offsets; only the checksums stay in order
+    OutputFile *const fo_at = (fo && fo->canWriteAt()) ? fo : nullptr;
+    upx_off_t pos = 0;
+    if (fo_at) {
+        upx_off_t total = 0;
+        for (BlockIndex::Entry const &e : index)
+            total += e.sz_unc;
+        fo->flush();
+        pos = fo->tell();
+        fo->preallocate(pos, total);
+    }
+    std::unique_ptr<UnpackBlock[]> blocks(new UnpackBlock[num_threads]);
+    for (size_t k0 = 0; k0 < index.size(); k0 += num_threads) {
+        unsigned const n = (unsigned) UPX_MIN(index.size() - k0, (size_t) num_threads);
+        for (unsigned j = 0; j < n; j++) {
+            BlockIndex::Entry const &e = index[k0 + j];
+            UnpackBlock &b = blocks[j];
+            if (b.ubuf.getVoidPtr() == nullptr)
+                b.ubuf.alloc(blocksize);
+            b.cptr = cdata + (e.offset - first);
+            b.sz_unc = e.sz_unc;
+            b.sz_cpr = e.sz_cpr;
+            b.ftid = e.ftid;
+            b.cto = e.cto;
+        }
+
+        decompressBlocks(ph, blocks.get(), n, num_threads, fo_at, pos);
+
+        for (unsigned j = 0; j < n; j++) {
+            UnpackBlock const &b = blocks[j];
+            c_adler = upx_adler32(b.input(), b.sz_cpr, c_adler);
+            u_adler = upx_adler32(b.data(), b.sz_unc, u_adler);
+            total_in  += b.sz_cpr;
+            total_out += b.sz_unc;
+            if (fo_at)
+                pos += b.sz_unc;
+            else if (fo)
+                fo->write(b.data(), b.sz_unc);
+        }
+    }
+    if (fo_at)
+        fo->seek(pos, SEEK_SET);
+}
+
 /*************************************************************************
 // Generic Unix canUnpack().
 **************************************************************************/
@@ -642,6 +1456,11 @@ void PackUnix::unpack(OutputFile *fo)
     total_in = 0;
     total_out = 0;
     memset(&bhdr, 0, sizeof(bhdr));
+    unsigned const num_threads = upx::get_num_threads(orig_file_size / blocksize + 1);
+    if (num_threads >= 2) {
+        unpackBlocksParallel(fo, c_adler, u_adler, num_threads);
+    }
+    else
     for (;;)
     {
 #define buf ibuf
@@ -71,6 +71,7 @@ protected:
     virtual void updateLoader(OutputFile *) = 0;
 
     virtual void writePackHeader(OutputFile *fo);
+    unsigned getAutoBlocksize() const;
 
     virtual bool checkCompressionRatio(unsigned, unsigned) const override;
 
@@ -83,11 +84,38 @@ protected:
         Filter *, OutputFile *,
         unsigned hdr_len = 0, unsigned b_extra = 0 ,
         bool inhibit_compression_check = false);
+    void packExtentParallel(const Extent &x, OutputFile *fo, unsigned b_extra,
+        unsigned num_threads);
+    // Compress Extents without filter ahead of time on a background thread,
+    // while the caller goes on with other Extents; packExtent() then only
+    // chains the checksums and writes the blocks. (n == 0) drops them all.
+    void precompressExtents(const Extent *xs, unsigned n);
+    struct PackedBlock;
+    struct Precompressed;
+    void compressBlock(PackedBlock &b) const;  // thread-safe
+    // store a block without trying to compress it; see mem_looks_incompressible()
+    bool skipCompression(const byte *buf, unsigned len) const;
+    void writePackedBlock(PackedBlock &b, OutputFile *fo, unsigned b_extra,
+        unsigned init_c_adler);
+    bool writePrecompressed(const Extent &x, OutputFile *fo, unsigned b_extra);
+    std::unique_ptr<Precompressed> precompressed;
+    // "--reuse-from": the compressed blocks of an older packed file
+    struct ReuseIndex;
+    void openReuseIndex();
+    bool reuseBlock(PackHeader &xph, const byte *in, byte *out) const;  // thread-safe
+    std::unique_ptr<ReuseIndex> reuse;
     virtual unsigned unpackExtent(unsigned wanted, OutputFile *fo,
         unsigned &c_adler, unsigned &u_adler,
         bool first_PF_X,
         int is_rewrite = false  // 0(false): write; 1(true): rewrite; -1: no write
         );
+    void unpackExtentParallel(unsigned wanted, OutputFile *fo,
+        unsigned &c_adler, unsigned &u_adler, bool first_PF_X, unsigned num_threads);
+    void unpackBlocksParallel(OutputFile *fo, unsigned &c_adler, unsigned &u_adler,
+        unsigned num_threads);
+    // host-side index of the b_info chain: the offset, sizes and filter of every block
+    struct BlockIndex;
+    void readBlockIndex(BlockIndex &index);
     unsigned total_in, total_out;  // unpack
 
     int exetype;  // 0: unknown; 1: ELF; 2: pre-ELF; -1: /bin/sh; -2: Java
@@ -206,7 +206,8 @@ tribool PackVmlinuxBase<T>::canPack()
     fi->readx(phdri, ehdri.e_phnum * sizeof(*phdri));
 
     // Put PT_LOAD together at the beginning, ascending by .p_paddr.
-    upx_qsort(phdri, ehdri.e_phnum, sizeof(*phdri), compare_Phdr);
+    upx_sort(phdri, ehdri.e_phnum,
+             [](const Phdr &a, const Phdr &b) { return compare_Phdr(&a, &b) < 0; });
 
     // Find convex hull of physical addresses, and count the PT_LOAD.
     // Ignore ".bss": .p_filesz < .p_memsz
@@ -35,7 +35,6 @@
 #include "packer.h"
 #include "p_vmlinz.h"
 #include "linker.h"
-#include <zlib/zlib.h>
 
 static const CLANG_FORMAT_DUMMY_STATEMENT
 #include "stub/i386-linux.kernel.vmlinuz.h"
@@ -47,6 +46,34 @@ static const unsigned stack_offset_during_uncompression = 0x9000;
 static const unsigned zimage_offset = 0x1000;
 static const unsigned bzimage_offset = 0x100000;
 
+// Decompress the gzip'ed kernel at gz into ibuf; the whole file is already
+// in memory, so this needs no file i/o. Returns the size of the kernel, or
+// -1 on error; *gz_end is the file offset after the gzip member.
+static int gunzip_kernel(MemBuffer &ibuf, const byte *gz, unsigned gzlen,
+                         upx_off_t gzoff, upx_off_t *gz_end)
+{
+    *gz_end = -1;
+    // estimate gzip-decompressed kernel size & alloc buffer
+    if (ibuf.getSize() == 0)
+        ibuf.alloc(gzlen * 3);
+    for (;;) {
+        unsigned klen = ibuf.getSize();
+        unsigned used = 0;
+        int r = upx_gunzip(gz, gzlen, raw_bytes(ibuf, klen), &klen, &used);
+        if (r == UPX_E_OUTPUT_OVERRUN) {
+            // realloc and try again
+            unsigned const s = ibuf.getSize();
+            ibuf.dealloc();
+            ibuf.alloc(3 * s / 2);
+            continue;
+        }
+        if (r != UPX_E_OK || (int) klen < 0)
+            return -1;
+        *gz_end = gzoff + used;
+        return (int) klen;
+    }
+}
+
 
 /*************************************************************************
 //
@@ -257,39 +284,20 @@ int PackVmlinuzI386::decompressKernel()
             continue;
         //printf("found gzip header at offset %d\n", gzoff);
 
+        // payload_length is exact, so the gzip trailer (ISIZE) tells the
+        // size of the kernel; with a buffer of that size the upx_gunzip() below
+        // succeeds at the first attempt instead of inflating up to 3 times
+        if (ibuf.getSize() == 0 && 0x208 <= h.version && gzoff + gzlen <= file_size) {
+            const unsigned isize = get_le32(obuf + gzoff + gzlen - 4);
+            if ((unsigned) gzlen < isize && isize / 64 < (unsigned) gzlen
+            &&  mem_size_valid_bytes(isize + 1ull))
+                ibuf.alloc(isize + 1);  // +1: a full buffer means "too small"
+        }
+
         // try to decompress
         int klen;
-        int fd;
         upx_off_t fd_pos;
-        for (;;)
-        {
-            klen = -1;
-            fd_pos = -1;
-            // open
-            fi->seek(gzoff, SEEK_SET);
-            fd = dup(fi->getFd());
-            if (fd < 0)
-                break;
-            gzFile zf = gzdopen(fd, "rb");
-            if (zf == nullptr)
-                break;
-            // estimate gzip-decompressed kernel size & alloc buffer
-            if (ibuf.getSize() == 0)
-                ibuf.alloc(gzlen * 3);
-            // decompress
-            klen = gzread(zf, ibuf, ibuf.getSize());
-            fd_pos = lseek(fd, 0, SEEK_CUR);
-            gzclose(zf);
-            fd = -1;
-            if (klen != (int)ibuf.getSize())
-                break;
-            // realloc and try again
-            unsigned s = ibuf.getSize();
-            ibuf.dealloc();
-            ibuf.alloc(3 * s / 2);
-        }
-        if (fd >= 0)
-            (void) close(fd);
+        klen = gunzip_kernel(ibuf, raw_index_bytes(obuf, gzoff, gzlen), gzlen, gzoff, &fd_pos);
         if (klen <= 0)
             continue;
 
@@ -841,37 +849,8 @@ int PackVmlinuzARMEL::decompressKernel()
 
         // try to decompress
         int klen;
-        int fd;
         upx_off_t fd_pos;
-        for (;;)
-        {
-            klen = -1;
-            fd_pos = -1;
-            // open
-            fi->seek(gzoff, SEEK_SET);
-            fd = dup(fi->getFd());
-            if (fd < 0)
-                break;
-            gzFile zf = gzdopen(fd, "rb");
-            if (zf == nullptr)
-                break;
-            // estimate gzip-decompressed kernel size & alloc buffer
-            if (ibuf.getSize() == 0)
-                ibuf.alloc(gzlen * 3);
-            // decompress
-            klen = gzread(zf, ibuf, ibuf.getSize());
-            fd_pos = lseek(fd, 0, SEEK_CUR);
-            gzclose(zf);
-            fd = -1;
-            if (klen != (int)ibuf.getSize())
-                break;
-            // realloc and try again
-            unsigned const s = ibuf.getSize();
-            ibuf.dealloc();
-            ibuf.alloc(3 * s / 2);
-        }
-        if (fd >= 0)
-            (void) close(fd);
+        klen = gunzip_kernel(ibuf, raw_index_bytes(obuf, gzoff, gzlen), gzlen, gzoff, &fd_pos);
         if (klen <= 0)
             continue;
 
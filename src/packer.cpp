@@ -26,11 +26,16 @@
  */
 
 #include "conf.h"
+#include <chrono>
+#include <cmath>
 #include "file.h"
 #include "packer.h"
 #include "filter.h"
 #include "linker.h"
 #include "ui.h"
+#include "util/decision_cache.h"
+#include "util/threads.h"
+#include "util/trace.h"
 
 /*************************************************************************
 //
@@ -87,10 +92,57 @@ void Packer::assertPacker() const {
 // public entries called from class PackMaster
 **************************************************************************/
 
+static upx_uint64_t steady_msecs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
 void Packer::doPack(OutputFile *fo) {
+    typedef std::chrono::steady_clock Clock;
+    const bool metrics = upx::metrics_is_enabled();
+    const Clock::time_point t0 = metrics ? Clock::now() : Clock::time_point();
+    const std::clock_t cpu0 = metrics ? std::clock() : 0;
+    upx::PerfCounters counters0;
+    const bool counters = metrics && upx::perf_counters_is_enabled() &&
+                          upx::perf_counters_read(&counters0);
+    search_deadline = opt->time_budget ? steady_msecs() + opt->time_budget * 1000ull : 0;
+    if (opt->run_memory)
+        checkRunMemory();
     uip->uiPackStart(fo);
     pack(fo);
     uip->uiPackEnd(fo);
+    if (metrics) {
+        upx::PackMetrics m;
+        m.file = fi->getName();
+        m.format = getName();
+        m.method = ph.method;
+        m.level = ph.level;
+        m.filter = ph.filter;
+        m.filter_cto = ph.filter_cto;
+        m.u_file_size = file_size_u;
+        m.c_file_size = fo->st_size();
+        m.u_len = ph.u_len;
+        m.c_len = ph.c_len;
+        int lsize = 0;
+        m.loader_size = (linker != nullptr && linker->getLoader(&lsize) != nullptr && lsize > 0)
+                            ? (unsigned) lsize
+                            : 0;
+        m.overlap_overhead = ph.overlap_overhead;
+        m.wall_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+        m.cpu_ms = double(std::clock() - cpu0) * 1000.0 / CLOCKS_PER_SEC;
+        m.peak_memory = MemBuffer::getPeakActiveBytes();
+        m.counters.valid = 0;
+        upx::PerfCounters counters1;
+        if (counters && upx::perf_counters_read(&counters1))
+            upx::perf_counters_sub(&m.counters, counters1, counters0);
+        upx::metrics_write(m);
+    }
+}
+
+// "--time-budget": whether compressWithFilters() should stop starting new trials
+bool Packer::searchTimeIsUp() const {
+    return search_deadline != 0 && steady_msecs() >= search_deadline;
 }
 
 void Packer::doUnpack(OutputFile *fo) {
@@ -117,6 +169,8 @@ void Packer::doFileInfo() {
     uip->uiFileInfoEnd();
 }
 
+void Packer::doAnalyze() { analyze(); }
+
 /*************************************************************************
 // default actions
 **************************************************************************/
@@ -144,25 +198,131 @@ bool Packer::testUnpackFormat(int format) const {
     return canUnpackFormat(format);
 }
 
+/*************************************************************************
+// --lzma-tune: choose lc/lp/pb and num_fast_bytes by compressing a sample
+// of the (already filtered) input with a few settings, one parameter at a
+// time, so that only one full compression is needed. Settings that were
+// given explicitly or by the caller are kept.
+**************************************************************************/
+
+static void tune_lzma_config(const byte *in, unsigned u_len, int level,
+                             upx_compress_config_t *cconf) may_throw {
+    constexpr unsigned slice = 64 * 1024;
+    constexpr unsigned nslices = 4;
+    constexpr unsigned sample_len = slice * nslices;
+    if (u_len < 2 * sample_len)
+        return; // not worth it: compressing a quarter of the input costs too much
+    upx::TraceScope trace_scope("tune_lzma_config", u_len);
+    MemBuffer sample(sample_len);
+    for (unsigned k = 0; k < nslices; k++) // evenly spread over the input
+        memcpy(sample + k * slice, in + (u_len - slice) / (nslices - 1) * k, slice);
+    MemBuffer out;
+    out.allocForCompression(sample_len);
+
+    lzma_compress_config_t &best = cconf->conf_lzma;
+    unsigned best_len = ~0u;
+    auto trial = [&](const lzma_compress_config_t &c) {
+        upx_compress_config_t tconf = *cconf;
+        tconf.conf_lzma = c;
+        upx_compress_result_t cresult;
+        unsigned c_len = 0;
+        int r = upx_compress(sample, sample_len, out, &c_len, nullptr, M_LZMA, level, &tconf,
+                             &cresult);
+        if (r == UPX_E_OUT_OF_MEMORY)
+            throwOutOfMemoryException();
+        if (r == UPX_E_OK && c_len < best_len) {
+            best_len = c_len;
+            best = c;
+        }
+    };
+    trial(best);
+    const lzma_compress_config_t start = best;
+    if (!start.pos_bits.is_set) {
+        for (unsigned pb : {0u, 1u, 4u}) {
+            lzma_compress_config_t c = best;
+            c.pos_bits = pb;
+            trial(c);
+        }
+    }
+    if (!start.lit_context_bits.is_set) {
+        for (unsigned lc : {0u, 1u, 4u, 8u}) {
+            lzma_compress_config_t c = best;
+            c.lit_context_bits = lc;
+            trial(c);
+        }
+    }
+    if (!start.lit_pos_bits.is_set) {
+        for (unsigned lp : {1u, 2u}) {
+            lzma_compress_config_t c = best;
+            c.lit_pos_bits = lp;
+            trial(c);
+        }
+    }
+    if (!start.num_fast_bytes.is_set) {
+        for (unsigned fb : {128u, 273u}) {
+            lzma_compress_config_t c = best;
+            c.num_fast_bytes = fb;
+            trial(c);
+        }
+    }
+    NO_printf("tune_lzma_config: pb=%u lp=%u lc=%u fb=%u: %u\n", unsigned(best.pos_bits),
+              unsigned(best.lit_pos_bits), unsigned(best.lit_context_bits),
+              unsigned(best.num_fast_bytes), best_len);
+}
+
 /*************************************************************************
 // compress - wrap call to low-level upx_compress()
 **************************************************************************/
 
 bool Packer::compress(SPAN_P(byte) i_ptr, unsigned i_len, SPAN_P(byte) o_ptr,
                       const upx_compress_config_t *cconf_parm) {
-    ph.u_len = i_len;
-    ph.c_len = 0;
-    assert(ph.level >= 1);
-    assert(ph.level <= 10);
+    return compress(ph, i_ptr, i_len, o_ptr, cconf_parm, uip);
+}
+
+// Decompress [c_ptr, +xph.c_len) into d_ptr, and check the result against
+// the checksum of the uncompressed data that compress() has computed.
+static void verify_decompression(const PackHeader &xph, const byte *c_ptr, byte *d_ptr) {
+    upx::TraceScope trace_scope("verifyDecompression", xph.u_len);
+    const int method = ph_forced_method(xph.method);
+    unsigned new_len = xph.u_len;
+    int r = upx_decompress(c_ptr, xph.c_len, d_ptr, &new_len, method, &xph.compress_result);
+    if (r == UPX_E_OUT_OF_MEMORY)
+        throwOutOfMemoryException();
+    // printf("%d %d: %d %d %d\n", method, r, ph.c_len, ph.u_len, new_len);
+    if (r != UPX_E_OK)
+        throwInternalError("decompression failed");
+    if (new_len != xph.u_len)
+        throwInternalError("decompression failed (size error)");
+
+    // verify decompression
+    if (xph.u_adler != upx_adler32(d_ptr, xph.u_len, xph.saved_u_adler))
+        throwInternalError("decompression failed (checksum error)");
+}
+
+// thread-safe version; a nullptr ui means no progress bar of its own, but
+// the progress can still be reported through cb, see UiPacker::SharedCallback.
+// If !verify then the caller has to call verify_decompression() later on if
+// it keeps the result. If u_adler is not nullptr then it is the already
+// known checksum of [i_ptr, +i_len), see findTrialAdler().
+bool Packer::compress(PackHeader &xph, SPAN_P(byte) i_ptr, unsigned i_len, SPAN_P(byte) o_ptr,
+                      const upx_compress_config_t *cconf_parm, UiPacker *ui,
+                      upx_callback_t *cb, bool verify, const unsigned *u_adler) const {
+    xph.u_len = i_len;
+    xph.c_len = 0;
+    assert(xph.level >= 1);
+    assert(xph.level <= 10);
 
     // Avoid too many progress bar updates. 64 is s->bar_len in ui.cpp.
-    unsigned step = (ph.u_len < 64 * 1024) ? 0 : ph.u_len / 64;
+    unsigned step = (xph.u_len < 64 * 1024) ? 0 : xph.u_len / 64;
 
     // save current checksums
-    ph.saved_u_adler = ph.u_adler;
-    ph.saved_c_adler = ph.c_adler;
+    xph.saved_u_adler = xph.u_adler;
+    xph.saved_c_adler = xph.c_adler;
     // update checksum of uncompressed data
-    ph.u_adler = upx_adler32(raw_bytes(i_ptr, ph.u_len), ph.u_len, ph.u_adler);
+    if (u_adler != nullptr)
+        xph.u_adler = *u_adler;
+    else
+        xph.u_adler = upx_adler32(raw_bytes(i_ptr, xph.u_len), xph.u_len, xph.u_adler);
 
     // set compression parameters
     upx_compress_config_t cconf;
@@ -170,7 +330,7 @@ bool Packer::compress(SPAN_P(byte) i_ptr, unsigned i_len, SPAN_P(byte) o_ptr,
     if (cconf_parm)
         cconf = *cconf_parm;
     // cconf options
-    int method = ph_forced_method(ph.method);
+    int method = ph_forced_method(xph.method);
     if (M_IS_NRV2B(method) || M_IS_NRV2D(method) || M_IS_NRV2E(method)) {
         if (opt->crp.crp_ucl.c_flags != -1)
             cconf.conf_ucl.c_flags = opt->crp.crp_ucl.c_flags;
@@ -185,7 +345,7 @@ bool Packer::compress(SPAN_P(byte) i_ptr, unsigned i_len, SPAN_P(byte) o_ptr,
             opt->crp.crp_ucl.max_match < cconf.conf_ucl.max_match)
             cconf.conf_ucl.max_match = opt->crp.crp_ucl.max_match;
 #if (WITH_NRV)
-        if ((ph.level >= 7 || (ph.level >= 4 && ph.u_len >= 512 * 1024)) && !opt->prefer_ucl)
+        if ((xph.level >= 7 || (xph.level >= 4 && xph.u_len >= 512 * 1024)) && !opt->prefer_ucl)
             step = 0;
 #endif
     }
@@ -195,75 +355,87 @@ bool Packer::compress(SPAN_P(byte) i_ptr, unsigned i_len, SPAN_P(byte) o_ptr,
         oassign(cconf.conf_lzma.lit_context_bits, opt->crp.crp_lzma.lit_context_bits);
         oassign(cconf.conf_lzma.dict_size, opt->crp.crp_lzma.dict_size);
         oassign(cconf.conf_lzma.num_fast_bytes, opt->crp.crp_lzma.num_fast_bytes);
+        if (opt->lzma_tune && method == M_LZMA) // no parameters in the method itself
+            tune_lzma_config(raw_bytes(i_ptr, xph.u_len), xph.u_len, xph.level, &cconf);
+        // "--run-memory=": lower lit_context_bits/lit_pos_bits if needed
+        unsigned &max_num_probs = cconf.conf_lzma.max_num_probs;
+        if (run_memory_max_num_probs != 0 &&
+            (max_num_probs == 0 || max_num_probs > run_memory_max_num_probs))
+            max_num_probs = run_memory_max_num_probs;
     }
     if (M_IS_DEFLATE(method)) {
         oassign(cconf.conf_zlib.mem_level, opt->crp.crp_zlib.mem_level);
         oassign(cconf.conf_zlib.window_bits, opt->crp.crp_zlib.window_bits);
         oassign(cconf.conf_zlib.strategy, opt->crp.crp_zlib.strategy);
     }
-    if (uip->ui_pass >= 0)
-        uip->ui_pass++;
-    uip->startCallback(ph.u_len, step, uip->ui_pass, uip->ui_total_passes);
-    uip->firstCallback();
+    if (M_IS_ZSTD(method)) {
+        oassign(cconf.conf_zstd.level, opt->crp.crp_zstd.level);
+        oassign(cconf.conf_zstd.window_log, opt->crp.crp_zstd.window_log);
+        oassign(cconf.conf_zstd.long_distance, opt->crp.crp_zstd.long_distance);
+        oassign(cconf.conf_zstd.strategy, opt->crp.crp_zstd.strategy);
+    }
+    if (ui != nullptr) {
+        if (ui->ui_pass >= 0)
+            ui->ui_pass++;
+        ui->startCallback(xph.u_len, step, ui->ui_pass, ui->ui_total_passes);
+        ui->firstCallback();
+    }
 
     // OutputFile::dump("data.raw", in, ph.u_len);
 
+    char trace_detail[32];
+    set_method_name(trace_detail, sizeof(trace_detail), method, xph.level);
+    upx::TraceScope trace_scope("compress", xph.u_len, trace_detail);
+
     // compress
-    int r = upx_compress(raw_bytes(i_ptr, ph.u_len), ph.u_len, raw_bytes(o_ptr, 0), &ph.c_len,
-                         uip->getCallback(), method, ph.level, &cconf, &ph.compress_result);
+    int r = upx_compress(raw_bytes(i_ptr, xph.u_len), xph.u_len, raw_bytes(o_ptr, 0), &xph.c_len,
+                         ui ? ui->getCallback() : cb, method, xph.level, &cconf,
+                         &xph.compress_result);
 
     // uip->finalCallback(ph.u_len, ph.c_len);
-    uip->endCallback();
+    if (ui != nullptr)
+        ui->endCallback();
 
+    if (r == UPX_E_OVER_BUDGET) {
+        // see trialConfig(); xph.c_len is only a lower bound then
+        xph.c_len = UPX_MAX(xph.c_len, cconf.max_c_len + 1);
+        return false;
+    }
     if (r == UPX_E_OUT_OF_MEMORY)
         throwOutOfMemoryException();
     if (r != UPX_E_OK)
         throwInternalError("compression failed");
 
     if (M_IS_NRV2B(method) || M_IS_NRV2D(method) || M_IS_NRV2E(method)) {
-        const ucl_uint *res = ph.compress_result.result_ucl.result;
+        const ucl_uint *res = xph.compress_result.result_ucl.result;
         // ph.min_offset_found = res[0];
-        ph.max_offset_found = res[1];
+        xph.max_offset_found = res[1];
         // ph.min_match_found = res[2];
-        ph.max_match_found = res[3];
+        xph.max_match_found = res[3];
         // ph.min_run_found = res[4];
-        ph.max_run_found = res[5];
-        ph.first_offset_found = res[6];
+        xph.max_run_found = res[5];
+        xph.first_offset_found = res[6];
         // ph.same_match_offsets_found = res[7];
         if (cconf_parm) {
             assert(cconf.conf_ucl.max_offset == 0 ||
-                   cconf.conf_ucl.max_offset >= ph.max_offset_found);
-            assert(cconf.conf_ucl.max_match == 0 || cconf.conf_ucl.max_match >= ph.max_match_found);
+                   cconf.conf_ucl.max_offset >= xph.max_offset_found);
+            assert(cconf.conf_ucl.max_match == 0 ||
+                   cconf.conf_ucl.max_match >= xph.max_match_found);
         }
     }
 
-    NO_printf("\nPacker::compress: %d/%d: %7d -> %7d\n", method, ph.level, ph.u_len, ph.c_len);
-    if (!checkCompressionRatio(ph.u_len, ph.c_len))
+    NO_printf("\nPacker::compress: %d/%d: %7d -> %7d\n", method, xph.level, xph.u_len, xph.c_len);
+    if (!checkCompressionRatio(xph.u_len, xph.c_len))
         return false;
     // return in any case if not compressible
-    if (ph.c_len >= ph.u_len)
+    if (xph.c_len >= xph.u_len)
         return false;
 
     // update checksum of compressed data
-    ph.c_adler = upx_adler32(raw_bytes(o_ptr, ph.c_len), ph.c_len, ph.c_adler);
+    xph.c_adler = upx_adler32(raw_bytes(o_ptr, xph.c_len), xph.c_len, xph.c_adler);
     // Decompress and verify. Skip this when using the fastest level.
-    if (!ph_skipVerify(ph)) {
-        // decompress
-        unsigned new_len = ph.u_len;
-        r = upx_decompress(raw_bytes(o_ptr, ph.c_len), ph.c_len, raw_bytes(i_ptr, ph.u_len),
-                           &new_len, method, &ph.compress_result);
-        if (r == UPX_E_OUT_OF_MEMORY)
-            throwOutOfMemoryException();
-        // printf("%d %d: %d %d %d\n", method, r, ph.c_len, ph.u_len, new_len);
-        if (r != UPX_E_OK)
-            throwInternalError("decompression failed");
-        if (new_len != ph.u_len)
-            throwInternalError("decompression failed (size error)");
-
-        // verify decompression
-        if (ph.u_adler != upx_adler32(raw_bytes(i_ptr, ph.u_len), ph.u_len, ph.saved_u_adler))
-            throwInternalError("decompression failed (checksum error)");
-    }
+    if (verify && !ph_skipVerify(xph))
+        verify_decompression(xph, raw_bytes(o_ptr, xph.c_len), raw_bytes(i_ptr, xph.u_len));
     return true;
 }
 
@@ -332,6 +504,7 @@ void Packer::verifyOverlappingDecompression(Filter *ft) {
 
     if (ph_skipVerify(ph))
         return;
+    upx::TraceScope trace_scope("verifyOverlappingDecompression", ph.u_len);
     unsigned offset = (ph.u_len + ph.overlap_overhead) - ph.c_len;
     if (offset + ph.c_len > obuf.getSize())
         return;
@@ -345,6 +518,7 @@ void Packer::verifyOverlappingDecompression(byte *o_ptr, unsigned o_size, Filter
     assert((int) ph.overlap_overhead > 0);
     if (ph_skipVerify(ph))
         return;
+    upx::TraceScope trace_scope("verifyOverlappingDecompression", ph.u_len);
     unsigned offset = (ph.u_len + ph.overlap_overhead) - ph.c_len;
     if (offset + ph.c_len > o_size)
         return;
@@ -355,6 +529,10 @@ void Packer::verifyOverlappingDecompression(byte *o_ptr, unsigned o_size, Filter
 /*************************************************************************
 // Find overhead for in-place decompression in a heuristic way
 // (using a binary search). Return 0 on error.
+// For NRV the exact value is already reported by upx_compress() (see
+// upx_find_overlap()), and the binary search is only a fallback.
+// Only depends on xph and the buffers, so this is safe to call from
+// several threads with different PackHeaders at the same time.
 //
 // To speed up things:
 //   - you can pass the range of an acceptable interval (so that
@@ -362,15 +540,38 @@ void Packer::verifyOverlappingDecompression(byte *o_ptr, unsigned o_size, Filter
 //   - you can enforce an upper_limit (so that we can fail early)
 **************************************************************************/
 
-unsigned Packer::findOverlapOverhead(const byte *buf, const byte *tbuf, unsigned range,
-                                     unsigned upper_limit) const {
+unsigned Packer::findOverlapOverhead(const PackHeader &xph, const byte *buf, const byte *tbuf,
+                                     unsigned range, unsigned upper_limit, unsigned hint) const {
     assert((int) range >= 0);
+    upx::TraceScope trace_scope("findOverlapOverhead", xph.c_len);
 
     // prepare to deal with very pessimistic values
     unsigned low = 1;
-    unsigned high = UPX_MIN(ph.u_len + 512, upper_limit);
+    unsigned high = UPX_MIN(xph.u_len + 512, upper_limit);
+
+    // Fast path if the exact value can be computed in a single pass;
+    // verify the result instead of searching.
+    unsigned m = 0;
+    if (ph_estimateOverlapOverhead(xph, buf, &m) && m <= high) {
+        // the estimate is exact (or at the lower limit of the test), so a
+        // single confirming test is enough and there is nothing to refine
+        if (ph_testOverlappingDecompression(xph, buf, tbuf, m))
+            return alignOverlapOverhead(xph, m);
+        NO_printf("findOverlapOverhead: bad estimate %u\n", m);
+    } else if (hint >= low && hint <= high) {
+        // a value from an earlier run; if it still works it is at least an upper bound
+        if (ph_testOverlappingDecompression(xph, buf, tbuf, hint)) {
+            if (hint == low || !ph_testOverlappingDecompression(xph, buf, tbuf, hint - 1))
+                return alignOverlapOverhead(xph, hint);
+            high = hint - 1;
+        }
+    }
+    // --fast: accept the first value that works; that is a safe upper bound,
+    // we just do not refine it (costs a few bytes, saves most of the tests)
+    if (opt->fast)
+        range = high;
     // but be optimistic for first try (speedup)
-    unsigned m = UPX_MIN(16u, high);
+    m = UPX_MIN(16u, high);
     //
     unsigned overhead = 0;
     unsigned nr = 0; // statistics
@@ -380,7 +581,7 @@ unsigned Packer::findOverlapOverhead(const byte *buf, const byte *tbuf, unsigned
         assert(m <= high);
         assert(m < overhead || overhead == 0);
         nr++;
-        bool success = testOverlappingDecompression(buf, tbuf, m);
+        bool success = ph_testOverlappingDecompression(xph, buf, tbuf, m);
         // printf("testOverlapOverhead(%d): %d %d: %d -> %d\n", nr, low, high, m, (int)success);
         if (success) {
             overhead = m;
@@ -402,6 +603,10 @@ unsigned Packer::findOverlapOverhead(const byte *buf, const byte *tbuf, unsigned
         throwInternalError("this is an oo bug");
 
     UNUSED(nr);
+    return alignOverlapOverhead(xph, overhead);
+}
+
+unsigned Packer::alignOverlapOverhead(const PackHeader &, unsigned overhead) const {
     return overhead;
 }
 
@@ -414,10 +619,7 @@ unsigned Packer::findOverlapOverhead(const byte *buf, const byte *tbuf, unsigned
         if (size > 0) {
             // copy stub from exe
             info("Copying original stub: %u bytes", size);
-            ByteArray(stub, size);
-            fif->seek(0, SEEK_SET);
-            fif->readx(stub, size);
-            fo->write(stub, size);
+            fo->copyRangeFrom(*fif, 0, size);
         } else {
             // no stub
         }
@@ -449,18 +651,8 @@ void Packer::copyOverlay(OutputFile *fo, unsigned overlay, MemBuffer &buf, bool
     if (do_seek)
         fi->seek(-(upx_off_t) overlay, SEEK_END);
 
-    // get buffer size, align to improve i/o speed
-    unsigned buf_size = buf.getSize();
-    if (buf_size > 65536)
-        buf_size = ALIGN_DOWN(buf_size, 4096u);
-    assert((int) buf_size > 0);
-
-    do {
-        unsigned len = overlay < buf_size ? overlay : buf_size;
-        fi->readx(buf, len);
-        fo->write(buf, len);
-        overlay -= len;
-    } while (overlay > 0);
+    // big overlays (installers, archives) do not need to pass through buf
+    fo->copyRangeFrom(*fi, fi->tell(), overlay, buf);
     buf.checkState();
 }
 
@@ -832,6 +1024,115 @@ int Packer::getLoaderSize() const {
     return size;
 }
 
+// Needed for every promising candidate in compressWithFilters(), but
+// building (and for some formats also compressing) the loader is slow.
+unsigned Packer::getTrialLoaderSize(const Filter *ft) {
+    const upx_uint64_t key = getLoaderSizeCacheKey(ft);
+    if (key != 0) {
+        for (unsigned i = 0; i < loader_size_cache_len; i++)
+            if (loader_size_cache[i].key == key)
+                return loader_size_cache[i].lsize;
+    }
+    {
+        upx::TraceScope trace_scope("buildLoader");
+        buildLoader(ft);
+    }
+    const unsigned lsize = getLoaderSize();
+    if (key != 0 && loader_size_cache_len < TABLESIZE(loader_size_cache)) {
+        loader_size_cache[loader_size_cache_len].key = key;
+        loader_size_cache[loader_size_cache_len].lsize = lsize;
+        loader_size_cache_len++;
+    }
+    return lsize;
+}
+
+namespace {
+// The compressed parts of the loaders (e.g. FOLDEXEC) only depend on the
+// stub, the method and the level, so in batch mode the same compression
+// would be repeated for every file.
+struct CompressedLoaderCache final {
+    struct Entry {
+        int method;
+        int level;
+        unsigned u_len;
+        unsigned c_len;
+        byte *data; // the u_len bytes of input, then the c_len bytes of output
+    };
+    static constexpr unsigned CAPACITY = 32; // plenty, there are only a few stubs per format
+    Entry entries[CAPACITY];
+    unsigned n = 0;
+    ~CompressedLoaderCache() noexcept {
+        for (unsigned i = 0; i < n; i++)
+            delete[] entries[i].data;
+    }
+    const Entry *find(const byte *src, unsigned src_len, int method, int level) const {
+        for (unsigned i = 0; i < n; i++) {
+            const Entry &e = entries[i];
+            if (e.method == method && e.level == level && e.u_len == src_len &&
+                memcmp(e.data, src, src_len) == 0)
+                return &e;
+        }
+        return nullptr;
+    }
+};
+CompressedLoaderCache compressed_loader_cache;
+#if WITH_THREADS
+std::mutex compressed_loader_mutex; // protects compressed_loader_cache
+#endif
+} // namespace
+
+// same as upx_compress() without cconf and result, but remembers the
+// output for the next file with the same loader
+/*static*/ int Packer::compressLoader(const byte *src, unsigned src_len, byte *dst,
+                                      unsigned *dst_len, int method, int level) {
+    {
+#if WITH_THREADS
+        std::lock_guard<std::mutex> lock(compressed_loader_mutex);
+#endif
+        const CompressedLoaderCache::Entry *e =
+            compressed_loader_cache.find(src, src_len, method, level);
+        if (e != nullptr) {
+            memcpy(dst, e->data + e->u_len, e->c_len);
+            *dst_len = e->c_len;
+            return UPX_E_OK;
+        }
+    }
+    // compress outside of the lock; if another thread has been faster it wins
+    const int r =
+        upx_compress(src, src_len, dst, dst_len, nullptr, method, level, nullptr, nullptr);
+    if (r != UPX_E_OK)
+        return r;
+#if WITH_THREADS
+    std::lock_guard<std::mutex> lock(compressed_loader_mutex);
+#endif
+    if (compressed_loader_cache.n == CompressedLoaderCache::CAPACITY ||
+        compressed_loader_cache.find(src, src_len, method, level) != nullptr)
+        return r;
+    byte *const data = new byte[mem_size(1, src_len, *dst_len)];
+    memcpy(data, src, src_len);
+    memcpy(data + src_len, dst, *dst_len);
+    compressed_loader_cache.entries[compressed_loader_cache.n++] = {method, level, src_len,
+                                                                    *dst_len, data};
+    return r;
+}
+
+const unsigned *Packer::findTrialAdler(int filter, unsigned cto) const {
+    for (unsigned i = 0; i < trial_adler_cache_len; i++)
+        if (trial_adler_cache[i].filter == filter && trial_adler_cache[i].cto == cto)
+            return &trial_adler_cache[i].u_adler;
+    return nullptr;
+}
+
+void Packer::storeTrialAdler(int filter, unsigned cto, unsigned u_adler) {
+    if (findTrialAdler(filter, cto) != nullptr ||
+        trial_adler_cache_len >= TABLESIZE(trial_adler_cache))
+        return;
+    trial_adler_cache[trial_adler_cache_len].filter = filter;
+    trial_adler_cache[trial_adler_cache_len].cto = cto;
+    trial_adler_cache[trial_adler_cache_len].u_adler = u_adler;
+    trial_adler_cache_len++;
+}
+
 bool Packer::hasLoaderSection(const char *name) const {
     void *section = linker->findSection(name, false);
     return section != nullptr;
@@ -971,6 +1272,10 @@ static int prepareFilters(int *filters, int &filter_strategy, const int *all_fil
             filter_strategy = -1;
     }
     assert(filter_strategy != 0);
+    // --fast: the first filter of a format is its predicted best one, so
+    // only try the first working filter instead of comparing several
+    if (opt->fast && !opt->all_filters && filter_strategy > 0)
+        filter_strategy = -1;
 
     if (filter_strategy == -3)
         goto done;
@@ -1026,6 +1331,311 @@ done:
     return nfilters;
 }
 
+/*************************************************************************
+// "--optimize-for=startup": a rough model of the load time of a packed
+// program, in picoseconds: reading its packed bytes plus running the stub
+// decompressor over the unpacked bytes. The figures are for a current
+// x86-64 core and a warm page cache, and only their ratios matter;
+// "--benchmark" shows the corresponding decompression times of a file.
+**************************************************************************/
+
+static constexpr unsigned STARTUP_READ_COST = 1000; // per packed byte
+
+static unsigned startupDecodeCost(int method) { // per unpacked byte
+    method = ph_forced_method(method);
+    if (M_IS_LZMA(method))
+        return 12000;
+    if (M_IS_BZIP2(method))
+        return 30000;
+    if (M_IS_DEFLATE(method))
+        return 3500;
+    if (M_IS_ZSTD(method))
+        return 1200;
+    if (M_IS_NRV2E(method))
+        return 2300;
+    if (M_IS_NRV2D(method))
+        return 2100;
+    return 2000; // NRV2B
+}
+
+static upx_uint64_t startupCost(int method, unsigned u_len, unsigned total) {
+    return upx_uint64_t(total) * STARTUP_READ_COST +
+           upx_uint64_t(u_len) * startupDecodeCost(method);
+}
+
+// The largest c_len of a trial with the given method that still can win
+// in isBetterTrial() against the best total so far, given that lsize > 0.
+static unsigned maxWinningCLen(int method, unsigned u_len, unsigned hdr_c_len,
+                               const PackHeader &best_ph, unsigned best_ph_lsize,
+                               unsigned best_hdr_c_len) {
+    const unsigned best_total = best_ph.c_len + best_ph_lsize + best_hdr_c_len;
+    upx_uint64_t limit = best_total; // limit of c_len + hdr_c_len
+    if (opt->optimize_startup && best_ph.overlap_overhead == 0)
+        return u_len; // no valid best version yet, see isBetterTrial()
+    if (opt->optimize_startup) {
+        const upx_uint64_t best_cost = startupCost(best_ph.method, best_ph.u_len, best_total);
+        const upx_uint64_t decode_cost = upx_uint64_t(u_len) * startupDecodeCost(method);
+        limit = best_cost > decode_cost ? (best_cost - decode_cost) / STARTUP_READ_COST : 0;
+    }
+    if (limit <= hdr_c_len)
+        return 0;
+    return ACC_ICONV(unsigned, UPX_MIN(limit - hdr_c_len, upx_uint64_t(u_len)));
+}
+
+// the selection rule of compressWithFilters(); on a tie the earlier trial wins
+static bool isBetterTrial(const PackHeader &ph, unsigned lsize, unsigned hdr_c_len,
+                          const PackHeader &best_ph, unsigned best_ph_lsize,
+                          unsigned best_hdr_c_len) {
+    if (opt->optimize_startup && best_ph.overlap_overhead > 0) {
+        const upx_uint64_t cost = startupCost(ph.method, ph.u_len, ph.c_len + lsize + hdr_c_len);
+        const upx_uint64_t best_cost = startupCost(
+            best_ph.method, best_ph.u_len, best_ph.c_len + best_ph_lsize + best_hdr_c_len);
+        if (cost != best_cost)
+            return cost < best_cost;
+        // else use the size rule below
+    }
+    if (ph.c_len + lsize + hdr_c_len < best_ph.c_len + best_ph_lsize + best_hdr_c_len)
+        return true;
+    if (ph.c_len + lsize + hdr_c_len == best_ph.c_len + best_ph_lsize + best_hdr_c_len) {
+        // prefer smaller loaders
+        if (lsize + hdr_c_len < best_ph_lsize + best_hdr_c_len)
+            return true;
+        if (lsize + hdr_c_len == best_ph_lsize + best_hdr_c_len) {
+            // prefer less overlap_overhead
+            if (ph.overlap_overhead < best_ph.overlap_overhead)
+                return true;
+        }
+    }
+    return false;
+}
+
+/*************************************************************************
+// trialConfig - a trial of compressWithFilters() whose compressed size is
+// bigger than maxWinningCLen() cannot win in isBetterTrial(), so let
+// upx_compress() give up early at that size;
+// this saves a lot of time with "--brute" where most trials lose.
+// Returns cconf itself if there is no valid best version yet.
+**************************************************************************/
+
+static const upx_compress_config_t *trialConfig(upx_compress_config_t &tmp,
+                                                const upx_compress_config_t *cconf,
+                                                const PackHeader &ph, const PackHeader &best_ph,
+                                                unsigned best_ph_lsize,
+                                                unsigned best_hdr_c_len, unsigned hdr_c_len) {
+    if (best_ph.overlap_overhead == 0)
+        return cconf;
+    const unsigned max_c_len =
+        maxWinningCLen(ph.method, ph.u_len, hdr_c_len, best_ph, best_ph_lsize, best_hdr_c_len);
+    if (max_c_len == 0)
+        return cconf;
+    tmp.reset();
+    if (cconf)
+        tmp = *cconf;
+    tmp.max_c_len = max_c_len;
+    return &tmp;
+}
+
+/*************************************************************************
+// compressHeader - the header of compressWithFilters() gets compressed
+// with every method of the search, and then once more with the winning
+// method by the caller (e.g. PackUnix::packExtent()); remember the results
+// of the last header, so that it is compressed at most once per method.
+//
+// Returns the compressed size; *c_ptr points to the compressed data,
+// which is valid until the next call.
+**************************************************************************/
+
+unsigned Packer::compressHeader(const byte *hdr_ptr, unsigned hdr_len, int method,
+                                const byte **c_ptr) {
+    assert(hdr_ptr != nullptr && hdr_len > 0);
+    method = ph_forced_method(method);
+    if (hdr_len != hdr_cache_u_len || memcmp(hdr_cache_u_buf, hdr_ptr, hdr_len) != 0) {
+        // a new header
+        hdr_cache_len = 0;
+        hdr_cache_u_len = 0;
+        if (hdr_cache_u_buf.getSize() < hdr_len) {
+            hdr_cache_u_buf.dealloc();
+            hdr_cache_u_buf.alloc(hdr_len);
+        }
+        memcpy(hdr_cache_u_buf, hdr_ptr, hdr_len);
+        hdr_cache_u_len = hdr_len;
+    }
+    unsigned i = 0;
+    while (i < hdr_cache_len && hdr_cache[i].method != method)
+        i++;
+    if (i == hdr_cache_len) {
+        if (hdr_cache_len < TABLESIZE(hdr_cache))
+            hdr_cache_len++;
+        else
+            i = TABLESIZE(hdr_cache) - 1; // full; just reuse the last entry
+        HeaderCacheEntry &e = hdr_cache[i];
+        e.method = -1;
+        if (e.c_buf.getVoidPtr() == nullptr ||
+            e.c_buf.getSize() < MemBuffer::getSizeForCompression(hdr_len)) {
+            e.c_buf.dealloc();
+            e.c_buf.allocForCompression(hdr_len);
+        }
+        e.c_len = 0;
+        int r = upx_compress(hdr_ptr, hdr_len, e.c_buf, &e.c_len, nullptr, method, 10, nullptr,
+                             nullptr);
+        if (r != UPX_E_OK)
+            throwInternalError("header compression failed");
+        if (e.c_len >= hdr_len)
+            throwInternalError("header compression size increase");
+        e.method = method;
+    }
+    if (c_ptr != nullptr)
+        *c_ptr = raw_bytes(hdr_cache[i].c_buf, hdr_cache[i].c_len);
+    return hdr_cache[i].c_len;
+}
+
+/*************************************************************************
+// reuse a trial buffer of compressWithFilters() if it is big enough
+**************************************************************************/
+
+static void reserve_buffer(MemBuffer &mb, unsigned bytes) {
+    if (mb.getVoidPtr() == nullptr || mb.getSize() < bytes) {
+        mb.dealloc();
+        mb.alloc(bytes);
+    }
+}
+
+static void reserve_buffer_for_compression(MemBuffer &mb, unsigned uncompressed_size) {
+    if (mb.getVoidPtr() == nullptr ||
+        mb.getSize() < MemBuffer::getSizeForCompression(uncompressed_size)) {
+        mb.dealloc();
+        mb.allocForCompression(uncompressed_size);
+    }
+}
+
+/*************************************************************************
+// "--explain-search": log one method/filter candidate; ph may be nullptr
+// if the candidate never got compressed
+**************************************************************************/
+
+static double explain_msecs(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0)
+        .count();
+}
+
+static void explain_trial(const char *file, const char *status, int method, int filter,
+                          const PackHeader *ph = nullptr, unsigned lsize = 0,
+                          unsigned hdr_c_len = 0, double ms = 0) {
+    upx::SearchTrial t;
+    t.file = file;
+    t.status = status;
+    t.method = method;
+    t.filter = filter;
+    t.filter_cto = ph ? ph->filter_cto : 0;
+    t.u_len = ph ? ph->u_len : 0;
+    t.c_len = ph ? ph->c_len : 0;
+    t.loader_size = lsize;
+    t.hdr_c_len = hdr_c_len;
+    t.overlap_overhead = ph ? ph->overlap_overhead : 0;
+    t.ms = ms;
+    upx::explain_write(t);
+}
+
+/*************************************************************************
+// sortCompressionTrials - "--time-budget": stably sort the methods and the
+// filters by the best sample size of pruneCompressionTrials() in any of
+// their candidates, and permute trial_mask[k], k == mm * nfilters + ff,
+// to match.
+**************************************************************************/
+
+static void sortCompressionTrials(int *methods, int nmethods, int *filters, int nfilters,
+                                  byte *trial_mask, const upx_uint64_t *score) {
+    upx_uint64_t m_best[256], f_best[256];
+    for (int mm = 0; mm < nmethods; mm++)
+        m_best[mm] = ~(upx_uint64_t) 0;
+    for (int ff = 0; ff < nfilters; ff++)
+        f_best[ff] = ~(upx_uint64_t) 0;
+    for (int k = 0; k < nmethods * nfilters; k++) {
+        if (!trial_mask[k])
+            continue;
+        m_best[k / nfilters] = UPX_MIN(m_best[k / nfilters], score[k]);
+        f_best[k % nfilters] = UPX_MIN(f_best[k % nfilters], score[k]);
+    }
+    // insertion sort of the indices; n is small
+    auto sort_order = [](int *order, int n, const upx_uint64_t *best) {
+        for (int i = 0; i < n; i++) {
+            int j = i;
+            for (; j > 0 && best[order[j - 1]] > best[i]; j--)
+                order[j] = order[j - 1];
+            order[j] = i;
+        }
+    };
+    int m_order[256], f_order[256];
+    sort_order(m_order, nmethods, m_best);
+    sort_order(f_order, nfilters, f_best);
+
+    int old_methods[256], old_filters[256];
+    memcpy(old_methods, methods, sizeof(methods[0]) * nmethods);
+    memcpy(old_filters, filters, sizeof(filters[0]) * nfilters);
+    MemBuffer old_mask(nmethods * nfilters);
+    memcpy(old_mask, trial_mask, nmethods * nfilters);
+    for (int mm = 0; mm < nmethods; mm++) {
+        methods[mm] = old_methods[m_order[mm]];
+        for (int ff = 0; ff < nfilters; ff++)
+            trial_mask[mm * nfilters + ff] = old_mask[m_order[mm] * nfilters + f_order[ff]];
+    }
+    for (int ff = 0; ff < nfilters; ff++)
+        filters[ff] = old_filters[f_order[ff]];
+}
+
+/*************************************************************************
+// orderFiltersByScan - with filter_strategy < 0 compressWithFilters() stops
+// at the first working filter, so the static order of getFilters() decides
+// which one is used. The x86 calltricks all count call sites, so for them
+// Filter::scan() of the actual buffer gives a better guess: stably move the
+// ones which rewrite the most calls and leave the fewest out-of-range ones
+// behind to the front. All other filters keep their places.
+// This only depends on the buffer, so the output stays deterministic.
+**************************************************************************/
+
+static inline bool isX86CallFilter(int filter_id) noexcept {
+    return (filter_id >= 0x01 && filter_id <= 0x4f) || (filter_id >= 0x80 && filter_id <= 0x87);
+}
+
+void Packer::orderFiltersByScan(int *filters, int nfilters, const byte *f_ptr, unsigned f_len,
+                                const Filter &orig_ft) const {
+    int slot[256]; // the positions of the x86 calltricks in filters[]
+    upx_int64_t score[256];
+    int n = 0;
+    for (int ff = 0; ff < nfilters; ff++) {
+        if (!isX86CallFilter(filters[ff]))
+            continue;
+        Filter ft = orig_ft;
+        ft.init(filters[ff], orig_ft.addvalue);
+        optimizeFilter(&ft, f_ptr, f_len);
+        if (ft.scan(f_ptr, f_len) && ft.calls > 0)
+            score[n] = upx_int64_t(ft.calls) - ft.noncalls - ft.wrongcalls;
+        else
+            score[n] = -(upx_int64_t(1) << 40); // will fail; keep it last
+        NO_printf("orderFiltersByScan: 0x%02x %lld\n", filters[ff], (long long) score[n]);
+        slot[n++] = ff;
+    }
+    if (n < 2)
+        return;
+    // insertion sort of the slots, so that ties keep the order of getFilters()
+    int ids[256];
+    for (int i = 0; i < n; i++)
+        ids[i] = filters[slot[i]];
+    for (int i = 1; i < n; i++) {
+        const int id = ids[i];
+        const upx_int64_t s = score[i];
+        int j = i;
+        for (; j > 0 && score[j - 1] < s; j--) {
+            ids[j] = ids[j - 1];
+            score[j] = score[j - 1];
+        }
+        ids[j] = id;
+        score[j] = s;
+    }
+    for (int i = 0; i < n; i++)
+        filters[slot[i]] = ids[i];
+}
+
 void Packer::compressWithFilters(byte *i_ptr,
                                  const unsigned i_len, // written and restored by filters
                                  byte *const o_ptr,    // where to put compressed output
@@ -1037,11 +1647,12 @@ void Packer::compressWithFilters(byte *i_ptr,
                                  upx_compress_config_t const *const cconf,
                                  int filter_strategy, // in+out for prepareFilters
                                  bool const inhibit_compression_check) {
+    upx::TraceScope trace_scope("compressWithFilters", i_len);
     parm_ft->buf_len = f_len;
     // struct copies
     const PackHeader orig_ph = this->ph;
     PackHeader best_ph = this->ph;
-    const Filter orig_ft = *parm_ft;
+    Filter orig_ft = *parm_ft; // only orig_ft.adler may change, see below
     Filter best_ft = *parm_ft;
     //
     best_ph.c_len = i_len;
@@ -1062,6 +1673,8 @@ void Packer::compressWithFilters(byte *i_ptr,
     int nfilters = prepareFilters(filters, filter_strategy, getFilters());
     assert(nfilters > 0);
     assert(nfilters < 256);
+    if (filter_strategy < 0 && nfilters > 2 && f_len > 0)
+        orderFiltersByScan(filters, nfilters, f_ptr, f_len, orig_ft);
 #if 0
     printf("compressWithFilters: m(%d):", nmethods);
     for (int i = 0; i < nmethods; i++)
@@ -1072,6 +1685,17 @@ void Packer::compressWithFilters(byte *i_ptr,
     printf("\n");
 #endif
 
+    if (opt->benchmark)
+        benchmarkCompression(i_ptr, i_len, f_ptr, f_len, orig_ft, methods[0], cconf);
+
+    // All trials filter the very same data, so compute the checksum which
+    // Filter::filter() saves for unfilter(verify) only once; every trial
+    // filter is a copy of orig_ft, and Filter::init() keeps this.
+    if (nmethods * nfilters > 1 && f_len > 0) {
+        orig_ft.adler = upx_adler32(f_ptr, f_len);
+        orig_ft.adler_is_known = true;
+    }
+
     // update total_passes; previous (ui_total_passes > 0) means incremental
     if (!ph_is_forced_method(ph.method)) {
         if (uip->ui_total_passes > 0)
@@ -1082,34 +1706,324 @@ void Packer::compressWithFilters(byte *i_ptr,
             uip->ui_total_passes += nfilters * nmethods;
     }
 
+    // optionally try the winner of an earlier run first; see util/decision_cache.h
+    const bool searching = filter_strategy >= 0 && nmethods * nfilters > 1;
+    const bool use_search_shard = searching && opt->search_shards > 1;
+    const bool use_decision_cache = searching && opt->decision_cache && !use_search_shard;
+    const bool use_search_result = searching && opt->search_result != nullptr;
+    const bool use_search_merge = searching && opt->search_merge != nullptr;
+    upx::DecisionCacheKey cache_key = {};
+    upx::CompressionDecision cached = {};
+    MemBuffer cache_mask_buf;
+    const byte *cache_mask = nullptr;
+    if (use_decision_cache || use_search_result || use_search_merge) {
+        upx::DecisionHasher h;
+        h.add(UPX_VERSION_STRING, sizeof(UPX_VERSION_STRING));
+        h.add(upx_uint64_t(getFormat()));
+        h.add(upx_uint64_t(ph.level) | (upx_uint64_t(i_len) << 32));
+        h.add(upx_uint64_t(overlap_range) | (upx_uint64_t(orig_ft.addvalue) << 32));
+        h.add(upx_uint64_t(opt->small) | (upx_uint64_t(opt->exact) << 32));
+        h.add(upx_uint64_t(opt->optimize_startup));
+        h.add(methods, sizeof(methods[0]) * nmethods);
+        h.add(filters, sizeof(filters[0]) * nfilters);
+        if (cconf != nullptr)
+            h.add(*cconf);
+        // the filtered area may start before i_ptr
+        const byte *const b_ptr = (f_len && f_ptr < i_ptr) ? f_ptr : i_ptr;
+        const unsigned f_off = f_len ? ptr_udiff_bytes(f_ptr, b_ptr) : 0;
+        h.add(upx_uint64_t(f_off) | (upx_uint64_t(f_len) << 32));
+        h.add(b_ptr, ptr_udiff_bytes(i_ptr + i_len, b_ptr));
+        if (hdr_ptr != nullptr && hdr_len)
+            h.add(hdr_ptr, hdr_len);
+        cache_key = h.get();
+        // "--search-merge": the winner of all the "--search-shard" runs
+        if ((use_search_merge && upx::search_result_lookup(opt->search_merge, cache_key, &cached))
+            || (use_decision_cache && upx::decision_cache_lookup(cache_key, &cached))) {
+            for (int k = 0; k < nmethods * nfilters; k++) {
+                if (methods[k / nfilters] == cached.method &&
+                    filters[k % nfilters] == cached.filter) {
+                    cache_mask_buf.allocZeroed(nmethods * nfilters);
+                    cache_mask_buf[k] = 1;
+                    cache_mask = cache_mask_buf;
+                    break;
+                }
+            }
+        }
+    }
+
+    // optionally do a quick pre-selection of the candidates on some samples;
+    // "--time-budget" also uses the sample sizes to try the best ones first
+    MemBuffer trial_mask_buf;
+    const byte *trial_mask = nullptr; // nullptr means use all candidates
+    const bool use_pruning = opt->prune_trials > 0 &&
+                             opt->prune_trials < unsigned(nmethods * nfilters);
+    const bool use_time_budget = searching && search_deadline != 0;
+    MemBuffer score_buf;
+    bool have_scores = false;
+    if (cache_mask == nullptr && filter_strategy >= 0 && (use_pruning || use_time_budget)) {
+        trial_mask_buf.alloc(nmethods * nfilters);
+        score_buf.alloc(mem_size(sizeof(upx_uint64_t), nmethods * nfilters));
+        const unsigned keep = use_pruning ? opt->prune_trials : unsigned(nmethods * nfilters);
+        upx_uint64_t *const score = (upx_uint64_t *) score_buf.getVoidPtr();
+        have_scores = pruneCompressionTrials(trial_mask_buf, score, keep, i_ptr, i_len, f_ptr,
+                                             f_len, methods, nmethods, filters, nfilters, orig_ft,
+                                             cconf);
+        if (have_scores)
+            trial_mask = trial_mask_buf;
+    }
+
+    // "--search-shard=I/N": only try every N-th candidate, starting at I
+    if (cache_mask == nullptr && use_search_shard) {
+        if (trial_mask == nullptr) {
+            trial_mask_buf.alloc(nmethods * nfilters);
+            memset(trial_mask_buf, 1, nmethods * nfilters);
+            trial_mask = trial_mask_buf;
+        }
+        for (int k = 0; k < nmethods * nfilters; k++)
+            if (unsigned(k) % opt->search_shards != opt->search_shard)
+                trial_mask_buf[k] = 0;
+    }
+
+    // Whether a filter works does not depend on the method, so filter once
+    // per filter id here and drop a failing (or useless) filter from all
+    // methods, instead of filtering again for every method just to find out.
+    if (cache_mask == nullptr && filter_strategy >= 0 && nmethods >= 2) {
+        for (int ff = 0; ff < nfilters; ff++) {
+            if (filters[ff] == 0)
+                continue; // always works
+            bool wanted = (trial_mask == nullptr);
+            for (int mm = 0; mm < nmethods && !wanted; mm++)
+                wanted = trial_mask[mm * nfilters + ff] != 0;
+            if (!wanted)
+                continue;
+            Filter ft = orig_ft;
+            ft.init(filters[ff], orig_ft.addvalue);
+            optimizeFilter(&ft, f_ptr, f_len);
+            bool success = ft.filter(f_ptr, f_len);
+            if (success && ft.calls == 0)
+                success = false; // filter did not do anything - no need to call ft.unfilter()
+            else if (success)
+                ft.unfilter(f_ptr, f_len, true);
+            if (success)
+                continue;
+            if (trial_mask == nullptr) {
+                if (trial_mask_buf.getVoidPtr() == nullptr)
+                    trial_mask_buf.alloc(nmethods * nfilters);
+                memset(trial_mask_buf, 1, nmethods * nfilters);
+                trial_mask = trial_mask_buf;
+            }
+            for (int mm = 0; mm < nmethods; mm++)
+                trial_mask_buf[mm * nfilters + ff] = 0;
+            NO_printf("compressWithFilters: dropped filter 0x%02x\n", filters[ff]);
+        }
+    }
+    if (cache_mask == nullptr && use_search_shard) {
+        bool any = false;
+        for (int k = 0; k < nmethods * nfilters && !any; k++)
+            any = trial_mask_buf[k] != 0;
+        if (!any) {
+            // nothing left in this shard - still produce a valid file
+            int ff = 0;
+            while (ff + 1 < nfilters && filters[ff] != 0)
+                ff++;
+            trial_mask_buf[ff] = 1;
+        }
+    }
+
+    // "--time-budget": order the methods and the filters by their best sample size,
+    // so that the most promising candidates are tried before the time is up
+    if (cache_mask == nullptr && use_time_budget && have_scores)
+        sortCompressionTrials(methods, nmethods, filters, nfilters, trial_mask_buf,
+                              (const upx_uint64_t *) score_buf.getVoidPtr());
+
+    // Most trials lose, so do not decompress and verify each of them in
+    // compress(); the winner is verified below before it gets used.
+    defer_trial_verify = nmethods * nfilters > 1;
+    trial_adler_cache_len = 0;
+
+    int nfilters_success_total = 0;
+    if (cache_mask != nullptr) {
+        // only try the cached decision
+        const int ui_pass = uip->ui_pass;
+        nfilters_success_total = compressWithFiltersSerial(
+            i_ptr, i_len, o_ptr, f_ptr, f_len, hdr_ptr, hdr_len, methods, nmethods, filters,
+            nfilters, cache_mask, orig_ft, filter_strategy, overlap_range, cconf, &cached, best_ph,
+            best_ft, best_ph_lsize, best_hdr_c_len);
+        if (best_ph.overlap_overhead == 0) {
+            // stale cache entry - just try everything
+            NO_printf("compressWithFilters: cached decision failed\n");
+            this->ph = orig_ph;
+            uip->ui_pass = ui_pass;
+            nfilters_success_total = 0;
+            cache_mask = nullptr;
+        }
+    }
+    if (cache_mask == nullptr) {
+        unsigned num_threads =
+            (filter_strategy >= 0) ? upx::get_num_threads(size_t(nmethods) * nfilters) : 1;
+        if (num_threads >= 2 && opt->memory_limit) {
+            // each parallel trial owns a copy of the input, an output buffer
+            // and the working memory of its compressor; the cheapest method
+            // gives the upper limit, and compressWithFiltersParallel() then
+            // sizes each batch by the methods that it actually contains
+            upx_uint64_t work_memory = ~(upx_uint64_t) 0;
+            for (int mm = 0; mm < nmethods; mm++)
+                work_memory = UPX_MIN(work_memory, upx_compress_work_memory(i_len, methods[mm],
+                                                                            ph.level, cconf));
+            const upx_uint64_t per_thread = upx_uint64_t(i_len) + f_len +
+                                            MemBuffer::getSizeForCompression(i_len) + work_memory;
+            num_threads = upx::limit_threads_by_memory(num_threads, per_thread);
+        }
+        if (num_threads >= 2) {
+            nfilters_success_total = compressWithFiltersParallel(
+                num_threads, i_ptr, i_len, o_ptr, f_ptr, f_len, hdr_ptr, hdr_len, methods,
+                nmethods, filters, nfilters, trial_mask, orig_ft, overlap_range, cconf, best_ph,
+                best_ft, best_ph_lsize, best_hdr_c_len);
+        } else {
+            nfilters_success_total = compressWithFiltersSerial(
+                i_ptr, i_len, o_ptr, f_ptr, f_len, hdr_ptr, hdr_len, methods, nmethods, filters,
+                nfilters, trial_mask, orig_ft, filter_strategy, overlap_range, cconf, nullptr,
+                best_ph, best_ft, best_ph_lsize, best_hdr_c_len);
+        }
+        if ((use_decision_cache || use_search_result) && nfilters_success_total > 0 &&
+            best_ph.overlap_overhead > 0) {
+            upx::CompressionDecision d;
+            d.method = best_ph.method;
+            d.filter = best_ph.filter;
+            d.filter_cto = best_ph.filter_cto;
+            d.overlap_overhead = best_ph.overlap_overhead;
+            if (use_decision_cache)
+                upx::decision_cache_store(cache_key, d);
+            if (use_search_result) {
+                // see isBetterTrial()
+                upx::SearchRank rank;
+                rank.size = best_ph.c_len + best_ph_lsize + best_hdr_c_len;
+                rank.loader_size = best_ph_lsize + best_hdr_c_len;
+                rank.overlap_overhead = best_ph.overlap_overhead;
+                rank.cost = opt->optimize_startup
+                                ? startupCost(best_ph.method, best_ph.u_len, rank.size)
+                                : 0;
+                rank.order = 0;
+                for (int k = 0; k < nmethods * nfilters; k++) {
+                    if (methods[k / nfilters] == best_ph.method &&
+                        filters[k % nfilters] == best_ph.filter) {
+                        rank.order = unsigned(k);
+                        break;
+                    }
+                }
+                upx::search_result_store(opt->search_result, cache_key, d, rank);
+            }
+        }
+    }
+
+    // postconditions 1)
+    assert(nfilters_success_total > 0);
+    assert(best_ph.u_len == orig_ph.u_len);
+    assert(best_ph.filter == best_ft.id);
+    assert(best_ph.filter_cto == best_ft.cto);
+    // FIXME  assert(best_ph.n_mru == best_ft.n_mru);
+
+    // the trials were not verified, so do that now for the winner only
+    if (defer_trial_verify && !ph_skipVerify(best_ph)) {
+        reserve_buffer_for_compression(trial_obuf, best_ph.u_len);
+        verify_decompression(best_ph, o_ptr, raw_bytes(trial_obuf, best_ph.u_len));
+    }
+    defer_trial_verify = false;
+
+    // copy back results
+    this->ph = best_ph;
+    *parm_ft = best_ft;
+    if (upx::explain_is_enabled())
+        explain_trial(fi->getName(), "chosen", best_ph.method, best_ph.filter, &best_ph,
+                      best_ph_lsize, best_hdr_c_len);
+
+    // Finally, check compression ratio.
+    // Might be inhibited when blocksize < file_size, for instance.
+    if (!inhibit_compression_check) {
+        if (best_ph.c_len + best_ph_lsize >= best_ph.u_len)
+            throwNotCompressible();
+        if (!checkCompressionRatio(best_ph.u_len, best_ph.c_len))
+            throwNotCompressible();
+
+        // postconditions 2)
+        assert(best_ph.overlap_overhead > 0);
+    }
+
+    // convenience
+    upx::TraceScope trace_loader("buildLoader");
+    buildLoader(&best_ft);
+}
+
+/*************************************************************************
+// compressWithFiltersSerial - the method/filter trials of
+// compressWithFilters() on the calling thread.
+//
+// Every trial filters and compresses [i_ptr, +i_len) in place, and the best
+// version so far is kept in o_ptr. If "hint" is not nullptr then it is a
+// cached decision of an earlier run, which is used to speed up the matching
+// trial; see util/decision_cache.h.
+//
+// Returns the number of successful filters.
+**************************************************************************/
+
+int Packer::compressWithFiltersSerial(byte *i_ptr, const unsigned i_len, byte *const o_ptr,
+                                      byte *f_ptr, const unsigned f_len, byte *const hdr_ptr,
+                                      const unsigned hdr_len, const int *methods, int nmethods,
+                                      const int *filters, int nfilters, const byte *trial_mask,
+                                      const Filter &orig_ft, int filter_strategy,
+                                      const unsigned overlap_range,
+                                      upx_compress_config_t const *cconf,
+                                      const upx::CompressionDecision *hint, PackHeader &best_ph,
+                                      Filter &best_ft, unsigned &best_ph_lsize,
+                                      unsigned &best_hdr_c_len) {
+    const PackHeader orig_ph = this->ph;
+    int nfilters_success_total = 0;
+    const bool explain = upx::explain_is_enabled();
+
     // Working buffer for compressed data. Don't waste memory and allocate as needed.
     byte *o_tmp = o_ptr;
-    MemBuffer o_tmp_buf;
+
+    // "--time-budget": once a valid version exists, do not start new trials after the deadline
+    bool out_of_time = false;
+    auto time_is_up = [&]() -> bool {
+        if (!out_of_time && hint == nullptr && best_ph.overlap_overhead > 0 && searchTimeIsUp())
+            out_of_time = true;
+        return out_of_time;
+    };
 
     // compress using all methods/filters
-    int nfilters_success_total = 0;
     for (int mm = 0; mm < nmethods; mm++) // for all methods
     {
         NO_printf("\nmethod %d (%d of %d)\n", methods[mm], 1 + mm, nmethods);
         assert(isValidCompressionMethod(methods[mm]));
-        unsigned hdr_c_len = 0;
-        if (hdr_ptr != nullptr && hdr_len) {
-            if (nfilters_success_total != 0 && o_tmp == o_ptr) {
-                // do not overwrite o_ptr
-                o_tmp_buf.allocForCompression(UPX_MAX(hdr_len, i_len));
-                o_tmp = o_tmp_buf;
-            }
-            int r = upx_compress(hdr_ptr, hdr_len, o_tmp, &hdr_c_len, nullptr, methods[mm], 10,
-                                 nullptr, nullptr);
-            if (r != UPX_E_OK)
-                throwInternalError("header compression failed");
-            if (hdr_c_len >= hdr_len)
-                throwInternalError("header compression size increase");
+        if ((trial_mask != nullptr && !memchr(trial_mask + mm * nfilters, 1, nfilters)) ||
+            time_is_up()) {
+            // all filters of this method have been pruned, or no time is left
+            if (uip->ui_pass >= 0)
+                uip->ui_pass += nfilters;
+            for (int ff = 0; explain && ff < nfilters; ff++)
+                explain_trial(fi->getName(), out_of_time ? "out-of-time" : "pruned", methods[mm],
+                              filters[ff]);
+            continue;
         }
+        unsigned hdr_c_len = 0;
+        if (hdr_ptr != nullptr && hdr_len)
+            hdr_c_len = compressHeader(hdr_ptr, hdr_len, methods[mm]);
         int nfilters_success_mm = 0;
         for (int ff = 0; ff < nfilters; ff++) // for all filters
         {
             assert(isValidFilter(filters[ff]));
+            if ((trial_mask != nullptr && !trial_mask[mm * nfilters + ff]) || time_is_up()) {
+                // pruned, or no time left
+                if (uip->ui_pass >= 0)
+                    uip->ui_pass++;
+                if (explain)
+                    explain_trial(fi->getName(), out_of_time ? "out-of-time" : "pruned",
+                                  methods[mm], filters[ff]);
+                continue;
+            }
+            const auto t0 = explain ? std::chrono::steady_clock::now()
+                                    : std::chrono::steady_clock::time_point();
             // get fresh packheader
             ph = orig_ph;
             ph.method = methods[mm];
@@ -1118,9 +2032,15 @@ void Packer::compressWithFilters(byte *i_ptr,
             // get fresh filter
             Filter ft = orig_ft;
             ft.init(ph.filter, orig_ft.addvalue);
+            const bool use_hint = hint && hint->method == ph.method && hint->filter == ph.filter;
+            int preferred_ctos[2] = {use_hint ? int(hint->filter_cto) : -1, -1};
+            if (use_hint)
+                ft.preferred_ctos = preferred_ctos; // try the cached cto first
             // filter
             optimizeFilter(&ft, f_ptr, f_len);
             bool success = ft.filter(f_ptr, f_len);
+            if (use_hint)
+                ft.preferred_ctos = nullptr; // do not keep a pointer to a local
             if (ft.id != 0 && ft.calls == 0) {
                 // filter did not do anything - no need to call ft.unfilter()
                 success = false;
@@ -1132,6 +2052,9 @@ void Packer::compressWithFilters(byte *i_ptr,
                     if (uip->ui_pass >= 0)
                         uip->ui_pass++;
                 }
+                if (explain)
+                    explain_trial(fi->getName(), "filter-failed", ph.method, ph.filter, nullptr, 0,
+                                  hdr_c_len, explain_msecs(t0));
                 continue;
             }
             // filter success
@@ -1139,44 +2062,44 @@ void Packer::compressWithFilters(byte *i_ptr,
                       ft.id, ft.buf_len, ft.calls, ft.noncalls, ft.wrongcalls, ft.firstcall,
                       ft.lastcall, ft.cto);
             if (nfilters_success_total != 0 && o_tmp == o_ptr) {
-                o_tmp_buf.allocForCompression(i_len);
-                o_tmp = o_tmp_buf;
+                reserve_buffer_for_compression(trial_obuf, i_len);
+                o_tmp = trial_obuf;
             }
             nfilters_success_total++;
             nfilters_success_mm++;
             ph.filter_cto = ft.cto;
             ph.n_mru = ft.n_mru;
             // compress
-            if (compress(i_ptr, i_len, o_tmp, cconf)) {
+            const unsigned *u_adler = findTrialAdler(ph.filter, ph.filter_cto);
+            upx_compress_config_t trial_cconf;
+            const upx_compress_config_t *const t_cconf = trialConfig(
+                trial_cconf, cconf, ph, best_ph, best_ph_lsize, best_hdr_c_len, hdr_c_len);
+            const bool compressed = compress(ph, i_ptr, i_len, o_tmp, t_cconf, uip, nullptr,
+                                             !defer_trial_verify, u_adler);
+            if (u_adler == nullptr)
+                storeTrialAdler(ph.filter, ph.filter_cto, ph.u_adler);
+            if (compressed) {
                 unsigned lsize = 0;
                 // findOverlapOperhead() might be slow; omit if already too big.
-                if (ph.c_len + lsize + hdr_c_len <=
-                    best_ph.c_len + best_ph_lsize + best_hdr_c_len) {
+                if (ph.c_len <= maxWinningCLen(ph.method, ph.u_len, hdr_c_len, best_ph,
+                                               best_ph_lsize, best_hdr_c_len)) {
                     // get results
-                    ph.overlap_overhead = findOverlapOverhead(o_tmp, i_ptr, overlap_range);
-                    buildLoader(&ft);
-                    lsize = getLoaderSize();
+                    ph.overlap_overhead =
+                        findOverlapOverhead(ph, o_tmp, i_ptr, overlap_range, ~0u,
+                                            use_hint ? hint->overlap_overhead : 0);
+                    lsize = getTrialLoaderSize(&ft);
                     assert(lsize > 0);
                 }
                 NO_printf("\n%2d %02x: %d +%4d +%3d = %d  (best: %d +%4d +%3d = %d)\n", ph.method,
                           ph.filter, ph.c_len, lsize, hdr_c_len, ph.c_len + lsize + hdr_c_len,
                           best_ph.c_len, best_ph_lsize, best_hdr_c_len,
                           best_ph.c_len + best_ph_lsize + best_hdr_c_len);
-                bool update = false;
-                if (ph.c_len + lsize + hdr_c_len < best_ph.c_len + best_ph_lsize + best_hdr_c_len)
-                    update = true;
-                else if (ph.c_len + lsize + hdr_c_len ==
-                         best_ph.c_len + best_ph_lsize + best_hdr_c_len) {
-                    // prefer smaller loaders
-                    if (lsize + hdr_c_len < best_ph_lsize + best_hdr_c_len)
-                        update = true;
-                    else if (lsize + hdr_c_len == best_ph_lsize + best_hdr_c_len) {
-                        // prefer less overlap_overhead
-                        if (ph.overlap_overhead < best_ph.overlap_overhead)
-                            update = true;
-                    }
-                }
-                if (update) {
+                const bool better =
+                    isBetterTrial(ph, lsize, hdr_c_len, best_ph, best_ph_lsize, best_hdr_c_len);
+                if (explain)
+                    explain_trial(fi->getName(), better ? "best" : lsize ? "worse" : "too-big",
+                                  ph.method, ph.filter, &ph, lsize, hdr_c_len, explain_msecs(t0));
+                if (better) {
                     assert((int) ph.overlap_overhead > 0);
                     // update o_ptr[] with best version
                     if (o_tmp != o_ptr)
@@ -1187,40 +2110,658 @@ void Packer::compressWithFilters(byte *i_ptr,
                     best_hdr_c_len = hdr_c_len;
                     best_ft = ft;
                 }
+            } else if (explain) {
+                const bool too_big = t_cconf != cconf && ph.c_len > t_cconf->max_c_len;
+                explain_trial(fi->getName(), too_big ? "too-big" : "failed", ph.method, ph.filter,
+                              too_big ? &ph : nullptr, 0, hdr_c_len, explain_msecs(t0));
             }
             // restore - unfilter with verify
             ft.unfilter(f_ptr, f_len, true);
             if (filter_strategy < 0)
                 break;
         }
-        assert(nfilters_success_mm > 0);
+        // a cached filter may fail
+        assert(nfilters_success_mm > 0 || hint != nullptr || out_of_time);
     }
+    return nfilters_success_total;
+}
 
-    // postconditions 1)
-    assert(nfilters_success_total > 0);
-    assert(best_ph.u_len == orig_ph.u_len);
-    assert(best_ph.filter == best_ft.id);
-    assert(best_ph.filter_cto == best_ft.cto);
-    // FIXME  assert(best_ph.n_mru == best_ft.n_mru);
+/*************************************************************************
+// pruneCompressionTrials - quick pre-selection for compressWithFilters()
+//
+// Compress a few evenly spaced slices of the (filtered) input with every
+// method/filter candidate, and only keep the "keep" candidates with the
+// smallest total sample size in trial_mask[k], k == mm * nfilters + ff.
+// On a tie the earlier candidate wins, so the selection is deterministic.
+// The sample sizes are stored in score[k], ~0 for a failing filter.
+//
+// Returns false if the input is too small to be worth pruning.
+**************************************************************************/
 
-    // copy back results
-    this->ph = best_ph;
-    *parm_ft = best_ft;
+bool Packer::pruneCompressionTrials(byte *trial_mask, upx_uint64_t *score, unsigned keep,
+                                    byte *i_ptr, const unsigned i_len, byte *f_ptr,
+                                    const unsigned f_len, const int *methods, int nmethods,
+                                    const int *filters, int nfilters, const Filter &orig_ft,
+                                    upx_compress_config_t const *cconf) {
+    constexpr unsigned NSLICES = 4;
+    constexpr unsigned SLICE_LEN = 64 * 1024;
+    if (i_len < 4 * NSLICES * SLICE_LEN)
+        return false;
+    unsigned slice_off[NSLICES];
+    for (unsigned i = 0; i < NSLICES; i++)
+        slice_off[i] = ACC_ICONV(unsigned, (upx_uint64_t(i_len - SLICE_LEN) * i) / (NSLICES - 1));
+
+    const int ntrials = nmethods * nfilters;
+    const unsigned o_slice_size = MemBuffer::getSizeForCompression(SLICE_LEN);
+    MemBuffer o_buf(mem_size(o_slice_size, nmethods * NSLICES));
+    const unsigned num_threads = upx::get_num_threads(nmethods * NSLICES);
+
+    for (int ff = 0; ff < nfilters; ff++) {
+        assert(isValidFilter(filters[ff]));
+        // filter in place; see compressWithFilters()
+        Filter ft = orig_ft;
+        ft.init(filters[ff], orig_ft.addvalue);
+        optimizeFilter(&ft, f_ptr, f_len);
+        bool success = ft.filter(f_ptr, f_len);
+        if (ft.id != 0 && ft.calls == 0)
+            success = false; // filter did not do anything - no need to call ft.unfilter()
+        if (!success) {
+            for (int mm = 0; mm < nmethods; mm++)
+                score[mm * nfilters + ff] = ~(upx_uint64_t) 0; // will fail again
+            continue;
+        }
+        unsigned c_lens[256 * NSLICES];
+        upx::parallel_for(nmethods * NSLICES, num_threads, [&](size_t j) {
+            const int mm = (int) (j / NSLICES);
+            byte *const o_ptr = o_buf + mem_size(o_slice_size, j);
+            unsigned c_len = o_slice_size;
+            int r = upx_compress(i_ptr + slice_off[j % NSLICES], SLICE_LEN, o_ptr, &c_len,
+                                 nullptr, methods[mm], ph.level, cconf, nullptr);
+            if (r == UPX_E_OUT_OF_MEMORY)
+                throwOutOfMemoryException();
+            if (r != UPX_E_OK)
+                throwInternalError("compression failed");
+            c_lens[j] = c_len;
+        });
+        for (int mm = 0; mm < nmethods; mm++) {
+            upx_uint64_t sum = 0;
+            for (unsigned i = 0; i < NSLICES; i++)
+                sum += c_lens[mm * NSLICES + i];
+            // "--optimize-for=startup": rank by the load time instead of the size
+            score[mm * nfilters + ff] =
+                opt->optimize_startup
+                    ? startupCost(methods[mm], NSLICES * SLICE_LEN, ACC_ICONV(unsigned, sum))
+                    : sum;
+        }
+        // restore - unfilter with verify
+        ft.unfilter(f_ptr, f_len, true);
+    }
 
-    // Finally, check compression ratio.
-    // Might be inhibited when blocksize < file_size, for instance.
-    if (!inhibit_compression_check) {
-        if (best_ph.c_len + best_ph_lsize >= best_ph.u_len)
-            throwNotCompressible();
-        if (!checkCompressionRatio(best_ph.u_len, best_ph.c_len))
-            throwNotCompressible();
+    // select the best candidates
+    memset(trial_mask, 0, ntrials);
+    for (unsigned n = 0; n < keep; n++) {
+        int best = -1;
+        for (int k = 0; k < ntrials; k++)
+            if (!trial_mask[k] && score[k] != ~(upx_uint64_t) 0 &&
+                (best < 0 || score[k] < score[best]))
+                best = k;
+        if (best < 0)
+            break;
+        trial_mask[best] = 1;
+    }
+    if (!memchr(trial_mask, 1, ntrials))
+        return false; // all filters failed; let compressWithFilters() handle that
+    NO_printf("pruneCompressionTrials: keeping %u of %d\n", keep, ntrials);
+    return true;
+}
 
-        // postconditions 2)
-        assert(best_ph.overlap_overhead > 0);
+/*************************************************************************
+// benchmarkCompression - "--benchmark": report the cost of every method
+// and level that getCompressionMethods() allows, and of every filter
+// from getFilters(), for the data of compressWithFilters().
+//
+// The filters are measured with default_method at ph.level only, as the
+// size/speed tradeoff of a filter hardly depends on the method.
+// The runtime stubs implement the very same decoders, so the host time of
+// decompression plus unfilter is used as the estimate of the stub time.
+// The buffer is restored, and nothing of this has any effect on packing.
+**************************************************************************/
+
+void Packer::benchmarkCompression(byte *i_ptr, const unsigned i_len, byte *f_ptr,
+                                  const unsigned f_len, const Filter &orig_ft,
+                                  int default_method, upx_compress_config_t const *cconf) {
+    typedef std::chrono::steady_clock Clock;
+    auto msecs_since = [](const Clock::time_point &t0) -> double {
+        return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    };
+    MemBuffer cbuf;
+    cbuf.allocForCompression(i_len);
+    MemBuffer dbuf;
+    dbuf.allocForDecompression(i_len);
+    // compress and decompress [i_ptr, +i_len); returns the c_len or 0 on failure
+    auto measure = [&](int method, int level, double *c_ms, double *d_ms) -> unsigned {
+        upx_compress_result_t cresult;
+        unsigned c_len = 0;
+        Clock::time_point t0 = Clock::now();
+        int r = upx_compress(i_ptr, i_len, cbuf, &c_len, nullptr, method, level, cconf, &cresult);
+        *c_ms = msecs_since(t0);
+        if (r != UPX_E_OK || c_len >= i_len)
+            return 0;
+        unsigned d_len = i_len;
+        t0 = Clock::now();
+        r = upx_decompress(cbuf, c_len, dbuf, &d_len, method, &cresult);
+        *d_ms = msecs_since(t0);
+        if (r != UPX_E_OK || d_len != i_len || memcmp(dbuf, i_ptr, i_len) != 0)
+            throwInternalError("benchmark: decompression failed");
+        return c_len;
+    };
+    auto mbps = [i_len](double ms) -> double { return ms > 0 ? i_len / ms / 1000.0 : 0.0; };
+
+    FILE *f = stdout;
+    con_fprintf(f, "\nbenchmark: %u bytes, %u filtered\n", i_len, f_len);
+    con_fprintf(f, "  %-18s %5s %10s %7s %11s %12s %10s\n", "method", "level", "packed", "ratio",
+                "compress", "decompress", "est.stub");
+
+    const int *const all_methods = getCompressionMethods(M_ALL, ph.level);
+    for (int mm = 0; all_methods != nullptr && all_methods[mm] != M_END; ++mm) {
+        const int method = all_methods[mm];
+        if (method == M_ULTRA_BRUTE && !opt->ultra_brute)
+            break;
+        if (method == M_SKIP || method == M_ULTRA_BRUTE)
+            continue;
+        char name[32];
+        set_method_name(name, sizeof(name), method, 0);
+        upx_safe_snprintf(name + strlen(name), sizeof(name) - strlen(name), " (%#x)", method);
+        const int level1 = opt->level > 0 ? opt->level : 1;
+        const int level2 = opt->level > 0 ? opt->level : 10;
+        for (int level = level1; level <= level2; level++) {
+            double c_ms = 0, d_ms = 0;
+            const unsigned c_len = measure(method, level, &c_ms, &d_ms);
+            if (c_len == 0) {
+                con_fprintf(f, "  %-18s %5d %10s\n", name, level, "failed");
+                continue;
+            }
+            con_fprintf(f, "  %-18s %5d %10u %6.2f%% %9.1fms %7.1f MB/s %8.1fms\n", name, level,
+                        c_len, 100.0 * c_len / i_len, c_ms, mbps(d_ms), d_ms);
+        }
     }
 
-    // convenience
-    buildLoader(&best_ft);
+    const int *const all_filters = getFilters();
+    if (all_filters == nullptr || f_len == 0)
+        return;
+    char name[32];
+    set_method_name(name, sizeof(name), default_method, ph.level);
+    con_fprintf(f, "  %-18s %7s %8s %7s %11s %12s %10s\n", "filter", "calls", "packed", "ratio",
+                "filter", "unfilter", "est.stub");
+    for (int ff = 0; all_filters[ff] != FT_END; ++ff) {
+        const int filter_id = all_filters[ff];
+        if (filter_id == FT_ULTRA_BRUTE && !opt->ultra_brute)
+            break;
+        if (filter_id == FT_SKIP || filter_id == FT_ULTRA_BRUTE || filter_id == 0)
+            continue;
+        Filter ft = orig_ft;
+        ft.init(filter_id, orig_ft.addvalue);
+        optimizeFilter(&ft, f_ptr, f_len);
+        Clock::time_point t0 = Clock::now();
+        const bool success = ft.filter(f_ptr, f_len);
+        const double f_ms = msecs_since(t0);
+        char fname[32];
+        upx_safe_snprintf(fname, sizeof(fname), "0x%02x with %s", filter_id, name);
+        if (!success) {
+            con_fprintf(f, "  %-18s %7s\n", fname, "failed");
+            continue;
+        }
+        const unsigned calls = ft.calls;
+        double c_ms = 0, d_ms = 0;
+        const unsigned c_len = calls ? measure(default_method, ph.level, &c_ms, &d_ms) : 0;
+        t0 = Clock::now();
+        ft.unfilter(f_ptr, f_len, true);
+        const double u_ms = msecs_since(t0);
+        if (c_len == 0) {
+            con_fprintf(f, "  %-18s %7u %8s\n", fname, calls, calls ? "failed" : "-");
+            continue;
+        }
+        con_fprintf(f, "  %-18s %7u %8u %6.2f%% %9.1fms %10.1fms %8.1fms\n", fname, calls, c_len,
+                    100.0 * c_len / i_len, f_ms, u_ms, d_ms + u_ms);
+    }
+}
+
+/*************************************************************************
+// analyze - "--analyze": a read-only report of how well the regions of
+// getAnalyzeRegions() would compress, without packing the file.
+//
+// The order-0 entropy is computed over each whole region. The packed size
+// of every method of getCompressionMethods() is extrapolated from a sample
+// of a few slices spread over the region, and so is the host time to
+// decompress it, which also is the estimate of the stub time (see
+// benchmarkCompression()). Once unpacked, all regions live in anonymous
+// memory; the read-only ones would otherwise be file-backed pages which
+// are shared by all processes, so they add to the private memory (RSS) of
+// every process.
+**************************************************************************/
+
+unsigned Packer::getAnalyzeRegions(AnalyzeRegion *regions, unsigned max_regions) {
+    if (max_regions == 0)
+        return 0;
+    AnalyzeRegion &r = regions[0];
+    upx_safe_snprintf(r.name, sizeof(r.name), "file");
+    r.offset = 0;
+    r.size = r.mem_size = file_size_u;
+    r.prot = 4 | 1;
+    return 1;
+}
+
+upx_uint64_t Packer::getRunImageSize() {
+    AnalyzeRegion regions[64];
+    const unsigned nregions = getAnalyzeRegions(regions, TABLESIZE(regions));
+    upx_uint64_t size = 0;
+    for (unsigned i = 0; i < nregions; i++)
+        size += ALIGN_UP(regions[i].mem_size, upx_uint64_t(4096));
+    return size;
+}
+
+// "--run-memory=": at runtime the packed program needs its decompressed
+// image (private memory, while the original program could page from the
+// file), the stub with its stack, and the working memory of the
+// decompressor. Only the LZMA decompressor has a working memory worth
+// mentioning, its probabilities (see getDecompressorWrkmemSize()), so give
+// it what is left of the budget. The block size does not matter, as the
+// stubs decompress every block in place.
+void Packer::checkRunMemory() {
+    constexpr upx_uint64_t STUB_OVERHEAD = 64 * 1024; // incl. the smallest LZMA wrkmem
+    constexpr unsigned MIN_NUM_PROBS = 1846 + 768;    // lit_context_bits + lit_pos_bits == 0
+    const upx_uint64_t need = getRunImageSize() + STUB_OVERHEAD;
+    if (need > opt->run_memory)
+        throwCantPack("needs %llu KiB of memory to run, more than --run-memory=%llu KiB",
+                      (unsigned long long) ((need + 1023) / 1024),
+                      (unsigned long long) (opt->run_memory / 1024));
+    const upx_uint64_t spare_probs = (opt->run_memory - need) / 2; // 16-bit probabilities
+    run_memory_max_num_probs = unsigned(UPX_MIN(MIN_NUM_PROBS + spare_probs, upx_uint64_t(~0u)));
+    NO_printf("checkRunMemory: need %llu, max_num_probs %u\n", (unsigned long long) need,
+              run_memory_max_num_probs);
+}
+
+void Packer::analyze() {
+    typedef std::chrono::steady_clock Clock;
+    constexpr unsigned SLICE_LEN = 64 * 1024;
+    constexpr unsigned NSLICES = 4;
+    constexpr unsigned SAMPLE_LEN = SLICE_LEN * NSLICES;
+    constexpr unsigned MAX_METHODS = 8;
+    constexpr upx_uint64_t PAGE_SIZE = 4096;
+
+    AnalyzeRegion regions[64];
+    const unsigned nregions = getAnalyzeRegions(regions, TABLESIZE(regions));
+    const int level = opt->level > 0 ? opt->level : 7;
+    int methods[MAX_METHODS];
+    unsigned nmethods = 0;
+    // "--lzma" etc. restrict the methods
+    const int method = opt->method > 0 ? opt->method : M_ALL;
+    const int *const all_methods = getCompressionMethods(method, level);
+    for (int mm = 0; all_methods != nullptr && all_methods[mm] != M_END; ++mm) {
+        if (all_methods[mm] == M_ULTRA_BRUTE)
+            break;
+        if (all_methods[mm] != M_SKIP && nmethods < MAX_METHODS)
+            methods[nmethods++] = all_methods[mm];
+    }
+
+    MemBuffer sample(SAMPLE_LEN);
+    MemBuffer cbuf;
+    cbuf.allocForCompression(SAMPLE_LEN);
+    MemBuffer dbuf;
+    dbuf.allocForDecompression(SAMPLE_LEN);
+    MemBuffer rbuf(1024 * 1024);
+
+    FILE *f = stdout;
+    con_fprintf(f, "\nanalyze: %s [%s], %llu bytes, level %d\n", fi->getName(), getName(),
+                (unsigned long long) file_size_u, level);
+    con_fprintf(f, "  %-14s %3s %10s %10s %7s", "region", "rwx", "offset", "size", "entropy");
+    for (unsigned m = 0; m < nmethods; m++) {
+        char name[32];
+        set_method_name(name, sizeof(name), methods[m], 0);
+        con_fprintf(f, " %7.7s", name);
+    }
+    con_fprintf(f, "\n");
+
+    upx_uint64_t total_size = 0, private_bytes = 0;
+    upx_uint64_t total_c[MAX_METHODS] = {};
+    double total_d_ms[MAX_METHODS] = {};
+    for (unsigned rr = 0; rr < nregions; rr++) {
+        const AnalyzeRegion &r = regions[rr];
+        if (!(r.prot & 2))
+            private_bytes += (r.mem_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        if (r.offset >= file_size_u)
+            continue;
+        const upx_uint64_t size = UPX_MIN(r.size, file_size_u - r.offset);
+        const char prot[4] = {r.prot & 4 ? 'r' : '-', r.prot & 2 ? 'w' : '-',
+                              r.prot & 1 ? 'x' : '-', 0};
+        con_fprintf(f, "  %-14s %3s %#10llx %10llu", r.name, prot, (unsigned long long) r.offset,
+                    (unsigned long long) size);
+        if (size == 0) {
+            con_fprintf(f, "\n");
+            continue;
+        }
+        total_size += size;
+
+        // entropy of the whole region
+        upx_uint64_t hist[256] = {};
+        fi->seek(r.offset, SEEK_SET);
+        for (upx_uint64_t done = 0; done < size;) {
+            const int l = (int) UPX_MIN(size - done, upx_uint64_t(rbuf.getSize()));
+            fi->readx(rbuf, l);
+            const byte *p = rbuf;
+            for (int i = 0; i < l; i++)
+                hist[p[i]]++;
+            done += l;
+        }
+        double entropy = 0;
+        for (unsigned i = 0; i < 256; i++)
+            if (hist[i])
+                entropy -= double(hist[i]) / size * std::log2(double(hist[i]) / size);
+        con_fprintf(f, " %7.3f", entropy);
+
+        // the sample: all of a small region, else NSLICES evenly spaced slices
+        unsigned s_len = 0;
+        if (size <= SAMPLE_LEN) {
+            s_len = unsigned(size);
+            fi->seek(r.offset, SEEK_SET);
+            fi->readx(sample, s_len);
+        } else {
+            for (unsigned i = 0; i < NSLICES; i++) {
+                fi->seek(r.offset + (size - SLICE_LEN) / (NSLICES - 1) * i, SEEK_SET);
+                fi->readx(sample + s_len, SLICE_LEN);
+                s_len += SLICE_LEN;
+            }
+        }
+        const double scale = double(size) / s_len;
+        for (unsigned m = 0; m < nmethods; m++) {
+            upx_compress_result_t cresult;
+            unsigned c_len = 0;
+            int e = upx_compress(sample, s_len, cbuf, &c_len, nullptr, methods[m], level, nullptr,
+                                 &cresult);
+            if (e != UPX_E_OK || c_len >= s_len)
+                c_len = s_len; // stored
+            unsigned d_len = s_len;
+            double d_ms = 0;
+            if (c_len < s_len) {
+                const Clock::time_point t0 = Clock::now();
+                e = upx_decompress(cbuf, c_len, dbuf, &d_len, methods[m], &cresult);
+                d_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+                if (e != UPX_E_OK || d_len != s_len)
+                    throwInternalError("analyze: decompression failed");
+            }
+            total_c[m] += upx_uint64_t(c_len * scale);
+            total_d_ms[m] += d_ms * scale;
+            con_fprintf(f, " %6.2f%%", 100.0 * c_len / s_len);
+        }
+        con_fprintf(f, "\n");
+    }
+
+    if (nmethods == 0 || total_size == 0)
+        return;
+    unsigned best = 0;
+    for (unsigned m = 1; m < nmethods; m++)
+        if (total_c[m] < total_c[best])
+            best = m;
+    con_fprintf(f, "  %-14s %3s %10s %10llu %7s", "total", "", "",
+                (unsigned long long) total_size, "");
+    for (unsigned m = 0; m < nmethods; m++)
+        con_fprintf(f, " %6.2f%%", 100.0 * total_c[m] / total_size);
+    con_fprintf(f, "\n  %-14s %3s %10s %10s %7s", "decode ms", "", "", "", "");
+    for (unsigned m = 0; m < nmethods; m++)
+        con_fprintf(f, " %7.1f", total_d_ms[m]);
+    char name[32];
+    set_method_name(name, sizeof(name), methods[best], level);
+    con_fprintf(f,
+                "\n  best: %s, about %llu of %llu bytes (%.1f%%), decompression about %.1f ms;\n"
+                "  unpacking adds about %llu KiB of private memory to every process\n",
+                name, (unsigned long long) total_c[best], (unsigned long long) total_size,
+                100.0 * total_c[best] / total_size, total_d_ms[best],
+                (unsigned long long) (private_bytes / 1024));
+}
+
+/*************************************************************************
+// compressWithFiltersParallel - run the method/filter trials of
+// compressWithFilters() on several threads.
+//
+// The trials are run in batches of num_threads. Every trial filters and
+// compresses its own copy of the input (compress() also verifies by
+// decompressing into that copy), and determines its overlap_overhead.
+// Then the loader is built and the best version is selected in the very
+// same order as the serial loop does, so the result does not depend on
+// the number of threads.
+//
+// Returns the number of successful filters.
+**************************************************************************/
+
+int Packer::compressWithFiltersParallel(unsigned num_threads, byte *i_ptr, const unsigned i_len,
+                                        byte *const o_ptr, byte *f_ptr, const unsigned f_len,
+                                        byte *const hdr_ptr, const unsigned hdr_len,
+                                        const int *methods, int nmethods, const int *filters,
+                                        int nfilters, const byte *trial_mask,
+                                        const Filter &orig_ft,
+                                        const unsigned overlap_range,
+                                        upx_compress_config_t const *cconf, PackHeader &best_ph,
+                                        Filter &best_ft, unsigned &best_ph_lsize,
+                                        unsigned &best_hdr_c_len) {
+    const PackHeader orig_ph = this->ph;
+    assert(num_threads >= 2);
+    const bool explain = upx::explain_is_enabled();
+
+    // compress the header once per method
+    unsigned hdr_c_lens[256];
+    if (hdr_ptr != nullptr && hdr_len) {
+        for (int mm = 0; mm < nmethods; mm++) {
+            assert(isValidCompressionMethod(methods[mm]));
+            hdr_c_lens[mm] = 0;
+            if (trial_mask != nullptr && !memchr(trial_mask + mm * nfilters, 1, nfilters))
+                continue; // pruned
+            hdr_c_lens[mm] = compressHeader(hdr_ptr, hdr_len, methods[mm]);
+        }
+    } else {
+        for (int mm = 0; mm < nmethods; mm++)
+            hdr_c_lens[mm] = 0;
+    }
+
+    // the filtered area may start before i_ptr; copy that part as well
+    byte *const b_ptr = (f_len && f_ptr < i_ptr) ? f_ptr : i_ptr;
+    const unsigned b_len = ptr_udiff_bytes(i_ptr + i_len, b_ptr);
+
+    if (trial_bufs_len < num_threads) {
+        trial_bufs.reset(new TrialBuffers[num_threads]);
+        trial_bufs_len = num_threads;
+    }
+    struct Trial {
+        TrialBuffers *bufs; // private copy of [b_ptr, +b_len), and compressed output
+        PackHeader ph;
+        Filter ft{0};
+        bool filtered;
+        bool compressed;
+        unsigned max_c_len; // see trialConfig()
+        double ms;          // "--explain-search"
+        UiPacker::SharedCallback scb;
+    };
+    std::unique_ptr<Trial[]> trials(new Trial[num_threads]);
+    for (unsigned j = 0; j < num_threads; j++)
+        trials[j].bufs = &trial_bufs[j];
+
+    // list of candidates; k == mm * nfilters + ff
+    MemBuffer trial_list_buf(mem_size(sizeof(int), nmethods * nfilters));
+    int *const trial_list = (int *) trial_list_buf.getVoidPtr();
+    int ntrials = 0;
+    for (int k = 0; k < nmethods * nfilters; k++) {
+        if (trial_mask == nullptr || trial_mask[k])
+            trial_list[ntrials++] = k;
+        else {
+            if (uip->ui_pass >= 0)
+                uip->ui_pass++; // pruned
+            if (explain)
+                explain_trial(fi->getName(), "pruned", methods[k / nfilters],
+                              filters[k % nfilters]);
+        }
+    }
+    bool method_used[256] = {};
+    for (int i = 0; i < ntrials; i++)
+        method_used[trial_list[i] / nfilters] = true;
+
+    // "--memory-limit": the memory of a trial depends a lot on its method
+    // (e.g. the dictionary size of the LZMA variants of --ultra-brute), so
+    // fill each batch only up to the available memory instead of assuming
+    // the most expensive method for all of them
+    upx_uint64_t trial_memory[256] = {};
+    upx_uint64_t available_memory = 0;
+    if (opt->memory_limit) {
+        available_memory = MemBuffer::getAvailableBytes();
+        for (int mm = 0; mm < nmethods; mm++)
+            trial_memory[mm] = upx_uint64_t(b_len) + MemBuffer::getSizeForCompression(i_len) +
+                               upx_compress_work_memory(i_len, methods[mm], ph.level, cconf);
+    }
+
+    int nfilters_success_total = 0;
+    int nfilters_success_mm[256] = {};
+    bool out_of_time = false;
+    for (int k0 = 0, batch = 0; k0 < ntrials; k0 += batch) {
+        // "--time-budget": once a valid version exists, do not start new batches after the deadline
+        if (best_ph.overlap_overhead > 0 && searchTimeIsUp()) {
+            NO_printf("compressWithFiltersParallel: out of time after %d of %d\n", k0, ntrials);
+            if (uip->ui_pass >= 0)
+                uip->ui_pass += ntrials - k0;
+            for (int i = k0; explain && i < ntrials; i++)
+                explain_trial(fi->getName(), "out-of-time", methods[trial_list[i] / nfilters],
+                              filters[trial_list[i] % nfilters]);
+            out_of_time = true;
+            break;
+        }
+        batch = 0;
+        upx_uint64_t batch_memory = 0;
+        while (k0 + batch < ntrials && batch < (int) num_threads) {
+            const upx_uint64_t m = trial_memory[trial_list[k0 + batch] / nfilters];
+            if (batch > 0 && available_memory && batch_memory + m > available_memory)
+                break; // at least one trial per batch
+            batch_memory += m;
+            batch++;
+        }
+        // one progress bar for the whole batch
+        if (uip->ui_pass >= 0)
+            uip->startSharedCallback(i_len, batch, uip->ui_pass + 1, uip->ui_total_passes);
+        upx::parallel_for(batch, num_threads, [&](size_t j) {
+            const int k = trial_list[k0 + j];
+            Trial &t = trials[j];
+            const auto t0 = explain ? std::chrono::steady_clock::now()
+                                    : std::chrono::steady_clock::time_point();
+            // get fresh packheader
+            t.ph = orig_ph;
+            t.ph.method = methods[k / nfilters];
+            t.ph.filter = filters[k % nfilters];
+            t.ph.overlap_overhead = 0;
+            assert(isValidFilter(t.ph.filter));
+            // get fresh filter
+            t.ft = orig_ft;
+            t.ft.init(t.ph.filter, orig_ft.addvalue);
+            t.filtered = t.compressed = false;
+            t.max_c_len = 0;
+            t.ms = 0;
+            // get fresh input
+            MemBuffer &t_ibuf = t.bufs->ibuf;
+            MemBuffer &t_obuf = t.bufs->obuf;
+            reserve_buffer(t_ibuf, b_len);
+            reserve_buffer_for_compression(t_obuf, i_len);
+            byte *const ti_ptr = raw_bytes(t_ibuf, b_len) + ptr_udiff_bytes(i_ptr, b_ptr);
+            byte *const tf_ptr = f_len ? raw_bytes(t_ibuf, b_len) + ptr_udiff_bytes(f_ptr, b_ptr)
+                                       : ti_ptr;
+            memcpy(raw_bytes(t_ibuf, b_len), b_ptr, b_len);
+            // filter
+            optimizeFilter(&t.ft, tf_ptr, f_len);
+            t.filtered = t.ft.filter(tf_ptr, f_len);
+            if (t.ft.id != 0 && t.ft.calls == 0) {
+                // filter did not do anything
+                t.filtered = false;
+            }
+            if (!t.filtered) {
+                if (explain)
+                    t.ms = explain_msecs(t0);
+                return;
+            }
+            t.ph.filter_cto = t.ft.cto;
+            t.ph.n_mru = t.ft.n_mru;
+            // compress, adding to the progress bar of the batch
+            // the checksum cache is only updated between the batches
+            const unsigned *u_adler = findTrialAdler(t.ph.filter, t.ph.filter_cto);
+            // best_ph only changes between the batches
+            upx_compress_config_t trial_cconf;
+            const upx_compress_config_t *const t_cconf =
+                trialConfig(trial_cconf, cconf, t.ph, best_ph, best_ph_lsize, best_hdr_c_len,
+                            hdr_c_lens[k / nfilters]);
+            if (t_cconf != cconf)
+                t.max_c_len = t_cconf->max_c_len;
+            t.compressed = compress(t.ph, ti_ptr, i_len, t_obuf, t_cconf, nullptr,
+                                    uip->ui_pass >= 0 ? uip->initSharedCallback(&t.scb) : nullptr,
+                                    !defer_trial_verify, u_adler);
+            if (t.compressed)
+                t.ph.overlap_overhead = findOverlapOverhead(t.ph, t_obuf, ti_ptr, overlap_range);
+            if (explain)
+                t.ms = explain_msecs(t0);
+            // unfilter with verify; keep t.ft as it was after filtering
+            Filter ft = t.ft;
+            ft.unfilter(tf_ptr, f_len, true);
+        });
+        if (uip->ui_pass >= 0)
+            uip->endCallback(k0 + batch >= ntrials && uip->ui_pass + batch >= uip->ui_total_passes);
+
+        // now pick the best version in serial order
+        for (int j = 0; j < batch; j++) {
+            const int mm = trial_list[k0 + j] / nfilters;
+            Trial &t = trials[j];
+            const unsigned hdr_c_len = hdr_c_lens[mm];
+            if (uip->ui_pass >= 0)
+                uip->ui_pass++;
+            if (!t.filtered) {
+                if (explain)
+                    explain_trial(fi->getName(), "filter-failed", t.ph.method, t.ph.filter,
+                                  nullptr, 0, hdr_c_len, t.ms);
+                continue;
+            }
+            nfilters_success_total++;
+            nfilters_success_mm[mm]++;
+            storeTrialAdler(t.ph.filter, t.ph.filter_cto, t.ph.u_adler);
+            if (!t.compressed) {
+                const bool too_big = t.max_c_len != 0 && t.ph.c_len > t.max_c_len;
+                if (explain)
+                    explain_trial(fi->getName(), too_big ? "too-big" : "failed", t.ph.method,
+                                  t.ph.filter, too_big ? &t.ph : nullptr, 0, hdr_c_len, t.ms);
+                continue;
+            }
+            t.ft.buf = f_ptr; // as if we had filtered in place
+            unsigned lsize = 0;
+            // getTrialLoaderSize() is not thread-safe, and also omit if already too big
+            if (t.ph.c_len <= maxWinningCLen(t.ph.method, t.ph.u_len, hdr_c_len, best_ph,
+                                             best_ph_lsize, best_hdr_c_len)) {
+                ph = t.ph;
+                lsize = getTrialLoaderSize(&t.ft);
+                assert(lsize > 0);
+            }
+            const bool better =
+                isBetterTrial(t.ph, lsize, hdr_c_len, best_ph, best_ph_lsize, best_hdr_c_len);
+            if (explain)
+                explain_trial(fi->getName(), better ? "best" : lsize ? "worse" : "too-big",
+                              t.ph.method, t.ph.filter, &t.ph, lsize, hdr_c_len, t.ms);
+            if (better) {
+                assert((int) t.ph.overlap_overhead > 0);
+                // update o_ptr[] with best version
+                memcpy(o_ptr, raw_bytes(t.bufs->obuf, t.ph.c_len), t.ph.c_len);
+                // save compression results
+                best_ph = t.ph;
+                best_ph_lsize = lsize;
+                best_hdr_c_len = hdr_c_len;
+                best_ft = t.ft;
+            }
+        }
+    }
+    for (int mm = 0; mm < nmethods; mm++)
+        assert(nfilters_success_mm[mm] > 0 || !method_used[mm] || out_of_time);
+    UNUSED(nfilters_success_mm);
+    UNUSED(out_of_time);
+    UNUSED(method_used);
+    return nfilters_success_total;
 }
 
 /*************************************************************************
@@ -34,6 +34,9 @@ class InputFile;
 class OutputFile;
 class UiPacker;
 class Filter;
+namespace upx {
+struct CompressionDecision;
+}
 
 /*************************************************************************
 // PackerBase: abstract minimal base class for all packers
@@ -75,6 +78,7 @@ public:
     virtual void doTest() = 0;
     virtual void doList() = 0;
     virtual void doFileInfo() = 0;
+    virtual void doAnalyze() = 0;
 
 protected:
     InputFile *const fi;                // reference
@@ -108,6 +112,15 @@ public:
     virtual void doTest() final override;
     virtual void doList() final override;
     virtual void doFileInfo() final override;
+    virtual void doAnalyze() final override;
+
+    // "--analyze": a part of the input file that would get compressed
+    struct AnalyzeRegion final {
+        char name[24];
+        upx_uint64_t offset, size; // in the file
+        upx_uint64_t mem_size;     // in memory; may be larger than size (.bss)
+        unsigned prot;             // 4 = read, 2 = write, 1 = execute (as ELF p_flags)
+    };
 
     // unpacker capabilities
     virtual bool canUnpackVersion(int version) const { return (version >= 8); }
@@ -125,11 +138,22 @@ protected:
     virtual void test();
     virtual void list();
     virtual void fileInfo();
+    virtual void analyze();
+    // the regions for analyze(); the default is the whole file as one region
+    virtual unsigned getAnalyzeRegions(AnalyzeRegion *regions, unsigned max_regions);
+    // "--run-memory=": the memory of the decompressed image; the default is
+    // the sum of getAnalyzeRegions()
+    virtual upx_uint64_t getRunImageSize();
+    void checkRunMemory();
 
 protected:
     // main compression drivers
     bool compress(SPAN_P(byte) i_ptr, unsigned i_len, SPAN_P(byte) o_ptr,
                   const upx_compress_config_t *cconf = nullptr);
+    bool compress(PackHeader &xph, SPAN_P(byte) i_ptr, unsigned i_len, SPAN_P(byte) o_ptr,
+                  const upx_compress_config_t *cconf, UiPacker *ui,
+                  upx_callback_t *cb = nullptr, bool verify = true,
+                  const unsigned *u_adler = nullptr) const;
     void decompress(SPAN_P(const byte) in, SPAN_P(byte) out, bool verify_checksum = true,
                     Filter *ft = nullptr);
     virtual bool checkDefaultCompressionRatio(unsigned u_len, unsigned c_len) const;
@@ -153,14 +177,46 @@ protected:
                              Filter *parm_ft, // updated
                              unsigned overlap_range, upx_compress_config_t const *cconf,
                              int filter_strategy, bool inhibit_compression_check = false);
+    int compressWithFiltersSerial(byte *i_ptr, unsigned i_len, byte *o_ptr, byte *f_ptr,
+                                  unsigned f_len, byte *hdr_ptr, unsigned hdr_len,
+                                  const int *methods, int nmethods, const int *filters,
+                                  int nfilters, const byte *trial_mask, const Filter &orig_ft,
+                                  int filter_strategy, unsigned overlap_range,
+                                  upx_compress_config_t const *cconf,
+                                  const upx::CompressionDecision *hint, PackHeader &best_ph,
+                                  Filter &best_ft, unsigned &best_ph_lsize,
+                                  unsigned &best_hdr_c_len);
+    int compressWithFiltersParallel(unsigned num_threads, byte *i_ptr, unsigned i_len,
+                                    byte *o_ptr, byte *f_ptr, unsigned f_len, byte *hdr_ptr,
+                                    unsigned hdr_len, const int *methods, int nmethods,
+                                    const int *filters, int nfilters, const byte *trial_mask,
+                                    const Filter &orig_ft, unsigned overlap_range,
+                                    upx_compress_config_t const *cconf, PackHeader &best_ph,
+                                    Filter &best_ft, unsigned &best_ph_lsize,
+                                    unsigned &best_hdr_c_len);
+    bool pruneCompressionTrials(byte *trial_mask, upx_uint64_t *score, unsigned keep, byte *i_ptr,
+                                unsigned i_len, byte *f_ptr, unsigned f_len, const int *methods,
+                                int nmethods, const int *filters, int nfilters,
+                                const Filter &orig_ft, upx_compress_config_t const *cconf);
+    void orderFiltersByScan(int *filters, int nfilters, const byte *f_ptr, unsigned f_len,
+                            const Filter &orig_ft) const;
+    bool searchTimeIsUp() const;
+    // compress a header with "method" at level 10, at most once per method
+    unsigned compressHeader(const byte *hdr_ptr, unsigned hdr_len, int method,
+                            const byte **c_ptr = nullptr);
+    void benchmarkCompression(byte *i_ptr, unsigned i_len, byte *f_ptr, unsigned f_len,
+                              const Filter &orig_ft, int default_method,
+                              upx_compress_config_t const *cconf);
 
     // util for verifying overlapping decompression
     //   non-destructive test
     virtual bool testOverlappingDecompression(const byte *buf, const byte *tbuf,
                                               unsigned overlap_overhead) const;
     //   non-destructive find
-    virtual unsigned findOverlapOverhead(const byte *buf, const byte *tbuf, unsigned range = 0,
-                                         unsigned upper_limit = ~0u) const;
+    unsigned findOverlapOverhead(const PackHeader &xph, const byte *buf, const byte *tbuf,
+                                 unsigned range = 0, unsigned upper_limit = ~0u,
+                                 unsigned hint = 0) const;
+    virtual unsigned alignOverlapOverhead(const PackHeader &xph, unsigned overhead) const;
     //   destructive decompress + verify
     void verifyOverlappingDecompression(Filter *ft = nullptr);
     void verifyOverlappingDecompression(byte *o_ptr, unsigned o_size, Filter *ft = nullptr);
@@ -196,6 +252,13 @@ protected:
 #else
     void addLoaderVA(const char *s, ...);
 #endif
+    // loader size cache for compressWithFilters(); a format may return a non-zero
+    // key if its loader size only depends on that key and on per-file constants
+    virtual upx_uint64_t getLoaderSizeCacheKey(const Filter *) const { return 0; }
+    unsigned getTrialLoaderSize(const Filter *ft); // buildLoader() + getLoaderSize()
+    // upx_compress() of a part of the loader, cached across files
+    static int compressLoader(const byte *src, unsigned src_len, byte *dst, unsigned *dst_len,
+                              int method, int level);
     virtual bool hasLoaderSection(const char *name) const;
     virtual int getLoaderSection(const char *name, int *slen = nullptr) const;
     virtual int getLoaderSectionStart(const char *name, int *slen = nullptr) const;
@@ -210,6 +273,8 @@ protected:
     int prepareMethods(int *methods, int ph_method, const int *all_methods) const;
     virtual const char *getDecompressorSections() const;
     virtual unsigned getDecompressorWrkmemSize() const;
+    // the stub decompresses each block with its own LZMA properties
+    static bool callsManyTimes(int format);
     virtual void defineDecompressorSymbols();
 
     // filter handling [see packer_f.cpp]
@@ -313,6 +378,56 @@ protected:
     // linker
     OwningPointer(Linker) linker = nullptr; // owner
 
+    // "--time-budget": steady clock msecs; 0 means unlimited
+    upx_uint64_t search_deadline = 0;
+    // "--run-memory=": upper limit of cconf.conf_lzma.max_num_probs; 0 means unlimited
+    unsigned run_memory_max_num_probs = 0;
+
+private:
+    // private to getTrialLoaderSize()
+    struct LoaderSizeCacheEntry {
+        upx_uint64_t key;
+        unsigned lsize;
+    };
+    LoaderSizeCacheEntry loader_size_cache[32];
+    unsigned loader_size_cache_len = 0;
+
+private:
+    // private to compressWithFilters(): the trial buffers are kept across
+    // calls, as block based packers compress many blocks of similar size
+    MemBuffer trial_obuf; // serial trials and header compression
+    struct TrialBuffers {
+        MemBuffer ibuf; // private copy of the input of a parallel trial
+        MemBuffer obuf; // private compressed output
+    };
+    std::unique_ptr<TrialBuffers[]> trial_bufs; // parallel trials
+    unsigned trial_bufs_len = 0;
+    // with several candidates only the winner gets the round-trip check
+    bool defer_trial_verify = false;
+    // the same filter gives the same filtered input for every method, so
+    // remember its checksum; only valid during one compressWithFilters()
+    struct TrialAdlerCacheEntry {
+        int filter;
+        unsigned cto;
+        unsigned u_adler;
+    };
+    TrialAdlerCacheEntry trial_adler_cache[32];
+    unsigned trial_adler_cache_len = 0;
+    const unsigned *findTrialAdler(int filter, unsigned cto) const;
+    void storeTrialAdler(int filter, unsigned cto, unsigned u_adler);
+
+private:
+    // private to compressHeader()
+    struct HeaderCacheEntry {
+        int method;
+        unsigned c_len;
+        MemBuffer c_buf;
+    };
+    MemBuffer hdr_cache_u_buf; // a copy of the header of the entries
+    unsigned hdr_cache_u_len = 0;
+    HeaderCacheEntry hdr_cache[8];
+    unsigned hdr_cache_len = 0;
+
 private:
     // private to checkPatch()
     void *last_patch = nullptr;
@@ -99,7 +99,7 @@ const int *Packer::getDefaultCompressionMethods_le32(int method, int level, int
 // loader util
 **************************************************************************/
 
-static bool callsManyTimes(int format) {
+/*static*/ bool Packer::callsManyTimes(int format) {
     // clang-format off
     return
         UPX_F_LINUX_ELF_i386   ==format
@@ -234,6 +234,10 @@ const char *Packer::getDecompressorSections() const {
         }
         return opt->small ? lzma_small : lzma_fast;
     }
+    // M_ZSTD is host-only for now: there is no zstd_d stub yet, and so no
+    // format may offer it in getCompressionMethods()
+    if (M_IS_ZSTD(method))
+        throwInternalError("no runtime decompressor for zstd");
     throwInternalError("bad decompressor");
     return nullptr;
 }
@@ -242,9 +246,31 @@ unsigned Packer::getDecompressorWrkmemSize() const {
     unsigned size = 0;
     if (M_IS_LZMA(ph.method)) {
         const lzma_compress_result_t *res = &ph.compress_result.result_lzma;
-        // FIXME - this is for i386 only
-        size = 8 + 4 + ALIGN_UP(2 * res->num_probs, 4u);
-        size = ALIGN_UP(size, 16u);
+        // CLzmaDecoderState plus the 16-bit probabilities, laid out as the
+        // stub does it (see LZMA_DEC00 and LZMA_ELF00 in stub/src/arch/*/lzma_d.S)
+        unsigned state = 8 + 4, align = 16; // 32-bit stubs with "lzma_stack_adjust"
+        switch (ph.format) {
+        case UPX_F_LINUX_ELF64_AMD64:
+        case UPX_F_VMLINUX_AMD64:
+        case UPX_F_MACH_AMD64:
+        case UPX_F_DYLIB_AMD64:
+        case UPX_F_W64PE_AMD64:
+            align = 64;
+            break;
+        case UPX_F_LINUX_ELF32_ARM:
+        case UPX_F_LINUX_ELF32_ARMEB:
+        case UPX_F_LINUX_ELF64_ARM64:
+        case UPX_F_MACH_ARM:
+        case UPX_F_MACH_ARM64:
+        case UPX_F_LINUX_ELF32_MIPSEL:
+        case UPX_F_LINUX_ELF32_MIPS:
+            state = 16;
+            break;
+        default:
+            break;
+        }
+        size = state + ALIGN_UP(2 * res->num_probs, 4u);
+        size = ALIGN_UP(size, align);
     }
     assert((int) size >= 0);
     return size;
@@ -340,6 +340,11 @@ void ph_decompress(PackHeader &ph, SPAN_P(const byte) in, SPAN_P(byte) out, bool
         throwCompressedDataViolation();
 
     // verify checksum of decompressed data
+    // Note: the unfilter cannot run on each decoded window while it is
+    //   still in the cache: later matches copy the *filtered* bytes, from
+    //   as far back as the whole window of the method (16 MiB for NRV, the
+    //   dictionary for LZMA), so unfiltering in place would corrupt them.
+    //   The same holds for f_expand and f_unfilter in the runtime stubs.
     if (verify_checksum) {
         if (ft)
             ft->unfilter(out, ph.u_len);
@@ -381,4 +386,25 @@ bool ph_testOverlappingDecompression(const PackHeader &ph, const byte *buf, cons
     return (r == UPX_E_OK && new_len == ph.u_len);
 }
 
+bool ph_estimateOverlapOverhead(const PackHeader &ph, const byte *buf, unsigned *overlap_overhead) {
+    *overlap_overhead = 0;
+    if (ph.c_len >= ph.u_len)
+        return false;
+    const int method = ph_forced_method(ph.method);
+    unsigned overlap = 0;
+    const upx_compress_result_t &cr = ph.compress_result;
+    if (cr.have_overlap && cr.debug.method == method && cr.debug.u_len == ph.u_len &&
+        cr.debug.c_len == ph.c_len) {
+        // already reported by upx_compress()
+        overlap = cr.overlap;
+    } else if (upx_find_overlap(buf, ph.c_len, ph.u_len, method, &overlap) != UPX_E_OK)
+        return false;
+    // see ph_testOverlappingDecompression() above
+    unsigned extra = 0;
+    if (M_IS_NRV2B(method) || M_IS_NRV2D(method) || M_IS_NRV2E(method))
+        extra = 3;
+    *overlap_overhead = UPX_MAX(overlap, 5u) + extra;
+    return true;
+}
+
 /* vim:set ts=4 sw=4 et: */
@@ -101,3 +101,6 @@ void ph_decompress(PackHeader &ph, SPAN_P(const byte) in, SPAN_P(byte) out, bool
 
 bool ph_testOverlappingDecompression(const PackHeader &ph, const byte *buf, const byte *tbuf,
                                      unsigned overlap_overhead);
+// single-pass estimate for the smallest overlap_overhead that passes
+// ph_testOverlappingDecompression(); returns false if not available
+bool ph_estimateOverlapOverhead(const PackHeader &ph, const byte *buf, unsigned *overlap_overhead);
@@ -54,19 +54,21 @@
 #include "p_w64pe_arm64.h"
 #include "p_wcle.h"
 #include "p_wince_arm.h"
+#include "util/trace.h"
 
 /*************************************************************************
 //
 **************************************************************************/
 
 PackMaster::PackMaster(InputFile *f, Options *o) noexcept : fi(f) {
-    // replace global options with local options
+    // replace the options of this thread with local options for this job;
+    // "opt" is thread-local, so concurrent jobs need no locking here, and
+    // the worker threads of a job inherit it (see util/threads.cpp)
     if (o != nullptr) {
-#if WITH_THREADS
-        // TODO later: check for possible "noexcept" violation here
-        std::lock_guard<std::mutex> lock(opt_lock_mutex);
-#endif
-        saved_opt = o;
+        // save the previous options of this thread, which may be nullptr;
+        // "o" itself may not outlive us (see lib_run() in libupx.cpp)
+        saved_opt = opt;
+        opt_replaced = true;
         memcpy(&this->local_options, o, sizeof(*o)); // struct copy
         opt = &this->local_options;
     }
@@ -74,14 +76,11 @@ PackMaster::PackMaster(InputFile *f, Options *o) noexcept : fi(f) {
 
 PackMaster::~PackMaster() noexcept {
     upx::owner_delete(packer);
-    // restore global options
-    if (saved_opt != nullptr) {
-#if WITH_THREADS
-        // TODO later: check for possible "noexcept" violation here
-        std::lock_guard<std::mutex> lock(opt_lock_mutex);
-#endif
+    // restore the options of this thread
+    if (opt_replaced) {
         opt = saved_opt;
         saved_opt = nullptr;
+        opt_replaced = false;
     }
 }
 
@@ -92,6 +91,7 @@ PackMaster::~PackMaster() noexcept {
 static noinline tribool try_can_pack(PackerBase *pb, void *user) may_throw {
     InputFile *f = (InputFile *) user;
     try {
+        upx::TraceScope trace_scope("canPack", 0, pb->getName());
         pb->initPackHeader();
         f->seek(0, SEEK_SET);
         tribool r = pb->canPack();
@@ -103,8 +103,10 @@ static noinline tribool try_can_pack(PackerBase *pb, void *user) may_throw {
         }
         if (r.isThird()) // aka "-1"
             return r;    // canPack() says the format is recognized and we should fail early
-    } catch (const IOException &) {
-        // ignored
+    } catch (const IOException &e) {
+        // ignored; usually a short read of a file that is too small for this format
+        if (opt->debug.debug_level)
+            fprintf(stderr, "  %s: %s\n", pb->getName(), e.getMsg());
     }
     return false;
 }
@@ -121,12 +123,106 @@ static noinline tribool try_can_unpack(PackerBase *pb, void *user) may_throw {
         }
         if (r.isThird()) // aka "-1"
             return r;    // canUnpack() says the format is recognized and we should fail early
-    } catch (const IOException &) {
-        // ignored
+    } catch (const IOException &e) {
+        // ignored; usually a short read of a file that is too small for this format
+        if (opt->debug.debug_level)
+            fprintf(stderr, "  %s: %s\n", pb->getName(), e.getMsg());
     }
     return false;
 }
 
+/*************************************************************************
+// FileMagic - read the first bytes of a file only once, so that
+// visitAllPackers() does not have to construct and try packers which can
+// never recognize the file.
+// Every check mirrors the very first test of the readFileHeader() /
+// canPack() / canUnpack() functions of the respective packers, so the
+// result of visitAllPackers() does not change. Formats without a magic
+// number (dos/com, dos/sys, linux/386 execve, ...) are always tried,
+// except when packing a file that is shorter than the header their
+// canPack() reads: that could only end in an EOFException.
+**************************************************************************/
+
+namespace {
+struct FileMagic final {
+    byte buf[0x200];
+    unsigned len = 0;
+    upx_off_t size = 0;
+    bool all = false; // no file - accept everything
+
+    explicit FileMagic(InputFile *f) noexcept {
+        if (f == nullptr) {
+            all = true;
+            return;
+        }
+        try {
+            f->seek(0, SEEK_SET);
+            const int r = f->read(buf, sizeof(buf));
+            f->seek(0, SEEK_SET);
+            len = r > 0 ? unsigned(r) : 0;
+            size = f->st_size();
+        } catch (...) {
+            all = true; // let every packer handle the error
+        }
+    }
+    FileMagic(const byte *b, unsigned n, upx_off_t file_size) noexcept
+        : len(UPX_MIN(n, unsigned(sizeof(buf)))), size(file_size) {
+        memcpy(buf, b, len);
+    }
+    bool has(unsigned off, const char *s, unsigned n) const noexcept {
+        return off + n <= len && memcmp(buf + off, s, n) == 0;
+    }
+    // dos/exe stubs and the extended formats behind them; see readFileHeader()
+    // of PackDjgpp2 (MZ, coff), PackTmt, LeFile, PeFile and PackExe (ZM)
+    bool isExe() const noexcept {
+        return all || has(0, "MZ", 2) || has(0, "ZM", 2) || has(0, "BW", 2) || has(0, "LE", 2) ||
+               has(0, "PMW1", 4) || has(0, "Adam", 4) || has(0, "PE\0\0", 4) ||
+               (len >= 2 && get_le16(buf) == 0x014c);
+    }
+    bool isElf() const noexcept { return all || has(0, "\177ELF", 4); }
+    // PackVmlinuzI386: boot_flag
+    bool isBootSector() const noexcept {
+        return all || (len >= 0x200 && get_le16(buf + 0x1fe) == 0xaa55);
+    }
+    // PackVmlinuzARMEL: 8 * "mov r0,r0"
+    bool isArmZImage() const noexcept {
+        if (all)
+            return true;
+        for (unsigned i = 0; i < 32; i += 4)
+            if (i + 4 > len || get_le32(buf + i) != 0xe1a00000)
+                return false;
+        return true;
+    }
+    bool isMachFat() const noexcept { return all || (len >= 4 && get_be32(buf) == 0xcafebabe); }
+    // MH_MAGIC and MH_MAGIC_64 in either byte order
+    bool isMach() const noexcept {
+        if (all)
+            return true;
+        if (len < 4)
+            return false;
+        const unsigned le = get_le32(buf), be = get_be32(buf);
+        return (le | 1) == 0xfeedfacf || (be | 1) == 0xfeedfacf;
+    }
+    // PackTos::readFileHeader()
+    bool isTos() const noexcept { return all || (len >= 2 && get_be16(buf) == 0x601a); }
+    // PackPs1::readFileHeader()
+    bool isPs1() const noexcept { return all || has(0, "PS-X EXE", 8) || has(0, "EXE X-SP", 8); }
+    // the first fi->readx() of a canPack() would fail
+    bool isShorterThan(upx_off_t n) const noexcept { return !all && size < n; }
+    // any format with a magic number
+    bool isKnown() const noexcept {
+        return isExe() || isElf() || isBootSector() || isArmZImage() || isMachFat() || isMach() ||
+               isTos() || isPs1();
+    }
+};
+} // namespace
+
+/*static*/
+bool PackMaster::hasKnownMagic(const byte *buf, unsigned len, upx_off_t file_size) noexcept {
+    const FileMagic magic(buf, len, file_size);
+    return magic.isKnown();
+}
+
 /*************************************************************************
 //
 **************************************************************************/
@@ -151,44 +247,52 @@ PackerBase *PackMaster::visitAllPackers(visit_func_t func, InputFile *f, const O
     } while (0)
 
     // NOTE: order of tries is important !!!
+    const FileMagic magic(f);
+    const bool packing = func == try_can_pack;
 
     //
     // .exe
     //
-    if (!o->dos_exe.force_stub) {
-        // dos32
-        VISIT(PackDjgpp2);
-        VISIT(PackTmt);
-        VISIT(PackWcle);
-        // Windows
-        // VISIT(PackW64PeArm64EC); // NOT YET IMPLEMENTED
-        // VISIT(PackW64PeArm64); // NOT YET IMPLEMENTED
-        VISIT(PackW64PeAmd64);
-        VISIT(PackW32PeI386);
-        VISIT(PackWinCeArm);
+    if (magic.isExe()) {
+        if (!o->dos_exe.force_stub) {
+            // dos32
+            VISIT(PackDjgpp2);
+            VISIT(PackTmt);
+            VISIT(PackWcle);
+            // Windows
+            // VISIT(PackW64PeArm64EC); // NOT YET IMPLEMENTED
+            // VISIT(PackW64PeArm64); // NOT YET IMPLEMENTED
+            VISIT(PackW64PeAmd64);
+            VISIT(PackW32PeI386);
+            VISIT(PackWinCeArm);
+        }
+        VISIT(PackExe); // dos/exe
     }
-    VISIT(PackExe); // dos/exe
 
     //
     // linux kernel
     //
-    VISIT(PackVmlinuxARMEL);
-    VISIT(PackVmlinuxARMEB);
-    VISIT(PackVmlinuxPPC32);
-    VISIT(PackVmlinuxPPC64LE);
-    VISIT(PackVmlinuxAMD64);
-    VISIT(PackVmlinuxI386);
-    VISIT(PackVmlinuzI386);
-    VISIT(PackBvmlinuzI386);
-    VISIT(PackVmlinuzARMEL);
+    if (magic.isElf()) {
+        VISIT(PackVmlinuxARMEL);
+        VISIT(PackVmlinuxARMEB);
+        VISIT(PackVmlinuxPPC32);
+        VISIT(PackVmlinuxPPC64LE);
+        VISIT(PackVmlinuxAMD64);
+        VISIT(PackVmlinuxI386);
+    }
+    if (magic.isBootSector()) {
+        VISIT(PackVmlinuzI386);
+        VISIT(PackBvmlinuzI386);
+    }
+    if (magic.isArmZImage())
+        VISIT(PackVmlinuzARMEL);
 
     //
     // linux
     //
-    if (!o->o_unix.force_execve) {
-        if (o->o_unix.use_ptinterp) {
-            VISIT(PackLinuxElf32x86interp);
-        }
+    if (!o->o_unix.force_execve && o->o_unix.use_ptinterp)
+        VISIT(PackLinuxElf32x86interp); // "--make-ptinterp" ignores the file
+    if (!o->o_unix.force_execve && magic.isElf()) {
         VISIT(PackFreeBSDElf32x86);
         VISIT(PackNetBSDElf32x86);
         VISIT(PackOpenBSDElf32x86);
@@ -202,19 +306,23 @@ PackerBase *PackMaster::visitAllPackers(visit_func_t func, InputFile *f, const O
         VISIT(PackLinuxElf64ppcle);
         VISIT(PackLinuxElf32mipsel);
         VISIT(PackLinuxElf32mipseb);
-        VISIT(PackLinuxI386sh);
     }
+    if (!o->o_unix.force_execve && !(packing && magic.isShorterThan(512)))
+        VISIT(PackLinuxI386sh); // shell script
     VISIT(PackBSDI386);
-    VISIT(PackMachFat);   // cafebabe conflict
-    VISIT(PackLinuxI386); // cafebabe conflict
+    if (magic.isMachFat())
+        VISIT(PackMachFat); // cafebabe conflict
+    VISIT(PackLinuxI386);   // cafebabe conflict
 
     // Mach (Darwin / macOS)
-    VISIT(PackDylibAMD64);
-    VISIT(PackMachPPC32); // TODO: this works with upx 3.91..3.94 but got broken in 3.95; FIXME
-    VISIT(PackMachI386);
-    VISIT(PackMachAMD64);
-    VISIT(PackMachARMEL);
-    VISIT(PackMachARM64EL);
+    if (magic.isMach()) {
+        VISIT(PackDylibAMD64);
+        VISIT(PackMachPPC32); // TODO: this works with upx 3.91..3.94 but got broken in 3.95; FIXME
+        VISIT(PackMachI386);
+        VISIT(PackMachAMD64);
+        VISIT(PackMachARMEL);
+        VISIT(PackMachARM64EL);
+    }
 
     // 2010-03-12  omit these because PackMachBase<T>::pack4dylib (p_mach.cpp)
     // does not understand what the Darwin (Apple Mac OS X) dynamic loader
@@ -225,10 +333,14 @@ PackerBase *PackMaster::visitAllPackers(visit_func_t func, InputFile *f, const O
     //
     // misc
     //
-    VISIT(PackTos); // atari/tos
-    VISIT(PackPs1); // ps1/exe
-    VISIT(PackSys); // dos/sys
-    VISIT(PackCom); // dos/com
+    if (magic.isTos())
+        VISIT(PackTos); // atari/tos
+    if (magic.isPs1())
+        VISIT(PackPs1); // ps1/exe
+    if (!(packing && magic.isShorterThan(128))) {
+        VISIT(PackSys); // dos/sys
+        VISIT(PackCom); // dos/com
+    }
 
     return nullptr;
 #undef VISIT
@@ -255,6 +367,11 @@ PackerBase *PackMaster::visitAllPackers(visit_func_t func, InputFile *f, const O
 void PackMaster::pack(OutputFile *fo) may_throw {
     assert(packer == nullptr);
     packer = getPacker(fi);
+    // the shared PT_INTERP runtime (--use-ptinterp) exists only for linux/i386
+    if (opt->o_unix.use_ptinterp && packer->getFormat() != UPX_F_LINUX_ELFI_i386)
+        printWarn(fi->getName(), "--use-ptinterp is not supported for %s, ignored",
+                  packer->getName());
+    upx::TraceScope trace_scope("pack", fi->st_size(), packer->getName());
     packer->doPack(fo);
 }
 
@@ -286,4 +403,11 @@ void PackMaster::fileInfo() may_throw {
     packer->doFileInfo();
 }
 
+void PackMaster::analyze() may_throw {
+    assert(packer == nullptr);
+    packer = getPacker(fi);
+    upx::TraceScope trace_scope("analyze", fi->st_size(), packer->getName());
+    packer->doAnalyze();
+}
+
 /* vim:set ts=4 sw=4 et: */
@@ -45,10 +45,14 @@ public:
     void test() may_throw;
     void list() may_throw;
     void fileInfo() may_throw;
+    void analyze() may_throw;
 
     typedef tribool (*visit_func_t)(PackerBase *pb, void *user);
     static noinline PackerBase *visitAllPackers(visit_func_t, InputFile *f, const Options *,
                                                 void *user) may_throw;
+    // cheap pre-filter for "--tree": buf holds the first bytes of the file; false
+    // if no format that has a magic number can handle the file
+    static bool hasKnownMagic(const byte *buf, unsigned len, upx_off_t file_size) noexcept;
 
 private:
     static PackerBase *getPacker(InputFile *f) may_throw;
@@ -58,7 +62,8 @@ private:
     InputFile *const fi;                        // reference, required
     // setup local options for each file
     Options local_options;
-    Options *saved_opt = nullptr;
+    Options *saved_opt = nullptr; // the options of this thread before us
+    bool opt_replaced = false;
 };
 
 /* vim:set ts=4 sw=4 et: */
@@ -239,32 +239,51 @@ int __acc_cdecl_qsort PeFile::Interval::compare(const void *p1, const void *p2)
     return 0;
 }
 
+void PeFile::Interval::reserve(unsigned n) {
+    if (n <= capacity)
+        return;
+    // grow geometrically, so that adding thousands of intervals stays linear
+    unsigned new_capacity = UPX_MAX(n, capacity + capacity / 2 + 16);
+    void *p = realloc(ivarr, mem_size(sizeof(interval), new_capacity));
+    if (p == nullptr)
+        throwOutOfMemoryException();
+    ivarr = (interval *) p;
+    capacity = new_capacity;
+}
+
 void PeFile::Interval::add(unsigned start, unsigned len) {
     if (ivnum == capacity)
-        ivarr = (interval *) realloc(ivarr, (capacity += 15) * sizeof(interval));
+        reserve(ivnum + 1);
     ivarr[ivnum].start = start;
     ivarr[ivnum++].len = len;
 }
 
-void PeFile::Interval::add(const Interval *iv) {
-    for (unsigned ic = 0; ic < iv->ivnum; ic++)
-        add(iv->ivarr[ic].start, iv->ivarr[ic].len);
+void PeFile::Interval::add(const interval *ivs, unsigned n) {
+    if (n == 0)
+        return;
+    reserve(mem_size_get_n(sizeof(interval), upx_uint64_t(ivnum) + n));
+    memcpy(ivarr + ivnum, ivs, sizeof(interval) * n);
+    ivnum += n;
 }
 
+void PeFile::Interval::add(const Interval *iv) { add(iv->ivarr, iv->ivnum); }
+
 void PeFile::Interval::flatten() {
     if (!ivnum)
         return;
-    upx_qsort(ivarr, ivnum, sizeof(interval), Interval::compare);
-    for (unsigned ic = 0; ic < ivnum - 1; ic++) {
-        unsigned jc;
-        for (jc = ic + 1; jc < ivnum && ivarr[ic].start + ivarr[ic].len >= ivarr[jc].start; jc++)
-            if (ivarr[ic].start + ivarr[ic].len < ivarr[jc].start + ivarr[jc].len)
+    upx_sort(ivarr, ivnum,
+             [](const interval &a, const interval &b) { return Interval::compare(&a, &b) < 0; });
+    // merge in a single pass; "ic" is the last interval of the result
+    unsigned ic = 0;
+    for (unsigned jc = 1; jc < ivnum; jc++) {
+        const unsigned end = ivarr[ic].start + ivarr[ic].len;
+        if (end >= ivarr[jc].start) {
+            if (end < ivarr[jc].start + ivarr[jc].len)
                 ivarr[ic].len = ivarr[jc].start + ivarr[jc].len - ivarr[ic].start;
-        if (jc > ic + 1) {
-            memmove(ivarr + ic + 1, ivarr + jc, sizeof(interval) * (ivnum - jc));
-            ivnum -= jc - ic - 1;
-        }
+        } else
+            ivarr[++ic] = ivarr[jc];
     }
+    ivnum = ic + 1;
 }
 
 void PeFile::Interval::clear() {
@@ -385,8 +404,8 @@ void PeFile::Reloc::add(unsigned pos, unsigned type) {
 
 void PeFile::Reloc::finish(byte *(&result_ptr), unsigned &result_size) {
     assert(start_did_alloc);
-    upx_qsort(raw_index_bytes(start_buf, RELOC_INPLACE_OFFSET, 4 * counts[0]), counts[0], 4,
-              le32_compare);
+    upx_radix_sort_le32(raw_index_bytes(start_buf, RELOC_INPLACE_OFFSET, 4 * counts[0]),
+                        counts[0]);
 
     auto finish_block = [](SPAN_S(BaseReloc) rel) -> byte * {
         unsigned sob = rel->size_of_block;
@@ -443,6 +462,24 @@ void PeFile::Reloc::finish(byte *(&result_ptr), unsigned &result_size) {
 #endif
 }
 
+// Sort the positions of one relocation type and remove duplicates; returns
+// the new count. The base relocation blocks of a linker are in ascending
+// order almost always, so check that first and skip the sort: for DLLs
+// with hundreds of thousands of fixups this saves most of the time.
+static unsigned sort_unique_relocs(LE32 *fix, unsigned n) {
+    unsigned kc = 1;
+    while (kc < n && fix[kc - 1] <= fix[kc])
+        kc++;
+    if (kc < n)
+        upx_radix_sort_le32(fix, n);
+    unsigned prev = ~0u;
+    unsigned jc = 0;
+    for (kc = 0; kc < n; kc++)
+        if (fix[kc] != prev)
+            prev = fix[jc++] = fix[kc];
+    return jc;
+}
+
 void PeFile32::processRelocs() // pass1
 {
     big_relocs = 0;
@@ -464,8 +501,7 @@ void PeFile32::processRelocs() // pass1
             ibuf.fill(IDADDR(PEDIR_BASERELOC), IDSIZE(PEDIR_BASERELOC), FILLVAL);
             ih.objects = tryremove(IDADDR(PEDIR_BASERELOC), ih.objects);
         }
-        mb_orelocs.alloc(1);
-        mb_orelocs.clear();
+        mb_orelocs.allocZeroed(1);
         orelocs = mb_orelocs; // => orelocs now is a SPAN_S
         sorelocs = 0;
         return;
@@ -498,13 +534,7 @@ void PeFile32::processRelocs() // pass1
 
     // remove duplicated records
     for (ic = 1; ic <= 3; ic++) {
-        upx_qsort(fix[ic], xcounts[ic], 4, le32_compare);
-        unsigned prev = ~0u;
-        unsigned jc = 0;
-        for (unsigned kc = 0; kc < xcounts[ic]; kc++)
-            if (fix[ic][kc] != prev)
-                prev = fix[ic][jc++] = fix[ic][kc];
-
+        const unsigned jc = sort_unique_relocs(fix[ic], xcounts[ic]);
         NO_printf("reloc xcounts[%u] %u->%u\n", ic, xcounts[ic], jc);
         xcounts[ic] = jc;
     }
@@ -566,8 +596,7 @@ void PeFile64::processRelocs() // pass1
             ibuf.fill(IDADDR(PEDIR_BASERELOC), IDSIZE(PEDIR_BASERELOC), FILLVAL);
             ih.objects = tryremove(IDADDR(PEDIR_BASERELOC), ih.objects);
         }
-        mb_orelocs.alloc(1);
-        mb_orelocs.clear();
+        mb_orelocs.allocZeroed(1);
         orelocs = mb_orelocs; // => orelocs now is a SPAN_S
         sorelocs = 0;
         return;
@@ -600,13 +629,7 @@ void PeFile64::processRelocs() // pass1
 
     // remove duplicated records
     for (ic = 1; ic < 16; ic++) {
-        upx_qsort(fix[ic], xcounts[ic], 4, le32_compare);
-        unsigned prev = ~0u;
-        unsigned jc = 0;
-        for (unsigned kc = 0; kc < xcounts[ic]; kc++)
-            if (fix[ic][kc] != prev)
-                prev = fix[ic][jc++] = fix[ic][kc];
-
+        const unsigned jc = sort_unique_relocs(fix[ic], xcounts[ic]);
         NO_printf("xcounts[%u] %u->%u\n", ic, xcounts[ic], jc);
         xcounts[ic] = jc;
     }
@@ -738,7 +761,7 @@ class PeFile::ImportLinker final : public ElfLinkerAMD64 {
 
     unsigned thunk_size; // 4 or 8 bytes
 
-    void add(const char *dll, const char *proc, unsigned ordinal) {
+    void add(const char *dll, const char *proc, unsigned ordinal, unsigned hint = 0) {
         TStr sdll(name_for_dll(dll, dll_name_id));
         TStr desc_name(name_for_dll(dll, descriptor_id));
 
@@ -770,7 +793,8 @@ class PeFile::ImportLinker final : public ElfLinkerAMD64 {
             addRelocation(thunk, 0, reltype, "*UND*", ordinal | (1ull << (thunk_size * 8 - 1)));
         } else if (proc != nullptr) {
             TStr proc_name(name_for_proc(dll, proc, proc_name_id, procname_separator));
-            addSection(proc_name, zeros, 2, 1); // 2 bytes of word aligned "hint"
+            const byte h[2] = {byte(hint), byte(hint >> 8)};
+            addSection(proc_name, h, 2, 1); // 2 bytes of word aligned "hint"
             addSymbol(proc_name, proc_name, 0);
             addRelocation(thunk, 0, reltype, proc_name, 0);
 
@@ -833,6 +857,16 @@ public:
         add((const char *) dll, (const char *) proc, 0);
     }
 
+    // the hint is the index into the export name table of the dll that
+    // the OS loader tries first; a wrong hint only costs a binary search
+    template <typename C1, typename C2>
+    void addWithHint(const C1 *dll, const C2 *proc, unsigned hint) {
+        ACC_COMPILE_TIME_ASSERT(sizeof(C1) == 1) // "char" or "byte"
+        ACC_COMPILE_TIME_ASSERT(sizeof(C2) == 1) // "char" or "byte"
+        assert(proc);
+        add((const char *) dll, (const char *) proc, 0, hint & 0xffff);
+    }
+
     unsigned build() {
         assert(output == nullptr);
         int osize = 4 + 2 * nsections; // upper limit for alignments
@@ -1005,6 +1039,7 @@ unsigned PeFile::processImports0(ord_mask_t ord_mask) // pass 1
 
         soimport += strlen(dlls[ic].name) + 1 + 4;
 
+        unsigned shname_len = 0;
         for (IPTR_VAR(const LEXX, tarr, dlls[ic].lookupt); *tarr; tarr += 1) {
             if (*tarr & ord_mask) {
                 importbyordinal = true;
@@ -1015,14 +1050,17 @@ unsigned PeFile::processImports0(ord_mask_t ord_mask) // pass 1
                 IPTR_VAR(const byte, const name, ibuf + (*tarr + 2));
                 unsigned len = strlen(name);
                 soimport += len + 1;
-                if (dlls[ic].shname == nullptr || len < strlen(dlls[ic].shname))
+                if (dlls[ic].shname == nullptr || len < shname_len) {
                     dlls[ic].shname = ibuf + (*tarr + 2);
+                    shname_len = len;
+                }
             }
             soimport++; // separator
+            if (opt->win32_pe.fast_imports)
+                soimport += 4; // a pre-resolved entry may be longer than the name
         }
     }
-    mb_oimport.alloc(soimport);
-    mb_oimport.clear();
+    mb_oimport.allocZeroed(soimport);
     oimport = mb_oimport;
 
     upx_qsort(idlls, dllnum, sizeof(*idlls), UDll::compare);
@@ -1036,7 +1074,23 @@ unsigned PeFile::processImports0(ord_mask_t ord_mask) // pass 1
     // create the new import table
     addStubImports();
 
+    // "--fast-imports": put every import into the output import table, so
+    // that the OS loader resolves them all (using the hints of the original
+    // file), and the stub just copies the addresses instead of calling
+    // GetProcAddress() once per import
+    const bool fast_imports = opt->win32_pe.fast_imports;
     for (unsigned ic = 0; ic < dllnum; ic++) {
+        if (fast_imports && *idlls[ic]->lookupt) {
+            for (const LEXX *tarr = idlls[ic]->lookupt; *tarr; tarr++)
+                if (*tarr & ord_mask)
+                    ilinker->add(idlls[ic]->name, unsigned(*tarr & 0xffff));
+                else
+                    ilinker->addWithHint(idlls[ic]->name,
+                                         ibuf.subref("bad import name %#x", *tarr + 2, 1),
+                                         get_le16(ibuf.subref("bad import hint %#x", *tarr, 2)));
+            importbyordinal = kernel32ordinal = true; // select PEIBYORD and PEK32ORD
+            continue;
+        }
         if (idlls[ic]->isk32) {
             // for kernel32.dll we need to put all the imported
             // ordinals into the output import table, as on
@@ -1071,7 +1125,7 @@ unsigned PeFile::processImports0(ord_mask_t ord_mask) // pass 1
         for (; *tarr; tarr++)
             if (*tarr & ord_mask) {
                 const unsigned ord = *tarr & 0xffff;
-                if (idlls[ic]->isk32 && kernel32ordinal) {
+                if (fast_imports || (idlls[ic]->isk32 && kernel32ordinal)) {
                     *ppi++ = 0xfe; // signed + odd parity
                     set_le32(ppi, ilinker->getAddress(idlls[ic]->name, ord));
                     ppi += 4;
@@ -1080,6 +1134,12 @@ unsigned PeFile::processImports0(ord_mask_t ord_mask) // pass 1
                     set_le16(ppi, ord);
                     ppi += 2;
                 }
+            } else if (fast_imports) {
+                const byte *iname = ibuf.subref("bad import name %#x", 2 + *tarr, 1);
+                *ppi++ = 0xfe;
+                set_le32(ppi, ilinker->getAddress(idlls[ic]->name, iname));
+                ppi += 4;
+                names.add(*tarr, 2 + 1 + strlen(iname));
             } else {
                 *ppi++ = 1;
                 const unsigned skip2 = 2 + *tarr;
@@ -1276,8 +1336,7 @@ void PeFile::processExports(Export *xport) // pass1
     }
     xport->convert(IDADDR(PEDIR_EXPORT), IDSIZE(PEDIR_EXPORT));
     soexport = ALIGN_UP(xport->getsize(), 4u);
-    mb_oexport.alloc(soexport);
-    mb_oexport.clear();
+    mb_oexport.allocZeroed(soexport);
     oexport = mb_oexport;
 }
 
@@ -1402,8 +1461,7 @@ void PeFile::processTls1(Interval *iv, typename tls_traits<LEXX>::cb_value_t ima
     const unsigned aligned_sotls = ALIGN_UP(sotls, (unsigned) sizeof(LEXX));
 
     // the PE loader wants this stuff uncompressed
-    mb_otls.alloc(aligned_sotls);
-    mb_otls.clear();
+    mb_otls.allocZeroed(aligned_sotls);
     otls = mb_otls; // => otls now is a SPAN_S
     const unsigned skip1 = IDADDR(PEDIR_TLS);
     const unsigned take1 = sizeof(tls);
@@ -1582,10 +1640,36 @@ PeFile::Resource::Resource(const byte *p, const byte *ibufstart_, const byte *ib
 }
 
 PeFile::Resource::~Resource() noexcept {
-    if (root) {
-        destroy(root, 0);
-        root = nullptr;
+    root = head = current = nullptr;
+    arenaFree();
+}
+
+void *PeFile::Resource::arenaAlloc(size_t bytes) {
+    constexpr size_t align = alignof(upx_rbranch) > sizeof(void *) ? alignof(upx_rbranch)
+                                                                   : sizeof(void *);
+    bytes = ALIGN_UP(bytes, align);
+    if (arena == nullptr || bytes > arena_size - arena_used) {
+        const size_t header = ALIGN_UP(sizeof(byte *), align);
+        const unsigned new_size = mem_size(1, UPX_MAX(bytes + header, size_t(64 * 1024)));
+        byte *const block = New(byte, new_size);
+        memcpy(block, &arena, sizeof(arena)); // link to the previous block
+        arena = block;
+        arena_used = header;
+        arena_size = new_size;
+    }
+    void *const p = arena + arena_used;
+    arena_used += bytes;
+    return p;
+}
+
+void PeFile::Resource::arenaFree() noexcept {
+    while (arena != nullptr) {
+        byte *prev;
+        memcpy(&prev, arena, sizeof(prev));
+        delete[] arena;
+        arena = prev;
     }
+    arena_used = arena_size = 0;
 }
 
 unsigned PeFile::Resource::dirsize() const { return ALIGN_UP(dsize + ssize, 4u); }
@@ -1627,6 +1711,7 @@ void PeFile::Resource::init(const byte *res) {
 
     start = res;
     root = head = current = nullptr;
+    arenaFree();
     dsize = ssize = 0;
     check((const res_dir *) start, 0);
     root = convert(start, nullptr, 0);
@@ -1656,7 +1741,7 @@ PeFile::Resource::upx_rnode *PeFile::Resource::convert(const void *rnode, upx_rn
     if (level == 3) {
         const res_data *node = ACC_STATIC_CAST(const res_data *, rnode);
         ibufcheck(node, sizeof(*node));
-        upx_rleaf *leaf = new upx_rleaf;
+        upx_rleaf *leaf = new (arenaAlloc(sizeof(upx_rleaf))) upx_rleaf;
         leaf->id = 0;
         leaf->name = nullptr;
         leaf->parent = parent;
@@ -1675,12 +1760,12 @@ PeFile::Resource::upx_rnode *PeFile::Resource::convert(const void *rnode, upx_rn
     if (ic == 0)
         return nullptr;
 
-    upx_rbranch *branch = new upx_rbranch;
+    upx_rbranch *branch = new (arenaAlloc(sizeof(upx_rbranch))) upx_rbranch;
     branch->id = 0;
     branch->name = nullptr;
     branch->parent = parent;
     branch->nc = ic;
-    branch->children = New(upx_rnode *, ic);
+    branch->children = (upx_rnode **) arenaAlloc(mem_size(sizeof(upx_rnode *), ic));
     branch->data = *node;
 
     for (const res_dir_entry *rde = node->entries + ic - 1; --ic >= 0; rde--) {
@@ -1693,7 +1778,7 @@ PeFile::Resource::upx_rnode *PeFile::Resource::convert(const void *rnode, upx_rn
             ibufcheck(p, 2);
             const unsigned len = 2 + 2 * get_le16(p);
             ibufcheck(p, len);
-            child->name = New(byte, len);
+            child->name = (byte *) arenaAlloc(len);
             memcpy(child->name, p, len); // copy unicode string
             ssize += len;                // size of unicode strings
         }
@@ -1760,25 +1845,6 @@ byte *PeFile::Resource::build() {
     return newstart;
 }
 
-void PeFile::Resource::destroy(upx_rnode *node, unsigned level) noexcept {
-    xcheck(node);
-    if (level == 3) {
-        upx_rleaf *leaf = ACC_STATIC_CAST(upx_rleaf *, node);
-        delete[] leaf->name;
-        leaf->name = nullptr;
-        delete leaf;
-    } else {
-        upx_rbranch *branch = ACC_STATIC_CAST(upx_rbranch *, node);
-        delete[] branch->name;
-        branch->name = nullptr;
-        for (int ic = branch->nc; --ic >= 0;)
-            destroy(branch->children[ic], level + 1);
-        delete[] branch->children;
-        branch->children = nullptr;
-        delete branch;
-    }
-}
-
 static void lame_print_unicode(const byte *p) {
     for (unsigned ic = 0; ic < get_le16(p); ic++)
         printf("%c", (char) p[ic * 2 + 2]);
@@ -1901,8 +1967,7 @@ void PeFile::processResources(Resource *res) {
 
     for (soresources = res->dirsize(); res->next(); soresources += 4 + res->size())
         ;
-    mb_oresources.alloc(soresources);
-    mb_oresources.clear();
+    mb_oresources.allocZeroed(soresources);
     oresources = mb_oresources; // => SPAN_S
     SPAN_S_VAR(byte, ores, oresources + res->dirsize());
 
@@ -1967,6 +2032,15 @@ void PeFile::processResources(Resource *res) {
         if (do_compress)
             do_compress &= !match(res->itype(), res->ntype(), res->iname(), res->nname(),
                                   opt->win32_pe.keep_resource);
+        if (do_compress && opt->win32_pe.keep_large_resources &&
+            res->size() >= opt->win32_pe.keep_large_resources)
+            do_compress = false; // load on demand instead of at startup
+        if (do_compress && opt->win32_pe.keep_incompressible) {
+            // already compressed data: keep it out of the compressed image
+            const unsigned take = res->size();
+            if (mem_looks_incompressible(ibuf.subref("bad resoff %#x", res->offs(), take), take))
+                do_compress = false;
+        }
 
         if (do_compress) {
             csize += res->size();
@@ -2862,30 +2936,42 @@ void PeFile::rebuildImports(SPAN_S(byte) & extra_info, ord_mask_t ord_mask, bool
         OPTR_VAR(LEXX, newiat, (LEXX *) raw_bytes(Obuf + iatoffs, 0));
 
         // restore the imported names+ordinals
-        for (p += 8; *p; ++newiat)
+        for (p += 8; *p; ++newiat) {
+            const byte *iname = nullptr; // an import by name
             if (*p == 1) {
-                const unsigned ilen = strlen(++p) + 1;
+                iname = raw_bytes(p + 1, 1);
+                p += 1 + strlen(iname) + 1;
+            } else if (*p == 0xff) {
+                *newiat = get_le16(p + 1) + ord_mask;
+                //;;;printf(" %x",(unsigned)*newiat);
+                p += 3;
+            } else {
+                const upx_uint64_t thunk =
+                    *(const LEXX *) raw_bytes(import + get_le32(p + 1), sizeof(LEXX));
+                if (thunk & ord_mask)
+                    *newiat = thunk;
+                else {
+                    // "--fast-imports": the thunk points to the hint/name in our import table
+                    iname = raw_bytes(import + mem_size(1, thunk - IDADDR(PEDIR_IMPORT) + 2), 1);
+                    ICHECK(iname, strlen(iname) + 1);
+                }
+                p += 5;
+            }
+            if (iname != nullptr) {
+                const unsigned ilen = strlen(iname) + 1;
                 if (inamespos) {
                     if (ptr_udiff_bytes(importednames, importednames_start) & 1)
                         importednames -= 1;
-                    omemcpy(importednames + 2, p, ilen);
+                    omemcpy(importednames + 2, iname, ilen);
                     //;;;printf(" %s",importednames+2);
                     *newiat = ptr_udiff_bytes(importednames, obuf) + rvamin;
                     importednames += 2 + ilen;
                 } else {
                     // Beware overlap!
-                    omemmove(Obuf + (*newiat + 2), p, ilen);
+                    omemmove(Obuf + (*newiat + 2), iname, ilen);
                 }
-                p += ilen;
-            } else if (*p == 0xff) {
-                *newiat = get_le16(p + 1) + ord_mask;
-                //;;;printf(" %x",(unsigned)*newiat);
-                p += 3;
-            } else {
-                *newiat = *(const LEXX *) raw_bytes(import + get_le32(p + 1), sizeof(LEXX));
-                assert(*newiat & ord_mask);
-                p += 5;
             }
+        }
         *newiat = 0;
         im++;
     }
@@ -2998,8 +3084,7 @@ void PeFile::unpack0(OutputFile *fo, const ht &ih, ht &oh, ord_mask_t ord_mask,
             ic++;
 
         ibuf.dealloc();
-        ibuf.alloc(osection[ic].rawdataptr);
-        ibuf.clear();
+        ibuf.allocZeroed(osection[ic].rawdataptr);
         infoHeader("[Writing uncompressed file]");
 
         // write header + decompressed file
@@ -3015,6 +3100,30 @@ void PeFile::unpack0(OutputFile *fo, const ht &ih, ht &oh, ord_mask_t ord_mask,
     ibuf.dealloc();
 }
 
+// "--analyze": one region per section that has file data
+unsigned PeFile::getAnalyzeRegions0(AnalyzeRegion *regions, unsigned max_regions, unsigned objs,
+                                    unsigned sizeof_ih) {
+    readSectionHeaders(objs, sizeof_ih);
+    unsigned n = 0;
+    for (unsigned ic = 0; ic < objs && n < max_regions; ic++) {
+        const pe_section_t &s = isection[ic];
+        if (s.rawdataptr == 0 || s.size == 0)
+            continue;
+        AnalyzeRegion &r = regions[n++];
+        char name[sizeof(s.name) + 1];
+        memcpy(name, s.name, sizeof(s.name));
+        name[sizeof(s.name)] = 0;
+        snprintf(r.name, sizeof(r.name), "%s", name[0] ? name : "(noname)");
+        r.offset = s.rawdataptr;
+        r.size = s.size;
+        r.mem_size = UPX_MAX(unsigned(s.size), unsigned(s.vsize));
+        const unsigned flags = s.flags;
+        r.prot = ((flags & IMAGE_SCN_MEM_READ) ? 4 : 0) | ((flags & IMAGE_SCN_MEM_WRITE) ? 2 : 0) |
+                 ((flags & IMAGE_SCN_MEM_EXECUTE) ? 1 : 0);
+    }
+    return n;
+}
+
 int PeFile::canUnpack0(unsigned max_sections, unsigned objs, unsigned ih_entry, unsigned ih_size) {
     const unsigned min_sections = isefi ? 2 : 3;
     if (objs < min_sections)
@@ -3126,6 +3235,10 @@ tribool PeFile32::canUnpack() {
     return canUnpack0(getFormat() == UPX_F_WINCE_ARM ? 4 : 3, ih.objects, ih.entry, sizeof(ih));
 }
 
+unsigned PeFile32::getAnalyzeRegions(AnalyzeRegion *regions, unsigned max_regions) {
+    return getAnalyzeRegions0(regions, max_regions, ih.objects, sizeof(ih));
+}
+
 unsigned PeFile32::processImports() // pass 1
 {
     return processImports0<LE32>(1u << 31);
@@ -3177,6 +3290,10 @@ tribool PeFile64::canUnpack() {
     return canUnpack0(3, ih.objects, ih.entry, sizeof(ih));
 }
 
+unsigned PeFile64::getAnalyzeRegions(AnalyzeRegion *regions, unsigned max_regions) {
+    return getAnalyzeRegions0(regions, max_regions, ih.objects, sizeof(ih));
+}
+
 unsigned PeFile64::processImports() // pass 1
 {
     return processImports0<LE64>(1ULL << 63);
@@ -78,6 +78,8 @@ protected:
     }
 
     int canUnpack0(unsigned max_sections, unsigned objs, unsigned ih_entry, unsigned ih_size);
+    unsigned getAnalyzeRegions0(AnalyzeRegion *regions, unsigned max_regions, unsigned objs,
+                                unsigned sizeof_ih);
 
 protected:
     static int checkMachine(unsigned cpu);
@@ -373,6 +375,8 @@ protected:
         void add(const void *start, unsigned len);
         void add(const void *start, const void *end);
         void add(const Interval *iv);
+        void add(const interval *ivs, unsigned n); // bulk add
+        void reserve(unsigned n);
         void flatten();
 
         void clear();
@@ -438,12 +442,19 @@ protected:
         const byte *ibufstart = nullptr;
         const byte *ibufend = nullptr;
 
+        // all nodes, children arrays and names of the tree are bump allocated
+        // from a list of big blocks, which get freed all at once
+        byte *arena = nullptr; // current block; the first word links to the previous one
+        unsigned arena_used = 0;
+        unsigned arena_size = 0;
+        void *arenaAlloc(size_t bytes);
+        void arenaFree() noexcept;
+
         void check(const res_dir *, unsigned);
         upx_rnode *convert(const void *, upx_rnode *, unsigned);
         void build(const upx_rnode *, unsigned &, unsigned &, unsigned);
         void clear(byte *, unsigned, Interval *);
         void dump(const upx_rnode *, unsigned) const;
-        void destroy(upx_rnode *urd, unsigned level) noexcept;
 
         void ibufcheck(const void *m, unsigned size);
 
@@ -516,6 +527,8 @@ protected:
                bool last_section_rsrc_only);
     virtual void unpack(OutputFile *fo) override;
     virtual tribool canUnpack() override;
+    virtual unsigned getAnalyzeRegions(AnalyzeRegion *, unsigned max_regions) override;
+    virtual upx_uint64_t getRunImageSize() override { return ih.imagesize; }
 
     virtual void readPeHeader() override;
 
@@ -577,6 +590,8 @@ protected:
 
     virtual void unpack(OutputFile *fo) override;
     virtual tribool canUnpack() override;
+    virtual unsigned getAnalyzeRegions(AnalyzeRegion *, unsigned max_regions) override;
+    virtual upx_uint64_t getRunImageSize() override { return ih.imagesize; }
 
     virtual void readPeHeader() override;
 
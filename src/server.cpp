@@ -0,0 +1,324 @@
+/* server.cpp -- "--listen": process many jobs from one warm upx process
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+// "upx --listen=SOCKET" initializes once and then waits for jobs on a
+// Unix domain socket; "upx --connect=SOCKET ARGS..." sends such a job.
+//
+// Every job runs in a fork() of the listening process, so it starts with
+// all the startup work (sanity checks, compression library setup) already
+// done, and jobs from parallel build steps run side by side without sharing
+// any state. Within a job "--jobs" and "--threads" work as usual.
+//
+// The client passes its stdin/stdout/stderr with SCM_RIGHTS, so all output
+// of a job goes right to the client's terminal, and the job gets run in the
+// current directory and with the environment of the *server*; only the
+// current directory of the client gets transmitted.
+//
+// protocol (all numbers are little-endian):
+//   client: le32 request_size (carrying the 3 file descriptors)
+//   client: request_size bytes: cwd '\0' argv[0] '\0' ... argv[argc-1] '\0'
+//   server: le32 exit_code
+
+#include "headers.h"
+#include "conf.h"
+#include "util/membuffer.h"
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__wasi__)
+#define USE_SERVER 1
+#endif
+
+#if USE_SERVER
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+namespace {
+
+// a request is a command line, so this is plenty
+constexpr unsigned MAX_REQUEST_SIZE = 1024 * 1024;
+constexpr int NUM_FDS = 3;
+
+int reply_fd = -1; // only valid within a job
+
+bool write_all(int fd, const void *buf, size_t len) noexcept {
+    const char *p = (const char *) buf;
+    while (len > 0) {
+        ssize_t l = ::write(fd, p, len);
+        if (l < 0 && errno == EINTR)
+            continue;
+        if (l <= 0)
+            return false;
+        p += l;
+        len -= (size_t) l;
+    }
+    return true;
+}
+
+bool read_all(int fd, void *buf, size_t len) noexcept {
+    char *p = (char *) buf;
+    while (len > 0) {
+        ssize_t l = ::read(fd, p, len);
+        if (l < 0 && errno == EINTR)
+            continue;
+        if (l <= 0)
+            return false;
+        p += l;
+        len -= (size_t) l;
+    }
+    return true;
+}
+
+void set_socket_address(struct sockaddr_un *sa, const char *socket_name) {
+    mem_clear(sa);
+    sa->sun_family = AF_UNIX;
+    if (strlen(socket_name) >= sizeof(sa->sun_path))
+        throwIOException("socket name too long");
+    strcpy(sa->sun_path, socket_name);
+}
+
+// receive the size word and the file descriptors
+bool recv_header(int fd, unsigned *size, int fds[NUM_FDS]) noexcept {
+    byte buf[4];
+    union {
+        struct cmsghdr align;
+        char data[CMSG_SPACE(sizeof(int) * NUM_FDS)];
+    } control;
+    struct iovec iov = {buf, sizeof(buf)};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+    ssize_t l;
+    do
+        l = ::recvmsg(fd, &msg, 0);
+    while (l < 0 && errno == EINTR);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    if (c == nullptr || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS ||
+        c->cmsg_len != CMSG_LEN(sizeof(int) * NUM_FDS))
+        return false;
+    memcpy(fds, CMSG_DATA(c), sizeof(int) * NUM_FDS);
+    if (l != (ssize_t) sizeof(buf) || (msg.msg_flags & MSG_CTRUNC)) {
+        for (int i = 0; i < NUM_FDS; i++)
+            (void) ::close(fds[i]);
+        return false;
+    }
+    *size = get_le32(buf);
+    return true;
+}
+
+bool send_header(int fd, unsigned size) noexcept {
+    byte buf[4];
+    set_le32(buf, size);
+    union {
+        struct cmsghdr align;
+        char data[CMSG_SPACE(sizeof(int) * NUM_FDS)];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {buf, sizeof(buf)};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * NUM_FDS);
+    const int fds[NUM_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+    ssize_t l;
+    do
+        l = ::sendmsg(fd, &msg, 0);
+    while (l < 0 && errno == EINTR);
+    return l == (ssize_t) sizeof(buf);
+}
+
+// the forked child: set up the client's environment and run the job
+noreturn void run_job(int conn, const int fds[NUM_FDS], char *request, unsigned size,
+                      upx_server_job_func_t job) noexcept {
+    (void) signal(SIGCHLD, SIG_DFL);
+    reply_fd = conn;
+    int r = EXIT_ERROR;
+    for (int i = 0; i < NUM_FDS; i++) {
+        if (::dup2(fds[i], i) < 0)
+            upx_server_job_exit(r);
+        (void) ::close(fds[i]);
+    }
+    // split the request into cwd and argv[]
+    int n = 0;
+    for (unsigned pos = 0; pos < size; pos++)
+        n += request[pos] == 0;
+    char **args = (char **) malloc(sizeof(char *) * (n + 1));
+    if (args == nullptr)
+        upx_server_job_exit(r);
+    n = 0;
+    for (unsigned pos = 0; pos < size; pos += strlen(request + pos) + 1)
+        args[n++] = request + pos;
+    args[n] = nullptr;
+    if (n < 2 || ::chdir(args[0]) != 0)
+        upx_server_job_exit(r);
+    try {
+        r = job(n - 1, args + 1);
+    } catch (const Throwable &e) {
+        printErr("server", e);
+    } catch (...) {
+        printErr("server", "unexpected exception");
+    }
+    upx_server_job_exit(r);
+    ::_exit(r); // not reached
+}
+
+} // namespace
+
+int upx_server_listen(const char *socket_name, upx_server_job_func_t job) may_throw {
+    struct sockaddr_un sa;
+    set_socket_address(&sa, socket_name);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throwIOException("socket", errno);
+    // remove a stale socket of an earlier server, but never a regular file
+    struct stat st;
+    if (::lstat(socket_name, &st) == 0 && S_ISSOCK(st.st_mode))
+        (void) ::unlink(socket_name);
+    // everybody who may connect can pack files with our permissions
+    const mode_t old_umask = ::umask(0077);
+    int rr = ::bind(fd, (const struct sockaddr *) &sa, sizeof(sa));
+    (void) ::umask(old_umask);
+    if (rr != 0 || ::listen(fd, 64) != 0) {
+        int e = errno;
+        (void) ::close(fd);
+        throwIOException(socket_name, e);
+    }
+    (void) signal(SIGCHLD, SIG_IGN); // let the kernel reap the jobs
+    if (opt->verbose >= 1)
+        fprintf(stderr, "%s: listening on '%s'\n", progname, socket_name);
+    fflush(stdout);
+    fflush(stderr);
+
+    for (;;) {
+        int conn = ::accept(fd, nullptr, nullptr);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            int e = errno;
+            (void) ::close(fd);
+            throwIOException("accept", e);
+        }
+        unsigned size = 0;
+        int fds[NUM_FDS];
+        if (!recv_header(conn, &size, fds)) {
+            (void) ::close(conn);
+            continue;
+        }
+        char *request = nullptr;
+        if (size >= 3 && size <= MAX_REQUEST_SIZE)
+            request = (char *) malloc(size);
+        if (request != nullptr && read_all(conn, request, size) && request[size - 1] == 0) {
+            pid_t pid = ::fork();
+            if (pid == 0) {
+                (void) ::close(fd);
+                run_job(conn, fds, request, size, job);
+            }
+            if (pid < 0) {
+                byte buf[4];
+                set_le32(buf, EXIT_ERROR);
+                (void) write_all(conn, buf, sizeof(buf));
+            }
+        }
+        ::free(request);
+        for (int i = 0; i < NUM_FDS; i++)
+            (void) ::close(fds[i]);
+        (void) ::close(conn);
+    }
+}
+
+int upx_server_connect(const char *socket_name, int argc, char *argv[]) may_throw {
+    char cwd[ACC_FN_PATH_MAX + 1];
+    if (::getcwd(cwd, sizeof(cwd)) == nullptr)
+        throwIOException("getcwd", errno);
+    size_t size = strlen(cwd) + 1;
+    for (int i = 0; i < argc; i++)
+        size += strlen(argv[i]) + 1;
+    if (size > MAX_REQUEST_SIZE)
+        throwIOException("command line too long");
+    MemBuffer request(size);
+    char *p = (char *) request.getVoidPtr();
+    for (int i = -1; i < argc; i++) {
+        const char *s = i < 0 ? cwd : argv[i];
+        size_t l = strlen(s) + 1;
+        memcpy(p, s, l);
+        p += l;
+    }
+
+    struct sockaddr_un sa;
+    set_socket_address(&sa, socket_name);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throwIOException("socket", errno);
+    if (::connect(fd, (const struct sockaddr *) &sa, sizeof(sa)) != 0) {
+        int e = errno;
+        (void) ::close(fd);
+        throwIOException(socket_name, e);
+    }
+    byte buf[4];
+    bool ok = send_header(fd, (unsigned) size) && write_all(fd, request.getVoidPtr(), size) &&
+              read_all(fd, buf, sizeof(buf));
+    (void) ::close(fd);
+    if (!ok)
+        throwIOException("lost connection to the upx server");
+    return (int) get_le32(buf);
+}
+
+void upx_server_job_exit(int exit_code) noexcept {
+    if (reply_fd < 0)
+        return;
+    fflush(stdout);
+    fflush(stderr);
+    byte buf[4];
+    set_le32(buf, (unsigned) exit_code);
+    (void) write_all(reply_fd, buf, sizeof(buf));
+    ::_exit(exit_code);
+}
+
+#else // USE_SERVER
+
+int upx_server_listen(const char *, upx_server_job_func_t) may_throw {
+    throwIOException("--listen is not supported on this platform");
+}
+
+int upx_server_connect(const char *, int, char *[]) may_throw {
+    throwIOException("--connect is not supported on this platform");
+}
+
+void upx_server_job_exit(int) noexcept {}
+
+#endif // USE_SERVER
+
+/* vim:set ts=4 sw=4 et: */
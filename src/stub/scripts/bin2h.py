@@ -32,6 +32,7 @@ import getopt, os, re, struct, sys, zlib
 
 
 class opts:
+    digest = 0
     dry_run = 0
     ident = None
     methods = [ 0 ]
@@ -264,6 +265,92 @@ def compress_stub(method, idata):
     return method, odata
 
 
+# /***********************************************************************
+# // pre-digest the embedded objinfo dump
+# ************************************************************************/
+
+# Replace the "objdump -htr" text that f-embed_objinfo appends to a stub by
+# binary tables, so that ElfLinker::preprocessDigest() can load the
+# sections, symbols and relocations without any sscanf(). All numbers are
+# LE32, all names are offsets into the trailing string table:
+#   "UPX$OBJ\n" nsections nsymbols nrelocations
+#   sections:    name offset size p2align
+#   symbols:     name section_index offset
+#   relocations: section_index offset type symbol_index add_lo add_hi
+# The implicit sections "*ABS*" and "*UND*" have the indices nsections
+# and nsections + 1, just as ElfLinker::preprocessSections() adds them.
+
+def digest_objinfo(idata):
+    pos = idata.find("Sections:\n")
+    if pos < 0:
+        return idata
+    text = idata[pos:]
+    psymbols = text.find("SYMBOL TABLE:\n")
+    prelocs = text.find("RELOCATION RECORDS FOR ", max(psymbols, 0))
+    end_sections = len(text)
+    if psymbols >= 0: end_sections = psymbols
+    elif prelocs >= 0: end_sections = prelocs
+    strings, string_offsets = [], {}
+    def add_string(name):
+        if not string_offsets.has_key(name):
+            string_offsets[name] = sum([len(x) + 1 for x in strings])
+            strings.append(name)
+        return string_offsets[name]
+    sections, section_index = [], {}
+    for line in text[:end_sections].split("\n"):
+        m = re.search(r"^\s*\d+\s+(\S+)\s+([0-9a-fA-F]+)\s+[0-9a-fA-F]+\s+[0-9a-fA-F]+\s+([0-9a-fA-F]+)\s+2\*\*(\d+)", line)
+        if m:
+            name = m.group(1)
+            assert not section_index.has_key(name), name
+            section_index[name] = len(sections)
+            sections.append((add_string(name), int(m.group(3), 16), int(m.group(2), 16), int(m.group(4))))
+    section_index["*ABS*"] = len(sections)
+    section_index["*UND*"] = len(sections) + 1
+    symbols, symbol_index = [], {}
+    def add_symbol(name, section, offset):
+        assert not symbol_index.has_key(name), name
+        symbol_index[name] = len(symbols)
+        symbols.append((add_string(name), section_index[section], offset))
+    if psymbols >= 0:
+        end_symbols = len(text)
+        if prelocs >= 0: end_symbols = prelocs
+        for line in text[psymbols:end_symbols].split("\n"):
+            m = re.search(r"^([0-9a-fA-F]+)\s+g\s+\*ABS\*\s+([0-9a-fA-F]+)\s+(\S+)", line)
+            if m:
+                assert int(m.group(2), 16) == 0, line
+                add_symbol(m.group(3), "*ABS*", int(m.group(1), 16))
+                continue
+            m = re.search(r"^([0-9a-fA-F]+).{8}\s*(\S+)\s+[0-9a-fA-F]+\s+(\S+)", line)
+            if m:
+                offset = int(m.group(1), 16)
+                if m.group(2) == "*UND*":
+                    offset = 0xdeaddead
+                assert m.group(2) != "*ABS*", line
+                add_symbol(m.group(3), m.group(2), offset)
+    relocations = []
+    if prelocs >= 0:
+        section = None
+        for line in text[prelocs:].split("\n"):
+            m = re.search(r"^RELOCATION RECORDS FOR \[([^]]+)", line)
+            if m:
+                section = section_index[m.group(1)]
+            m = re.search(r"^\s*([0-9a-fA-F]+)\s+(\S+)\s+(\S+)", line)
+            if m and section is not None:
+                symbol, add = m.group(3), 0
+                m2 = re.search(r"^(.*?)([+-])0x([0-9a-fA-F]{8}|[0-9a-fA-F]{16})$", symbol)
+                if m2:
+                    symbol, add = m2.group(1), int(m2.group(3), 16)
+                    if m2.group(2) == "-":
+                        add = (0 - add) & 0xffffffffffffffff
+                relocations.append((section, int(m.group(1), 16), add_string(m.group(2)),
+                                    symbol_index[symbol], add & 0xffffffff, add >> 32))
+    odata = "UPX$OBJ\n" + struct.pack("<III", len(sections), len(symbols), len(relocations))
+    for r in sections + symbols + relocations:
+        odata += struct.pack("<" + "I" * len(r), *r)
+    odata += "".join([x + "\0" for x in strings])
+    return idata[:pos] + odata
+
+
 # /***********************************************************************
 # // main
 # ************************************************************************/
@@ -273,7 +360,7 @@ def main(argv):
     except AssertionError: pass
     else: raise Exception("fatal error - assertions not enabled")
     shortopts, longopts = "qv", [
-        "compress=", "dry-run", "ident=", "mode=", "quiet", "verbose"
+        "compress=", "digest", "dry-run", "ident=", "mode=", "quiet", "verbose"
     ]
     xopts, args = getopt.gnu_getopt(argv[1:], shortopts, longopts)
     for opt, optarg in xopts:
@@ -281,6 +368,7 @@ def main(argv):
         elif opt in ["-q", "--quiet"]: opts.verbose = opts.verbose - 1
         elif opt in ["-v", "--verbose"]: opts.verbose = opts.verbose + 1
         elif opt in ["--compress"]: opts.methods = map(int, optarg.split(","))
+        elif opt in ["--digest"]: opts.digest = opts.digest + 1
         elif opt in ["--dry-run"]: opts.dry_run = opts.dry_run + 1
         elif opt in ["--ident"]: opts.ident = optarg
         elif opt in ["--mode"]: opts.mode = optarg.lower()
@@ -305,6 +393,8 @@ def main(argv):
     idata = ifp.read()
     ifp.close()
     assert len(idata) == st.st_size
+    if opts.digest:
+        idata = digest_objinfo(idata)
 
     # opts.ident
     if opts.ident in ["auto", "auto-stub"]:
@@ -25,9 +25,11 @@
    <markus@oberhumer.com>               <ezerotven+github@gmail.com>
  */
 
-// INFO: not thread-safe; instantiated and used by class Packer, and the
-// static (global) variables are also updated in work.cpp
+// INFO: instantiated and used by class Packer, and the static (global)
+// variables are also updated in work.cpp; when processing files in parallel
+// ("--jobs") there is no progress bar and each file only prints one line
 
+#include <chrono>
 #include "conf.h"
 #include "file.h"
 #include "packer.h"
@@ -64,6 +66,7 @@ struct UiPacker::State final {
     int bar_pos;
     int bar_len;
     int pass_digits; // number of digits needed to print total_passes
+    upx_int64_t last_draw_ms; // drawing is rate-limited, see doCallback()
 
 #if (UI_USE_SCREEN)
     screen_t *screen;
@@ -80,16 +83,19 @@ struct UiPacker::State final {
 };
 
 // static
-unsigned UiPacker::total_files = 0;
-unsigned UiPacker::total_files_done = 0;
+upx_std_atomic(unsigned) UiPacker::total_files(0);
+upx_std_atomic(unsigned) UiPacker::total_files_done(0);
 upx_uint64_t UiPacker::total_c_len = 0;
 upx_uint64_t UiPacker::total_u_len = 0;
 upx_uint64_t UiPacker::total_fc_len = 0;
 upx_uint64_t UiPacker::total_fu_len = 0;
-unsigned UiPacker::update_c_len = 0;
-unsigned UiPacker::update_u_len = 0;
-unsigned UiPacker::update_fc_len = 0;
-unsigned UiPacker::update_fu_len = 0;
+upx_thread_local unsigned UiPacker::update_c_len = 0;
+upx_thread_local unsigned UiPacker::update_u_len = 0;
+upx_thread_local unsigned UiPacker::update_fc_len = 0;
+upx_thread_local unsigned UiPacker::update_fu_len = 0;
+#if WITH_THREADS
+static std::mutex total_mutex; // protects total_xx_len
+#endif
 
 /*************************************************************************
 // constants
@@ -100,7 +106,11 @@ static const char header_line2[] = "   --------------------   ------   ---------
 
 static const char progress_filler[4 + 1] = ".*[]";
 
+// every packer tried by PackMaster gets a UiPacker, so ask the OS only once
+static bool stdout_is_tty = false;
+
 static void init_global_constants(void) noexcept {
+    stdout_is_tty = acc_isatty(STDOUT_FILENO) != 0;
 #if 0 && (ACC_OS_DOS16 || ACC_OS_DOS32)
     // FIXME: should test codepage here
 
@@ -128,7 +138,7 @@ static void init_global_constants(void) noexcept {
 static const char *mkline(upx_uint64_t fu_len, upx_uint64_t fc_len, upx_uint64_t u_len,
                           upx_uint64_t c_len, const char *format_name, const char *filename,
                           bool decompress = false) {
-    static char buf[2048]; // static! // TODO later: check if affected by WITH_THREADS
+    static upx_thread_local char buf[2048]; // static!
     char r[7 + 1];
     char fn[15 + 1];
     const char *f;
@@ -173,7 +183,7 @@ UiPacker::UiPacker(const PackerBase *pb_) : pb(pb_) {
 
     if (opt->verbose < 0)
         s->mode = M_QUIET;
-    else if (opt->verbose == 0 || !acc_isatty(STDOUT_FILENO))
+    else if (opt->verbose == 0 || !stdout_is_tty || opt->jobs > 1)
         s->mode = M_INFO;
     else if (opt->verbose == 1 || opt->no_progress)
         s->mode = M_MSG;
@@ -360,6 +370,52 @@ void __acc_cdecl UiPacker::progress_callback(upx_callback_t *cb, unsigned isize,
     self->doCallback(isize, osize);
 }
 
+/*static*/
+void __acc_cdecl UiPacker::shared_progress_callback(upx_callback_t *cb, unsigned isize,
+                                                    unsigned osize) {
+    SharedCallback *scb = (SharedCallback *) cb->user;
+    UiPacker *self = scb->ui;
+    // the callbacks of one compression always come from the same thread
+    if (isize < scb->last_isize || osize < scb->last_osize)
+        return;
+    self->shared_isize += isize - scb->last_isize;
+    self->shared_osize += osize - scb->last_osize;
+    scb->last_isize = isize;
+    scb->last_osize = osize;
+#if (WITH_THREADS)
+    if (self->shared_drawing.exchange(true, std::memory_order_acquire))
+        return; // another thread is drawing
+#endif
+    const upx_uint64_t n = self->shared_n;
+    self->doCallback((unsigned) (self->shared_isize / n), (unsigned) (self->shared_osize / n));
+#if (WITH_THREADS)
+    self->shared_drawing.store(false, std::memory_order_release);
+#endif
+}
+
+void UiPacker::startSharedCallback(unsigned u_len, unsigned n, int pass, int total_passes) {
+    assert(n > 0);
+    // avoid too many progress bar updates, as in Packer::compress()
+    const unsigned step = (u_len < 64 * 1024) ? 0 : u_len / 64;
+    startCallback(u_len, step, pass, total_passes);
+    shared_n = n;
+    shared_isize = 0;
+    shared_osize = 0;
+    shared_drawing = false;
+    firstCallback();
+}
+
+upx_callback_t *UiPacker::initSharedCallback(SharedCallback *scb) {
+    if (cb.nprogress == nullptr) // no progress bar
+        return nullptr;
+    scb->cb.nprogress = shared_progress_callback;
+    scb->cb.user = scb;
+    scb->ui = this;
+    scb->last_isize = 0;
+    scb->last_osize = 0;
+    return &scb->cb;
+}
+
 void UiPacker::doCallback(unsigned isize, unsigned osize) {
     int i;
     static const char spinner[] = "|/-\\";
@@ -396,6 +452,15 @@ void UiPacker::doCallback(unsigned isize, unsigned osize) {
     if (pos < 0 && pos == s->pos)
         return;
 
+    // draw at most 10 times per second, but always the first and the last state
+    typedef std::chrono::steady_clock Clock;
+    const upx_int64_t now_ms = (upx_int64_t) std::chrono::duration_cast<std::chrono::milliseconds>(
+                                   Clock::now().time_since_epoch())
+                                   .count();
+    if (s->pos != -2 && pos != s->bar_len && now_ms - s->last_draw_ms < 100)
+        return;
+    s->last_draw_ms = now_ms;
+
     // fill the progress bar
     char *m = &s->msg_buf[s->bar_pos];
     *m++ = progress_filler[2];
@@ -528,8 +593,8 @@ void UiPacker::uiListEnd() { uiUpdate(); }
 /*static*/ void UiPacker::uiListTotal(bool decompress) {
     if (opt->verbose >= 1 && total_files >= 2) {
         char name[32];
-        upx_safe_snprintf(name, sizeof(name), "[ %u file%s ]", total_files_done,
-                          total_files_done == 1 ? "" : "s");
+        const unsigned n = total_files_done;
+        upx_safe_snprintf(name, sizeof(name), "[ %u file%s ]", n, n == 1 ? "" : "s");
         con_fprintf(
             stdout, "%s%s\n", header_line2,
             mkline(total_fu_len, total_fc_len, total_u_len, total_c_len, "", name, decompress));
@@ -544,7 +609,7 @@ void UiPacker::uiListEnd() { uiUpdate(); }
 void UiPacker::uiTestStart() {
     total_files++;
 
-    if (opt->verbose >= 1) {
+    if (opt->verbose >= 1 && opt->jobs <= 1) {
         con_fprintf(stdout, "testing %s ", pb->fi->getName());
         fflush(stdout);
         printSetNl(1);
@@ -553,7 +618,10 @@ void UiPacker::uiTestStart() {
 
 void UiPacker::uiTestEnd() {
     if (opt->verbose >= 1) {
-        con_fprintf(stdout, "[OK]\n");
+        if (opt->jobs > 1) // print a single line so that parallel jobs do not get mixed up
+            con_fprintf(stdout, "testing %s [OK]\n", pb->fi->getName());
+        else
+            con_fprintf(stdout, "[OK]\n");
         fflush(stdout);
         printSetNl(0);
     }
@@ -598,7 +666,7 @@ void UiPacker::uiFileInfoEnd() { uiUpdate(); }
     if (done)
         return;
     done = true;
-    if (opt->cmd == CMD_TEST || opt->cmd == CMD_FILEINFO)
+    if (opt->cmd == CMD_TEST || opt->cmd == CMD_FILEINFO || opt->cmd == CMD_ANALYZE)
         return;
     if (opt->verbose >= 1) {
         con_fprintf(stdout, "%s%s", header_line1, header_line2);
@@ -621,6 +689,16 @@ void UiPacker::uiFileInfoEnd() { uiUpdate(); }
             con_fprintf(stdout, "\n%s %u file%s: %u ok, %u error%s.\n", t, n1, n1 == 1 ? "" : "s",
                         n2, n3, n3 == 1 ? "" : "s");
     }
+    if (opt->verbose >= 3) { // "-v"
+        // MemBuffers and the estimated working memory of the compressors
+        const upx_uint64_t peak = MemBuffer::getPeakActiveBytes();
+        const upx_uint64_t limit = opt->memory_limit;
+        if (limit > 0)
+            con_fprintf(stdout, "Peak memory usage: %llu KiB, limit %llu KiB.\n",
+                        (peak + 1023) / 1024, (limit + 1023) / 1024);
+        else if (peak > 0)
+            con_fprintf(stdout, "Peak memory usage: %llu KiB.\n", (peak + 1023) / 1024);
+    }
 }
 
 void UiPacker::uiUpdate(upx_off_t fc_len, upx_off_t fu_len) {
@@ -631,6 +709,9 @@ void UiPacker::uiUpdate(upx_off_t fc_len, upx_off_t fu_len) {
 }
 
 /*static*/ void UiPacker::uiConfirmUpdate() {
+#if WITH_THREADS
+    std::lock_guard<std::mutex> lock(total_mutex);
+#endif
     total_files_done++;
     total_fc_len += update_fc_len;
     total_fu_len += update_fu_len;
@@ -68,8 +68,24 @@ public:
     virtual void endCallback(bool done);
     virtual upx_callback_t *getCallback() { return &cb; }
 
+    // Progress of several compressions that run at once on worker threads,
+    // see Packer::compressWithFilters(). Each one reports through its own
+    // SharedCallback, the sums are kept in atomic counters, and the bar
+    // shows their average. Whoever finds the bar free draws it; the other
+    // threads just return. Finish with endCallback().
+    struct SharedCallback final {
+        upx_callback_t cb;
+        UiPacker *ui;
+        unsigned last_isize;
+        unsigned last_osize;
+    };
+    virtual void startSharedCallback(unsigned u_len, unsigned n, int pass, int total_passes);
+    // returns nullptr if there is no progress bar
+    virtual upx_callback_t *initSharedCallback(SharedCallback *scb);
+
 protected:
     static void __acc_cdecl progress_callback(upx_callback_t *, unsigned, unsigned);
+    static void __acc_cdecl shared_progress_callback(upx_callback_t *, unsigned, unsigned);
     virtual void doCallback(unsigned isize, unsigned osize);
 
 protected:
@@ -88,22 +104,34 @@ protected:
 
     // callback
     upx_callback_t cb = {};
+    // shared callback
+    unsigned shared_n = 0;
+#if WITH_THREADS
+    // avoid link errors on some 32-bit platforms: undefined reference to __atomic_fetch_add_8
+    upx_std_atomic(size_t) shared_isize{0};
+    upx_std_atomic(size_t) shared_osize{0};
+#else
+    upx_std_atomic(upx_uint64_t) shared_isize{0};
+    upx_std_atomic(upx_uint64_t) shared_osize{0};
+#endif
+    upx_std_atomic(bool) shared_drawing{false};
 
     // internal state
     struct State;
     OwningPointer(State) s = nullptr; // owner
 
-    // static totals
-    static unsigned total_files;
-    static unsigned total_files_done;
+    // static totals; the lengths are protected by a mutex when using WITH_THREADS
+    static upx_std_atomic(unsigned) total_files;
+    static upx_std_atomic(unsigned) total_files_done;
     static upx_uint64_t total_c_len;
     static upx_uint64_t total_u_len;
     static upx_uint64_t total_fc_len;
     static upx_uint64_t total_fu_len;
-    static unsigned update_c_len;
-    static unsigned update_u_len;
-    static unsigned update_fc_len;
-    static unsigned update_fu_len;
+    // per-file values for uiConfirmUpdate(); thread-local because of "--jobs"
+    static upx_thread_local unsigned update_c_len;
+    static upx_thread_local unsigned update_u_len;
+    static upx_thread_local unsigned update_fc_len;
+    static upx_thread_local unsigned update_fu_len;
 };
 
 /* vim:set ts=4 sw=4 et: */
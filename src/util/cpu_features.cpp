@@ -0,0 +1,177 @@
+/* cpu_features.cpp -- runtime CPU feature detection and kernel dispatch
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+#include "../conf.h"
+#include "cpu_features.h"
+
+#if (ACC_ARCH_ARM64) && defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_SVE
+#define HWCAP_SVE (1ul << 22)
+#endif
+#endif
+
+namespace upx {
+
+/*************************************************************************
+// detection
+**************************************************************************/
+
+static unsigned detect_features() noexcept {
+    unsigned f = 0;
+#if (ACC_ARCH_AMD64 || ACC_ARCH_I386) && (ACC_CC_CLANG || ACC_CC_GNUC) && !defined(_MSC_VER)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        f |= CPU_SSE2;
+    if (__builtin_cpu_supports("ssse3"))
+        f |= CPU_SSSE3;
+    if (__builtin_cpu_supports("sse4.1"))
+        f |= CPU_SSE41;
+    if (__builtin_cpu_supports("avx2"))
+        f |= CPU_AVX2;
+    if (__builtin_cpu_supports("avx512bw"))
+        f |= CPU_AVX512BW;
+#elif (ACC_ARCH_AMD64)
+    f |= CPU_SSE2; // part of the amd64 baseline; no cpuid probing for other compilers yet
+#elif (ACC_ARCH_ARM64)
+    f |= CPU_NEON; // part of the arm64 baseline
+#if defined(__linux__)
+    if (getauxval(AT_HWCAP) & HWCAP_SVE)
+        f |= CPU_SVE;
+#endif
+#endif
+    return f;
+}
+
+unsigned cpu_features_detected() noexcept {
+    static const unsigned features = detect_features();
+    return features;
+}
+
+/*************************************************************************
+// "--host-cpu="
+**************************************************************************/
+
+static upx_std_atomic(unsigned) cpu_limit{~0u};
+
+unsigned cpu_features() noexcept { return cpu_features_detected() & cpu_limit; }
+
+namespace {
+struct CpuLimit final {
+    const char *name;
+    unsigned features; // cumulative
+};
+constexpr unsigned X86_AVX2 = CPU_SSE2 | CPU_SSSE3 | CPU_SSE41 | CPU_AVX2;
+const CpuLimit cpu_limits[] = {
+    {"baseline", 0},
+    {"sse2", CPU_SSE2},
+    {"ssse3", CPU_SSE2 | CPU_SSSE3},
+    {"sse4.1", CPU_SSE2 | CPU_SSSE3 | CPU_SSE41},
+    {"avx2", X86_AVX2},
+    {"avx512", X86_AVX2 | CPU_AVX512BW},
+    {"neon", CPU_NEON},
+    {"sve", CPU_NEON | CPU_SVE},
+    {"native", ~0u},
+};
+const char *const feature_names[] = {"sse2", "ssse3", "sse4.1", "avx2", "avx512bw", nullptr,
+                                     nullptr, nullptr, "neon", "sve"};
+} // namespace
+
+bool cpu_set_limit(const char *name) noexcept {
+    if (name == nullptr)
+        return false;
+    for (const auto &l : cpu_limits) {
+        if (strcmp(name, l.name) == 0) {
+            cpu_limit = l.features;
+            return true;
+        }
+    }
+    return false;
+}
+
+void cpu_features_name(char *buf, size_t size, unsigned features) noexcept {
+    if (size == 0)
+        return;
+    buf[0] = 0;
+    size_t len = 0;
+    for (size_t i = 0; i < TABLESIZE(feature_names); i++) {
+        if (!(features & (1u << i)) || feature_names[i] == nullptr)
+            continue;
+        int n = snprintf(buf + len, size - len, "%s%s", len ? " " : "", feature_names[i]);
+        if (n < 0 || size_t(n) >= size - len)
+            break;
+        len += size_t(n);
+    }
+    if (len == 0)
+        snprintf(buf, size, "baseline");
+}
+
+} // namespace upx
+
+/*************************************************************************
+// tests
+**************************************************************************/
+
+namespace {
+typedef int (*test_fn)();
+int test_fn_avx2() { return 2; }
+int test_fn_sse2() { return 1; }
+int test_fn_portable() { return 0; }
+} // namespace
+
+TEST_CASE("upx::cpu_select") {
+    using namespace upx;
+    static const CpuKernel<test_fn> table[] = {
+        {CPU_AVX2 | CPU_SSE2, test_fn_avx2},
+        {CPU_SSE2, test_fn_sse2},
+        {0, test_fn_portable},
+    };
+    CHECK(cpu_select(table, 0)() == 0);
+    CHECK(cpu_select(table, CPU_SSE2)() == 1);
+    CHECK(cpu_select(table, CPU_AVX2)() == 0);
+    CHECK(cpu_select(table, CPU_SSE2 | CPU_SSSE3 | CPU_AVX2)() == 2);
+    CHECK(cpu_select(table, CPU_NEON)() == 0);
+}
+
+TEST_CASE("upx::cpu_features") {
+    using namespace upx;
+    // the current "--host-cpu=" limit is left alone
+    const unsigned features = cpu_features();
+    CHECK((features & ~cpu_features_detected()) == 0);
+    CHECK(!cpu_set_limit("no-such-cpu"));
+    CHECK(!cpu_set_limit(nullptr));
+    CHECK(cpu_features() == features);
+    char buf[64];
+    cpu_features_name(buf, sizeof(buf), 0);
+    CHECK(strcmp(buf, "baseline") == 0);
+    cpu_features_name(buf, sizeof(buf), CPU_SSE2 | CPU_AVX2);
+    CHECK(strcmp(buf, "sse2 avx2") == 0);
+    cpu_features_name(buf, 5, CPU_SSE2 | CPU_AVX2);
+    CHECK(strcmp(buf, "sse2") == 0);
+}
+
+/* vim:set ts=4 sw=4 et: */
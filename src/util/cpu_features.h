@@ -0,0 +1,97 @@
+/* cpu_features.h -- runtime CPU feature detection and kernel dispatch
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+#pragma once
+
+namespace upx {
+
+/*************************************************************************
+// The release binary is built for the baseline ISA of its architecture.
+// Host kernels that have faster variants for newer CPUs (compiled with
+// __attribute__((__target__(...))) in the same translation unit) list
+// them in a small table of CpuKernel, best first, and pick the first one
+// the host supports with cpu_select():
+//
+//   static const CpuKernel<adler32_fn> table[] = {
+//       {CPU_AVX2, adler32_avx2},
+//       {0, adler32_portable}, // the last entry must need no features
+//   };
+//   return cpu_select(table)(buf, len, adler);
+//
+// "--host-cpu=NAME" limits the features to those of NAME (for example
+// "sse2" or "baseline"), so that all variants can be tested on one host.
+// It never enables a feature the CPU does not have. (Not to be confused
+// with "--cpu=", which selects the CPU of the packed program's stub.)
+**************************************************************************/
+
+enum : unsigned {
+    // x86 / amd64
+    CPU_SSE2 = 1u << 0,
+    CPU_SSSE3 = 1u << 1,
+    CPU_SSE41 = 1u << 2,
+    CPU_AVX2 = 1u << 3,
+    CPU_AVX512BW = 1u << 4,
+    // arm64
+    CPU_NEON = 1u << 8,
+    CPU_SVE = 1u << 9,
+};
+
+// the features of the host CPU, detected once
+unsigned cpu_features_detected() noexcept;
+// the features the kernels may use: cpu_features_detected() minus "--host-cpu="
+unsigned cpu_features() noexcept;
+
+// "--host-cpu=NAME"; returns false for an unknown NAME. Not thread-safe with
+// respect to running kernels, so call it during option parsing only.
+bool cpu_set_limit(const char *name) noexcept;
+
+// a short text like "sse2 ssse3 sse4.1 avx2" (or "baseline") for -v output
+void cpu_features_name(char *buf, size_t size, unsigned features) noexcept;
+
+template <class Fn>
+struct CpuKernel final {
+    unsigned required; // CPU_xxx bits
+    Fn fn;
+};
+
+template <class Fn, size_t N>
+inline Fn cpu_select(const CpuKernel<Fn> (&table)[N], unsigned features) noexcept {
+    static_assert(N >= 1);
+    for (size_t i = 0; i + 1 < N; i++)
+        if ((table[i].required & ~features) == 0)
+            return table[i].fn;
+    return table[N - 1].fn;
+}
+
+template <class Fn, size_t N>
+inline Fn cpu_select(const CpuKernel<Fn> (&table)[N]) noexcept {
+    return cpu_select(table, cpu_features());
+}
+
+} // namespace upx
+
+/* vim:set ts=4 sw=4 et: */
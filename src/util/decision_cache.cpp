@@ -0,0 +1,379 @@
+/* decision_cache.cpp -- persistent cache of compression decisions
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+#include "../conf.h"
+#include "decision_cache.h"
+
+namespace upx {
+
+/*************************************************************************
+// DecisionHasher - two independent 64-bit multiply/rotate lanes; this is
+// not a cryptographic hash, but a collision only ever costs compression
+**************************************************************************/
+
+static forceinline upx_uint64_t rotl64(upx_uint64_t x, unsigned n) noexcept {
+    return (x << n) | (x >> (64 - n));
+}
+
+DecisionHasher::DecisionHasher() noexcept
+    : h1(0x9e3779b97f4a7c15ull), h2(0xc2b2ae3d27d4eb4full), len(0) {}
+
+void DecisionHasher::add(const void *p, size_t n) noexcept {
+    const byte *b = (const byte *) p;
+    len += n;
+    for (; n >= 8; b += 8, n -= 8) {
+        const upx_uint64_t w = get_le64(b);
+        h1 = (h1 ^ w) * 0xff51afd7ed558ccdull;
+        h1 ^= h1 >> 29;
+        h2 = rotl64(h2 + w, 31) * 0x9e3779b97f4a7c15ull;
+    }
+    if (n != 0) {
+        upx_uint64_t w = 0;
+        for (size_t i = 0; i < n; i++)
+            w |= upx_uint64_t(b[i]) << (8 * i);
+        h1 = (h1 ^ w ^ (upx_uint64_t(n) << 56)) * 0xff51afd7ed558ccdull;
+        h1 ^= h1 >> 29;
+        h2 = rotl64(h2 + w, 31) * 0x9e3779b97f4a7c15ull;
+    }
+}
+
+void DecisionHasher::add(upx_uint64_t v) noexcept {
+    byte b[8];
+    set_le64(b, v);
+    add(b, 8);
+}
+
+template <class T, T default_value, T min_value, T max_value>
+static inline upx_uint64_t
+optvar_bits(const OptVar<T, default_value, min_value, max_value> &v) noexcept {
+    return upx_uint64_t(v.value) | (upx_uint64_t(v.is_set) << 63);
+}
+
+void DecisionHasher::add(const lzma_compress_config_t &c) noexcept {
+    add(optvar_bits(c.pos_bits));
+    add(optvar_bits(c.lit_pos_bits));
+    add(optvar_bits(c.lit_context_bits));
+    add(optvar_bits(c.dict_size));
+    add(optvar_bits(c.num_fast_bytes));
+    add(upx_uint64_t(c.fast_mode) | (upx_uint64_t(c.match_finder_cycles) << 32));
+    add(upx_uint64_t(c.max_num_probs));
+}
+
+void DecisionHasher::add(const ucl_compress_config_t &c) noexcept {
+    add(upx_uint64_t(upx_uint32_t(c.bb_endian)) | (upx_uint64_t(upx_uint32_t(c.bb_size)) << 32));
+    add(upx_uint64_t(c.max_offset));
+    add(upx_uint64_t(c.max_match));
+    add(upx_uint64_t(upx_uint32_t(c.s_level)) | (upx_uint64_t(upx_uint32_t(c.h_level)) << 32));
+    add(upx_uint64_t(upx_uint32_t(c.p_level)) | (upx_uint64_t(upx_uint32_t(c.c_flags)) << 32));
+    add(upx_uint64_t(c.m_size));
+}
+
+void DecisionHasher::add(const zlib_compress_config_t &c) noexcept {
+    add(optvar_bits(c.mem_level));
+    add(optvar_bits(c.window_bits));
+    add(optvar_bits(c.strategy));
+}
+
+void DecisionHasher::add(const zstd_compress_config_t &c) noexcept {
+    add(optvar_bits(c.level));
+    add(optvar_bits(c.window_log));
+    add(optvar_bits(c.long_distance));
+    add(optvar_bits(c.strategy));
+}
+
+void DecisionHasher::add(const upx_compress_config_t &c) noexcept {
+    add(upx_uint64_t(c.conf_bzip2.dummy) | (upx_uint64_t(c.max_c_len) << 32));
+    add(c.conf_lzma);
+    add(c.conf_ucl);
+    add(c.conf_zlib);
+    add(c.conf_zstd);
+}
+
+DecisionCacheKey DecisionHasher::get() const noexcept {
+    // final avalanche
+    upx_uint64_t a = h1 ^ len, b = h2 ^ rotl64(len, 17);
+    a ^= a >> 33;
+    a *= 0xc4ceb9fe1a85ec53ull;
+    a ^= a >> 33;
+    b ^= b >> 31;
+    b *= 0xff51afd7ed558ccdull;
+    b ^= b >> 31;
+    DecisionCacheKey key;
+    key.h[0] = a;
+    key.h[1] = b ^ a;
+    return key;
+}
+
+/*************************************************************************
+// the cache file
+**************************************************************************/
+
+namespace {
+
+// the file gets started over once it grows beyond this size
+constexpr long MAX_CACHE_FILE_SIZE = 1024 * 1024;
+
+#if WITH_THREADS
+std::mutex cache_mutex; // serialize access from "--jobs" workers
+#endif
+
+} // namespace
+
+bool get_cache_path(char *fn, size_t fn_size, const char *name, bool create_dir) noexcept {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *sub = "/upx";
+    if (base == nullptr || !base[0]) {
+        base = getenv("HOME");
+        sub = "/.cache/upx";
+#if defined(_WIN32)
+        if (base == nullptr || !base[0]) {
+            base = getenv("LOCALAPPDATA");
+            sub = "/upx";
+        }
+#endif
+    }
+    if (base == nullptr || !base[0])
+        return false;
+    if (strlen(base) + strlen(name) + 64 > fn_size)
+        return false;
+    snprintf(fn, fn_size, "%s%s", base, sub);
+    if (create_dir) {
+        // also create ".cache" if needed; errors are detected by the caller
+        if (strcmp(sub, "/.cache/upx") == 0) {
+            fn[strlen(fn) - 4] = 0;
+            (void) acc_mkdir(fn, 0700);
+            fn[strlen(fn)] = '/';
+        }
+        (void) acc_mkdir(fn, 0700);
+    }
+    snprintf(fn + strlen(fn), fn_size - strlen(fn), "/%s", name);
+    return true;
+}
+
+bool decision_cache_lookup(const DecisionCacheKey &key, CompressionDecision *d) noexcept {
+    bool found = false;
+    try {
+#if WITH_THREADS
+        std::lock_guard<std::mutex> lock(cache_mutex);
+#endif
+        char fn[1024];
+        if (!get_cache_path(fn, sizeof(fn), "decisions-v1.txt", false))
+            return false;
+        FILE *f = fopen(fn, "rb");
+        if (f == nullptr)
+            return false;
+        char line[256];
+        while (fgets(line, sizeof(line), f) != nullptr) {
+            unsigned long long h0, h1;
+            int method, filter;
+            unsigned cto, overlap;
+            if (sscanf(line, "%16llx%16llx %d %d %u %u", &h0, &h1, &method, &filter, &cto,
+                       &overlap) != 6)
+                continue;
+            if (h0 != key.h[0] || h1 != key.h[1])
+                continue;
+            // the last entry wins
+            d->method = method;
+            d->filter = filter;
+            d->filter_cto = cto;
+            d->overlap_overhead = overlap;
+            found = true;
+        }
+        fclose(f);
+    } catch (...) {
+        found = false;
+    }
+    return found;
+}
+
+void decision_cache_store(const DecisionCacheKey &key, const CompressionDecision &d) noexcept {
+    try {
+#if WITH_THREADS
+        std::lock_guard<std::mutex> lock(cache_mutex);
+#endif
+        char fn[1024];
+        if (!get_cache_path(fn, sizeof(fn), "decisions-v1.txt", true))
+            return;
+        FILE *f = fopen(fn, "ab");
+        if (f == nullptr)
+            return;
+        if (fseek(f, 0, SEEK_END) == 0 && ftell(f) > MAX_CACHE_FILE_SIZE) {
+            fclose(f);
+            f = fopen(fn, "wb");
+            if (f == nullptr)
+                return;
+        }
+        // a single short line, so that concurrent processes do not interleave
+        char line[256];
+        snprintf(line, sizeof(line), "%016llx%016llx %d %d %u %u\n", (unsigned long long) key.h[0],
+                 (unsigned long long) key.h[1], d.method, d.filter, d.filter_cto,
+                 d.overlap_overhead);
+        fputs(line, f);
+        fclose(f);
+    } catch (...) {
+        // ignore
+    }
+}
+
+bool search_result_lookup(const char *fn, const DecisionCacheKey &key,
+                          CompressionDecision *d) noexcept {
+    bool found = false;
+    try {
+#if WITH_THREADS
+        std::lock_guard<std::mutex> lock(cache_mutex);
+#endif
+        FILE *f = fopen(fn, "rb");
+        if (f == nullptr)
+            return false;
+        SearchRank best_rank = {};
+        char line[256];
+        while (fgets(line, sizeof(line), f) != nullptr) {
+            unsigned long long h0, h1, cost = 0;
+            int method, filter;
+            unsigned cto;
+            SearchRank rank = {};
+            const int n = sscanf(line, "%16llx%16llx %d %d %u %u %u %u %llu %u", &h0, &h1,
+                                 &method, &filter, &cto, &rank.overlap_overhead, &rank.size,
+                                 &rank.loader_size, &cost, &rank.order);
+            if (n == 7) {
+                // written by an older version: keep the first one of equal size
+                rank.loader_size = 0;
+                cost = 0;
+                rank.order = ~0u;
+            } else if (n != 10)
+                continue;
+            if (h0 != key.h[0] || h1 != key.h[1])
+                continue;
+            rank.cost = cost;
+            if (found && !search_rank_less(rank, best_rank))
+                continue;
+            d->method = method;
+            d->filter = filter;
+            d->filter_cto = cto;
+            d->overlap_overhead = rank.overlap_overhead;
+            best_rank = rank;
+            found = true;
+        }
+        fclose(f);
+    } catch (...) {
+        found = false;
+    }
+    return found;
+}
+
+bool search_rank_less(const SearchRank &a, const SearchRank &b) noexcept {
+    if (a.cost != b.cost)
+        return a.cost < b.cost;
+    if (a.size != b.size)
+        return a.size < b.size;
+    if (a.loader_size != b.loader_size)
+        return a.loader_size < b.loader_size;
+    if (a.overlap_overhead != b.overlap_overhead)
+        return a.overlap_overhead < b.overlap_overhead;
+    return a.order < b.order;
+}
+
+void search_result_store(const char *fn, const DecisionCacheKey &key, const CompressionDecision &d,
+                         const SearchRank &rank) noexcept {
+    try {
+#if WITH_THREADS
+        std::lock_guard<std::mutex> lock(cache_mutex);
+#endif
+        FILE *f = fopen(fn, "ab");
+        if (f == nullptr)
+            return;
+        char line[256];
+        snprintf(line, sizeof(line), "%016llx%016llx %d %d %u %u %u %u %llu %u\n",
+                 (unsigned long long) key.h[0], (unsigned long long) key.h[1], d.method, d.filter,
+                 d.filter_cto, d.overlap_overhead, rank.size, rank.loader_size,
+                 (unsigned long long) rank.cost, rank.order);
+        fputs(line, f);
+        fclose(f);
+    } catch (...) {
+        // ignore
+    }
+}
+
+} // namespace upx
+
+/*************************************************************************
+// doctest checks
+**************************************************************************/
+
+TEST_CASE("upx::DecisionHasher") {
+    const byte data[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+    upx::DecisionHasher a, b, c;
+    a.add(data, sizeof(data));
+    b.add(data, 8);
+    b.add(data + 8, 3);
+    c.add(data, sizeof(data) - 1);
+    CHECK(a.get().h[0] == b.get().h[0]);
+    CHECK(a.get().h[1] == b.get().h[1]);
+    CHECK(a.get().h[0] != c.get().h[0]);
+    CHECK(a.get().h[1] != c.get().h[1]);
+    upx::DecisionHasher d;
+    d.add(upx_uint64_t(0));
+    CHECK(d.get().h[0] != upx::DecisionHasher().get().h[0]);
+    // the padding bytes of the compression parameters do not matter
+    alignas(upx_compress_config_t) byte x[sizeof(upx_compress_config_t)];
+    alignas(upx_compress_config_t) byte y[sizeof(upx_compress_config_t)];
+    memset(x, 0x00, sizeof(x));
+    memset(y, 0x5a, sizeof(y));
+    upx_compress_config_t *const cx = new (x) upx_compress_config_t;
+    upx_compress_config_t *const cy = new (y) upx_compress_config_t;
+    cx->reset();
+    cy->reset();
+    upx::DecisionHasher e, f;
+    e.add(*cx);
+    f.add(*cy);
+    CHECK(e.get().h[0] == f.get().h[0]);
+    CHECK(e.get().h[1] == f.get().h[1]);
+    cy->conf_lzma.dict_size = 1u << 20;
+    upx::DecisionHasher g;
+    g.add(*cy);
+    CHECK(e.get().h[0] != g.get().h[0]);
+}
+
+TEST_CASE("upx::search_rank_less") {
+    upx::SearchRank a = {0, 1000, 300, 50, 7};
+    upx::SearchRank b = a;
+    CHECK(!upx::search_rank_less(a, b));
+    b.order = 3; // same result, earlier candidate
+    CHECK(upx::search_rank_less(b, a));
+    CHECK(!upx::search_rank_less(a, b));
+    b.overlap_overhead = 60;
+    CHECK(upx::search_rank_less(a, b));
+    b.loader_size = 200;
+    CHECK(upx::search_rank_less(b, a));
+    b.size = 1001;
+    CHECK(upx::search_rank_less(a, b));
+    b.cost = 0;
+    a.cost = 1; // "--optimize-for=startup" comes first
+    CHECK(upx::search_rank_less(b, a));
+}
+
+/* vim:set ts=4 sw=4 et: */
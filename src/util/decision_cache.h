@@ -0,0 +1,100 @@
+/* decision_cache.h -- persistent cache of compression decisions
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+#pragma once
+
+namespace upx {
+
+/*************************************************************************
+// "--decision-cache": remember the winning method/filter candidate of
+// Packer::compressWithFilters() across runs, so that packing the very same
+// data with the very same options again only has to try that winner.
+//
+// The cache is a small text file in $XDG_CACHE_HOME/upx (or ~/.cache/upx).
+// It only ever gives hints - every cached decision is compressed and
+// verified again, so a stale or corrupt cache cannot produce bad output.
+**************************************************************************/
+
+struct DecisionCacheKey final {
+    upx_uint64_t h[2];
+};
+
+// incremental 128-bit hash for building a DecisionCacheKey
+class DecisionHasher final {
+public:
+    DecisionHasher() noexcept;
+    void add(const void *p, size_t n) noexcept;
+    void add(upx_uint64_t v) noexcept;
+    // compression parameters field by field, so that padding bytes do not matter
+    void add(const lzma_compress_config_t &c) noexcept;
+    void add(const ucl_compress_config_t &c) noexcept;
+    void add(const zlib_compress_config_t &c) noexcept;
+    void add(const zstd_compress_config_t &c) noexcept;
+    void add(const upx_compress_config_t &c) noexcept;
+    DecisionCacheKey get() const noexcept;
+
+private:
+    upx_uint64_t h1, h2, len;
+};
+
+struct CompressionDecision final {
+    int method;
+    int filter;
+    unsigned filter_cto;
+    unsigned overlap_overhead;
+};
+
+// get "$XDG_CACHE_HOME/upx/NAME" (or "~/.cache/upx/NAME"), optionally
+// creating the directory; returns false if there is no cache directory
+bool get_cache_path(char *fn, size_t fn_size, const char *name, bool create_dir) noexcept;
+
+// both functions are thread-safe and silently ignore all I/O errors
+bool decision_cache_lookup(const DecisionCacheKey &key, CompressionDecision *d) noexcept;
+void decision_cache_store(const DecisionCacheKey &key, const CompressionDecision &d) noexcept;
+
+// "--search-shard=I/N" runs append their winners, together with their
+// SearchRank, to the file of "--search-result=FILE"; the shard files then
+// get concatenated, and a "--search-merge=FILE" run looks up the best one
+bool search_result_lookup(const char *fn, const DecisionCacheKey &key,
+                          CompressionDecision *d) noexcept;
+struct SearchRank final {
+    upx_uint64_t cost;         // "--optimize-for=startup", else 0
+    unsigned size;             // compressed data + loader + compressed header
+    unsigned loader_size;      // loader + compressed header
+    unsigned overlap_overhead;
+    unsigned order;            // index of the candidate in the unsharded search
+};
+// The selection rule of Packer::compressWithFilters(), with ties going to
+// the earlier candidate; so the merge picks the winner of an unsharded
+// search, whatever the order of the concatenated shard files.
+bool search_rank_less(const SearchRank &a, const SearchRank &b) noexcept;
+void search_result_store(const char *fn, const DecisionCacheKey &key, const CompressionDecision &d,
+                         const SearchRank &rank) noexcept;
+
+} // namespace upx
+
+/* vim:set ts=4 sw=4 et: */
@@ -28,6 +28,7 @@
 // A MemBuffer allocates memory on the heap, and automatically
 // gets destructed when leaving scope or on exceptions.
 
+#define WANT_WINDOWS_LEAN_H 1 // CreateFileMapping, MapViewOfFile
 #include "../conf.h"
 #include "membuffer.h"
 
@@ -43,6 +44,13 @@ unsigned membuffer_get_size(MemBuffer &mb) noexcept { return mb.getSize(); }
 #define debug_set(var, expr) /*empty*/
 #endif
 
+#if (HAVE_MMAP) && (HAVE_MUNMAP) && (HAVE_SYS_MMAN_H) && defined(MAP_PRIVATE)
+#define USE_MMAP 1
+#elif (ACC_OS_WIN32 || ACC_OS_WIN64) && defined(_WIN32) && !defined(__CYGWIN__)
+#define USE_WIN32_MMAP 1
+#include <io.h> // _get_osfhandle
+#endif
+
 /*************************************************************************
 // bool use_simple_mcheck()
 **************************************************************************/
@@ -69,12 +77,143 @@ static bool use_simple_mcheck() noexcept {
 static forceinline constexpr bool use_simple_mcheck() noexcept { return true; }
 #endif
 
+/*************************************************************************
+// BlockPool - recycle big blocks of MemBuffer::alloc()
+//
+// Packing a file allocates several buffers of 1-3x the file size, and for
+// glibc each of these is a fresh mmap() region that gets page-faulted in
+// again. So the process keeps a few freed blocks for the next compression
+// trial or the next file. There is one locked pool for all threads, so
+// that "--jobs" cannot pin more than MAX_TOTAL_SIZE, and short-lived worker
+// threads still find the blocks of the others. Not used with sanitizers or
+// valgrind, so that these still see every use-after-free.
+**************************************************************************/
+
+namespace {
+
+// set by ~BlockPool(); static MemBuffers may get freed after the pool
+static upx_std_atomic(bool) block_pool_destroyed(false);
+
+struct BlockPool final {
+    static constexpr size_t MIN_BLOCK_SIZE = 256 * 1024;
+    static constexpr size_t MAX_TOTAL_SIZE = 256 * 1024 * 1024; // per process
+    enum { MAX_BLOCKS = 8 };
+    struct Block {
+        void *p;
+        size_t size;
+    };
+    Block blocks[MAX_BLOCKS]; // [0] is the oldest one
+    unsigned num_blocks = 0;
+    size_t total_size = 0;
+#if WITH_THREADS
+    std::mutex lock;
+#endif
+
+    BlockPool() noexcept = default;
+    ~BlockPool() noexcept {
+        block_pool_destroyed = true;
+        while (num_blocks > 0)
+            ::free(blocks[--num_blocks].p);
+    }
+
+    // round up in 4 steps per power of 2, so that similar requests share a
+    // size class while at most 25% get wasted
+    static size_t size_class(size_t n) noexcept {
+        if (n < MIN_BLOCK_SIZE)
+            return n;
+        size_t step = 1;
+        while (step <= n / 8)
+            step <<= 1;
+        return (n + step - 1) & ~(step - 1);
+    }
+    void *take(size_t size) noexcept {
+        if (size < MIN_BLOCK_SIZE || block_pool_destroyed)
+            return nullptr;
+#if WITH_THREADS
+        std::lock_guard<std::mutex> guard(lock);
+#endif
+        for (unsigned i = num_blocks; i-- > 0;) {
+            if (blocks[i].size == size) {
+                void *p = blocks[i].p;
+                total_size -= size;
+                blocks[i] = blocks[--num_blocks];
+                return p;
+            }
+        }
+        return nullptr;
+    }
+    void put(void *p, size_t size) noexcept {
+        // with "--memory-limit" freed memory really goes back to the system
+        if (block_pool_destroyed || size < MIN_BLOCK_SIZE || size > MAX_TOTAL_SIZE ||
+            opt->memory_limit) {
+            ::free(p);
+            return;
+        }
+        // free the evicted blocks after unlocking; munmap() is not cheap
+        void *evicted[MAX_BLOCKS];
+        unsigned num_evicted = 0;
+        {
+#if WITH_THREADS
+            std::lock_guard<std::mutex> guard(lock);
+#endif
+            while (num_blocks == MAX_BLOCKS || total_size + size > MAX_TOTAL_SIZE) {
+                total_size -= blocks[0].size;
+                evicted[num_evicted++] = blocks[0].p;
+                memmove(&blocks[0], &blocks[1], sizeof(blocks[0]) * --num_blocks);
+            }
+            blocks[num_blocks++] = Block{p, size};
+            total_size += size;
+        }
+        while (num_evicted > 0)
+            ::free(evicted[--num_evicted]);
+    }
+
+    UPX_CXX_DISABLE_COPY_MOVE(BlockPool)
+};
+
+BlockPool block_pool;
+
+/*************************************************************************
+// huge blocks - back the buffers of big files with transparent huge pages
+//
+// The compressors walk these buffers in a mostly random order, so with 4 KiB
+// pages a 100 MiB input thrashes the TLB. Aligning big blocks to 2 MiB lets
+// the kernel back them with huge pages; the blocks are still released with
+// free(), and the BlockPool keeps them for the next trial.
+**************************************************************************/
+
+#if defined(__linux__) && (HAVE_SYS_MMAN_H) && !defined(__ANDROID__)
+#include <sys/mman.h>
+#if defined(MADV_HUGEPAGE)
+#define USE_HUGE_BLOCKS 1
+#endif
+#endif
+
+void *malloc_block(size_t size) noexcept {
+#if (USE_HUGE_BLOCKS)
+    constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+    constexpr size_t MIN_HUGE_BLOCK_SIZE = 4 * HUGE_PAGE_SIZE;
+    if (use_simple_mcheck() && size >= MIN_HUGE_BLOCK_SIZE) {
+        void *p = nullptr;
+        if (posix_memalign(&p, HUGE_PAGE_SIZE, size) == 0 && p != nullptr) {
+            // only advise the whole huge pages that lie inside the block
+            (void) madvise(p, size & ~(HUGE_PAGE_SIZE - 1), MADV_HUGEPAGE);
+            return p;
+        }
+    }
+#endif
+    return ::malloc(size);
+}
+
+} // namespace
+
 /*************************************************************************
 //
 **************************************************************************/
 
 MemBuffer::MemBuffer(upx_uint64_t bytes) : MemBufferBase<byte>() {
-    alloc(bytes);
+    alloc(bytes, false);
+    stats_add_site("MemBuffer", upx_return_address());
     debug_set(debug.last_return_address_alloc, upx_return_address());
 }
 
@@ -121,15 +260,29 @@ unsigned MemBuffer::getSizeForDecompression(unsigned uncompressed_size, unsigned
     return ACC_ICONV(unsigned, bytes);
 }
 
+// The worst-case reserve of getSizeForCompression() is rarely written, so big
+// output buffers are fresh anonymous mappings: the kernel only commits the
+// pages which the compressor actually touches, and with MAP_NORESERVE the
+// unused rest does not count against the overcommit limit either.
 void MemBuffer::allocForCompression(unsigned uncompressed_size, unsigned extra) {
     unsigned bytes = getSizeForCompression(uncompressed_size, extra);
-    alloc(bytes);
+    alloc(bytes, bytes >= LAZY_MIN_SIZE);
+    stats_add_site("allocForCompression", upx_return_address());
     debug_set(debug.last_return_address_alloc, upx_return_address());
 }
 
 void MemBuffer::allocForDecompression(unsigned uncompressed_size, unsigned extra) {
     unsigned bytes = getSizeForDecompression(uncompressed_size, extra);
-    alloc(bytes);
+    alloc(bytes, false);
+    stats_add_site("allocForDecompression", upx_return_address());
+    debug_set(debug.last_return_address_alloc, upx_return_address());
+}
+
+void MemBuffer::allocZeroed(upx_uint64_t bytes) {
+    alloc(bytes, bytes >= LAZY_MIN_SIZE);
+    if (!is_lazy)
+        memset(ptr, 0, size_in_bytes);
+    stats_add_site("allocZeroed", upx_return_address());
     debug_set(debug.last_return_address_alloc, upx_return_address());
 }
 
@@ -155,7 +308,7 @@ void MemBuffer::checkState() const {
     if (!ptr)
         throwInternalError("block not allocated");
     assert(size_in_bytes > 0);
-    if (use_simple_mcheck()) {
+    if (use_simple_mcheck() && !is_mapped) {
         const byte *p = (const byte *) ptr;
         if (get_ne32(p - 4) != MAGIC1(p))
             throwInternalError("memory clobbered before allocated block 1");
@@ -166,7 +319,29 @@ void MemBuffer::checkState() const {
     }
 }
 
+#if (USE_MMAP) && defined(MAP_ANONYMOUS)
+static void *mmap_lazy(size_t size) noexcept {
+#if defined(MAP_NORESERVE)
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#else
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#endif
+    void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return p != MAP_FAILED ? p : nullptr;
+}
+#else
+static forceinline void *mmap_lazy(size_t size) noexcept {
+    UNUSED(size);
+    return nullptr;
+}
+#endif
+
 void MemBuffer::alloc(upx_uint64_t bytes) {
+    alloc(bytes, false);
+    stats_add_site("alloc", upx_return_address());
+}
+
+void MemBuffer::alloc(upx_uint64_t bytes, bool lazy) {
     // INFO: we don't automatically free a used buffer
     assert(ptr == nullptr);
     assert(size_in_bytes == 0);
@@ -174,9 +349,18 @@ void MemBuffer::alloc(upx_uint64_t bytes) {
     assert(bytes > 0);
     debug_set(debug.last_return_address_alloc, upx_return_address());
     size_t malloc_bytes = mem_size(1, bytes); // check size
-    if (use_simple_mcheck())
-        malloc_bytes += 32;
-    byte *p = (byte *) ::malloc(malloc_bytes);
+    byte *p = nullptr;
+    if (use_simple_mcheck()) {
+        malloc_bytes = BlockPool::size_class(malloc_bytes + 32);
+        // a recycled block would already have all its pages committed
+        if (lazy)
+            p = (byte *) mmap_lazy(malloc_bytes);
+        is_lazy = (p != nullptr);
+        if (!p)
+            p = (byte *) block_pool.take(malloc_bytes);
+    }
+    if (!p)
+        p = (byte *) malloc_block(malloc_bytes);
     NO_printf("MemBuffer::alloc %llu: %p\n", bytes, p);
     if (!p)
         throwOutOfMemoryException();
@@ -191,19 +375,248 @@ void MemBuffer::alloc(upx_uint64_t bytes) {
     }
     ptr = upx::ptr_static_cast<pointer>(p);
 #if !defined(__SANITIZE_MEMORY__) && DEBUG
-    memset(ptr, 0xfb, size_in_bytes);
+    if (!is_lazy)
+        memset(ptr, 0xfb, size_in_bytes);
     (void) VALGRIND_MAKE_MEM_UNDEFINED(ptr, size_in_bytes);
 #endif
     stats.global_alloc_counter += 1;
     stats.global_total_bytes += size_in_bytes;
-    stats.global_total_active_bytes += size_in_bytes;
+    stats_add_active(size_in_bytes);
 #if DEBUG || 1
     checkState();
 #endif
 }
 
+// Pages which never get written stay shared with the page cache, so this
+// avoids a full copy of big input files. NOTE: like any mmap() of a regular
+// file this assumes that nobody truncates the file while we are using it.
+bool MemBuffer::allocMapped(int fd, upx_off_t offset, upx_uint64_t bytes) {
+    assert(ptr == nullptr);
+    assert(size_in_bytes == 0);
+    assert(bytes > 0);
+    (void) mem_size(1, bytes); // check size
+#if (USE_MMAP)
+    struct stat st;
+    if (fd < 0 || offset < 0 || ::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    if (upx_uint64_t(st.st_size) < upx_uint64_t(offset) + bytes)
+        return false; // never map beyond EOF
+    const long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size <= 0 || (page_size & (page_size - 1)) != 0)
+        return false;
+    const unsigned delta = ACC_ICONV(unsigned, offset & (page_size - 1));
+    const size_t map_bytes = mem_size(1, bytes, delta);
+    void *p = ::mmap(nullptr, map_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset - delta);
+    if (p == MAP_FAILED)
+        return false;
+#elif (USE_WIN32_MMAP)
+    // same as MAP_PRIVATE: a copy-on-write view of the file
+    if (fd < 0 || offset < 0)
+        return false;
+    const HANDLE h = (HANDLE) _get_osfhandle(fd);
+    if (h == INVALID_HANDLE_VALUE || GetFileType(h) != FILE_TYPE_DISK)
+        return false;
+    DWORD size_high = 0;
+    const DWORD size_low = GetFileSize(h, &size_high);
+    if (size_low == INVALID_FILE_SIZE && GetLastError() != NO_ERROR)
+        return false;
+    if (((upx_uint64_t(size_high) << 32) | size_low) < upx_uint64_t(offset) + bytes)
+        return false; // never map beyond EOF
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    const upx_uint64_t granularity = si.dwAllocationGranularity; // not the page size
+    if (granularity == 0 || (granularity & (granularity - 1)) != 0)
+        return false;
+    const unsigned delta = ACC_ICONV(unsigned, offset & (granularity - 1));
+    const size_t map_bytes = mem_size(1, bytes, delta);
+    const upx_uint64_t map_offset = upx_uint64_t(offset) - delta;
+    const HANDLE m = CreateFileMappingW(h, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (m == nullptr)
+        return false;
+    void *p = MapViewOfFile(m, FILE_MAP_COPY, DWORD(map_offset >> 32), DWORD(map_offset),
+                            map_bytes);
+    (void) CloseHandle(m); // the view keeps the mapping alive
+    if (p == nullptr)
+        return false;
+#endif
+#if (USE_MMAP) || (USE_WIN32_MMAP)
+    NO_printf("MemBuffer::allocMapped %llu: %p\n", bytes, p);
+    is_mapped = true;
+    map_delta = delta;
+    size_in_bytes = ACC_ICONV(unsigned, bytes);
+    ptr = (byte *) p + delta;
+    stats.global_alloc_counter += 1;
+    stats.global_total_bytes += size_in_bytes;
+    stats_add_active(size_in_bytes);
+    stats_add_site("allocMapped", upx_return_address());
+    return true;
+#else
+    UNUSED(fd);
+    UNUSED(offset);
+    return false;
+#endif
+}
+
+/*static*/ void MemBuffer::stats_add_active(size_t bytes) noexcept {
+    const upx_uint64_t active = (stats.global_total_active_bytes += bytes);
+#if (WITH_THREADS)
+    size_t peak = stats.global_peak_active_bytes.load();
+    while (active > peak && !stats.global_peak_active_bytes.compare_exchange_weak(peak, active)) {
+    }
+#else
+    if (active > stats.global_peak_active_bytes)
+        stats.global_peak_active_bytes = active;
+#endif
+}
+
+/*static*/ upx_uint64_t MemBuffer::getActiveBytes() noexcept {
+    return stats.global_total_active_bytes;
+}
+/*static*/ upx_uint64_t MemBuffer::getPeakActiveBytes() noexcept {
+    return stats.global_peak_active_bytes;
+}
+/*static*/ upx_uint64_t MemBuffer::getAvailableBytes() noexcept {
+    const upx_uint64_t limit = opt->memory_limit;
+    if (limit == 0)
+        return ~(upx_uint64_t) 0;
+    const upx_uint64_t active = stats.global_total_active_bytes;
+    return active < limit ? limit - active : 0;
+}
+/*static*/ void MemBuffer::addWorkMemory(size_t bytes) noexcept { stats_add_active(bytes); }
+/*static*/ void MemBuffer::subWorkMemory(size_t bytes) noexcept {
+    stats.global_total_active_bytes -= bytes;
+}
+
+/*************************************************************************
+// "--stats=alloc"
+**************************************************************************/
+
+// A site is the kind of allocation and the return address into its caller,
+// so the inlined helpers of one packer method count as that method. Only
+// used for diagnostics, so a plain mutex is good enough.
+namespace {
+struct AllocSite final {
+    const char *kind;
+    const void *caller;
+    upx_uint64_t count;
+    upx_uint64_t total_bytes;
+    upx_uint64_t live_bytes;
+    upx_uint64_t peak_live_bytes;
+    upx_uint64_t largest;
+};
+constexpr unsigned MAX_ALLOC_SITES = 512; // the last one collects the rest
+AllocSite alloc_sites[MAX_ALLOC_SITES];
+unsigned num_alloc_sites = 1; // alloc_sites[0] is unused, see MemBuffer::stats_site
+upx_std_atomic(bool) alloc_sites_enabled{false};
+#if WITH_THREADS
+std::mutex alloc_sites_mutex;
+#endif
+} // namespace
+
+// offset of an address in the executable, for "addr2line -e upx"
+static upx_uint64_t image_offset(const void *p) noexcept {
+#if defined(__ELF__) && (ACC_CC_CLANG || ACC_CC_GNUC)
+    extern const char __executable_start[] __attribute__((__weak__));
+    if (__executable_start != nullptr && p != nullptr)
+        return upx_uint64_t((const char *) p - __executable_start);
+#endif
+    return (upx_uintptr_t) p;
+}
+
+/*static*/ void MemBuffer::enableSiteStats() noexcept { alloc_sites_enabled = true; }
+
+void MemBuffer::stats_add_site(const char *kind, const void *caller) noexcept {
+    if (!alloc_sites_enabled)
+        return;
+#if WITH_THREADS
+    std::lock_guard<std::mutex> lock(alloc_sites_mutex);
+#endif
+    unsigned i = 1;
+    while (i < num_alloc_sites && (alloc_sites[i].caller != caller || alloc_sites[i].kind != kind))
+        i++;
+    if (i == num_alloc_sites) {
+        if (i == MAX_ALLOC_SITES - 1) {
+            kind = "(other sites)";
+            caller = nullptr;
+        }
+        if (i < MAX_ALLOC_SITES) {
+            alloc_sites[i].kind = kind;
+            alloc_sites[i].caller = caller;
+            num_alloc_sites++;
+        } else
+            i = MAX_ALLOC_SITES - 1;
+    }
+    AllocSite &s = alloc_sites[i];
+    s.count += 1;
+    s.total_bytes += size_in_bytes;
+    s.live_bytes += size_in_bytes;
+    if (s.live_bytes > s.peak_live_bytes)
+        s.peak_live_bytes = s.live_bytes;
+    if (size_in_bytes > s.largest)
+        s.largest = size_in_bytes;
+    stats_site = i;
+}
+
+/*static*/ void MemBuffer::stats_sub_site(unsigned site, size_t bytes) noexcept {
+#if WITH_THREADS
+    std::lock_guard<std::mutex> lock(alloc_sites_mutex);
+#endif
+    alloc_sites[site].live_bytes -= bytes;
+}
+
+// the sites with the biggest peak of live bytes first
+/*static*/ void MemBuffer::printSiteStats(FILE *f) noexcept {
+    if (!alloc_sites_enabled)
+        return;
+    AllocSite sites[MAX_ALLOC_SITES];
+    unsigned n = 0;
+    {
+#if WITH_THREADS
+        std::lock_guard<std::mutex> lock(alloc_sites_mutex);
+#endif
+        for (unsigned i = 1; i < num_alloc_sites; i++)
+            sites[n++] = alloc_sites[i];
+    }
+    upx_sort(sites, n, [](const AllocSite &a, const AllocSite &b) {
+        if (a.peak_live_bytes != b.peak_live_bytes)
+            return a.peak_live_bytes > b.peak_live_bytes;
+        if (a.total_bytes != b.total_bytes)
+            return a.total_bytes > b.total_bytes;
+        if (a.caller != b.caller)
+            return (upx_uintptr_t) a.caller < (upx_uintptr_t) b.caller;
+        return strcmp(a.kind, b.kind) < 0;
+    });
+    fprintf(f, "upx: MemBuffer allocations: %u site%s, peak %llu bytes in total\n", n,
+            n == 1 ? "" : "s", (unsigned long long) stats.global_peak_active_bytes);
+    fprintf(f, "  %-22s %-12s %8s %14s %14s %12s\n", "kind", "caller", "count", "total",
+            "peak live", "largest");
+    for (unsigned i = 0; i < n; i++) {
+        const AllocSite &s = sites[i];
+        fprintf(f, "  %-22s %#-12llx %8llu %14llu %14llu %12llu\n", s.kind,
+                (unsigned long long) image_offset(s.caller), (unsigned long long) s.count,
+                (unsigned long long) s.total_bytes, (unsigned long long) s.peak_live_bytes,
+                (unsigned long long) s.largest);
+    }
+}
+
 void MemBuffer::dealloc() noexcept {
-    if (ptr != nullptr) {
+    if (stats_site != 0)
+        stats_sub_site(stats_site, size_in_bytes);
+    stats_site = 0;
+    if (ptr != nullptr && is_mapped) {
+        debug_set(debug.last_return_address_dealloc, upx_return_address());
+        stats.global_dealloc_counter += 1;
+        stats.global_total_active_bytes -= size_in_bytes;
+#if (USE_MMAP)
+        (void) ::munmap(ptr - map_delta, size_t(size_in_bytes) + map_delta);
+#elif (USE_WIN32_MMAP)
+        (void) UnmapViewOfFile(ptr - map_delta);
+#endif
+        is_mapped = false;
+        map_delta = 0;
+        ptr = nullptr;
+        size_in_bytes = 0;
+    } else if (ptr != nullptr) {
         debug_set(debug.last_return_address_dealloc, upx_return_address());
 #if DEBUG || 1
         // info: calling checkState() here violates "noexcept", so we need a try block
@@ -231,7 +644,14 @@ void MemBuffer::dealloc() noexcept {
             set_ne32(p + size_in_bytes, 0);
             set_ne32(p + size_in_bytes + 4, 0);
             //
-            ::free(p - 16); // NOLINT(clang-analyzer-unix.Malloc) // see NOTE above
+            const size_t malloc_bytes = BlockPool::size_class(size_t(size_in_bytes) + 32);
+            if (is_lazy) {
+#if (USE_MMAP)
+                (void) ::munmap(p - 16, malloc_bytes);
+#endif
+                is_lazy = false;
+            } else
+                block_pool.put(p - 16, malloc_bytes);
         } else {
             ::free(ptr); // NOLINT(clang-analyzer-unix.Malloc) // see NOTE above
         }
@@ -361,4 +781,29 @@ TEST_CASE("MemBuffer::getSizeForCompression") {
     CHECK_THROWS(MemBuffer::getSizeForCompression(715827428 + 1));           // 0x2aaaa8e4 + 1
 }
 
+TEST_CASE("MemBuffer::allocZeroed") {
+    for (unsigned size : {100u, 2u * 1024 * 1024}) {
+        MemBuffer mb;
+        mb.allocZeroed(size);
+        CHECK(mb.getSize() == size);
+        CHECK(mb[0] == 0);
+        CHECK(mb[size / 2] == 0);
+        CHECK(mb[size - 1] == 0);
+        mb.checkState();
+    }
+}
+
+TEST_CASE("MemBuffer::allocForCompression") {
+    // big buffers are mapped lazily; they must behave like any other buffer
+    for (int i = 0; i < 2; i++) {
+        MemBuffer mb;
+        mb.allocForCompression(2 * 1024 * 1024);
+        CHECK(mb.getSize() == MemBuffer::getSizeForCompression(2 * 1024 * 1024));
+        mb[0] = 1;
+        mb[mb.getSize() - 1] = 2;
+        mb.checkState();
+        CHECK((mb[0] + mb[mb.getSize() - 1]) == 3);
+    }
+}
+
 /* vim:set ts=4 sw=4 et: */
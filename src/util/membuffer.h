@@ -197,10 +197,29 @@ public:
     void alloc(upx_uint64_t bytes) may_throw;
     void allocForCompression(unsigned uncompressed_size, unsigned extra = 0) may_throw;
     void allocForDecompression(unsigned uncompressed_size, unsigned extra = 0) may_throw;
+    // like alloc() followed by clear(), but big buffers are fresh anonymous
+    // mappings which the kernel zero-fills page by page on first use
+    void allocZeroed(upx_uint64_t bytes) may_throw;
+    // map [offset, +bytes) of an open file copy-on-write instead of allocating;
+    // returns false if mmap() is not available or fails; see InputFile::mapx()
+    bool allocMapped(int fd, upx_off_t offset, upx_uint64_t bytes) may_throw;
 
     void dealloc() noexcept;
     void checkState() const may_throw;
 
+    // global accounting of all MemBuffers and of the working memory of the
+    // compressors, for "--memory-limit" and the "-v" summary
+    static upx_uint64_t getActiveBytes() noexcept;
+    static upx_uint64_t getPeakActiveBytes() noexcept;
+    // bytes that are still free below opt->memory_limit; ~0 if there is no limit
+    static upx_uint64_t getAvailableBytes() noexcept;
+    static void addWorkMemory(size_t bytes) noexcept;
+    static void subWorkMemory(size_t bytes) noexcept;
+    // "--stats=alloc": count the allocations per call site of alloc(),
+    // allocForCompression(), ... and print the biggest sites at exit
+    static void enableSiteStats() noexcept;
+    static void printSiteStats(FILE *f) noexcept;
+
     // explicit conversion
     void *getVoidPtr() noexcept { return (void *) ptr; }
     const void *getVoidPtr() const noexcept { return (const void *) ptr; }
@@ -222,6 +241,21 @@ public:
 private:
     void *subref_impl(const char *errfmt, size_t skip, size_t take) may_throw;
 
+    // allocMapped() state
+    bool is_mapped = false;
+    unsigned map_delta = 0; // offset of ptr into the page-aligned mapping
+    // allocForCompression() or allocZeroed() of a big buffer: pages get
+    // committed on first use
+    bool is_lazy = false;
+    static constexpr unsigned LAZY_MIN_SIZE = 1024 * 1024;
+    void alloc(upx_uint64_t bytes, bool lazy) may_throw;
+
+    static void stats_add_active(size_t bytes) noexcept;
+    // "--stats=alloc": index into the table of sites; 0 if not counted
+    unsigned stats_site = 0;
+    void stats_add_site(const char *kind, const void *caller) noexcept;
+    static void stats_sub_site(unsigned site, size_t bytes) noexcept;
+
     // static debug stats
     struct Stats {
         upx_std_atomic(upx_uint32_t) global_alloc_counter;
@@ -230,9 +264,11 @@ private:
         // avoid link errors on some 32-bit platforms: undefined reference to __atomic_fetch_add_8
         upx_std_atomic(size_t) global_total_bytes; // stats may overflow on 32-bit systems
         upx_std_atomic(size_t) global_total_active_bytes;
+        upx_std_atomic(size_t) global_peak_active_bytes;
 #else
         upx_std_atomic(upx_uint64_t) global_total_bytes;
         upx_std_atomic(upx_uint64_t) global_total_active_bytes;
+        upx_std_atomic(upx_uint64_t) global_peak_active_bytes;
 #endif
     };
     static Stats stats;
@@ -0,0 +1,233 @@
+/* pack_cache.cpp -- "--pack-cache": reuse the packed output of identical input
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+#include "../conf.h"
+#include "../file.h"
+#include "membuffer.h"
+#include "threads.h"
+#include "pack_cache.h"
+
+namespace upx {
+
+namespace {
+
+#if WITH_THREADS
+std::mutex pack_cache_mutex; // serialize stores from "--jobs" workers
+#endif
+
+// get "<cache>/packed-v1/<key>"
+bool get_packed_path(char *fn, size_t fn_size, const DecisionCacheKey &key,
+                     bool create_dir) noexcept {
+    char name[64];
+    snprintf(name, sizeof(name), "packed-v1/%016llx%016llx", (unsigned long long) key.h[0],
+             (unsigned long long) key.h[1]);
+    if (create_dir) {
+        if (!get_cache_path(fn, fn_size, "packed-v1", true))
+            return false;
+        (void) acc_mkdir(fn, 0700);
+    }
+    return get_cache_path(fn, fn_size, name, false);
+}
+
+} // namespace
+
+DecisionCacheKey pack_cache_key(InputFile *fi, const Options *o) {
+    // only hash the options that can change the packed file; the hash of a
+    // string option is the hash of its contents. Not hashed: the options for
+    // the UI and for the output file, the caches, "--benchmark", "--upgrade"
+    // (the upgraded file is the result of the options without it), and the
+    // names of the trace, metrics, search result and manifest files.
+    DecisionHasher hasher;
+    hasher.add(UPX_VERSION_STRING, sizeof(UPX_VERSION_STRING));
+    const int ints[] = {
+        o->cmd,
+        o->method,
+        o->method_lzma_seen,
+        o->method_nrv2b_seen,
+        o->method_nrv2d_seen,
+        o->method_nrv2e_seen,
+        o->level,
+        o->filter,
+        o->ultra_brute,
+        o->fast,
+        o->all_methods,
+        o->all_methods_use_lzma,
+        o->all_filters,
+        o->no_filter,
+        o->prefer_ucl,
+        o->exact,
+        int(o->prune_trials),
+        int(o->time_budget),
+        o->nrv_parallel,
+        o->optimize_startup,
+        o->lzma_tune,
+        int(o->search_shard),
+        int(o->search_shards),
+        o->small,
+        o->overlay,
+        o->cpu_x86,
+        o->debug.disable_random_id,
+        o->debug.use_random_method,
+        o->debug.use_random_filter,
+        o->atari_tos.split_segments,
+        o->darwin_macho.force_macos,
+        o->djgpp2_coff.coff,
+        o->dos_exe.force_stub,
+        o->dos_exe.no_reloc,
+        int(o->o_unix.blocksize),
+        o->o_unix.auto_blocksize,
+        // the automatic block size depends on the number of threads
+        o->o_unix.auto_blocksize ? int(upx::get_num_threads(256)) : 0,
+        o->o_unix.force_execve,
+        o->o_unix.is_ptinterp,
+        o->o_unix.use_ptinterp,
+        o->o_unix.make_ptinterp,
+        o->o_unix.unmap_all_pages,
+        o->o_unix.osabi0,
+        o->o_unix.preserve_build_id,
+        o->o_unix.android_shlib,
+        o->o_unix.force_pie,
+        o->o_unix.split_blocks,
+        o->ps1_exe.boot_only,
+        o->ps1_exe.no_align,
+        o->ps1_exe.do_8bit,
+        o->ps1_exe.do_8mib,
+        o->watcom_le.le,
+        o->win32_pe.compress_exports,
+        o->win32_pe.compress_icons,
+        o->win32_pe.compress_resources.getValue(),
+        o->win32_pe.strip_relocs,
+        o->win32_pe.keep_incompressible,
+        int(o->win32_pe.keep_large_resources),
+        o->win32_pe.fast_imports,
+    };
+    for (int v : ints)
+        hasher.add(upx_uint64_t(unsigned(v)));
+    for (const auto &rt : o->win32_pe.compress_rt)
+        hasher.add(upx_uint64_t(rt.getValue()));
+    hasher.add(o->memory_limit);
+    hasher.add(o->run_memory);
+    const char *const strings[] = {
+        o->reuse_from,
+        o->search_merge,
+        o->win32_pe.keep_resource,
+        o->debug.fake_stub_version,
+        o->debug.fake_stub_year,
+    };
+    for (const char *str : strings) {
+        const size_t len = (str != nullptr) ? strlen(str) + 1 : 0; // 0 means not set
+        hasher.add(upx_uint64_t(len));
+        if (len)
+            hasher.add(str, len);
+    }
+    hasher.add(upx_uint64_t(o->crp.crp_bzip2.dummy));
+    hasher.add(o->crp.crp_lzma);
+    hasher.add(o->crp.crp_ucl);
+    hasher.add(o->crp.crp_zlib);
+    hasher.add(o->crp.crp_zstd);
+
+    const upx_off_t size = fi->st_size();
+    hasher.add((upx_uint64_t) size);
+    if (size > 0) {
+        MemBuffer mb;
+        fi->mapx(mb, 0, size);
+        hasher.add(raw_bytes(mb, size), size);
+    }
+    fi->seek(0, SEEK_SET);
+    return hasher.get();
+}
+
+bool pack_cache_fetch(const DecisionCacheKey &key, OutputFile *fo) {
+    char fn[1024];
+    if (!get_packed_path(fn, sizeof(fn), key, false))
+        return false;
+    FILE *f = fopen(fn, "rb");
+    if (f == nullptr)
+        return false;
+    MemBuffer buf(64 * 1024);
+    upx_off_t total = 0;
+    try {
+        for (;;) {
+            size_t l = fread(raw_bytes(buf, buf.getSize()), 1, buf.getSize(), f);
+            if (l == 0)
+                break;
+            fo->write(buf, l);
+            total += l;
+        }
+    } catch (...) {
+        fclose(f);
+        throw;
+    }
+    bool ok = !ferror(f) && total > 0;
+    fclose(f);
+    if (!ok && total > 0)
+        throwIOException("pack cache: read error", 0);
+    return ok;
+}
+
+void pack_cache_store(const DecisionCacheKey &key, const char *packed_name) noexcept {
+    try {
+#if WITH_THREADS
+        std::lock_guard<std::mutex> lock(pack_cache_mutex);
+#endif
+        char fn[1024];
+        if (!get_packed_path(fn, sizeof(fn), key, true))
+            return;
+        // write a temporary file first, so that a concurrent
+        // pack_cache_fetch() never sees a partial entry
+        char tmp_fn[1024 + 32];
+        unsigned pid = 0;
+#if HAVE_GETPID
+        pid = (unsigned) getpid();
+#endif
+        snprintf(tmp_fn, sizeof(tmp_fn), "%s.%u.tmp", fn, pid);
+        FILE *fi = fopen(packed_name, "rb");
+        if (fi == nullptr)
+            return;
+        FILE *f = fopen(tmp_fn, "wb");
+        if (f == nullptr) {
+            fclose(fi);
+            return;
+        }
+        bool ok = true;
+        char buf[16 * 1024];
+        size_t l;
+        while (ok && (l = fread(buf, 1, sizeof(buf), fi)) > 0)
+            ok = fwrite(buf, 1, l, f) == l;
+        ok = ok && !ferror(fi);
+        fclose(fi);
+        ok = (fclose(f) == 0) && ok;
+        if (!ok || ::rename(tmp_fn, fn) != 0)
+            (void) ::unlink(tmp_fn);
+    } catch (...) {
+        // ignore
+    }
+}
+
+} // namespace upx
+
+/* vim:set ts=4 sw=4 et: */
@@ -0,0 +1,55 @@
+/* pack_cache.h -- "--pack-cache": reuse the packed output of identical input
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+#pragma once
+
+#include "decision_cache.h" // DecisionCacheKey
+
+namespace upx {
+
+/*************************************************************************
+// "--pack-cache": store the packed file keyed by a hash of the input
+// bytes, of all options that can change the output, and of the UPX
+// version; packing identical input again just copies the stored result.
+//
+// The files live in $XDG_CACHE_HOME/upx/packed-v1 (or ~/.cache/upx) and
+// may be deleted at any time. "--pack-cache" implies "--disable-random-id",
+// so that a cached result is byte-identical to a fresh one.
+**************************************************************************/
+
+// hashes the whole file; the file position is reset to 0
+DecisionCacheKey pack_cache_key(InputFile *fi, const Options *o) may_throw;
+
+// copy a cached result to fo; returns false if there is none
+bool pack_cache_fetch(const DecisionCacheKey &key, OutputFile *fo) may_throw;
+
+// remember the packed file; silently ignores all I/O errors
+void pack_cache_store(const DecisionCacheKey &key, const char *packed_name) noexcept;
+
+} // namespace upx
+
+/* vim:set ts=4 sw=4 et: */
@@ -0,0 +1,435 @@
+/* threads.cpp -- simple worker pool
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+#include "../conf.h"
+#include "threads.h"
+#include "membuffer.h"
+#if WITH_THREADS
+#include <condition_variable>
+#include <exception>
+#include <system_error>
+#include <thread>
+#include <vector>
+#endif
+#if WITH_THREADS && defined(__linux__) && defined(CPU_SETSIZE)
+#define USE_NUMA_AFFINITY 1
+#endif
+
+namespace upx {
+
+unsigned get_hardware_concurrency() noexcept {
+#if WITH_THREADS
+    unsigned n = std::thread::hardware_concurrency();
+    return n >= 1 ? n : 1;
+#else
+    return 1;
+#endif
+}
+
+unsigned get_num_workers(unsigned requested, size_t num_jobs) noexcept {
+    unsigned n = requested ? requested : get_hardware_concurrency();
+#if !(WITH_THREADS)
+    n = 1;
+#endif
+    if (n > 256) // sanity limit
+        n = 256;
+    if (n > num_jobs)
+        n = (unsigned) num_jobs;
+    return n >= 1 ? n : 1;
+}
+
+unsigned get_num_threads(size_t num_jobs) noexcept {
+    unsigned requested = opt->threads;
+    if (requested == 0 && opt->jobs != 1)
+        requested = 1; // do not oversubscribe the CPUs
+    return get_num_workers(requested, num_jobs);
+}
+
+unsigned limit_threads_by_memory(unsigned num_threads, upx_uint64_t bytes_per_thread) noexcept {
+    if (num_threads <= 1 || opt->memory_limit == 0 || bytes_per_thread == 0)
+        return num_threads >= 1 ? num_threads : 1;
+    const upx_uint64_t n = MemBuffer::getAvailableBytes() / bytes_per_thread;
+    return n >= num_threads ? num_threads : (n >= 1 ? unsigned(n) : 1);
+}
+
+/*************************************************************************
+// NUMA nodes
+**************************************************************************/
+
+#if USE_NUMA_AFFINITY
+
+namespace {
+// parse a Linux "cpulist" like "0-3,8-11"; returns the number of CPUs
+unsigned parse_cpulist(const char *s, cpu_set_t *set) noexcept {
+    CPU_ZERO(set);
+    unsigned count = 0;
+    while (*s >= '0' && *s <= '9') {
+        char *end = nullptr;
+        unsigned long lo = strtoul(s, &end, 10);
+        unsigned long hi = lo;
+        if (*end == '-')
+            hi = strtoul(end + 1, &end, 10);
+        for (unsigned long cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++, count++)
+            CPU_SET(cpu, set);
+        s = end;
+        if (*s != ',')
+            break;
+        s++;
+    }
+    return count;
+}
+
+struct NumaNodes final {
+    enum { MAX_NODES = 64 };
+    unsigned n = 0;
+    cpu_set_t cpus[MAX_NODES];
+
+    NumaNodes() noexcept {
+        for (unsigned node = 0; node < 1024 && n < MAX_NODES; node++) {
+            char fn[64];
+            snprintf(fn, sizeof(fn), "/sys/devices/system/node/node%u/cpulist", node);
+            FILE *f = fopen(fn, "rb");
+            if (f == nullptr)
+                continue; // node numbers may have holes
+            char buf[1024];
+            size_t l = fread(buf, 1, sizeof(buf) - 1, f);
+            fclose(f);
+            buf[l] = 0;
+            if (parse_cpulist(buf, &cpus[n]) > 0) // skip memory-only nodes
+                n++;
+        }
+    }
+    static const NumaNodes &get() noexcept {
+        static const NumaNodes nodes; // thread-safe initialization
+        return nodes;
+    }
+};
+
+// pin the calling thread to a node; errors are ignored, as this only affects speed
+void numa_bind_current_thread(unsigned worker) noexcept {
+    const NumaNodes &nodes = NumaNodes::get();
+    if (nodes.n >= 2)
+        (void) sched_setaffinity(0, sizeof(cpu_set_t), &nodes.cpus[worker % nodes.n]);
+}
+} // namespace
+
+#endif // USE_NUMA_AFFINITY
+
+unsigned get_numa_nodes() noexcept {
+#if USE_NUMA_AFFINITY
+    const unsigned n = NumaNodes::get().n;
+    return n >= 1 ? n : 1;
+#else
+    return 1;
+#endif
+}
+
+/*************************************************************************
+// parallel_for
+**************************************************************************/
+
+#if WITH_THREADS
+
+namespace {
+struct ParallelFor final {
+    parallel_func_t func;
+    void *user;
+    size_t n;
+    Options *caller_opt;
+    std::atomic<size_t> next{0};
+    std::atomic<bool> stop{false};
+    std::mutex mutex; // protects eptr and eindex
+    std::exception_ptr eptr;
+    size_t eindex = ~(size_t) 0;
+
+    void run() noexcept {
+        opt = caller_opt; // "opt" is thread-local
+        while (!stop) {
+            const size_t i = next.fetch_add(1);
+            if (i >= n)
+                break;
+            try {
+                func(i, user);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (i < eindex) {
+                    eindex = i;
+                    eptr = std::current_exception();
+                }
+                stop = true;
+            }
+        }
+    }
+};
+} // namespace
+
+#endif // WITH_THREADS
+
+void parallel_for(size_t n, unsigned num_threads, parallel_func_t func, void *user) may_throw {
+    if (n == 0)
+        return;
+#if WITH_THREADS
+    if (num_threads > n)
+        num_threads = (unsigned) n;
+    if (num_threads >= 2) {
+        ParallelFor pf;
+        pf.func = func;
+        pf.user = user;
+        pf.n = n;
+        pf.caller_opt = opt;
+        std::vector<std::thread> workers;
+        workers.reserve(num_threads - 1);
+        // "--numa": the calling thread keeps its affinity and counts as worker 0
+        const bool numa = opt->numa && get_numa_nodes() >= 2;
+        for (unsigned t = 1; t < num_threads; t++) {
+            try {
+                workers.emplace_back([&pf, numa, t]() noexcept {
+#if USE_NUMA_AFFINITY
+                    if (numa)
+                        numa_bind_current_thread(t);
+#else
+                    UNUSED(numa);
+                    UNUSED(t);
+#endif
+                    pf.run();
+                });
+            } catch (const std::system_error &) {
+                break; // cannot create more threads - just continue with what we have
+            }
+        }
+        pf.run(); // the calling thread is a worker as well
+        for (auto &w : workers)
+            w.join();
+        if (pf.eptr)
+            std::rethrow_exception(pf.eptr);
+        return;
+    }
+#endif
+    UNUSED(num_threads);
+    for (size_t i = 0; i < n; i++)
+        func(i, user);
+}
+
+/*************************************************************************
+// BackgroundTask
+**************************************************************************/
+
+// One long-lived thread per BackgroundTask: start() hands it the next
+// function, so a pipeline of many blocks does not create a thread per block.
+struct BackgroundTask::Impl final {
+#if WITH_THREADS
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable cond;
+    task_func_t func = nullptr; // the pending or running task
+    void *user = nullptr;
+    Options *caller_opt = nullptr;
+    bool busy = false; // protected by lock, as are the fields above
+    bool quit = false;
+
+    void run(BackgroundTask *task) noexcept {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            cond.wait(guard, [this]() { return busy || quit; });
+            if (!busy)
+                break; // quit
+            guard.unlock();
+            opt = caller_opt; // "opt" is thread-local
+            try {
+                func(user);
+            } catch (...) {
+                task->eptr = std::current_exception();
+            }
+            guard.lock();
+            busy = false;
+            cond.notify_all();
+        }
+    }
+#endif
+};
+
+BackgroundTask::BackgroundTask(bool use_thread_) noexcept : use_thread(use_thread_) {}
+
+BackgroundTask::~BackgroundTask() noexcept {
+    try {
+        wait();
+    } catch (...) {
+        // ignore
+    }
+#if WITH_THREADS
+    if (impl != nullptr && impl->thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(impl->lock);
+            impl->quit = true;
+        }
+        impl->cond.notify_all();
+        impl->thread.join();
+    }
+#endif
+    delete impl;
+}
+
+void BackgroundTask::start(task_func_t func, void *user) {
+    wait();
+#if WITH_THREADS
+    if (use_thread) {
+        if (impl == nullptr)
+            impl = new Impl;
+        if (!impl->thread.joinable()) {
+            try {
+                impl->thread = std::thread([this]() noexcept { impl->run(this); });
+            } catch (const std::system_error &) {
+                use_thread = false; // cannot create a thread - run everything right now
+            }
+        }
+        if (use_thread) {
+            {
+                std::lock_guard<std::mutex> guard(impl->lock);
+                impl->func = func;
+                impl->user = user;
+                impl->caller_opt = opt;
+                impl->busy = true;
+            }
+            impl->cond.notify_all();
+            return;
+        }
+    }
+#endif
+    try {
+        func(user);
+    } catch (...) {
+        eptr = std::current_exception();
+    }
+}
+
+void BackgroundTask::wait() {
+#if WITH_THREADS
+    if (impl != nullptr) {
+        std::unique_lock<std::mutex> guard(impl->lock);
+        impl->cond.wait(guard, [this]() { return !impl->busy; });
+    }
+#endif
+    if (eptr) {
+        std::exception_ptr e = eptr;
+        eptr = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+} // namespace upx
+
+/*************************************************************************
+// doctest checks
+**************************************************************************/
+
+TEST_CASE("upx::get_num_workers") {
+    CHECK(upx::get_hardware_concurrency() >= 1);
+    CHECK(upx::get_num_workers(0, 0) == 1);
+    CHECK(upx::get_num_workers(4, 1) == 1);
+    CHECK(upx::get_num_workers(0, 1000) <= 256);
+#if WITH_THREADS
+    CHECK(upx::get_num_workers(4, 1000) == 4);
+#else
+    CHECK(upx::get_num_workers(4, 1000) == 1);
+#endif
+    CHECK(upx::get_num_threads(0) == 1);
+    CHECK(upx::get_num_threads(1) == 1);
+}
+
+#if USE_NUMA_AFFINITY
+TEST_CASE("upx::parse_cpulist") {
+    cpu_set_t set;
+    CHECK(upx::parse_cpulist("0-3,8-11\n", &set) == 8);
+    CHECK(CPU_ISSET(3, &set));
+    CHECK(!CPU_ISSET(4, &set));
+    CHECK(CPU_ISSET(11, &set));
+    CHECK(upx::parse_cpulist("5", &set) == 1);
+    CHECK(upx::parse_cpulist("\n", &set) == 0);
+    CHECK(upx::get_numa_nodes() >= 1);
+}
+#endif
+
+TEST_CASE("upx::parallel_for") {
+    constexpr size_t N = 1000;
+    upx_std_atomic(unsigned) counts[N];
+    for (size_t i = 0; i < N; i++)
+        counts[i] = 0;
+    upx::parallel_for(N, 4, [&counts](size_t i) { counts[i] += 1; });
+    bool ok = true;
+    for (size_t i = 0; i < N; i++)
+        if (counts[i] != 1)
+            ok = false;
+    CHECK(ok);
+    // the global options are inherited by all workers
+    const Options *const caller_opt = opt;
+    upx_std_atomic(unsigned) wrong_opt(0);
+    upx::parallel_for(64, 4, [&](size_t) {
+        if (opt != caller_opt)
+            wrong_opt += 1;
+    });
+    CHECK(wrong_opt == 0);
+    // the exception of the lowest failed index gets re-thrown
+    try {
+        upx::parallel_for(N, 1, [](size_t i) {
+            if (i == 7 || i == 500)
+                throw int(i);
+        });
+        CHECK(false);
+    } catch (int e) {
+        CHECK(e == 7);
+    }
+    CHECK_THROWS(upx::parallel_for(N, 4, [](size_t i) {
+        if (i == 500)
+            throw int(i);
+    }));
+}
+
+TEST_CASE("upx::BackgroundTask") {
+    for (int use_thread = 0; use_thread <= 1; use_thread++) {
+        upx::BackgroundTask task(use_thread != 0);
+        unsigned value = 0;
+        auto inc = [&value]() { value += 1; };
+        task.start(inc);
+        task.wait();
+        CHECK(value == 1);
+        task.start(inc);
+        task.start(inc); // implies wait()
+        task.wait();
+        CHECK(value == 3);
+        for (int i = 0; i < 1000; i++) // the same thread runs all of them
+            task.start(inc);
+        task.wait();
+        CHECK(value == 1003);
+        auto fail = []() { throw int(42); };
+        task.start(fail);
+        CHECK_THROWS(task.wait());
+        task.wait(); // the exception is only re-thrown once
+        task.start(fail);
+    }
+}
+
+/* vim:set ts=4 sw=4 et: */
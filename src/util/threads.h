@@ -0,0 +1,114 @@
+/* threads.h -- simple worker pool
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+#pragma once
+
+namespace upx {
+
+/*************************************************************************
+// worker pool
+//
+// Without WITH_THREADS everything silently runs serially on the calling
+// thread, so callers never need their own #if WITH_THREADS fallback.
+**************************************************************************/
+
+// number of hardware threads; always >= 1
+unsigned get_hardware_concurrency() noexcept;
+
+// clamp a requested number of worker threads to [1, num_jobs];
+// a request of 0 means "use all hardware threads"
+unsigned get_num_workers(unsigned requested, size_t num_jobs) noexcept;
+
+// number of worker threads for splitting up the work on a single file,
+// as requested by "--threads"; "--threads=0" (the default) means "auto",
+// which is 1 when "--jobs" already processes several files in parallel
+unsigned get_num_threads(size_t num_jobs) noexcept;
+
+// reduce num_threads so that threads which need bytes_per_thread each stay
+// below "--memory-limit"; always >= 1
+unsigned limit_threads_by_memory(unsigned num_threads, upx_uint64_t bytes_per_thread) noexcept;
+
+// number of NUMA nodes with CPUs; always >= 1, and 1 if not Linux
+unsigned get_numa_nodes() noexcept;
+
+typedef void (*parallel_func_t)(size_t index, void *user);
+
+// Call func(i, user) for all i in [0, n) using up to num_threads threads;
+// the calling thread also does work. The global "opt" of the calling thread
+// is inherited by all workers.
+// If a call throws then no further indices get started, and after all workers
+// have finished the exception of the lowest failed index is re-thrown.
+// With "--numa" the worker threads get pinned to the NUMA nodes round-robin,
+// so that the buffers which a call allocates and touches first stay local to
+// the node that works on them (the default "first touch" policy of Linux).
+void parallel_for(size_t n, unsigned num_threads, parallel_func_t func, void *user) may_throw;
+
+template <class Func>
+inline void parallel_for(size_t n, unsigned num_threads, Func &&func) may_throw {
+    typedef std::remove_reference_t<Func> F;
+    parallel_for(
+        n, num_threads, [](size_t i, void *user) { (*(F *) user)(i); },
+        const_cast<void *>(static_cast<const void *>(&func)));
+}
+
+/*************************************************************************
+// BackgroundTask - run one function at a time on a background thread,
+// for example to overlap I/O with compression. The thread gets created by
+// the first start() and serves all later ones until the destructor.
+//
+// start() runs func(user) right away on the calling thread if no thread can
+// be used. An exception of func() is re-thrown by wait() in both cases.
+// The destructor also waits, but then any exception is discarded.
+**************************************************************************/
+
+typedef void (*task_func_t)(void *user);
+
+class BackgroundTask final {
+public:
+    explicit BackgroundTask(bool use_thread = true) noexcept;
+    ~BackgroundTask() noexcept;
+
+    void start(task_func_t func, void *user) may_throw;
+    // NOTE: func must stay alive until wait()
+    template <class Func>
+    void start(Func &func) may_throw {
+        start([](void *user) { (*(Func *) user)(); }, (void *) &func);
+    }
+    void wait() may_throw;
+
+private:
+    struct Impl;
+    Impl *impl = nullptr;
+    bool use_thread;
+    std::exception_ptr eptr;
+
+    UPX_CXX_DISABLE_COPY_MOVE(BackgroundTask)
+};
+
+} // namespace upx
+
+/* vim:set ts=4 sw=4 et: */
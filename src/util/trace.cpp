@@ -0,0 +1,376 @@
+/* trace.cpp -- "--trace": timings of the phases of packing
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+#include "../conf.h"
+#include "trace.h"
+#include <chrono>
+#include <vector>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#if defined(__NR_perf_event_open)
+#define USE_PERF_EVENT 1
+#endif
+#endif
+#endif
+
+namespace upx {
+
+namespace {
+
+struct TraceEvent final {
+    const char *name;
+    char detail[64];
+    upx_uint64_t bytes;
+    double ts, dur; // microseconds
+    unsigned tid;
+    PerfCounters counters;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+upx_std_atomic(bool) trace_enabled(false);
+FILE *trace_file = nullptr;
+Clock::time_point trace_t0;
+std::vector<TraceEvent> trace_events;
+#if WITH_THREADS
+std::mutex trace_mutex; // events get recorded by "--jobs" and "--threads" workers
+#endif
+
+double now_usecs() noexcept {
+    return std::chrono::duration<double, std::micro>(Clock::now() - trace_t0).count();
+}
+
+// small and stable thread ids: 1 is the first thread that records an event
+unsigned get_tid() noexcept {
+    static upx_std_atomic(unsigned) next_tid(0);
+    static upx_thread_local unsigned tid = 0;
+    if (tid == 0)
+        tid = ++next_tid;
+    return tid;
+}
+
+} // namespace
+
+void write_json_string(FILE *f, const char *s) noexcept {
+    fputc('"', f);
+    for (; *s; s++) {
+        const unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+void trace_open(const char *fn) may_throw {
+    assert(trace_file == nullptr);
+    trace_file = fopen(fn, "wb");
+    if (trace_file == nullptr)
+        throwIOException(fn, errno);
+    trace_t0 = Clock::now();
+    trace_events.reserve(1024);
+    trace_enabled = true;
+}
+
+void trace_close() noexcept {
+    if (trace_file == nullptr)
+        return;
+    trace_enabled = false;
+#if WITH_THREADS
+    std::lock_guard<std::mutex> lock(trace_mutex);
+#endif
+    FILE *f = trace_file;
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"upx\"}}");
+    for (const TraceEvent &e : trace_events) {
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"upx\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,", e.name,
+                e.tid);
+        fprintf(f, "\"ts\":%.3f,\"dur\":%.3f,\"args\":{", e.ts, e.dur);
+        fprintf(f, "\"bytes\":%llu", (unsigned long long) e.bytes);
+        perf_counters_write_json(f, e.counters);
+        if (e.detail[0]) {
+            fprintf(f, ",\"detail\":");
+            write_json_string(f, e.detail);
+        }
+        fprintf(f, "}}");
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(f);
+    trace_file = nullptr;
+    trace_events.clear();
+}
+
+bool trace_is_enabled() noexcept { return trace_enabled; }
+
+TraceScope::TraceScope(const char *name_, upx_uint64_t bytes_, const char *detail_) noexcept
+    : name(trace_enabled ? name_ : nullptr),
+      detail(detail_),
+      bytes(bytes_),
+      start(name ? now_usecs() : 0) {
+    if (name != nullptr && perf_counters_is_enabled())
+        has_counters = perf_counters_read(&counters_start);
+}
+
+TraceScope::~TraceScope() noexcept {
+    if (name == nullptr)
+        return;
+    TraceEvent e;
+    e.name = name;
+    size_t len = 0; // silently truncate the detail
+    if (detail != nullptr)
+        for (; detail[len] && len + 1 < sizeof(e.detail); len++)
+            e.detail[len] = detail[len];
+    e.detail[len] = 0;
+    e.bytes = bytes;
+    e.ts = start;
+    e.dur = now_usecs() - start;
+    e.tid = get_tid();
+    e.counters.valid = 0;
+    if (has_counters) {
+        PerfCounters end;
+        if (perf_counters_read(&end))
+            perf_counters_sub(&e.counters, end, counters_start);
+    }
+    try {
+#if WITH_THREADS
+        std::lock_guard<std::mutex> lock(trace_mutex);
+#endif
+        if (trace_enabled)
+            trace_events.push_back(e);
+    } catch (...) {
+        // ignore - tracing must never break packing
+    }
+}
+
+/*************************************************************************
+// perf counters
+**************************************************************************/
+
+namespace {
+upx_std_atomic(bool) perf_enabled(false);
+
+#if (USE_PERF_EVENT)
+// one group per thread, so that a single read() gets all counters at once
+struct ThreadCounters final {
+    int fd[PerfCounters::N] = {-1, -1, -1, -1}; // fd[0] is the group leader
+    unsigned valid = 0;
+    bool opened = false;
+    ~ThreadCounters() noexcept {
+        for (int i = PerfCounters::N - 1; i >= 0; i--)
+            if (fd[i] >= 0)
+                (void) ::close(fd[i]);
+    }
+    void open() noexcept {
+        opened = true;
+        static const upx_uint64_t configs[PerfCounters::N] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES};
+        for (int i = 0; i < PerfCounters::N; i++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.exclude_kernel = 1; // works with perf_event_paranoid <= 2
+            attr.exclude_hv = 1;
+            fd[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fd[0],
+                                  PERF_FLAG_FD_CLOEXEC);
+            if (fd[i] >= 0)
+                valid |= 1u << i;
+            else if (i == 0)
+                return; // no cycles counter: no group
+        }
+    }
+};
+upx_thread_local ThreadCounters thread_counters;
+#endif
+} // namespace
+
+bool perf_counters_enable() noexcept {
+    perf_enabled = true;
+    PerfCounters c;
+    if (perf_counters_read(&c))
+        return true;
+    perf_enabled = false;
+    return false;
+}
+
+bool perf_counters_is_enabled() noexcept { return perf_enabled; }
+
+bool perf_counters_read(PerfCounters *c) noexcept {
+    c->valid = 0;
+#if (USE_PERF_EVENT)
+    ThreadCounters &tc = thread_counters;
+    if (!tc.opened)
+        tc.open();
+    if (tc.fd[0] < 0)
+        return false;
+    upx_uint64_t buf[1 + PerfCounters::N]; // {nr, values in the order of opening}
+    const ssize_t n = ::read(tc.fd[0], buf, sizeof(buf));
+    if (n < (ssize_t) sizeof(buf[0]) || buf[0] > PerfCounters::N)
+        return false;
+    unsigned k = 1;
+    for (int i = 0; i < PerfCounters::N; i++) {
+        c->value[i] = 0;
+        if ((tc.valid & (1u << i)) && k <= buf[0])
+            c->value[i] = buf[k++];
+    }
+    c->valid = tc.valid;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void perf_counters_sub(PerfCounters *c, const PerfCounters &end,
+                       const PerfCounters &start) noexcept {
+    c->valid = end.valid & start.valid;
+    for (int i = 0; i < PerfCounters::N; i++)
+        c->value[i] = (c->valid & (1u << i)) ? end.value[i] - start.value[i] : 0;
+}
+
+void perf_counters_write_json(FILE *f, const PerfCounters &c) noexcept {
+    static const char *const names[PerfCounters::N] = {"cycles", "instructions", "llc_misses",
+                                                       "branch_misses"};
+    for (int i = 0; i < PerfCounters::N; i++)
+        if (c.valid & (1u << i))
+            fprintf(f, ",\"%s\":%llu", names[i], (unsigned long long) c.value[i]);
+}
+
+/*************************************************************************
+// metrics
+**************************************************************************/
+
+namespace {
+FILE *metrics_file = nullptr;
+#if WITH_THREADS
+std::mutex metrics_mutex; // lines get written by "--jobs" workers
+#endif
+} // namespace
+
+void metrics_open(const char *fn) may_throw {
+    assert(metrics_file == nullptr);
+    metrics_file = fopen(fn, "wb");
+    if (metrics_file == nullptr)
+        throwIOException(fn, errno);
+}
+
+void metrics_close() noexcept {
+    if (metrics_file == nullptr)
+        return;
+#if WITH_THREADS
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+#endif
+    fclose(metrics_file);
+    metrics_file = nullptr;
+}
+
+bool metrics_is_enabled() noexcept { return metrics_file != nullptr; }
+
+void metrics_write(const PackMetrics &m) noexcept {
+    if (metrics_file == nullptr)
+        return;
+#if WITH_THREADS
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+#endif
+    FILE *f = metrics_file;
+    fprintf(f, "{\"file\":");
+    write_json_string(f, m.file);
+    fprintf(f, ",\"format\":");
+    write_json_string(f, m.format);
+    fprintf(f, ",\"method\":%d,\"level\":%d,\"filter\":%d,\"filter_cto\":%d", m.method,
+            m.level, m.filter, m.filter_cto);
+    fprintf(f, ",\"u_file_size\":%llu,\"c_file_size\":%llu",
+            (unsigned long long) m.u_file_size, (unsigned long long) m.c_file_size);
+    fprintf(f, ",\"u_len\":%u,\"c_len\":%u,\"loader_size\":%u,\"overlap_overhead\":%u",
+            m.u_len, m.c_len, m.loader_size, m.overlap_overhead);
+    fprintf(f, ",\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"peak_memory\":%llu", m.wall_ms, m.cpu_ms,
+            (unsigned long long) m.peak_memory);
+    perf_counters_write_json(f, m.counters);
+    fprintf(f, "}\n");
+    fflush(f);
+}
+
+/*************************************************************************
+// explain-search
+**************************************************************************/
+
+namespace {
+FILE *explain_file = nullptr;
+#if WITH_THREADS
+std::mutex explain_mutex; // lines get written by "--jobs" workers
+#endif
+} // namespace
+
+void explain_open(const char *fn) may_throw {
+    assert(explain_file == nullptr);
+    explain_file = fopen(fn, "wb");
+    if (explain_file == nullptr)
+        throwIOException(fn, errno);
+}
+
+void explain_close() noexcept {
+    if (explain_file == nullptr)
+        return;
+#if WITH_THREADS
+    std::lock_guard<std::mutex> lock(explain_mutex);
+#endif
+    fclose(explain_file);
+    explain_file = nullptr;
+}
+
+bool explain_is_enabled() noexcept { return explain_file != nullptr; }
+
+void explain_write(const SearchTrial &t) noexcept {
+    if (explain_file == nullptr)
+        return;
+#if WITH_THREADS
+    std::lock_guard<std::mutex> lock(explain_mutex);
+#endif
+    FILE *f = explain_file;
+    fprintf(f, "{\"file\":");
+    write_json_string(f, t.file);
+    fprintf(f, ",\"status\":");
+    write_json_string(f, t.status);
+    fprintf(f, ",\"method\":%d,\"filter\":%d,\"filter_cto\":%d", t.method, t.filter,
+            t.filter_cto);
+    fprintf(f, ",\"u_len\":%u,\"c_len\":%u,\"loader_size\":%u,\"hdr_c_len\":%u", t.u_len,
+            t.c_len, t.loader_size, t.hdr_c_len);
+    fprintf(f, ",\"total\":%u,\"overlap_overhead\":%u,\"ms\":%.3f}\n",
+            t.c_len + t.loader_size + t.hdr_c_len, t.overlap_overhead, t.ms);
+    fflush(f);
+}
+
+} // namespace upx
+
+/* vim:set ts=4 sw=4 et: */
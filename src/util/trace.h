@@ -0,0 +1,146 @@
+/* trace.h -- "--trace": timings of the phases of packing
+
+   This file is part of the UPX executable compressor.
+
+   Copyright (C) 1996-2024 Markus Franz Xaver Johannes Oberhumer
+   Copyright (C) 1996-2024 Laszlo Molnar
+   All Rights Reserved.
+
+   UPX and the UCL library are free software; you can redistribute them
+   and/or modify them under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.
+   If not, write to the Free Software Foundation, Inc.,
+   59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Markus F.X.J. Oberhumer              Laszlo Molnar
+   <markus@oberhumer.com>               <ezerotven+github@gmail.com>
+ */
+
+#pragma once
+
+namespace upx {
+
+/*************************************************************************
+// "--trace=FILE": record how long the phases of packing take, and write
+// them as "complete" events of the Chrome Trace Event Format, which can be
+// loaded into chrome://tracing and https://ui.perfetto.dev
+//
+// A TraceScope costs close to nothing when tracing is not enabled.
+**************************************************************************/
+
+void trace_open(const char *fn) may_throw;
+// write all recorded events and close the file
+void trace_close() noexcept;
+bool trace_is_enabled() noexcept;
+
+/*************************************************************************
+// "--perf-counters": add the hardware counters of the calling thread to
+// the events of "--trace" and to the lines of "--metrics", to tell cache
+// or branch bound phases from algorithmic ones. Linux perf_event_open()
+// only; without it (or with a too strict perf_event_paranoid) the
+// counters are simply left out.
+**************************************************************************/
+
+struct PerfCounters final {
+    enum { CYCLES, INSTRUCTIONS, LLC_MISSES, BRANCH_MISSES, N };
+    upx_uint64_t value[N];
+    unsigned valid; // bit i: value[i] was counted
+};
+
+// returns false if the counters are not available on this host
+bool perf_counters_enable() noexcept;
+bool perf_counters_is_enabled() noexcept;
+// the counters of the calling thread so far; false if not available
+bool perf_counters_read(PerfCounters *c) noexcept;
+// c = end - start
+void perf_counters_sub(PerfCounters *c, const PerfCounters &end,
+                       const PerfCounters &start) noexcept;
+// write ',"cycles":N,...' for the valid counters
+void perf_counters_write_json(FILE *f, const PerfCounters &c) noexcept;
+
+class TraceScope final {
+public:
+    // NOTE: name must be a string literal; detail must live until the end of the scope
+    explicit TraceScope(const char *name_, upx_uint64_t bytes_ = 0,
+                        const char *detail_ = nullptr) noexcept;
+    ~TraceScope() noexcept;
+    void setBytes(upx_uint64_t bytes_) noexcept { bytes = bytes_; }
+
+private:
+    const char *name; // nullptr if not enabled
+    const char *detail;
+    upx_uint64_t bytes;
+    double start;
+    bool has_counters = false;
+    PerfCounters counters_start;
+
+    UPX_CXX_DISABLE_COPY_MOVE(TraceScope)
+};
+
+/*************************************************************************
+// "--metrics=FILE": write one line of JSON per packed file (NDJSON), with
+// the chosen method and filter, the sizes, and the cost of packing, so
+// that the results of many runs can be collected and compared
+**************************************************************************/
+
+struct PackMetrics final {
+    const char *file;
+    const char *format;
+    int method, level;
+    int filter, filter_cto;
+    upx_uint64_t u_file_size, c_file_size;
+    unsigned u_len, c_len;
+    unsigned loader_size;
+    unsigned overlap_overhead;
+    double wall_ms;
+    double cpu_ms; // CPU time of the whole process, including helper threads
+    upx_uint64_t peak_memory; // of the whole process so far
+    PerfCounters counters;    // of the packing thread only; valid == 0 if none
+};
+
+void metrics_open(const char *fn) may_throw;
+void metrics_close() noexcept;
+bool metrics_is_enabled() noexcept;
+// thread-safe; every line gets flushed
+void metrics_write(const PackMetrics &m) noexcept;
+
+/*************************************************************************
+// "--explain-search=FILE": write one line of JSON (NDJSON) for every
+// method/filter candidate of Packer::compressWithFilters(), with its sizes,
+// its cost and what became of it, so that the candidate lists of a binary
+// family can be trimmed to those that actually win
+**************************************************************************/
+
+struct SearchTrial final {
+    const char *file;
+    const char *status; // "best", "worse", "too-big", "failed", "filter-failed",
+                        // "pruned", "out-of-time", and finally "chosen"
+    int method, filter, filter_cto;
+    unsigned u_len, c_len;
+    unsigned loader_size; // 0 if not computed because already too big
+    unsigned hdr_c_len;
+    unsigned overlap_overhead; // 0 if not computed
+    double ms;                 // wall time of filtering & compression
+};
+
+void explain_open(const char *fn) may_throw;
+void explain_close() noexcept;
+bool explain_is_enabled() noexcept;
+// thread-safe; every line gets flushed
+void explain_write(const SearchTrial &t) noexcept;
+
+// write s as a quoted JSON string
+void write_json_string(FILE *f, const char *s) noexcept;
+
+} // namespace upx
+
+/* vim:set ts=4 sw=4 et: */
@@ -403,6 +403,50 @@ template void upx_std_stable_sort<56>(void *, size_t, upx_compare_func_t);
 template void upx_std_stable_sort<72>(void *, size_t, upx_compare_func_t);
 #endif
 
+// LSD radix sort, one byte per pass; a pass is skipped if all values have the
+// same byte there, which is common for the high bytes of relocation offsets
+void upx_radix_sort_le32(void *array, size_t n) {
+    mem_size_assert(4, n); // check size
+    byte *const p = (byte *) array;
+    if (n < 2)
+        return;
+    if (n < 64) {
+        upx_qsort(p, n, 4, le32_compare);
+        return;
+    }
+    std::unique_ptr<upx_uint32_t[]> buf(new upx_uint32_t[2 * n]);
+    upx_uint32_t *a = buf.get();
+    upx_uint32_t *b = a + n;
+    size_t counts[4][256] = {}; // all 4 histograms in a single pass
+    for (size_t i = 0; i < n; i++) {
+        const upx_uint32_t v = get_le32(p + 4 * i);
+        a[i] = v;
+        counts[0][v & 0xff] += 1;
+        counts[1][(v >> 8) & 0xff] += 1;
+        counts[2][(v >> 16) & 0xff] += 1;
+        counts[3][v >> 24] += 1;
+    }
+    for (unsigned k = 0; k < 4; k++) {
+        const unsigned shift = 8 * k;
+        size_t *const c = counts[k];
+        if (c[(a[0] >> shift) & 0xff] == n)
+            continue; // all the same
+        size_t pos = 0;
+        for (unsigned d = 0; d < 256; d++) {
+            const size_t t = c[d];
+            c[d] = pos;
+            pos += t;
+        }
+        for (size_t i = 0; i < n; i++)
+            b[c[(a[i] >> shift) & 0xff]++] = a[i];
+        upx_uint32_t *const t = a;
+        a = b;
+        b = t;
+    }
+    for (size_t i = 0; i < n; i++)
+        set_le32(p + 4 * i, a[i]);
+}
+
 #if !defined(DOCTEST_CONFIG_DISABLE) && DEBUG >= 1
 #if __cplusplus >= 202002L // use C++20 std::next_permutation() to test all permutations
 namespace {
@@ -585,13 +629,22 @@ int find(const void *buf, int blen, const void *what, int wlen) noexcept {
     if (buf == nullptr || blen < wlen || what == nullptr || wlen <= 0)
         return -1;
 
-    const byte *b = (const byte *) buf;
-    byte first_byte = *(const byte *) what;
-
-    blen -= wlen;
-    for (int i = 0; i <= blen; i++, b++)
-        if (*b == first_byte && memcmp(b, what, wlen) == 0)
-            return i;
+    // memchr() is vectorized by all C libraries, so let it skip ahead to
+    // the candidates; check the last byte before the full memcmp()
+    const byte *const b = (const byte *) buf;
+    const byte *const w = (const byte *) what;
+    const byte first_byte = w[0];
+    const byte last_byte = w[wlen - 1];
+    const byte *p = b;
+    const byte *const last = b + (blen - wlen); // last possible match
+    while (p <= last) {
+        p = (const byte *) memchr(p, first_byte, (size_t) (last - p) + 1);
+        if (p == nullptr)
+            break;
+        if (p[wlen - 1] == last_byte && memcmp(p + 1, w + 1, wlen - 1) == 0)
+            return (int) (p - b);
+        p++;
+    }
 
     return -1;
 }
@@ -632,6 +685,105 @@ int find_le64(const void *b, int blen, upx_uint64_t what) noexcept {
     return find(b, blen, w, 8);
 }
 
+// Whole blocks of values: on x86 these use SSE2 to swap 16 bytes at a time
+// (first the 16-bit words, then the bytes within the words), which is much
+// faster than calling get_be32() and set_le32() for every single value.
+#if (defined(__SSE2__) || defined(_M_X64)) && (ACC_ARCH_AMD64 || ACC_ARCH_I386)
+#include <emmintrin.h>
+#define UPX_BSWAP_SSE2 1
+static forceinline __m128i bswap16_sse2(__m128i v) noexcept {
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+#else
+#define UPX_BSWAP_SSE2 0
+#endif
+
+void bswap16_array(void *b, size_t n) noexcept {
+    byte *p = (byte *) b;
+    size_t i = 0;
+#if UPX_BSWAP_SSE2
+    for (; i + 8 <= n; i += 8, p += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (const void *) p);
+        _mm_storeu_si128((__m128i *) (void *) p, bswap16_sse2(v));
+    }
+#endif
+    for (; i < n; i++, p += 2)
+        set_ne16(p, bswap16(get_ne16(p)));
+}
+
+void bswap32_array(void *b, size_t n) noexcept {
+    byte *p = (byte *) b;
+    size_t i = 0;
+#if UPX_BSWAP_SSE2
+    for (; i + 4 <= n; i += 4, p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (const void *) p);
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1); // 1 0 3 2
+        _mm_storeu_si128((__m128i *) (void *) p, bswap16_sse2(v));
+    }
+#endif
+    for (; i < n; i++, p += 4)
+        set_ne32(p, bswap32(get_ne32(p)));
+}
+
+void bswap64_array(void *b, size_t n) noexcept {
+    byte *p = (byte *) b;
+    size_t i = 0;
+#if UPX_BSWAP_SSE2
+    for (; i + 2 <= n; i += 2, p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (const void *) p);
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x1b), 0x1b); // 3 2 1 0
+        _mm_storeu_si128((__m128i *) (void *) p, bswap16_sse2(v));
+    }
+#endif
+    for (; i < n; i++, p += 8)
+        set_ne64(p, bswap64(get_ne64(p)));
+}
+#undef UPX_BSWAP_SSE2
+
+TEST_CASE("upx_radix_sort_le32") {
+    constexpr size_t N = 1000;
+    byte a[1 + 4 * N], b[4 * N];
+    upx_uint32_t x = 12345;
+    for (size_t i = 0; i < N; i++) {
+        x = x * 1103515245 + 12345;
+        // mostly small offsets, so that the high byte passes get skipped
+        const upx_uint32_t v = (i & 1) ? x : (x >> 12);
+        set_le32(a + 1 + 4 * i, v);
+        set_le32(b + 4 * i, v);
+    }
+    upx_radix_sort_le32(a + 1, N);
+    upx_qsort(b, N, 4, le32_compare);
+    CHECK(memcmp(a + 1, b, sizeof(b)) == 0);
+    // small arrays and n == 0
+    upx_radix_sort_le32(a + 1, 3);
+    upx_radix_sort_le32(nullptr, 0);
+    CHECK(get_le32(a + 1) <= get_le32(a + 5));
+}
+
+TEST_CASE("bswap_array") {
+    byte b[1 + 8 * 9];
+    for (size_t i = 0; i < sizeof(b); i++)
+        b[i] = (byte) i;
+    bswap16_array(b + 1, 4);
+    CHECK(get_be16(b + 1) == 0x0201);
+    CHECK(get_be16(b + 7) == 0x0807);
+    CHECK(b[9] == 9);
+    bswap16_array(b + 1, 4);
+    bswap32_array(b + 1, 17);
+    CHECK(get_le32(b + 1) == 0x01020304);
+    CHECK(get_le32(b + 65) == 0x41424344);
+    CHECK(b[69] == 69);
+    bswap32_array(b + 1, 17);
+    bswap64_array(b + 1, 9);
+    CHECK(get_le64(b + 1) == 0x0102030405060708ULL);
+    CHECK(get_le64(b + 65) == 0x4142434445464748ULL);
+    bswap64_array(b + 1, 9);
+    for (size_t i = 0; i < sizeof(b); i++)
+        CHECK(b[i] == i);
+    bswap32_array(b, 0);
+    CHECK(b[0] == 0);
+}
+
 TEST_CASE("find") {
     CHECK(find(nullptr, -1, nullptr, -1) == -1);
     static const byte b[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
@@ -643,6 +795,11 @@ TEST_CASE("find") {
         CHECK(find(b, 16, b, i) == 0);
     }
     CHECK(find(b, 16, b, 17) == -1);
+    static const byte r[8] = {1, 1, 1, 2, 1, 1, 1, 1};
+    CHECK(find(r, 8, r + 1, 3) == 1);
+    CHECK(find(r, 8, r + 4, 4) == 4);
+    CHECK(find(r, 7, r + 4, 4) == -1);
+    UNUSED(r);
     CHECK(find_be16(b, 16, 0x0203) == 2);
     CHECK(find_le16(b, 16, 0x0302) == 2);
     CHECK(find_be32(b, 16, 0x04050607) == 4);
@@ -682,6 +839,136 @@ TEST_CASE("mem_replace") {
     UNUSED(b);
 }
 
+/*************************************************************************
+// mem_looks_incompressible - a quick estimate, cheap next to any compressor.
+// The byte histogram must be flat: chi-square against uniform below blen/64,
+// which leaves order-0 entropy within about 0.01 bit of 8 bits per byte.
+// And content-defined samples of 4-byte strings must not repeat, or else
+// an LZ compressor would find matches. Integer only, so that the result
+// (and thus the output of upx) is the same on every host.
+**************************************************************************/
+
+bool mem_looks_incompressible(const void *b, unsigned blen) noexcept {
+    if (blen < 16384) // small blocks are cheap to try anyway
+        return false;
+    if (blen > (1u << 24)) // keep 16384 * sumsq below 2**64
+        blen = 1u << 24;
+    const byte *const p = (const byte *) b;
+    unsigned count[256];
+    memset(count, 0, sizeof(count));
+    for (unsigned i = 0; i < blen; i++)
+        count[p[i]]++;
+    upx_uint64_t sumsq = 0;
+    for (unsigned c : count)
+        sumsq += upx_uint64_t(c) * c;
+    // chi2 == 256 * sumsq / blen - blen < blen / 64
+    if (16384 * sumsq >= 65 * upx_uint64_t(blen) * blen)
+        return false;
+
+    constexpr unsigned capacity = 4096, max_samples = capacity / 2;
+    unsigned table[capacity]; // 1 + hash, or 0
+    memset(table, 0, sizeof(table));
+    unsigned nsamples = 0, ndups = 0;
+    for (unsigned i = 0; i + 4 <= blen && nsamples < max_samples; i++) {
+        unsigned const h = get_le32(p + i) * 2654435761u;
+        if (h >> 25) // keep 1 of 128 positions
+            continue;
+        nsamples++;
+        for (unsigned j = h;; j++) {
+            unsigned &slot = table[j & (capacity - 1)];
+            if (slot == 0) {
+                slot = 1 + h;
+                break;
+            }
+            if (slot == 1 + h) {
+                ndups++;
+                break;
+            }
+        }
+    }
+    return 32 * ndups <= nsamples;
+}
+
+TEST_CASE("mem_looks_incompressible") {
+    constexpr unsigned N = 64 * 1024;
+    std::unique_ptr<byte[]> mb(new byte[N]);
+    byte *const b = mb.get();
+    upx_uint64_t x = 0x0123456789abcdefull;
+    for (unsigned i = 0; i < N; i++) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        b[i] = (byte) (x >> 56);
+    }
+    CHECK(mem_looks_incompressible(b, N));
+    CHECK(!mem_looks_incompressible(b, 8192)); // too small to tell
+    memcpy(b + N / 2, b, N / 2);               // flat histogram, but repeats
+    CHECK(!mem_looks_incompressible(b, N));
+    for (unsigned i = 0; i < N; i++)
+        b[i] = (byte) (i % 251);
+    CHECK(!mem_looks_incompressible(b, N));
+    memset(b, 0, N);
+    CHECK(!mem_looks_incompressible(b, N));
+}
+
+/*************************************************************************
+// mem_content_boundary - the offset of the first 16 KiB window, at least
+// 64 KiB into the buffer, whose byte statistics are far from those of the
+// windows before it: say code followed by a table of zeros, or by already
+// compressed data. Returns blen if there is none. The statistic of a
+// window is the bit length of 256 * sum(count**2) / W**2, which is 1 for
+// random bytes, about 4 for code and 9 for a constant, and a window must
+// differ from the average of the previous ones by at least 3.
+// Integer only, like mem_looks_incompressible().
+**************************************************************************/
+
+static unsigned window_level(const byte *p, unsigned w) noexcept {
+    unsigned count[256];
+    memset(count, 0, sizeof(count));
+    for (unsigned i = 0; i < w; i++)
+        count[p[i]]++;
+    upx_uint64_t sumsq = 0;
+    for (unsigned c : count)
+        sumsq += upx_uint64_t(c) * c;
+    upx_uint64_t q = 256 * sumsq / (upx_uint64_t(w) * w);
+    unsigned level = 0;
+    while (q != 0) {
+        q >>= 1;
+        level++;
+    }
+    return level;
+}
+
+unsigned mem_content_boundary(const void *b, unsigned blen) noexcept {
+    constexpr unsigned W = 16384, min_len = 4 * W;
+    const byte *const p = (const byte *) b;
+    unsigned sum = 0, n = 0;
+    for (unsigned off = 0; off + W <= blen; off += W) {
+        unsigned const level = window_level(p + off, W);
+        if (off >= min_len && (n * level >= sum + 3 * n || n * level + 3 * n <= sum))
+            return off;
+        sum += level;
+        n++;
+    }
+    return blen;
+}
+
+TEST_CASE("mem_content_boundary") {
+    constexpr unsigned N = 256 * 1024;
+    std::unique_ptr<byte[]> mb(new byte[N]);
+    byte *const b = mb.get();
+    upx_uint64_t x = 0x0123456789abcdefull;
+    for (unsigned i = 0; i < N; i++) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        b[i] = (byte) (x >> 56);
+    }
+    CHECK(mem_content_boundary(b, N) == N);
+    memset(b + 160 * 1024, 0, N - 160 * 1024);
+    CHECK(mem_content_boundary(b, N) == 160 * 1024);
+    CHECK(mem_content_boundary(b, 100 * 1024) == 100 * 1024);
+    memset(b, 0, N);
+    memset(b + 96 * 1024, 1, 64 * 1024); // other bytes, but the same statistics
+    CHECK(mem_content_boundary(b, N) == N);
+}
+
 /*************************************************************************
 // bele.h globals
 **************************************************************************/
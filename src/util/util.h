@@ -158,6 +158,11 @@ void upx_shellsort_memcpy(void *array, size_t n, size_t element_size, upx_compar
 template <size_t ElementSize>
 void upx_std_stable_sort(void *array, size_t n, upx_compare_func_t compare);
 
+// sort an array of n (possibly unaligned) LE32 values in ascending order;
+// same result as upx_qsort(array, n, 4, le32_compare), but a LSD radix sort
+// is much faster for the big relocation tables of DLLs and DOS/LE images
+void upx_radix_sort_le32(void *array, size_t n) may_throw;
+
 // #define UPX_CONFIG_USE_STABLE_SORT 1
 #if UPX_CONFIG_USE_STABLE_SORT
 // use std::stable_sort(); NOTE: requires that "element_size" is constexpr!
@@ -168,6 +173,16 @@ void upx_std_stable_sort(void *array, size_t n, upx_compare_func_t compare);
 #define upx_qsort qsort
 #endif
 
+// sort with a typed "less" (e.g. a lambda) which the compiler can inline,
+// so prefer this over upx_qsort() for sorts that matter; NOT stable, so
+// like with upx_qsort() the order must be total for a deterministic result
+template <class T, class Less>
+inline void upx_sort(T *array, size_t n, Less less) {
+    mem_size_assert(sizeof(T), n); // check size
+    if (n >= 2)
+        std::sort(array, array + n, less);
+}
+
 /*************************************************************************
 // misc support functions
 **************************************************************************/
@@ -180,7 +195,16 @@ int find_le16(const void *b, int blen, unsigned what) noexcept;
 int find_le32(const void *b, int blen, unsigned what) noexcept;
 int find_le64(const void *b, int blen, upx_uint64_t what) noexcept;
 
+// byte-swap n consecutive (possibly unaligned) 16/32/64-bit values in place
+void bswap16_array(void *b, size_t n) noexcept;
+void bswap32_array(void *b, size_t n) noexcept;
+void bswap64_array(void *b, size_t n) noexcept;
+
 int mem_replace(void *b, int blen, const void *what, int wlen, const void *r) noexcept;
+// already compressed or encrypted data, not worth another try
+bool mem_looks_incompressible(const void *b, unsigned blen) noexcept;
+// where the kind of content changes, or blen; see "--split-blocks"
+unsigned mem_content_boundary(const void *b, unsigned blen) noexcept;
 
 char *fn_basename(const char *name);
 int fn_strcmp(const char *n1, const char *n2);
@@ -32,7 +32,6 @@ XSPAN_NAMESPACE_BEGIN
 
 // debugging stats
 struct XSpanStats {
-    upx_std_atomic(size_t) check_range_counter;
     // these usually will be zero, but internal doctest checks will populate them; see dt_xspan.cpp
     upx_std_atomic(size_t) fail_nullptr;
     upx_std_atomic(size_t) fail_nullbase;
@@ -70,23 +69,6 @@ void xspan_fail_range_range() {
     throwCantPack("xspan_check_range: pointer out of range; take care!");
 }
 
-void xspan_check_range(const void *ptr, const void *base, ptrdiff_t size_in_bytes) {
-    xspan_stats.check_range_counter += 1;
-    if very_unlikely (ptr == nullptr)
-        xspan_fail_range_nullptr();
-    if very_unlikely (base == nullptr)
-        xspan_fail_range_nullbase();
-#if defined(__SANITIZE_ADDRESS__)
-    // info: pointers are out of range deliberately during internal doctest checks; see dt_xspan.cpp
-    const acc_intptr_t off = (acc_uintptr_t) ptr - (acc_uintptr_t) base;
-#else
-    const ptrdiff_t off = (const charptr) ptr - (const charptr) base;
-#endif
-    if very_unlikely (off < 0 || off > size_in_bytes || size_in_bytes > UPX_RSIZE_MAX)
-        xspan_fail_range_range();
-    NO_fprintf(stderr, "xspan_check_range done\n");
-}
-
 XSPAN_NAMESPACE_END
 
 #endif // WITH_XSPAN
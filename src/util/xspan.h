@@ -47,6 +47,13 @@
 #ifndef XSPAN_CONFIG_ENABLE_SPAN_CONVERSION
 #define XSPAN_CONFIG_ENABLE_SPAN_CONVERSION 1
 #endif
+// Range-check the result of pointer arithmetic (++, --, +=, -=, +, -). Without it
+// the arithmetic compiles to plain pointer arithmetic, while dereferencing, raw_bytes()
+// and span creation and conversion still check the range, so an out-of-range pointer is
+// caught when it gets used; see UPX_CONFIG_DISABLE_XSPAN_ARITHMETIC_CHECKS in CMakeLists.txt.
+#ifndef XSPAN_CONFIG_CHECK_ARITHMETIC
+#define XSPAN_CONFIG_CHECK_ARITHMETIC 1
+#endif
 
 // actual implementation
 #include "xspan_impl.h"
@@ -49,7 +49,23 @@ noreturn void xspan_fail_not_same_base(void) may_throw;
 noreturn void xspan_fail_range_nullptr(void) may_throw;
 noreturn void xspan_fail_range_nullbase(void) may_throw;
 noreturn void xspan_fail_range_range(void) may_throw;
-void xspan_check_range(const void *ptr, const void *base, ptrdiff_t size_in_bytes) may_throw;
+
+// inline, as this runs on every checked access; only the failures are out-of-line
+forceinline void xspan_check_range(const void *ptr, const void *base,
+                                   ptrdiff_t size_in_bytes) may_throw {
+    if very_unlikely (ptr == nullptr)
+        xspan_fail_range_nullptr();
+    if very_unlikely (base == nullptr)
+        xspan_fail_range_nullbase();
+#if defined(__SANITIZE_ADDRESS__)
+    // info: pointers are out of range deliberately during internal doctest checks; see dt_xspan.cpp
+    const acc_intptr_t off = (acc_uintptr_t) ptr - (acc_uintptr_t) base;
+#else
+    const ptrdiff_t off = (const char *) ptr - (const char *) base;
+#endif
+    if very_unlikely (off < 0 || off > size_in_bytes || size_in_bytes > UPX_RSIZE_MAX)
+        xspan_fail_range_range();
+}
 
 // help constructor to distinguish between number of elements and bytes
 struct XSpanCount final {
@@ -367,7 +367,7 @@ public:
     pointer operator->() const { return check_deref(ptr); }
 
     Self &operator++() {
-        ptr = check_add(ptr, 1);
+        ptr = arith_add(ptr, 1);
         return *this;
     }
     Self operator++(int) {
@@ -376,7 +376,7 @@ public:
         return tmp;
     }
     Self &operator--() {
-        ptr = check_add(ptr, -1);
+        ptr = arith_add(ptr, -1);
         return *this;
     }
     Self operator--(int) {
@@ -386,20 +386,20 @@ public:
     }
 
     Self &operator+=(ptrdiff_t n) {
-        ptr = check_add(ptr, n);
+        ptr = arith_add(ptr, n);
         return *this;
     }
     Self &operator-=(ptrdiff_t n) {
-        ptr = check_add(ptr, -n);
+        ptr = arith_add(ptr, -n);
         return *this;
     }
 
     Self operator+(ptrdiff_t n) const {
-        pointer first = check_add(ptr, n);
+        pointer first = arith_add(ptr, n);
         return Self(Unchecked, first, size_in_bytes, base);
     }
     Self operator-(ptrdiff_t n) const {
-        pointer first = check_add(ptr, -n);
+        pointer first = arith_add(ptr, -n);
         return Self(Unchecked, first, size_in_bytes, base);
     }
 
@@ -432,6 +432,16 @@ private:
             xspan_check_range(p, base, size_in_bytes);
         return p;
     }
+    // the pointer arithmetic operators; see XSPAN_CONFIG_CHECK_ARITHMETIC
+#if XSPAN_CONFIG_CHECK_ARITHMETIC
+    forceinline pointer arith_add(pointer p, ptrdiff_t n) const { return check_add(p, n); }
+#else
+    forceinline pointer arith_add(pointer p, ptrdiff_t n) const {
+        if __acc_cte (!configRequirePtr && p == nullptr)
+            xspan_fail_nullptr();
+        return p + n;
+    }
+#endif
 
     // disable taking the address => force passing by reference
     // [I'm not too sure about this design decision, but we can always allow it if needed]
@@ -464,6 +474,9 @@ public: // raw access
             return 0;
         if __acc_cte (!configRequireBase && base == nullptr)
             return 0;
+#if !(XSPAN_CONFIG_CHECK_ARITHMETIC)
+        xspan_check_range(ptr, base, size_in_bytes);
+#endif
         const charptr p_begin = (const charptr) ptr;
         const charptr p_end = (const charptr) base + size_in_bytes;
         return p_end - p_begin;
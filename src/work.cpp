@@ -37,11 +37,19 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #endif
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/fs.h> // FICLONE
+#endif
 #include "conf.h"
+#include <vector>
 #include "file.h"
 #include "packmast.h"
 #include "ui.h"
 #include "util/membuffer.h"
+#include "util/pack_cache.h"
+#include "util/threads.h"
+#include "util/trace.h"
 
 #if USE_UTIMENSAT && defined(AT_FDCWD)
 #elif (defined(_WIN32) || defined(__CYGWIN__)) && 1
@@ -115,6 +123,37 @@ static void set_fd_timestamp(int fd, const XStat *xst) noexcept {
     UNUSED(xst);
 }
 
+// Linux: copy all of ifd to the (empty) ofd within the kernel - share the
+// blocks if the file system can (FICLONE), else use copy_file_range();
+// returns false if nothing was copied and the caller has to do it
+static bool copy_fd_contents_in_kernel(int ifd, int ofd, const char *oname) may_throw {
+#if defined(__linux__) && defined(FICLONE)
+    if (ioctl(ofd, FICLONE, ifd) == 0)
+        return true;
+#endif
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 27)
+    bool copied = false;
+    for (;;) {
+        ssize_t l = copy_file_range(ifd, nullptr, ofd, nullptr, 1024 * 1024 * 1024, 0);
+        if (l == 0)
+            return true;
+        if (l < 0) {
+            if (errno == EINTR)
+                continue;
+            if (!copied) // EXDEV, ENOSYS, EINVAL, ...: not supported here
+                return false;
+            throwIOException(oname, errno);
+        }
+        copied = true;
+    }
+#else
+    UNUSED(ifd);
+    UNUSED(ofd);
+    UNUSED(oname);
+    return false;
+#endif
+}
+
 static void copy_file_contents(const char *iname, const char *oname, OpenMode om,
                                const XStat *oname_timestamp) may_throw {
     InputFile fi;
@@ -126,13 +165,16 @@ static void copy_file_contents(const char *iname, const char *oname, OpenMode om
     OutputFile fo;
     fo.sopen(oname, flags, shmode, omode);
     fo.seek(0, SEEK_SET);
-    MemBuffer buf(256 * 1024 * 1024);
-    for (;;) {
-        size_t bytes = fi.read(buf, buf.getSize());
-        if (bytes == 0)
-            break;
-        fo.write(buf, bytes);
+    if (!copy_fd_contents_in_kernel(fi.getFd(), fo.getFd(), oname)) {
+        MemBuffer buf(256 * 1024 * 1024);
+        for (;;) {
+            size_t bytes = fi.read(buf, buf.getSize());
+            if (bytes == 0)
+                break;
+            fo.write(buf, bytes);
+        }
     }
+    fo.flush(); // before the timestamp
     if (oname_timestamp != nullptr)
         set_fd_timestamp(fo.getFd(), oname_timestamp);
     fi.closex();
@@ -195,48 +237,184 @@ static void copy_file_attributes(const XStat *xst, const char *oname, bool prese
     UNUSED(preserve_timestamp);
 }
 
+// input file "-"
+struct StdinData final {
+    byte *ptr = nullptr; // malloc()ed
+    size_t size = 0;
+    StdinData() noexcept = default;
+    ~StdinData() noexcept { ::free(ptr); }
+    void readAll() may_throw;
+    UPX_CXX_DISABLE_COPY_MOVE(StdinData)
+};
+
+void StdinData::readAll() may_throw {
+    const int fd = STDIN_FILENO;
+    if (!opt->force && acc_isatty(fd))
+        throwIOException("data not read from a terminal; Use '-f' to force.");
+    if (acc_set_binmode(fd, 1) == -1)
+        throwIOException("<stdin>", errno);
+    size_t capacity = 0;
+    for (;;) {
+        if (size == capacity) {
+            capacity = capacity ? 2 * capacity : 1024 * 1024;
+            if (!mem_size_valid_bytes(capacity))
+                throwIOException("file is too large -- skipped");
+            byte *p = (byte *) ::realloc(ptr, capacity);
+            if (p == nullptr)
+                throw std::bad_alloc();
+            ptr = p;
+        }
+        errno = 0;
+        long l = acc_safe_hread(fd, ptr + size, (long) (capacity - size));
+        if (errno)
+            throwIOException("<stdin>", errno);
+        if (l <= 0)
+            break;
+        size += (size_t) l;
+    }
+}
+
 } // namespace
 
+/*************************************************************************
+// "--upgrade": do_one_file() packs with the options of "--fast" at once and
+// keeps a temporary copy of the input on disk. After all files are done,
+// do_upgrades() packs each of them again with the real options - in a
+// detached child process, unless "--upgrade-wait" - and atomically replaces the packed file if the
+// new one is smaller, passes the checks of "upx -t", and the packed file
+// has not been touched in the meantime. The winner goes into the decision
+// cache (and the pack cache with "--pack-cache"), so the next build of the
+// same data gets there quickly.
+**************************************************************************/
+
+namespace {
+struct UpgradeJob final {
+    char *name = nullptr;       // owned; the packed file
+    char *input_name = nullptr; // owned; a temporary copy of the original file
+    struct stat st = {};        // of the packed file after the fast pass
+    UpgradeJob() noexcept = default;
+    ~UpgradeJob() noexcept {
+        if (input_name != nullptr)
+            (void) FileBase::unlink_noexcept(input_name); // IGNORE_ERROR
+        ::free(name);
+        ::free(input_name);
+    }
+    // after fork() the child owns the copy
+    void releaseInput() noexcept {
+        ::free(input_name);
+        input_name = nullptr;
+    }
+    UPX_CXX_DISABLE_COPY_MOVE(UpgradeJob)
+};
+std::vector<std::unique_ptr<UpgradeJob> > upgrade_jobs;
+#if WITH_THREADS
+std::mutex upgrade_jobs_mutex;
+#endif
+} // namespace
+
+// the options of the fast pass, much like "--fast"
+static void set_upgrade_fast_options(Options *o) noexcept {
+    o->fast = true;
+    o->level = 1;
+    o->ultra_brute = false;
+    o->all_methods = false;
+    o->all_filters = false;
+    o->prune_trials = 0;
+    o->time_budget = 0;
+    o->nrv_parallel = false;
+    o->lzma_tune = false;
+    o->decision_cache = false; // only the winner of the real search is worth keeping
+    o->search_result = nullptr;
+    o->search_merge = nullptr;
+}
+
+// keep the original file next to the packed one, not in memory: a big batch
+// would otherwise hold all its inputs until do_upgrades()
+static void upgrade_save_input(UpgradeJob *job, InputFile &fi, const char *name) may_throw {
+    char base[ACC_FN_PATH_MAX + 1];
+    char tname[ACC_FN_PATH_MAX + 1];
+    upx_safe_snprintf(base, sizeof(base), "%s.x", name); // maketempname() replaces ".x"
+    if (!maketempname(tname, sizeof(tname), base, ".upi"))
+        throwIOException("could not create a temporary file name");
+    OutputFile fo;
+    fo.sopen(tname, get_open_flags(WO_MUST_CREATE), SH_DENYWR, 0600);
+    job->input_name = ::strdup(tname);
+    if (job->input_name == nullptr) {
+        fo.closex();
+        (void) FileBase::unlink_noexcept(tname); // IGNORE_ERROR
+        throwOutOfMemoryException();
+    }
+    fo.copyRangeFrom(fi, 0, fi.st_size()); // a reflink if the file system can
+    fo.closex();
+    fi.seek(0, SEEK_SET);
+}
+
+static void upgrade_add(std::unique_ptr<UpgradeJob> job, const char *name) may_throw {
+    if (::stat(name, &job->st) != 0)
+        throwIOException(name, errno);
+    job->name = ::strdup(name);
+    if (job->name == nullptr)
+        throwOutOfMemoryException();
+#if WITH_THREADS
+    std::lock_guard<std::mutex> lock(upgrade_jobs_mutex);
+#endif
+    upgrade_jobs.push_back(std::move(job));
+}
+
 /*************************************************************************
 // process one file
 **************************************************************************/
 
-void do_one_file(const char *const iname, char *const oname) may_throw {
+void do_one_file(const char *const iname, char *const oname, const char *const same_as) may_throw {
     oname[0] = 0; // make empty
+    upx::TraceScope trace_scope("file", 0, fn_basename(iname));
+    // "-" reads all of stdin into memory and, unless "-o" is given, writes
+    // the result to stdout once it is complete; so upx works in a pipeline,
+    // but the packers can still seek() and rewrite()
+    const bool from_stdin = strcmp(iname, "-") == 0;
 
     // check iname stat
     XStat xst = {};
     struct stat &st = xst.st;
+    StdinData stdin_data;
+    if (from_stdin) {
+        stdin_data.readAll();
+        st.st_mode = S_IFREG | 0755;
+        st.st_nlink = 1;
+        st.st_size = (upx_off_t) stdin_data.size;
+    } else {
 #if HAVE_LSTAT
-    int rr = lstat(iname, &st);
+        int rr = lstat(iname, &st);
 #else
-    int rr = stat(iname, &st);
+        int rr = stat(iname, &st);
 #endif
-    if (rr != 0) {
-        if (errno == ENOENT)
-            throw FileNotFoundException(iname, errno);
-        else
-            throwIOException(iname, errno);
-    }
+        if (rr != 0) {
+            if (errno == ENOENT)
+                throw FileNotFoundException(iname, errno);
+            else
+                throwIOException(iname, errno);
+        }
 #if HAVE_LSTAT
-    if (S_ISLNK(st.st_mode))
-        throwIOException("is a symlink -- skipped");
+        if (S_ISLNK(st.st_mode))
+            throwIOException("is a symlink -- skipped");
 #endif
-    if (S_ISDIR(st.st_mode))
-        throwIOException("is a directory -- skipped");
-    if (!(S_ISREG(st.st_mode)))
-        throwIOException("not a regular file -- skipped");
+        if (S_ISDIR(st.st_mode))
+            throwIOException("is a directory -- skipped");
+        if (!(S_ISREG(st.st_mode)))
+            throwIOException("not a regular file -- skipped");
 #if defined(__unix__)
-    // no special bits may be set
-    if ((st.st_mode & (S_ISUID | S_ISGID | S_ISVTX)) != 0)
-        throwIOException("file has special permissions -- skipped");
+        // no special bits may be set
+        if ((st.st_mode & (S_ISUID | S_ISGID | S_ISVTX)) != 0)
+            throwIOException("file has special permissions -- skipped");
 #endif
+    }
     if (st.st_size <= 0)
         throwIOException("empty file -- skipped");
     if (st.st_size < 512)
         throwIOException("file is too small -- skipped");
     if (!mem_size_valid_bytes(st.st_size))
         throwIOException("file is too large -- skipped");
+    trace_scope.setBytes(st.st_size);
     if ((st.st_mode & S_IWUSR) == 0) {
         bool skip = true;
         if (opt->output_name)
@@ -245,15 +423,20 @@ void do_one_file(const char *const iname, char *const oname) may_throw {
             skip = false;
         else if (opt->backup)
             skip = false;
+        else if (opt->benchmark)
+            skip = false;
         if (skip)
             throwIOException("file is write protected -- skipped");
     }
 
     // open input file
     InputFile fi;
-    fi.sopen(iname, get_open_flags(RO_MUST_EXIST), SH_DENYWR);
+    if (from_stdin)
+        fi.openMemory("<stdin>", stdin_data.ptr, st.st_size);
+    else
+        fi.sopen(iname, get_open_flags(RO_MUST_EXIST), SH_DENYWR);
 
-    if (opt->preserve_timestamp) {
+    if (opt->preserve_timestamp && !from_stdin) {
 #if USE_SETFILETIME
         if (GetFileTime((HANDLE) _get_osfhandle(fi.getFd()), nullptr, &xst.ft_atime,
                         &xst.ft_mtime) == 0)
@@ -268,6 +451,8 @@ void do_one_file(const char *const iname, char *const oname) may_throw {
     // NOTE: only use "preserve_link" if you really need it, e.g. it can fail
     //   with ETXTBSY and other unexpected errors; renaming files is much safer
     OutputFile fo;
+    char tmpfile_name[ACC_FN_PATH_MAX + 1]; // the name of an unnamed temporary file
+    tmpfile_name[0] = 0;
     bool preserve_link = opt->preserve_link;
     bool copy_timestamp_only = false;
     if (opt->cmd == CMD_COMPRESS || opt->cmd == CMD_DECOMPRESS) {
@@ -275,6 +460,11 @@ void do_one_file(const char *const iname, char *const oname) may_throw {
             preserve_link = false; // not needed
             if (!fo.openStdout(1, opt->force ? true : false))
                 throwIOException("data not written to a terminal; Use '-f' to force.");
+        } else if (from_stdin && !opt->output_name) {
+            preserve_link = false; // not needed
+            if (!opt->force && acc_isatty(STDOUT_FILENO))
+                throwIOException("data not written to a terminal; Use '-f' to force.");
+            fo.openMemory("<stdout>");
         } else {
             char tname[ACC_FN_PATH_MAX + 1];
             if (opt->output_name) {
@@ -282,7 +472,7 @@ void do_one_file(const char *const iname, char *const oname) may_throw {
                 if ((opt->force_overwrite || opt->force >= 2) && !preserve_link)
                     (void) FileBase::unlink_noexcept(tname); // IGNORE_ERROR
             } else {
-                if (st.st_nlink < 2)
+                if (st.st_nlink < 2 || opt->benchmark)
                     preserve_link = false; // not needed
                 if (!maketempname(tname, sizeof(tname), iname, ".upx"))
                     throwIOException("could not create a temporary file name");
@@ -319,15 +509,62 @@ void do_one_file(const char *const iname, char *const oname) may_throw {
             // cannot rely on open() because of umask
             // int omode = st.st_mode | 0600;
             int omode = opt->preserve_mode ? 0600 : 0666; // affected by umask; only for O_CREAT
-            fo.sopen(tname, flags, shmode, omode);
-            // open succeeded - now set oname[]
-            strcpy(oname, tname);
+            if (from_stdin)
+                omode = 0777; // there is no mode to preserve
+            // an unnamed temporary file vanishes by itself on errors, so oname[]
+            // only gets set once it has been linked to its name below
+            if (!opt->output_name && fo.openTmpfile(tname, omode)) {
+                strcpy(tmpfile_name, tname);
+            } else {
+                fo.sopen(tname, flags, shmode, omode);
+                // open succeeded - now set oname[]
+                strcpy(oname, tname);
+            }
         }
     }
 
+    // "--pack-cache": identical input and options give an identical packed file
+    upx::DecisionCacheKey pack_cache_key = {};
+    bool pack_cache_hit = false;
+    if (opt->pack_cache && fo.isOpen()) {
+        pack_cache_key = upx::pack_cache_key(&fi, opt);
+        pack_cache_hit = upx::pack_cache_fetch(pack_cache_key, &fo);
+        if (pack_cache_hit && opt->verbose >= 1)
+            con_fprintf(stdout, "%s: reused the packed file from the pack cache\n",
+                        fn_basename(iname));
+    }
+
+    // an identical file of this run has already been processed, see process_files();
+    // its result gets copied (or shared with a reflink if the file system can)
+    bool same_as_copied = false;
+    if (same_as != nullptr && !pack_cache_hit && fo.isOpen() && !fo.isMemory()) {
+        InputFile sfi;
+        sfi.sopen(same_as, get_open_flags(RO_MUST_EXIST), SH_DENYWR);
+        fo.copyRangeFrom(sfi, 0, sfi.st_size());
+        sfi.closex();
+        same_as_copied = true;
+        if (opt->verbose >= 1)
+            con_fprintf(stdout, "%s: same contents as %s, copied its result\n",
+                        fn_basename(iname), same_as);
+    }
+
+    // "--upgrade": keep the input, and pack with the options of "--fast" for now
+    std::unique_ptr<UpgradeJob> upgrade_job;
+    Options fast_options;
+    Options *pack_options = opt;
+    if (opt->upgrade && opt->cmd == CMD_COMPRESS && !from_stdin && !pack_cache_hit) {
+        upgrade_job.reset(new UpgradeJob);
+        upgrade_save_input(upgrade_job.get(), fi, opt->output_name ? opt->output_name : iname);
+        fast_options = *opt;
+        set_upgrade_fast_options(&fast_options);
+        pack_options = &fast_options;
+    }
+
     // handle command - actual work is here
-    PackMaster pm(&fi, opt);
-    if (opt->cmd == CMD_COMPRESS)
+    PackMaster pm(&fi, pack_options);
+    if (pack_cache_hit || same_as_copied)
+        ; // done
+    else if (opt->cmd == CMD_COMPRESS)
         pm.pack(&fo);
     else if (opt->cmd == CMD_DECOMPRESS)
         pm.unpack(&fo);
@@ -337,17 +574,42 @@ void do_one_file(const char *const iname, char *const oname) may_throw {
         pm.list();
     else if (opt->cmd == CMD_FILEINFO)
         pm.fileInfo();
+    else if (opt->cmd == CMD_ANALYZE)
+        pm.analyze();
     else
         throwInternalError("invalid command");
 
     // copy time stamp
-    if (oname[0] && opt->preserve_timestamp && fo.isOpen())
+    if ((oname[0] || fo.isTmpfile()) && opt->preserve_timestamp && fo.isOpen() && !from_stdin) {
+        fo.flush(); // before the timestamp
         set_fd_timestamp(fo.getFd(), &xst);
+    }
 
     // close files
     fi.closex();
+    if (fo.isTmpfile()) {
+        fo.linkTmpfile(tmpfile_name);
+        strcpy(oname, tmpfile_name);
+    }
+    // "-": now write the complete result
+    if (fo.isMemory() && !opt->benchmark) {
+        OutputFile so;
+        if (!so.openStdout(1, true))
+            throwIOException("<stdout>");
+        so.write(fo.getMemory(), fo.getMemorySize());
+        so.closex();
+    }
     fo.closex();
 
+    // "--benchmark" only packs into the temporary file to show the result
+    if (opt->benchmark && oname[0]) {
+        FileBase::unlink(oname);
+        oname[0] = 0; // done with oname
+    }
+
+    if (opt->pack_cache && !pack_cache_hit && !same_as_copied && !upgrade_job && oname[0])
+        upx::pack_cache_store(pack_cache_key, oname);
+
     // rename or copy files
     if (oname[0] && !opt->output_name) {
         // both iname and oname do exist; rename oname to iname
@@ -379,7 +641,9 @@ void do_one_file(const char *const iname, char *const oname) may_throw {
     }
 
     // copy file attributes
-    if (oname[0]) {
+    if (oname[0] && from_stdin) {
+        oname[0] = 0; // done with oname; there are no attributes to copy
+    } else if (oname[0]) {
         oname[0] = 0; // done with oname
         const char *name = opt->output_name ? opt->output_name : iname;
         if (copy_timestamp_only)
@@ -389,6 +653,9 @@ void do_one_file(const char *const iname, char *const oname) may_throw {
                                  opt->preserve_timestamp);
     }
 
+    if (upgrade_job)
+        upgrade_add(std::move(upgrade_job), opt->output_name ? opt->output_name : iname);
+
     UiPacker::uiConfirmUpdate();
 }
 
@@ -403,64 +670,241 @@ static void unlink_ofile(char *oname) noexcept {
     }
 }
 
-int do_files(int i, int argc, char *argv[]) may_throw {
-    upx_compiler_sanity_check();
-    if (opt->verbose >= 1) {
-        show_header();
-        UiPacker::uiHeader();
+#if WITH_THREADS
+static std::mutex report_mutex; // serialize error reports of parallel jobs
+#endif
+
+namespace {
+// what became of a file, for the "--tree-manifest"
+struct FileOutcome final {
+    const char *status = nullptr; // "ok", "skipped" or "error"
+    char msg[128] = {};
+    void set(const char *s, const char *m) noexcept {
+        status = s;
+        upx_safe_snprintf(msg, sizeof(msg), "%s", m ? m : "");
     }
+};
+} // namespace
 
-    for (; i < argc; i++) {
-        infoHeader();
+// must get called from within a catch block; returns -1 on fatal errors
+static int report_file_exception(const char *iname, char *oname, FileOutcome *outcome) noexcept {
+    unlink_ofile(oname);
+#if WITH_THREADS
+    std::lock_guard<std::mutex> lock(report_mutex);
+#endif
+    if (outcome != nullptr)
+        outcome->set("error", "unhandled exception");
+    try {
+        throw; // re-throw the current exception
+    } catch (const Exception &e) {
+        if (opt->verbose >= 1 || (opt->verbose >= 0 && !e.isWarning()))
+            printErr(iname, e);
+        main_set_exit_code(e.isWarning() ? EXIT_WARN : EXIT_ERROR);
+        if (outcome != nullptr)
+            outcome->set(e.isWarning() ? "skipped" : "error", e.getMsg());
+        return 0; // this is not fatal, continue processing more files
+    } catch (const Error &e) {
+        printErr(iname, e);
+        if (outcome != nullptr)
+            outcome->set("error", e.getMsg());
+    } catch (std::bad_alloc *e) {
+        printErr(iname, "out of memory");
+        UNUSED(e);
+        // delete e;
+    } catch (const std::bad_alloc &) {
+        printErr(iname, "out of memory");
+    } catch (std::exception *e) {
+        printUnhandledException(iname, e);
+        // delete e;
+    } catch (const std::exception &e) {
+        printUnhandledException(iname, &e);
+    } catch (...) {
+        printUnhandledException(iname, nullptr);
+    }
+    main_set_exit_code(EXIT_ERROR);
+    return -1; // fatal error
+}
 
-        const char *const iname = argv[i];
-        char oname[ACC_FN_PATH_MAX + 1];
-        oname[0] = 0;
+static int do_one_file_and_report(const char *iname, const char *same_as,
+                                  FileOutcome *outcome) noexcept {
+    char oname[ACC_FN_PATH_MAX + 1];
+    oname[0] = 0;
+    try {
+        do_one_file(iname, oname, same_as);
+    } catch (...) {
+        return report_file_exception(iname, oname, outcome);
+    }
+    if (outcome != nullptr)
+        outcome->set("ok", nullptr);
+    return 0;
+}
 
-        try {
-            do_one_file(iname, oname);
-        } catch (const Exception &e) {
-            unlink_ofile(oname);
-            if (opt->verbose >= 1 || (opt->verbose >= 0 && !e.isWarning()))
-                printErr(iname, e);
-            main_set_exit_code(e.isWarning() ? EXIT_WARN : EXIT_ERROR);
-            // this is not fatal, continue processing more files
-        } catch (const Error &e) {
-            unlink_ofile(oname);
-            printErr(iname, e);
-            main_set_exit_code(EXIT_ERROR);
-            return -1; // fatal error
-        } catch (std::bad_alloc *e) {
-            unlink_ofile(oname);
-            printErr(iname, "out of memory");
-            UNUSED(e);
-            // delete e;
-            main_set_exit_code(EXIT_ERROR);
-            return -1; // fatal error
-        } catch (const std::bad_alloc &) {
-            unlink_ofile(oname);
-            printErr(iname, "out of memory");
-            main_set_exit_code(EXIT_ERROR);
-            return -1; // fatal error
-        } catch (std::exception *e) {
-            unlink_ofile(oname);
-            printUnhandledException(iname, e);
-            // delete e;
-            main_set_exit_code(EXIT_ERROR);
-            return -1; // fatal error
-        } catch (const std::exception &e) {
-            unlink_ofile(oname);
-            printUnhandledException(iname, &e);
-            main_set_exit_code(EXIT_ERROR);
-            return -1; // fatal error
-        } catch (...) {
-            unlink_ofile(oname);
-            printUnhandledException(iname, nullptr);
-            main_set_exit_code(EXIT_ERROR);
-            return -1; // fatal error
+// Start reading a file that will get processed soon, so that its data is
+// already in the page cache when a worker gets to it - this keeps the workers
+// busy on high-latency storage. Only a hint, all errors are ignored.
+static void prefetch_file(const char *iname) noexcept {
+#if defined(POSIX_FADV_WILLNEED) && HAVE_LSTAT
+    struct stat st;
+    if (lstat(iname, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 512)
+        return;
+    int fd = ::open(iname, O_RDONLY | O_BINARY | O_NONBLOCK);
+    if (fd < 0)
+        return;
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    (void) ::close(fd);
+#else
+    UNUSED(iname);
+#endif
+}
+
+namespace {
+// Byte-identical inputs of one run (multi-call tools, copies per package)
+// only get processed once: the first one of every group is done first, and
+// the others then copy its result. The attributes of every path are still
+// handled by do_one_file().
+struct BatchDuplicates final {
+    std::vector<size_t> order;   // the first files of the groups, then the others
+    std::vector<size_t> same_as; // index of the first file with the same contents
+    size_t num_first = 0;        // order[0..num_first) has no same_as
+    static constexpr size_t NONE = ~size_t(0);
+
+    static bool isEnabled(size_t num_files) noexcept {
+        if (num_files < 2 || opt->benchmark || opt->to_stdout || opt->output_name)
+            return false;
+        return opt->cmd == CMD_COMPRESS || opt->cmd == CMD_DECOMPRESS;
+    }
+
+    void find(const char *const *names, size_t num_files) {
+        struct Info {
+            upx_uint64_t size, dev, ino;
+            upx::DecisionCacheKey key;
+            bool hashed;
+        };
+        std::vector<Info> info(num_files);
+        std::vector<size_t> by_size;
+        for (size_t k = 0; k < num_files; k++) {
+            Info &in = info[k];
+            in = {};
+            struct stat st;
+            if (strcmp(names[k], "-") == 0 || ::stat(names[k], &st) != 0 ||
+                !S_ISREG(st.st_mode) || st.st_size < 512)
+                continue;
+            in.size = st.st_size;
+            in.dev = st.st_dev;
+            in.ino = st.st_ino;
+            by_size.push_back(k);
         }
+        // only files whose size is not unique get hashed
+        std::stable_sort(by_size.begin(), by_size.end(),
+                         [&](size_t a, size_t b) { return info[a].size < info[b].size; });
+        same_as.assign(num_files, NONE);
+        for (size_t g = 0, g_end; g < by_size.size(); g = g_end) {
+            g_end = g + 1;
+            while (g_end < by_size.size() && info[by_size[g_end]].size == info[by_size[g]].size)
+                g_end++;
+            if (g_end - g < 2)
+                continue; // the size is unique
+            for (size_t j = g; j < g_end; j++) {
+                const size_t k = by_size[j];
+                try {
+                    InputFile fi;
+                    fi.sopen(names[k], get_open_flags(RO_MUST_EXIST), SH_DENYWR);
+                    info[k].key = upx::pack_cache_key(&fi, opt);
+                    info[k].hashed = true;
+                } catch (const Exception &) {
+                    continue; // do_one_file() will report the error
+                }
+                for (size_t i = g; i < j; i++) {
+                    const Info &a = info[by_size[i]], &b = info[k];
+                    if (!a.hashed || same_as[by_size[i]] != NONE ||
+                        memcmp(&a.key, &b.key, sizeof(a.key)) != 0)
+                        continue;
+                    if (a.dev == b.dev && a.ino == b.ino)
+                        continue; // a hard link of the same file is no copy
+                    same_as[k] = by_size[i];
+                    break;
+                }
+            }
+        }
+        for (size_t k = 0; k < num_files; k++)
+            if (same_as[k] == NONE)
+                order.push_back(k);
+        num_first = order.size();
+        for (size_t k = 0; k < num_files; k++)
+            if (same_as[k] != NONE)
+                order.push_back(k);
     }
+};
+} // namespace
 
+// process names[k] for all k in order[begin..end), with "--jobs" workers; the
+// source of a copy (see BatchDuplicates) is only used if it has succeeded
+static int process_files_in_order(const char *const *names, const size_t *order, size_t begin,
+                                  size_t end, const size_t *same_as,
+                                  FileOutcome *outcomes) may_throw {
+    const size_t num_files = end - begin;
+    auto source = [&](size_t k) -> const char * {
+        if (same_as == nullptr || same_as[k] == BatchDuplicates::NONE)
+            return nullptr;
+        const FileOutcome &o = outcomes[same_as[k]];
+        return (o.status && strcmp(o.status, "ok") == 0) ? names[same_as[k]] : nullptr;
+    };
+    const unsigned jobs = upx::get_num_workers(opt->jobs, num_files);
+    if (jobs <= 1) {
+        for (size_t j = begin; j < end; j++) {
+            const size_t k = order[j];
+            if (j + 1 < end)
+                prefetch_file(names[order[j + 1]]);
+            infoHeader();
+            if (do_one_file_and_report(names[k], source(k), &outcomes[k]) != 0)
+                return -1; // fatal error
+        }
+    } else {
+        // make sure that the console is initialized before starting the workers
+        con_fprintf(stdout, "%s", "");
+        upx_std_atomic(bool) fatal(false);
+        upx::parallel_for(num_files, jobs, [&](size_t i) {
+            if (fatal) // stop processing more files after a fatal error
+                return;
+            if (i + jobs < num_files) // the file after the ones that are in progress
+                prefetch_file(names[order[begin + i + jobs]]);
+            const size_t k = order[begin + i];
+            ConsoleJob console_job; // the messages of this file are written in one piece
+            infoHeader();
+            if (do_one_file_and_report(names[k], source(k), &outcomes[k]) != 0)
+                fatal = true;
+        });
+        if (fatal)
+            return -1; // fatal error
+    }
+    return 0;
+}
+
+// process names[0..num_files); outcomes may be nullptr
+static int process_files(const char *const *names, size_t num_files,
+                         FileOutcome *outcomes) may_throw {
+    std::vector<FileOutcome> local_outcomes;
+    if (outcomes == nullptr) {
+        local_outcomes.resize(num_files);
+        outcomes = local_outcomes.data();
+    }
+    BatchDuplicates dups;
+    if (BatchDuplicates::isEnabled(num_files))
+        dups.find(names, num_files);
+    if (dups.order.empty()) {
+        for (size_t k = 0; k < num_files; k++)
+            dups.order.push_back(k);
+        dups.num_first = num_files;
+    }
+    const size_t *same_as = dups.same_as.empty() ? nullptr : dups.same_as.data();
+    if (process_files_in_order(names, dups.order.data(), 0, dups.num_first, same_as,
+                               outcomes) != 0)
+        return -1; // fatal error
+    return process_files_in_order(names, dups.order.data(), dups.num_first, num_files, same_as,
+                                  outcomes);
+}
+
+static void show_totals() {
     if (opt->cmd == CMD_COMPRESS)
         UiPacker::uiPackTotal();
     else if (opt->cmd == CMD_DECOMPRESS)
@@ -471,7 +915,337 @@ int do_files(int i, int argc, char *argv[]) may_throw {
         UiPacker::uiTestTotal();
     else if (opt->cmd == CMD_FILEINFO)
         UiPacker::uiFileInfoTotal();
+}
+
+int do_files(int i, int argc, char *argv[]) may_throw {
+    upx_compiler_sanity_check();
+    if (opt->verbose >= 1) {
+        show_header();
+        UiPacker::uiHeader();
+    }
+
+    const size_t num_files = i < argc ? argc - i : 0;
+    if (process_files(argv + i, num_files, nullptr) != 0)
+        return -1; // fatal error
+    show_totals();
     return 0;
 }
 
+/*************************************************************************
+// "--tree DIR": process all executables below DIR
+// The walk does not follow symlinks, only keeps regular files that some
+// format with a magic number could handle (see PackMaster::hasKnownMagic()),
+// and processes every inode only once: the other hard links of a file are
+// listed as "hardlink" in the manifest. They still get the packed contents
+// with "--link" (which rewrites the file in place), else they keep the
+// original contents.
+**************************************************************************/
+
+namespace {
+struct TreeFile final {
+    char *name = nullptr; // owned
+    upx_uint64_t dev = 0, ino = 0;
+    unsigned nlink = 0;
+    upx_off_t size = 0;
+    size_t link_of = ~size_t(0); // index of the file that got processed for this inode
+    FileOutcome outcome;
+};
+
+struct TreeWalk final {
+    std::vector<TreeFile> files;
+    upx_uint64_t num_seen = 0; // all regular files
+    ~TreeWalk() noexcept {
+        for (auto &f : files)
+            ::free(f.name);
+    }
+
+    void walk(const char *dir) {
+#if HAVE_DIRENT_H && HAVE_LSTAT
+        DIR *d = ::opendir(dir);
+        if (d == nullptr) {
+            printWarn(dir, "cannot read directory: %s", strerror(errno));
+            main_set_exit_code(EXIT_WARN);
+            return;
+        }
+        const size_t dir_len = strlen(dir);
+        const bool need_slash = dir_len > 0 && dir[dir_len - 1] != '/';
+        while (const struct dirent *de = ::readdir(d)) {
+            const char *n = de->d_name;
+            if (strcmp(n, ".") == 0 || strcmp(n, "..") == 0)
+                continue;
+            char path[ACC_FN_PATH_MAX + 1];
+            const int len =
+                upx_safe_snprintf(path, sizeof(path), "%s%s%s", dir, need_slash ? "/" : "", n);
+            if (len < 0 || size_t(len) >= sizeof(path)) {
+                printWarn(dir, "file name too long -- skipped");
+                continue;
+            }
+            struct stat st;
+            if (::lstat(path, &st) != 0)
+                continue;
+            if (S_ISDIR(st.st_mode))
+                walk(path);
+            else if (S_ISREG(st.st_mode))
+                add(path, st);
+        }
+        (void) ::closedir(d);
+#else
+        UNUSED(dir);
+        throwIOException("--tree is not supported on this system");
+#endif
+    }
+
+    void add(const char *path, const struct stat &st) {
+        num_seen += 1;
+        if (st.st_size < 512) // do_one_file() would skip it anyway
+            return;
+        byte buf[0x200];
+        int fd = ::open(path, O_RDONLY | O_BINARY);
+        if (fd < 0)
+            return;
+        const int r = (int) ::read(fd, buf, sizeof(buf));
+        (void) ::close(fd);
+        if (r <= 0 || !PackMaster::hasKnownMagic(buf, unsigned(r), st.st_size))
+            return;
+        TreeFile f;
+        f.name = ::strdup(path);
+        if (f.name == nullptr)
+            throwOutOfMemoryException();
+        f.dev = st.st_dev;
+        f.ino = st.st_ino;
+        f.nlink = unsigned(st.st_nlink);
+        f.size = st.st_size;
+        files.push_back(f);
+    }
+
+    // sort by name, so that the manifest and the choice among the hard
+    // links do not depend on the order of readdir()
+    void sortAndFindLinks() {
+        std::sort(files.begin(), files.end(), [](const TreeFile &a, const TreeFile &b) {
+            return strcmp(a.name, b.name) < 0;
+        });
+        std::vector<size_t> linked;
+        for (size_t k = 0; k < files.size(); k++)
+            if (files[k].nlink >= 2)
+                linked.push_back(k);
+        std::stable_sort(linked.begin(), linked.end(), [&](size_t a, size_t b) {
+            if (files[a].dev != files[b].dev)
+                return files[a].dev < files[b].dev;
+            return files[a].ino < files[b].ino;
+        });
+        for (size_t k = 1; k < linked.size(); k++) {
+            const TreeFile &first = files[linked[k - 1]];
+            TreeFile &f = files[linked[k]];
+            if (f.dev == first.dev && f.ino == first.ino)
+                f.link_of = first.link_of != ~size_t(0) ? first.link_of : linked[k - 1];
+        }
+    }
+
+    void writeManifest(const char *fn) const {
+        FILE *fp = fopen(fn, "wb");
+        if (fp == nullptr)
+            throwIOException(fn, errno);
+        upx_uint64_t n_ok = 0, n_skipped = 0, n_error = 0, n_links = 0;
+        for (const TreeFile &f : files) {
+            const char *status = f.outcome.status ? f.outcome.status : "not-processed";
+            if (f.link_of != ~size_t(0))
+                status = "hardlink";
+            fprintf(fp, "{\"file\":");
+            upx::write_json_string(fp, f.name);
+            fprintf(fp, ",\"status\":");
+            upx::write_json_string(fp, status);
+            fprintf(fp, ",\"size\":%llu", (unsigned long long) f.size);
+            if (f.link_of != ~size_t(0)) {
+                n_links += 1;
+                fprintf(fp, ",\"link_of\":");
+                upx::write_json_string(fp, files[f.link_of].name);
+            } else if (strcmp(status, "ok") == 0) {
+                n_ok += 1;
+                struct stat st;
+                if (opt->cmd == CMD_COMPRESS || opt->cmd == CMD_DECOMPRESS) {
+                    if (::stat(f.name, &st) == 0)
+                        fprintf(fp, ",\"new_size\":%llu", (unsigned long long) st.st_size);
+                }
+            } else {
+                if (strcmp(status, "skipped") == 0)
+                    n_skipped += 1;
+                else
+                    n_error += 1;
+                fprintf(fp, ",\"message\":");
+                upx::write_json_string(fp, f.outcome.msg);
+            }
+            fprintf(fp, "}\n");
+        }
+        fprintf(fp,
+                "{\"summary\":{\"files\":%llu,\"candidates\":%llu,\"ok\":%llu,"
+                "\"skipped\":%llu,\"errors\":%llu,\"hardlinks\":%llu}}\n",
+                (unsigned long long) num_seen, (unsigned long long) files.size(),
+                (unsigned long long) n_ok, (unsigned long long) n_skipped,
+                (unsigned long long) n_error, (unsigned long long) n_links);
+        if (fclose(fp) != 0)
+            throwIOException(fn, errno);
+    }
+};
+} // namespace
+
+int do_tree(const char *dir) may_throw {
+    upx_compiler_sanity_check();
+    if (opt->verbose >= 1) {
+        show_header();
+        UiPacker::uiHeader();
+    }
+
+    struct stat st;
+    if (::stat(dir, &st) != 0)
+        throwIOException(dir, errno);
+    if (!S_ISDIR(st.st_mode))
+        throwIOException("--tree: not a directory");
+    TreeWalk tree;
+    tree.walk(dir);
+    tree.sortAndFindLinks();
+
+    std::vector<const char *> names;
+    std::vector<FileOutcome> outcomes;
+    names.reserve(tree.files.size());
+    for (const TreeFile &f : tree.files)
+        if (f.link_of == ~size_t(0))
+            names.push_back(f.name);
+    outcomes.resize(names.size());
+    const int r = process_files(names.data(), names.size(), outcomes.data());
+    for (size_t k = 0, j = 0; k < tree.files.size(); k++)
+        if (tree.files[k].link_of == ~size_t(0))
+            tree.files[k].outcome = outcomes[j++];
+    if (opt->tree_manifest_name)
+        tree.writeManifest(opt->tree_manifest_name);
+    if (r != 0)
+        return -1; // fatal error
+    show_totals();
+    return 0;
+}
+
+/*************************************************************************
+// "--upgrade": the second pass, see do_one_file()
+**************************************************************************/
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__wasi__)
+#define USE_UPGRADE_FORK 1
+#endif
+
+// returns the size of the new packed file, or 0 if the old one was kept
+static upx_off_t upgrade_one(const UpgradeJob *job) may_throw {
+    const char *const name = job->name;
+    Options o = *opt;
+    o.upgrade = o.UPGRADE_NONE;
+    o.decision_cache = true; // remember the winner
+    o.verbose = 0;
+    o.no_progress = true;
+    InputFile fi;
+    fi.sopen(job->input_name, get_open_flags(RO_MUST_EXIST), SH_DENYWR);
+    upx::DecisionCacheKey pack_cache_key = {};
+    if (o.pack_cache)
+        pack_cache_key = upx::pack_cache_key(&fi, &o);
+
+    char tname[ACC_FN_PATH_MAX + 1];
+    if (!maketempname(tname, sizeof(tname), name, ".upx"))
+        throwIOException("could not create a temporary file name");
+    upx_off_t new_size = 0;
+    try {
+        OutputFile fo;
+        fo.sopen(tname, get_open_flags(WO_MUST_CREATE), SH_DENYWR, 0600);
+        {
+            PackMaster pm(&fi, &o);
+            pm.pack(&fo);
+        }
+        fo.closex();
+        // the checks of "upx -t"
+        InputFile tfi;
+        tfi.sopen(tname, get_open_flags(RO_MUST_EXIST), SH_DENYWR);
+        {
+            PackMaster pm(&tfi, &o);
+            pm.test();
+        }
+        new_size = tfi.st_size();
+        tfi.closex();
+        // only replace a smaller result, and only the file of the fast pass
+        struct stat st;
+        if (new_size >= job->st.st_size || ::stat(name, &st) != 0 ||
+            st.st_dev != job->st.st_dev || st.st_ino != job->st.st_ino ||
+            st.st_size != job->st.st_size || st.st_mtime != job->st.st_mtime) {
+            FileBase::unlink(tname);
+            return 0;
+        }
+        XStat xst = {};
+        xst.st = job->st;
+        copy_file_attributes(&xst, tname, true, true, true);
+        if (o.pack_cache)
+            upx::pack_cache_store(pack_cache_key, tname);
+#if defined(_WIN32)
+        (void) FileBase::unlink_noexcept(name); // rename() does not replace files here
+#endif
+        FileBase::rename(tname, name);
+    } catch (...) {
+        (void) FileBase::unlink_noexcept(tname); // IGNORE_ERROR
+        throw;
+    }
+    return new_size;
+}
+
+static void upgrade_all(bool report) noexcept {
+    for (const auto &job : upgrade_jobs) {
+        const char *const name = job->name;
+        try {
+            const upx_off_t new_size = upgrade_one(job.get());
+            if (new_size > 0 && report && opt->verbose >= 1)
+                con_fprintf(stdout, "%s: upgraded from %lld to %lld bytes\n", fn_basename(name),
+                            (long long) job->st.st_size, (long long) new_size);
+            else if (report && opt->verbose >= 2)
+                con_fprintf(stdout, "%s: kept the packed file, no upgrade found\n",
+                            fn_basename(name));
+        } catch (const Throwable &e) {
+            printWarn(name, "--upgrade failed: %s", e.getMsg());
+        } catch (...) {
+            printWarn(name, "--upgrade failed");
+        }
+    }
+    upgrade_jobs.clear();
+}
+
+void do_upgrades() noexcept {
+    if (upgrade_jobs.empty())
+        return;
+#if USE_UPGRADE_FORK
+    if (opt->upgrade == opt->UPGRADE_BACKGROUND) {
+        // all worker threads have finished, so a fork() is safe here
+        fflush(con_term);
+        fflush(stdout);
+        fflush(stderr);
+        const pid_t pid = ::fork();
+        if (pid > 0) {
+            for (const auto &job : upgrade_jobs)
+                job->releaseInput();
+            upgrade_jobs.clear(); // the parent is done
+            return;
+        }
+        if (pid == 0) {
+            // detach from the terminal and from the pipes of a build tool,
+            // which would otherwise wait for the end of this process
+            (void) ::setsid();
+            const int fd = ::open("/dev/null", O_RDWR);
+            if (fd >= 0) {
+                for (int i = 0; i <= 2; i++)
+                    (void) ::dup2(fd, i);
+                if (fd > 2)
+                    (void) ::close(fd);
+            }
+            upgrade_all(false);
+            // the parent has written all the reports, and for a "--listen"
+            // job it has also sent the exit code; see upx_server_job_exit()
+            ::_exit(0);
+        }
+        printWarn("--upgrade", "cannot fork: %s; waiting for the upgrade", strerror(errno));
+    }
+#endif
+    upgrade_all(true);
+}
+
 /* vim:set ts=4 sw=4 et: */